@@ -0,0 +1,352 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <system_error>
+
+#include <libhal/error.hpp>
+#include <libhal/units.hpp>
+
+namespace hal {
+/**
+ * @brief Storage that is read and written in fixed size blocks
+ *
+ * Requires a `block_size` constant and `read(block, data)` and
+ * `write(block, data)` functions that transfer one or more consecutive blocks.
+ * `hal::sd_card` is a block device.
+ */
+template<class T>
+concept block_device = requires(T& p_device,
+                                std::uint32_t p_block,
+                                std::span<hal::byte> p_data_in,
+                                std::span<const hal::byte> p_data_out) {
+  { T::block_size } -> std::convertible_to<std::size_t>;
+  { p_device.read(p_block, p_data_in) } -> std::same_as<status>;
+  { p_device.write(p_block, p_data_out) } -> std::same_as<status>;
+};
+
+/**
+ * @brief Hits and misses of a block_cache
+ *
+ */
+struct block_cache_statistics
+{
+  /// Number of blocks served from the cache
+  std::uint32_t hits = 0;
+  /// Number of blocks read from the device
+  std::uint32_t misses = 0;
+  /// Number of blocks removed from the cache to make room for another
+  std::uint32_t evictions = 0;
+  /// Number of dirty blocks written to the device
+  std::uint32_t write_backs = 0;
+};
+
+/**
+ * @brief Write-back cache of the most recently used blocks of a block device
+ *
+ * Keeps Capacity blocks in memory, so that repeatedly used blocks, such as
+ * file system directories and allocation tables, stop reaching the bus.
+ * Single block reads and writes go through the cache. Writes only mark the
+ * cached block dirty; it reaches the device when it is evicted to make room
+ * for another block or when `flush()` is called. The least recently used
+ * block is evicted first.
+ *
+ * Transfers of more than one block are meant for bulk data and bypass the
+ * cache, so they keep the device's multiple block transfers and do not evict
+ * the blocks being reused. Cached blocks within the range are still kept
+ * consistent: reads take them from the cache and writes update them.
+ *
+ *     hal::block_cache<hal::sd_card, 8> cache(card);
+ *     std::array<hal::byte, hal::sd_card::block_size> fat{};
+ *     HAL_CHECK(cache.read(fat_block, fat));
+ *     // ... modify an entry
+ *     HAL_CHECK(cache.write(fat_block, fat));
+ *     HAL_CHECK(cache.flush());
+ *
+ * The cache is itself a block device. Nothing is allocated and the cache does
+ * not flush itself on destruction, as it could not report a failure.
+ *
+ * @tparam Device - block device type
+ * @tparam Capacity - number of blocks to cache
+ */
+template<block_device Device, std::size_t Capacity>
+class block_cache
+{
+public:
+  static_assert(Capacity > 0, "Capacity must be at least 1");
+
+  /// Number of bytes in a block
+  static constexpr std::size_t block_size = Device::block_size;
+
+  /**
+   * @brief Construct a new block cache
+   *
+   * @param p_device - device to cache. Must outlive this object.
+   */
+  explicit block_cache(Device& p_device)
+    : m_device(&p_device)
+  {
+  }
+
+  block_cache(block_cache&) = delete;
+  block_cache& operator=(block_cache&) = delete;
+  block_cache(block_cache&&) = delete;
+  block_cache& operator=(block_cache&&) = delete;
+
+  /**
+   * @brief Read one or more consecutive blocks
+   *
+   * @param p_block - first block to read
+   * @param p_data - buffer to read into, a multiple of block_size bytes
+   * @return status - success or failure
+   * @throws std::errc::invalid_argument - p_data is not a multiple of
+   * block_size bytes
+   */
+  [[nodiscard]] status read(std::uint32_t p_block, std::span<hal::byte> p_data)
+  {
+    HAL_CHECK(check_transfer(p_data.size()));
+
+    if (p_data.size() == block_size) {
+      auto* entry = find(p_block);
+      if (entry != nullptr) {
+        m_statistics.hits++;
+      } else {
+        entry = HAL_CHECK(allocate());
+        HAL_CHECK(m_device->read(p_block, entry->data));
+        m_statistics.misses++;
+        entry->block = p_block;
+        entry->valid = true;
+      }
+      touch(*entry);
+      std::copy(entry->data.begin(), entry->data.end(), p_data.begin());
+      return success();
+    }
+
+    // Read runs of uncached blocks with one device transfer each
+    const auto count = p_data.size() / block_size;
+    std::size_t index = 0;
+    while (index < count) {
+      const auto* entry = find(block_at(p_block, index));
+      if (entry != nullptr) {
+        m_statistics.hits++;
+        std::copy(entry->data.begin(),
+                  entry->data.end(),
+                  p_data.begin() + static_cast<std::ptrdiff_t>(
+                                     index * block_size));
+        index++;
+        continue;
+      }
+      auto end = index + 1;
+      while (end < count && find(block_at(p_block, end)) == nullptr) {
+        end++;
+      }
+      HAL_CHECK(m_device->read(
+        block_at(p_block, index),
+        p_data.subspan(index * block_size, (end - index) * block_size)));
+      m_statistics.misses += static_cast<std::uint32_t>(end - index);
+      index = end;
+    }
+    return success();
+  }
+
+  /**
+   * @brief Write one or more consecutive blocks
+   *
+   * A single block is written to the cache and marked dirty. Multiple blocks
+   * are written to the device immediately.
+   *
+   * @param p_block - first block to write
+   * @param p_data - bytes to write, a multiple of block_size bytes
+   * @return status - success or failure
+   * @throws std::errc::invalid_argument - p_data is not a multiple of
+   * block_size bytes
+   */
+  [[nodiscard]] status write(std::uint32_t p_block,
+                             std::span<const hal::byte> p_data)
+  {
+    HAL_CHECK(check_transfer(p_data.size()));
+
+    if (p_data.size() == block_size) {
+      auto* entry = find(p_block);
+      if (entry == nullptr) {
+        entry = HAL_CHECK(allocate());
+        entry->block = p_block;
+        entry->valid = true;
+      }
+      std::copy(p_data.begin(), p_data.end(), entry->data.begin());
+      entry->dirty = true;
+      touch(*entry);
+      return success();
+    }
+
+    HAL_CHECK(m_device->write(p_block, p_data));
+    // The device now holds the latest copy of every block in the range
+    const auto count = p_data.size() / block_size;
+    for (std::size_t index = 0; index < count; index++) {
+      auto* entry = find(block_at(p_block, index));
+      if (entry != nullptr) {
+        const auto block = p_data.subspan(index * block_size, block_size);
+        std::copy(block.begin(), block.end(), entry->data.begin());
+        entry->dirty = false;
+      }
+    }
+    return success();
+  }
+
+  /**
+   * @brief Write every dirty block to the device
+   *
+   * Blocks are written in ascending order.
+   *
+   * @return status - success or failure. On failure, blocks that were not
+   * written remain dirty.
+   */
+  [[nodiscard]] status flush()
+  {
+    while (true) {
+      entry_t* lowest = nullptr;
+      for (auto& entry : m_entries) {
+        if (entry.dirty && (lowest == nullptr || entry.block < lowest->block)) {
+          lowest = &entry;
+        }
+      }
+      if (lowest == nullptr) {
+        return success();
+      }
+      HAL_CHECK(write_back(*lowest));
+    }
+  }
+
+  /**
+   * @brief Forget every cached block
+   *
+   * Dirty blocks are discarded. Call after the medium has been replaced.
+   */
+  void invalidate()
+  {
+    for (auto& entry : m_entries) {
+      entry.valid = false;
+      entry.dirty = false;
+    }
+  }
+
+  /**
+   * @brief Determine if a block is cached
+   *
+   * @param p_block - block number
+   * @return true - the block is in the cache
+   */
+  [[nodiscard]] bool contains(std::uint32_t p_block) const
+  {
+    return std::any_of(m_entries.begin(), m_entries.end(), [p_block](auto& e) {
+      return e.valid && e.block == p_block;
+    });
+  }
+
+  /**
+   * @brief Get the number of blocks waiting to be written to the device
+   *
+   * @return std::size_t - number of dirty blocks
+   */
+  [[nodiscard]] std::size_t dirty_count() const
+  {
+    return static_cast<std::size_t>(std::count_if(
+      m_entries.begin(), m_entries.end(), [](auto& e) { return e.dirty; }));
+  }
+
+  /**
+   * @brief Get the hit and miss counts
+   *
+   * @return const block_cache_statistics& - statistics of the cache
+   */
+  [[nodiscard]] const block_cache_statistics& statistics() const
+  {
+    return m_statistics;
+  }
+
+  /**
+   * @brief Reset the hit and miss counts
+   *
+   */
+  void reset_statistics()
+  {
+    m_statistics = {};
+  }
+
+private:
+  struct entry_t
+  {
+    std::array<hal::byte, block_size> data{};
+    std::uint32_t block = 0;
+    std::uint32_t last_use = 0;
+    bool valid = false;
+    bool dirty = false;
+  };
+
+  static std::uint32_t block_at(std::uint32_t p_first, std::size_t p_index)
+  {
+    return p_first + static_cast<std::uint32_t>(p_index);
+  }
+
+  static status check_transfer(std::size_t p_size)
+  {
+    if (p_size == 0 || p_size % block_size != 0) {
+      return hal::new_error(std::errc::invalid_argument);
+    }
+    return success();
+  }
+
+  entry_t* find(std::uint32_t p_block)
+  {
+    for (auto& entry : m_entries) {
+      if (entry.valid && entry.block == p_block) {
+        return &entry;
+      }
+    }
+    return nullptr;
+  }
+
+  void touch(entry_t& p_entry)
+  {
+    p_entry.last_use = ++m_use_count;
+  }
+
+  /// Get an unused entry, evicting the least recently used block if needed
+  result<entry_t*> allocate()
+  {
+    entry_t* victim = &m_entries[0];
+    for (auto& entry : m_entries) {
+      if (!entry.valid) {
+        return &entry;
+      }
+      // Wrapping difference keeps the order correct when the count overflows
+      if (static_cast<std::int32_t>(entry.last_use - victim->last_use) < 0) {
+        victim = &entry;
+      }
+    }
+    if (victim->dirty) {
+      HAL_CHECK(write_back(*victim));
+    }
+    m_statistics.evictions++;
+    victim->valid = false;
+    return victim;
+  }
+
+  status write_back(entry_t& p_entry)
+  {
+    HAL_CHECK(m_device->write(p_entry.block, p_entry.data));
+    p_entry.dirty = false;
+    m_statistics.write_backs++;
+    return success();
+  }
+
+  Device* m_device;
+  std::array<entry_t, Capacity> m_entries{};
+  block_cache_statistics m_statistics{};
+  std::uint32_t m_use_count = 0;
+};
+}  // namespace hal
@@ -1,14 +1,27 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
 #include <cmath>
+#include <cstddef>
+#include <cstring>
 #include <functional>
+#include <limits>
 #include <optional>
+#include <span>
+#include <system_error>
+#include <type_traits>
+#include <utility>
 
 #include <libhal/can.hpp>
+#include <libhal/steady_clock.hpp>
+#include <libhal/units.hpp>
 
 #include "comparison.hpp"
 #include "math.hpp"
-#include "move_interceptor.hpp"
+#include "overflow_counter.hpp"
 #include "static_callable.hpp"
 #include "static_list.hpp"
 
@@ -32,6 +45,44 @@ namespace hal {
     p_settings.phase_segment1 + p_settings.phase_segment2);
 }
 
+/**
+ * @brief Validate the bit timing segments of configuration settings
+ *
+ * Checks rules 1 through 3 of `is_valid()`, which do not depend on the
+ * operating frequency of the CAN device.
+ *
+ * @param p_settings - settings object to check
+ * @return true - the segments are valid
+ * @return false - the segments break one of the rules
+ */
+[[nodiscard]] constexpr bool is_valid_segments(const can::settings& p_settings)
+{
+  // 1. propagation_delay, phase_segment1, phase_segment2 and
+  //    synchronization_jump_width must be nonzero.
+  if (p_settings.propagation_delay == 0 || p_settings.phase_segment1 == 0 ||
+      p_settings.phase_segment2 == 0 ||
+      p_settings.synchronization_jump_width == 0) {
+    return false;
+  }
+
+  // 2. synchronization_jump_width must be the lesser between phase_segment1
+  //    and phase_segment2.
+  if (p_settings.synchronization_jump_width > 4 ||
+      p_settings.synchronization_jump_width > p_settings.phase_segment1 ||
+      p_settings.synchronization_jump_width > p_settings.phase_segment2) {
+    return false;
+  }
+
+  // 3. The total bit width must be equal to or greater than 8 Tq/bit; the
+  //    sum of sync_segment, propagation_delay, phase_segment1 and
+  //    phase_segment2.
+  if (bit_width(p_settings) < 8) {
+    return false;
+  }
+
+  return true;
+}
+
 /**
  * @brief Validate configuration settings against an operating frequency
  *
@@ -57,28 +108,7 @@ namespace hal {
   const can::settings& p_settings,
   hertz p_operating_frequency)
 {
-  // 1. propagation_delay, phase_segment1, phase_segment2 and
-  //    synchronization_jump_width must be nonzero.
-  if (p_settings.propagation_delay == 0 || p_settings.phase_segment1 == 0 ||
-      p_settings.phase_segment2 == 0 ||
-      p_settings.synchronization_jump_width == 0) {
-    return std::nullopt;
-  }
-
-  // 2. synchronization_jump_width must be the lesser between phase_segment1
-  //    and phase_segment2.
-  if (p_settings.synchronization_jump_width > 4 ||
-      p_settings.synchronization_jump_width > p_settings.phase_segment1 ||
-      p_settings.synchronization_jump_width > p_settings.phase_segment2) {
-    return std::nullopt;
-  }
-
-  const std::uint16_t bit_width_v = bit_width(p_settings);
-
-  // 3. The total bit width must be equal to or greater than 8 Tq/bit; the
-  //    sum of sync_segment, propagation_delay, phase_segment1 and
-  //    phase_segment2.
-  if (bit_width_v < 8) {
+  if (!is_valid_segments(p_settings)) {
     return std::nullopt;
   }
 
@@ -86,7 +116,7 @@ namespace hal {
   //    bit rate to give the minimum.
   // 5. The ratio between the CAN device's operating frequency and the bit
   //    width must be close enough to an integer to produce a usable BRP.
-  const float bit_width_float = bit_width_v;
+  const float bit_width_float = bit_width(p_settings);
   const float scaled_baud = p_settings.baud_rate * bit_width_float;
   const float baud_rate_prescaler = p_operating_frequency / scaled_baud;
   const auto final_prescaler = std::lround(baud_rate_prescaler);
@@ -98,6 +128,214 @@ namespace hal {
   return final_prescaler;
 }
 
+/**
+ * @brief Hardware limits of a CAN peripheral's bit timing registers
+ *
+ * Defaults match the limits of the classic CAN bit timing register found on
+ * most microcontrollers.
+ */
+struct can_bit_timing_limits
+{
+  /// Largest baud rate prescaler supported
+  std::uint32_t max_prescaler = 1024;
+  /// Largest sum of propagation_delay and phase_segment1 supported
+  std::uint8_t max_time_segment1 = 16;
+  /// Largest phase_segment2 supported
+  std::uint8_t max_time_segment2 = 8;
+};
+
+/**
+ * @brief A bit timing configuration found by `solve_bit_timing()`
+ *
+ */
+struct can_bit_timing
+{
+  /// Settings for the operating frequency
+  can::settings settings{};
+  /// Baud rate prescaler for the settings, equal to the one returned by
+  /// `is_valid()` for the settings and operating frequency
+  std::uint32_t prescaler = 0;
+  /// Relative difference between the actual and target baud rate
+  float baud_error = 0.0f;
+  /// Position of the sample point within a bit from 0.0 to 1.0
+  float sample_point = 0.0f;
+};
+
+/**
+ * @brief Search for the bit timing configurations that best fit a baud rate
+ *
+ * Every bit width from 8 Tq up to the hardware limit is tried with the
+ * prescaler nearest to producing the target baud rate, which is the prescaler
+ * that `is_valid()` returns for the configuration, and with every
+ * phase_segment2 length. For each of these, the remaining time quanta are
+ * split between propagation_delay and phase_segment1, and the
+ * synchronization_jump_width is set to the largest value allowed by
+ * `is_valid_segments()`. Different splits of propagation_delay and
+ * phase_segment1 produce the same baud rate and sample point, thus this
+ * covers every distinct configuration.
+ *
+ * Configurations are ranked by baud rate error, then by distance from the
+ * target sample point, then by the number of time quanta per bit, as more
+ * time quanta allow finer resynchronization.
+ *
+ * This function is constexpr, thus the bit timing for a fixed operating
+ * frequency can be computed at compile time:
+ *
+ *     constexpr auto timing = [] {
+ *       std::array<hal::can_bit_timing, 1> results{};
+ *       hal::solve_bit_timing(16.0_MHz, 500.0_kHz, results);
+ *       return results[0];
+ *     }();
+ *
+ * @param p_operating_frequency - CAN device operating frequency
+ * @param p_baud_rate - target baud rate
+ * @param p_results - buffer to hold the best configurations, best first
+ * @param p_sample_point - target sample point from 0.0 to 1.0
+ * @param p_limits - hardware limits of the bit timing registers
+ * @return constexpr std::size_t - number of configurations stored in
+ * p_results
+ */
+constexpr std::size_t solve_bit_timing(
+  hertz p_operating_frequency,
+  hertz p_baud_rate,
+  std::span<can_bit_timing> p_results,
+  float p_sample_point = 0.875f,
+  can_bit_timing_limits p_limits = {})
+{
+  constexpr auto distance = [](float p_lhs, float p_rhs) {
+    return p_lhs < p_rhs ? p_rhs - p_lhs : p_lhs - p_rhs;
+  };
+
+  const auto is_better = [&distance, p_sample_point](
+                           const can_bit_timing& p_lhs,
+                           const can_bit_timing& p_rhs) {
+    if (p_lhs.baud_error != p_rhs.baud_error) {
+      return p_lhs.baud_error < p_rhs.baud_error;
+    }
+    const auto lhs_sample_error = distance(p_lhs.sample_point, p_sample_point);
+    const auto rhs_sample_error = distance(p_rhs.sample_point, p_sample_point);
+    if (lhs_sample_error != rhs_sample_error) {
+      return lhs_sample_error < rhs_sample_error;
+    }
+    return bit_width(p_lhs.settings) > bit_width(p_rhs.settings);
+  };
+
+  std::size_t count = 0;
+
+  if (p_results.empty() || !(p_baud_rate > 0.0f)) {
+    return count;
+  }
+
+  // The CAN device's operating frequency must be at least 8 times the baud
+  // rate, see rule 4 of `is_valid()`.
+  if (p_operating_frequency < p_baud_rate * 8.0f) {
+    return count;
+  }
+
+  const std::uint16_t max_bit_width =
+    can::settings::sync_segment + p_limits.max_time_segment1 +
+    p_limits.max_time_segment2;
+
+  for (std::uint16_t width = 8; width <= max_bit_width; width++) {
+    const float ideal_prescaler = p_operating_frequency / (p_baud_rate * width);
+    if (ideal_prescaler >= static_cast<float>(p_limits.max_prescaler) + 1.0f) {
+      continue;
+    }
+    const auto floor_prescaler = static_cast<std::uint32_t>(ideal_prescaler);
+
+    for (auto prescaler : { floor_prescaler, floor_prescaler + 1 }) {
+      if (prescaler == 0 || prescaler > p_limits.max_prescaler) {
+        continue;
+      }
+
+      const float actual_baud =
+        p_operating_frequency / static_cast<float>(prescaler * width);
+      const float baud_error = distance(actual_baud, p_baud_rate) / p_baud_rate;
+
+      for (int phase2 = 1; phase2 <= p_limits.max_time_segment2; phase2++) {
+        const int time_segment1 = width - can::settings::sync_segment - phase2;
+        if (time_segment1 < 2 || time_segment1 > p_limits.max_time_segment1) {
+          continue;
+        }
+
+        // Keep phase_segment1 as long as phase_segment2 so that the
+        // synchronization jump width can be as large as possible.
+        const auto phase1 =
+          static_cast<std::uint8_t>(std::min<int>(phase2, time_segment1 - 1));
+        const auto propagation =
+          static_cast<std::uint8_t>(time_segment1 - phase1);
+        const auto jump_width = static_cast<std::uint8_t>(
+          std::min<int>({ 4, phase1, phase2 }));
+
+        const can_bit_timing candidate{
+          .settings = {
+            .baud_rate = p_baud_rate,
+            .propagation_delay = propagation,
+            .phase_segment1 = phase1,
+            .phase_segment2 = static_cast<std::uint8_t>(phase2),
+            .synchronization_jump_width = jump_width,
+          },
+          .prescaler = prescaler,
+          .baud_error = baud_error,
+          .sample_point = static_cast<float>(width - phase2) / width,
+        };
+
+        // Rounding the ideal prescaler the other way gives a configuration
+        // that `is_valid()` would report with a different prescaler.
+        if (is_valid(candidate.settings, p_operating_frequency) != prescaler) {
+          continue;
+        }
+
+        // Insert the candidate into the sorted results, dropping the worst
+        // result if the buffer is full.
+        auto position = count;
+        while (position > 0 && is_better(candidate, p_results[position - 1])) {
+          if (position < p_results.size()) {
+            p_results[position] = p_results[position - 1];
+          }
+          position--;
+        }
+
+        if (position < p_results.size()) {
+          p_results[position] = candidate;
+          count = std::min(count + 1, p_results.size());
+        }
+      }
+    }
+  }
+
+  return count;
+}
+
+/**
+ * @brief Find the bit timing configuration that best fits a baud rate
+ *
+ * See `solve_bit_timing()` for details on how configurations are ranked.
+ *
+ * @param p_operating_frequency - CAN device operating frequency
+ * @param p_baud_rate - target baud rate
+ * @param p_sample_point - target sample point from 0.0 to 1.0
+ * @param p_limits - hardware limits of the bit timing registers
+ * @return constexpr std::optional<can_bit_timing> - best configuration or
+ * std::nullopt if no valid configuration exists.
+ */
+[[nodiscard]] constexpr std::optional<can_bit_timing> best_bit_timing(
+  hertz p_operating_frequency,
+  hertz p_baud_rate,
+  float p_sample_point = 0.875f,
+  can_bit_timing_limits p_limits = {})
+{
+  std::array<can_bit_timing, 1> result{};
+  if (solve_bit_timing(p_operating_frequency,
+                       p_baud_rate,
+                       result,
+                       p_sample_point,
+                       p_limits) == 0) {
+    return std::nullopt;
+  }
+  return result[0];
+}
+
 [[nodiscard]] constexpr auto operator==(const can::message_t& p_lhs,
                                         const can::message_t& p_rhs)
 {
@@ -108,149 +346,2498 @@ namespace hal {
 }
 
 /**
- * @brief Route CAN messages received on the can bus to callbacks based on ID.
+ * @brief Identifier format of a CAN frame
  *
+ * `can::message_t` does not record whether its ID is standard or extended.
+ * Use `can_id_format_of()` to assume extended only when the ID does not fit
+ * in 11 bits.
  */
-class can_router : public move_interceptor<can_router>
+enum class can_id_format : std::uint8_t
 {
-public:
-  friend class move_interceptor<can_router>;
+  /// 11-bit identifier
+  standard,
+  /// 29-bit identifier
+  extended,
+};
 
-  static constexpr auto noop =
-    []([[maybe_unused]] const can::message_t& p_message) {};
+/**
+ * @brief Guess the identifier format of an ID
+ *
+ * @param p_id - message ID
+ * @return constexpr can_id_format - extended if p_id does not fit in 11 bits,
+ * otherwise standard.
+ */
+[[nodiscard]] constexpr can_id_format can_id_format_of(hal::can::id_t p_id)
+{
+  return p_id > 0x7FF ? can_id_format::extended : can_id_format::standard;
+}
 
-  using message_handler = hal::callback<hal::can::handler>;
+/**
+ * @brief Number of bits in a classic CAN frame, without stuff bits
+ *
+ * Counts every bit from the start of frame bit through the 3 bit interframe
+ * space.
+ *
+ * @param p_length - number of data bytes, clamped to 8
+ * @param p_format - identifier format
+ * @param p_remote_request - remote frames carry no data bytes
+ * @return constexpr std::uint16_t - number of bits on the wire
+ */
+[[nodiscard]] constexpr std::uint16_t can_frame_bits_unstuffed(
+  std::uint8_t p_length,
+  can_id_format p_format,
+  bool p_remote_request = false)
+{
+  // SOF, ID, RTR, IDE, r0, DLC, and CRC are subject to bit stuffing
+  // CRC delimiter, ACK, ACK delimiter, EOF, and IFS are not
+  constexpr std::uint16_t standard_overhead = 34 + 13;
+  // Adds the SRR bit, 18 more ID bits, and r1
+  constexpr std::uint16_t extended_overhead = standard_overhead + 20;
 
-  struct route
+  const std::uint16_t data_bits =
+    p_remote_request ? 0 : 8 * std::min<std::uint8_t>(p_length, 8);
+
+  if (p_format == can_id_format::extended) {
+    return extended_overhead + data_bits;
+  }
+  return standard_overhead + data_bits;
+}
+
+/**
+ * @brief Largest number of bits a classic CAN frame can take on the wire
+ *
+ * A stuff bit is inserted after 5 consecutive bits of equal value. In the
+ * worst case, the first stuff bit comes after 5 bits and every following one
+ * after 4 more, as the stuff bit itself starts the next run.
+ *
+ * @param p_length - number of data bytes, clamped to 8
+ * @param p_format - identifier format
+ * @param p_remote_request - remote frames carry no data bytes
+ * @return constexpr std::uint16_t - number of bits on the wire including the
+ * worst case number of stuff bits
+ */
+[[nodiscard]] constexpr std::uint16_t can_frame_bits_worst_case(
+  std::uint8_t p_length,
+  can_id_format p_format,
+  bool p_remote_request = false)
+{
+  constexpr std::uint16_t unstuffed_tail = 13;
+  const auto total =
+    can_frame_bits_unstuffed(p_length, p_format, p_remote_request);
+  const auto stuffed_region = total - unstuffed_tail;
+  return total + (stuffed_region - 1) / 4;
+}
+
+/**
+ * @brief Exact number of bits a classic CAN frame takes on the wire
+ *
+ * Builds the frame's bit stream, including its CRC, and counts the stuff bits
+ * that will be inserted into it.
+ *
+ * @param p_message - message to measure
+ * @param p_format - identifier format
+ * @return constexpr std::uint16_t - number of bits on the wire including stuff
+ * bits
+ */
+[[nodiscard]] constexpr std::uint16_t can_frame_bits(
+  const can::message_t& p_message,
+  can_id_format p_format)
+{
+  struct bit_counter
   {
-    hal::can::id_t id = 0;
-    message_handler handler = noop;
+    std::uint16_t crc = 0;
+    std::uint16_t stuff_bits = 0;
+    std::uint8_t run = 0;
+    bool last = false;
+
+    constexpr void stuff(bool p_bit)
+    {
+      if (run > 0 && p_bit == last) {
+        run++;
+      } else {
+        last = p_bit;
+        run = 1;
+      }
+      // The stuff bit has the opposite value and starts the next run
+      if (run == 5) {
+        stuff_bits++;
+        last = !p_bit;
+        run = 1;
+      }
+    }
+
+    constexpr void push(std::uint32_t p_value, std::uint8_t p_width)
+    {
+      for (int i = p_width - 1; i >= 0; i--) {
+        const bool bit = (p_value >> i) & 1U;
+        // CRC-15, polynomial 0x4599
+        const bool crc_next = bit ^ ((crc >> 14) & 1U);
+        crc = (crc << 1) & 0x7FFF;
+        if (crc_next) {
+          crc ^= 0x4599;
+        }
+        stuff(bit);
+      }
+    }
   };
 
-  using route_item = static_list<route>::item;
+  bit_counter counter;
+  const auto length = std::min<std::uint8_t>(p_message.length, 8);
+  const std::uint32_t remote = p_message.is_remote_request ? 1 : 0;
 
-  static result<can_router> create(hal::can& p_can)
-  {
-    can_router new_can_router(p_can);
-    HAL_CHECK(p_can.on_receive(std::ref(new_can_router)));
-    return new_can_router;
+  // Start of frame
+  counter.push(0, 1);
+
+  if (p_format == can_id_format::extended) {
+    counter.push(p_message.id >> 18, 11);
+    // SRR and IDE are recessive
+    counter.push(0b11, 2);
+    counter.push(p_message.id & 0x3FFFF, 18);
+    counter.push(remote, 1);
+    // r1 and r0
+    counter.push(0, 2);
+  } else {
+    counter.push(p_message.id & 0x7FF, 11);
+    counter.push(remote, 1);
+    // IDE and r0
+    counter.push(0, 2);
   }
 
-  can_router() = delete;
-  can_router(can_router& p_other_self) = delete;
-  can_router& operator=(can_router& p_other_self) = delete;
-  can_router(can_router&& p_other_self) = default;
-  can_router& operator=(can_router&& p_other_self) = default;
-  ~can_router()
-  {
-    // Assume that if this succeeded in the create factory function, that it
-    // will work this time
-    (void)m_can->on_receive(
-      []([[maybe_unused]] const can::message_t& p_message) {});
+  counter.push(length, 4);
+
+  if (!p_message.is_remote_request) {
+    for (std::size_t i = 0; i < length; i++) {
+      counter.push(p_message.payload[i], 8);
+    }
+  }
+
+  const auto crc = counter.crc;
+  for (int i = 14; i >= 0; i--) {
+    counter.stuff((crc >> i) & 1U);
   }
 
+  return can_frame_bits_unstuffed(
+           length, p_format, p_message.is_remote_request) +
+         counter.stuff_bits;
+}
+
+/**
+ * @brief Exact number of bits a classic CAN frame takes on the wire
+ *
+ * Assumes the frame uses an extended ID only if its ID does not fit in 11
+ * bits.
+ *
+ * @param p_message - message to measure
+ * @return constexpr std::uint16_t - number of bits on the wire including stuff
+ * bits
+ */
+[[nodiscard]] constexpr std::uint16_t can_frame_bits(
+  const can::message_t& p_message)
+{
+  return can_frame_bits(p_message, can_id_format_of(p_message.id));
+}
+
+/**
+ * @brief Time it takes to transmit a number of bits
+ *
+ * @param p_bits - number of bits, for example from `can_frame_bits()`
+ * @param p_baud_rate - bus baud rate
+ * @return hal::time_duration - time spent on the wire
+ */
+[[nodiscard]] constexpr hal::time_duration can_wire_time(std::uint32_t p_bits,
+                                                         hertz p_baud_rate)
+{
+  const auto nanoseconds = (static_cast<float>(p_bits) * 1e9f) / p_baud_rate;
+  return hal::time_duration(static_cast<hal::time_duration::rep>(nanoseconds));
+}
+
+/**
+ * @brief Time it takes to transmit a message
+ *
+ * @param p_message - message to measure
+ * @param p_settings - bus settings
+ * @return hal::time_duration - time spent on the wire, including stuff bits
+ */
+[[nodiscard]] constexpr hal::time_duration can_wire_time(
+  const can::message_t& p_message,
+  const can::settings& p_settings)
+{
+  return can_wire_time(can_frame_bits(p_message), p_settings.baud_rate);
+}
+
+/**
+ * @brief Measure the fraction of time the bus spends carrying frames
+ *
+ * Add every frame seen on the bus with `operator()`, for example by
+ * registering the meter with `basic_can_router::on_message()`. Frames sent by
+ * this node are only seen if the driver receives its own frames; otherwise add
+ * them manually. Then periodically call `sample()` to get the load since the
+ * previous sample.
+ *
+ * Adding frames only uses atomic loads and stores of a single word, so frames
+ * may be added from the receive interrupt while sampling in task code. Only
+ * one context may add frames.
+ */
+class can_bus_load_meter
+{
+public:
   /**
-   * @brief Get a reference to the can peripheral driver
-   *
-   * Used to send can messages through the same port that the can_router is
-   * using.
+   * @brief Construct a new can bus load meter
    *
-   * @return can& reference to the can peripheral driver
+   * @param p_steady_clock - clock to measure sampling windows with. Must
+   * outlive this object.
+   * @param p_baud_rate - bus baud rate
    */
-  [[nodiscard]] hal::can& bus()
+  can_bus_load_meter(hal::steady_clock& p_steady_clock, hertz p_baud_rate)
+    : m_steady_clock(&p_steady_clock)
+    , m_baud_rate(p_baud_rate)
   {
-    return *m_can;
   }
 
+  can_bus_load_meter(can_bus_load_meter& p_other) = delete;
+  can_bus_load_meter& operator=(can_bus_load_meter& p_other) = delete;
+  can_bus_load_meter(can_bus_load_meter&& p_other) = delete;
+  can_bus_load_meter& operator=(can_bus_load_meter&& p_other) = delete;
+
   /**
-   * @brief Add a message route without setting the callback
-   *
-   * The default callback will do nothing and will drop the message.
+   * @brief Add a frame seen on the bus
    *
-   * @param p_id - Associated ID of messages to be stored.
-   * @return auto - route item from the linked list that must be stored stored
-   * in a variable
+   * @param p_message - frame seen on the bus
    */
-  [[nodiscard]] auto add_message_callback(hal::can::id_t p_id)
+  void operator()(const can::message_t& p_message)
   {
-    return m_handlers.push_back(route{
-      .id = p_id,
-    });
+    // Only one context adds frames, so a read-modify-write is not necessary.
+    // The total is allowed to wrap around.
+    const auto bits = m_bits.load(std::memory_order_relaxed);
+    m_bits.store(bits + can_frame_bits(p_message), std::memory_order_relaxed);
   }
 
   /**
-   * @brief Set a callback for when messages with a specific ID is received
+   * @brief Get the bus load since the previous sample
    *
-   * @param p_id - Associated ID of messages to be stored.
-   * @param p_handler - callback to be executed when a p_id message is received.
-   * @return auto - route item from the linked list that must be stored stored
-   * in a variable
+   * The first sample covers the time since the first call to `sample()` or
+   * construction, whichever is later. Sample at least once every 2^32 bit
+   * times, about 71 minutes at 1Mbit/s.
+   *
+   * @return result<float> - fraction of the window spent carrying frames,
+   * 0.0 for an idle bus and 1.0 for a saturated bus.
    */
-  [[nodiscard]] auto add_message_callback(hal::can::id_t p_id,
-                                          message_handler p_handler)
+  result<float> sample()
   {
-    return m_handlers.push_back(route{
-      .id = p_id,
-      .handler = p_handler,
-    });
+    const auto now = HAL_CHECK(m_steady_clock->uptime());
+    const auto bits = m_bits.load(std::memory_order_relaxed);
+
+    if (!m_started) {
+      m_started = true;
+      m_window_start = now;
+      m_window_bits = bits;
+      return 0.0f;
+    }
+
+    const auto elapsed_ticks = now - m_window_start;
+    const std::uint32_t window_bits = bits - m_window_bits;
+    m_window_start = now;
+    m_window_bits = bits;
+
+    if (elapsed_ticks == 0) {
+      return 0.0f;
+    }
+
+    const auto bus_seconds = static_cast<float>(window_bits) / m_baud_rate;
+    const auto elapsed_seconds = static_cast<float>(elapsed_ticks) /
+                                 m_steady_clock->frequency();
+    const auto load = bus_seconds / elapsed_seconds;
+    m_peak = std::max(m_peak, load);
+    return load;
   }
 
   /**
-   * @brief Get the list of handlers
-   *
-   * Meant for testing purposes or when direct inspection of the map is useful
-   * in userspace. Should not be used in by libraries.
+   * @brief Get the highest load returned by `sample()`
    *
-   * @return const auto& map of all of the can message handlers.
+   * @return float - peak bus load
    */
-  [[nodiscard]] const auto& handlers()
+  [[nodiscard]] float peak() const
   {
-    return m_handlers;
+    return m_peak;
   }
 
   /**
-   * @brief Message routing interrupt service handler
-   *
-   * Searches the static list and finds the first ID associated with the message
-   * and run's that route's callback.
+   * @brief Get the number of bits added so far
    *
-   * @param p_message - message received from the bus
+   * @return std::uint32_t - total bits, wraps around
    */
-  void operator()(const can::message_t& p_message)
+  [[nodiscard]] std::uint32_t bits() const
   {
-    for (auto& list_handler : m_handlers) {
-      if (p_message.id == list_handler.id) {
-        list_handler.handler(p_message);
-        return;
-      }
-    }
+    return m_bits.load(std::memory_order_relaxed);
   }
 
 private:
+  hal::steady_clock* m_steady_clock;
+  hertz m_baud_rate;
+  std::atomic<std::uint32_t> m_bits = 0;
+  std::uint64_t m_window_start = 0;
+  std::uint32_t m_window_bits = 0;
+  float m_peak = 0.0f;
+  bool m_started = false;
+};
+
+/**
+ * @brief Timestamp source that reads a steady clock
+ *
+ * Returns the clock's uptime in ticks. If the clock reports an error, the
+ * previous timestamp is returned.
+ */
+class can_steady_clock_timestamp
+{
+public:
   /**
-   * @brief Update the callback location if this object is moved
+   * @brief Construct a new can steady clock timestamp
    *
-   * @param p_old_self - the old version of the can_router
+   * @param p_steady_clock - clock to read. Must outlive this object.
    */
-  void intercept(can_router* p_old_self)
+  explicit can_steady_clock_timestamp(hal::steady_clock& p_steady_clock)
+    : m_steady_clock(&p_steady_clock)
   {
-    // Assume that if this succeeded in the create factory function, that it
-    // will work this time
-    (void)p_old_self->m_can->on_receive(std::ref(*this));
   }
 
   /**
-   * @brief Construct a new can message router
+   * @brief Read the clock
    *
-   * @param p_can - can peripheral to route messages for
-   * @param p_memory_resource - memory resource used for storing callbacks
+   * @return std::uint64_t - uptime in ticks of the steady clock
    */
-  explicit can_router(hal::can& p_can)
-    : m_can(&p_can)
+  std::uint64_t operator()()
   {
+    if (auto uptime = m_steady_clock->uptime(); uptime) {
+      m_previous = uptime.value();
+    }
+    return m_previous;
   }
 
-  static_list<route> m_handlers;
-  hal::can* m_can;
+private:
+  hal::steady_clock* m_steady_clock;
+  std::uint64_t m_previous = 0;
+};
+
+/**
+ * @brief Timestamp source that extends a free running hardware counter to
+ * 64 bits
+ *
+ * Reading a counter register directly is cheaper than going through a
+ * steady clock driver. Overflows are detected with `overflow_counter`, thus
+ * the source must be called at least once per counter period. Frequent
+ * traffic usually satisfies this; otherwise also call it from a periodic
+ * task.
+ *
+ * @tparam CountBitWidth - bit width of the counter
+ */
+template<std::size_t CountBitWidth = 32>
+class can_counter_timestamp
+{
+public:
+  /**
+   * @brief Construct a new can counter timestamp
+   *
+   * @param p_counter - counter register. Must outlive this object.
+   */
+  explicit can_counter_timestamp(const volatile std::uint32_t& p_counter)
+    : m_counter(&p_counter)
+  {
+  }
+
+  /**
+   * @brief Read the counter
+   *
+   * @return std::uint64_t - 64-bit count
+   */
+  std::uint64_t operator()()
+  {
+    return m_overflow.update(*m_counter);
+  }
+
+private:
+  const volatile std::uint32_t* m_counter;
+  overflow_counter<CountBitWidth> m_overflow{};
+};
+
+/**
+ * @brief Lock free single-producer/single-consumer queue of CAN messages
+ *
+ * Meant to move messages out of the receive interrupt and into task code. The
+ * interrupt service routine pushes messages into the queue and task code
+ * drains the queue in batches. Pushing a message takes constant time and never
+ * blocks. If the queue is full, the message is dropped and the overrun count
+ * is incremented.
+ *
+ * Only atomic loads and stores are used, thus this works on devices without
+ * atomic read-modify-write instructions.
+ *
+ * Only one producer and one consumer may use the queue at a time.
+ */
+class can_receive_queue
+{
+public:
+  /**
+   * @brief Construct a new can receive queue
+   *
+   * @param p_storage - memory to store messages in. The lifetime of this
+   * memory must outlive this object. One element of the storage is kept empty
+   * to distinguish between a full and empty queue, thus the capacity of the
+   * queue is one less than the size of the storage.
+   */
+  explicit can_receive_queue(std::span<can::message_t> p_storage)
+    : m_storage(p_storage)
+  {
+  }
+
+  /**
+   * @brief Construct a new can receive queue that also stores a timestamp
+   * for each message
+   *
+   * @param p_storage - memory to store messages in. See above.
+   * @param p_timestamps - memory to store timestamps in. Must be the same size
+   * as p_storage, otherwise timestamps are not stored. The lifetime of this
+   * memory must outlive this object.
+   */
+  can_receive_queue(std::span<can::message_t> p_storage,
+                    std::span<std::uint64_t> p_timestamps)
+    : m_storage(p_storage)
+  {
+    if (p_timestamps.size() == p_storage.size()) {
+      m_timestamps = p_timestamps;
+    }
+  }
+
+  can_receive_queue(can_receive_queue& p_other) = delete;
+  can_receive_queue& operator=(can_receive_queue& p_other) = delete;
+
+  /**
+   * @brief Push a message into the queue
+   *
+   * Must only be called by the producer.
+   *
+   * @param p_message - message to copy into the queue
+   * @param p_timestamp - time the message was received, only stored if the
+   * queue was constructed with timestamp storage
+   * @return true - message was stored
+   * @return false - queue was full and the message was dropped
+   */
+  bool push(const can::message_t& p_message, std::uint64_t p_timestamp = 0)
+  {
+    const auto head = m_head.load(std::memory_order_relaxed);
+    const auto next = advance(head);
+
+    if (next == m_tail.load(std::memory_order_acquire)) {
+      // Only the producer writes to the overrun count, so a read-modify-write
+      // is not necessary.
+      const auto overruns = m_overruns.load(std::memory_order_relaxed);
+      m_overruns.store(overruns + 1, std::memory_order_relaxed);
+      return false;
+    }
+
+    m_storage[head] = p_message;
+    if (!m_timestamps.empty()) {
+      m_timestamps[head] = p_timestamp;
+    }
+    m_head.store(next, std::memory_order_release);
+    return true;
+  }
+
+  /**
+   * @brief Push a message into the queue
+   *
+   * Allows the queue to be used directly as a can receive handler.
+   *
+   * @param p_message - message to copy into the queue
+   */
+  void operator()(const can::message_t& p_message)
+  {
+    (void)push(p_message);
+  }
+
+  /**
+   * @brief Remove the oldest message from the queue
+   *
+   * Must only be called by the consumer.
+   *
+   * @return std::optional<can::message_t> - the oldest message or
+   * std::nullopt if the queue is empty.
+   */
+  [[nodiscard]] std::optional<can::message_t> pop()
+  {
+    std::optional<can::message_t> message;
+    drain([&message](const can::message_t& p_message) { message = p_message; },
+          1);
+    return message;
+  }
+
+  /**
+   * @brief Pass queued messages to a handler, oldest first
+   *
+   * Must only be called by the consumer. Messages are released back to the
+   * producer once the whole batch has been handled.
+   *
+   * @param p_handler - callable with the signature `void(const
+   * can::message_t&)` or `void(const can::message_t&, std::uint64_t)`. The
+   * second form also receives the message's timestamp, or 0 if the queue
+   * does not store timestamps.
+   * @param p_max_messages - maximum number of messages to handle in this
+   * batch.
+   * @return std::size_t - number of messages handled
+   */
+  std::size_t drain(
+    auto&& p_handler,
+    std::size_t p_max_messages = std::numeric_limits<std::size_t>::max())
+  {
+    auto tail = m_tail.load(std::memory_order_relaxed);
+    const auto head = m_head.load(std::memory_order_acquire);
+    std::size_t count = 0;
+
+    while (tail != head && count < p_max_messages) {
+      if constexpr (std::is_invocable_v<decltype(p_handler),
+                                        const can::message_t&,
+                                        std::uint64_t>) {
+        const auto timestamp = m_timestamps.empty() ? 0 : m_timestamps[tail];
+        p_handler(std::as_const(m_storage[tail]), timestamp);
+      } else {
+        p_handler(std::as_const(m_storage[tail]));
+      }
+      tail = advance(tail);
+      count++;
+    }
+
+    m_tail.store(tail, std::memory_order_release);
+    return count;
+  }
+
+  /**
+   * @brief Get the number of messages in the queue
+   *
+   * @return std::size_t - number of messages waiting to be drained
+   */
+  [[nodiscard]] std::size_t size() const
+  {
+    const auto head = m_head.load(std::memory_order_acquire);
+    const auto tail = m_tail.load(std::memory_order_acquire);
+    if (head >= tail) {
+      return head - tail;
+    }
+    return m_storage.size() - (tail - head);
+  }
+
+  /**
+   * @brief Get the maximum number of messages the queue can hold
+   *
+   * @return std::size_t - capacity of the queue
+   */
+  [[nodiscard]] std::size_t capacity() const
+  {
+    if (m_storage.empty()) {
+      return 0;
+    }
+    return m_storage.size() - 1;
+  }
+
+  /**
+   * @brief Get the number of messages dropped because the queue was full
+   *
+   * @return std::uint32_t - number of dropped messages
+   */
+  [[nodiscard]] std::uint32_t overruns() const
+  {
+    return m_overruns.load(std::memory_order_relaxed);
+  }
+
+private:
+  [[nodiscard]] std::size_t advance(std::size_t p_index) const
+  {
+    const auto next = p_index + 1;
+    if (next >= m_storage.size()) {
+      return 0;
+    }
+    return next;
+  }
+
+  std::span<can::message_t> m_storage;
+  std::span<std::uint64_t> m_timestamps{};
+  std::atomic<std::size_t> m_head = 0;
+  std::atomic<std::size_t> m_tail = 0;
+  std::atomic<std::uint32_t> m_overruns = 0;
+};
+
+/**
+ * @brief can_router statistics policy that records nothing
+ *
+ * The default policy of basic_can_router. Every member is empty and every
+ * function is a no-op, thus it compiles away completely.
+ */
+struct can_router_no_statistics
+{
+  /// Statistics stored along side each route
+  struct route_statistics
+  {};
+
+  /**
+   * @brief Run a route's handler
+   *
+   * @param p_route_statistics - statistics of the route being run
+   * @param p_handler - callable that runs the route's handler
+   */
+  void record([[maybe_unused]] route_statistics& p_route_statistics,
+              auto&& p_handler)
+  {
+    p_handler();
+  }
+
+  /**
+   * @brief Called when a message does not match any route
+   *
+   */
+  void record_unmatched()
+  {
+  }
+};
+
+/**
+ * @brief can_router statistics policy that counts messages and times handlers
+ *
+ * For each route, records the number of messages routed to it and the last
+ * and maximum time, in steady_clock ticks, spent in its handler. Also counts
+ * the number of messages that did not match any route.
+ *
+ * Use `hal::duration_from_cycles(statistics.frequency(), ticks)` to convert
+ * the recorded ticks into a time duration.
+ */
+class can_router_statistics
+{
+public:
+  /// Statistics stored along side each route
+  struct route_statistics
+  {
+    /// Number of messages routed to this route
+    std::uint32_t hits = 0;
+    /// Number of ticks spent in the handler the last time it was called
+    std::uint64_t last_ticks = 0;
+    /// Maximum number of ticks spent in the handler
+    std::uint64_t max_ticks = 0;
+  };
+
+  /**
+   * @brief Construct a new can router statistics object
+   *
+   * @param p_steady_clock - clock used to time handlers. Must outlive this
+   * object.
+   */
+  explicit can_router_statistics(hal::steady_clock& p_steady_clock)
+    : m_steady_clock(&p_steady_clock)
+  {
+  }
+
+  /**
+   * @brief Run and time a route's handler
+   *
+   * If the steady clock fails to report its uptime, the message is counted
+   * but the handler is not timed.
+   *
+   * @param p_route_statistics - statistics of the route being run
+   * @param p_handler - callable that runs the route's handler
+   */
+  void record(route_statistics& p_route_statistics, auto&& p_handler)
+  {
+    auto start = m_steady_clock->uptime();
+    p_handler();
+    auto end = m_steady_clock->uptime();
+
+    p_route_statistics.hits++;
+
+    if (!start || !end) {
+      return;
+    }
+
+    const auto ticks = end.value() - start.value();
+    p_route_statistics.last_ticks = ticks;
+    p_route_statistics.max_ticks =
+      std::max(p_route_statistics.max_ticks, ticks);
+  }
+
+  /**
+   * @brief Called when a message does not match any route
+   *
+   */
+  void record_unmatched()
+  {
+    m_unmatched++;
+  }
+
+  /**
+   * @brief Get the number of messages that did not match any route
+   *
+   * @return std::uint32_t - number of unmatched messages
+   */
+  [[nodiscard]] std::uint32_t unmatched() const
+  {
+    return m_unmatched;
+  }
+
+  /**
+   * @brief Get the frequency of the ticks recorded in route statistics
+   *
+   * @return hertz - frequency of the steady clock
+   */
+  [[nodiscard]] hertz frequency()
+  {
+    return m_steady_clock->frequency();
+  }
+
+private:
+  hal::steady_clock* m_steady_clock;
+  std::uint32_t m_unmatched = 0;
+};
+
+/**
+ * @brief can_router ordering policy that keeps routes in insertion order
+ *
+ * The default policy of basic_can_router. Routes are searched in the order
+ * they were added and nothing is recorded.
+ */
+struct can_route_insertion_order
+{
+  /// True if `found()` relinks routes. Such orderings write to the route
+  /// lists while routing, so a router using one must route from task code,
+  /// see `basic_can_router`.
+  static constexpr bool reorders_routes = false;
+
+  /**
+   * @brief Called when a route matches a message
+   *
+   * @param p_list - list the route was found in
+   * @param p_position - iterator to the matching route
+   * @param p_comparisons - number of routes compared, including the match
+   */
+  void found([[maybe_unused]] auto& p_list,
+             [[maybe_unused]] auto p_position,
+             [[maybe_unused]] std::size_t p_comparisons)
+  {
+  }
+
+  /**
+   * @brief Called when no route matches a message
+   *
+   * @param p_comparisons - number of routes compared
+   */
+  void missed([[maybe_unused]] std::size_t p_comparisons)
+  {
+  }
+};
+
+/**
+ * @brief can_router ordering policy that moves matching routes to the front
+ * of their list
+ *
+ * On busses where a few IDs make up most of the traffic, those routes settle
+ * at the front of their list and are found within one or two comparisons,
+ * without the memory cost of more buckets. Rare IDs pay for a longer search
+ * once before being moved forward. Routes are relinked, never copied, thus
+ * route items remain valid.
+ *
+ * A lookup is counted as a hit when the matching route was already at the
+ * front of its list. Use `hit_rate()` and `average_comparisons()` to judge
+ * if the ordering suits the bus's traffic.
+ *
+ * Moving a route rewrites the links of its list, as does adding or removing
+ * a route. Both must run in the same execution context, thus routers using
+ * this ordering can only be created with a can_receive_queue, and routes
+ * must be added and removed in the same context that calls `process()`.
+ */
+class can_route_move_to_front
+{
+public:
+  /// Routes are relinked while routing
+  static constexpr bool reorders_routes = true;
+
+  /**
+   * @brief Move a matching route to the front of its list
+   *
+   * @param p_list - list the route was found in
+   * @param p_position - iterator to the matching route
+   * @param p_comparisons - number of routes compared, including the match
+   */
+  void found(auto& p_list, auto p_position, std::size_t p_comparisons)
+  {
+    m_lookups++;
+    m_comparisons += p_comparisons;
+    if (p_comparisons == 1) {
+      m_hits++;
+      return;
+    }
+    p_list.move_to_front(p_position);
+  }
+
+  /**
+   * @brief Count a message that did not match any route
+   *
+   * @param p_comparisons - number of routes compared
+   */
+  void missed(std::size_t p_comparisons)
+  {
+    m_lookups++;
+    m_comparisons += p_comparisons;
+  }
+
+  /**
+   * @brief Get the number of messages searched for
+   *
+   * @return std::uint32_t - number of lookups, including misses
+   */
+  [[nodiscard]] std::uint32_t lookups() const
+  {
+    return m_lookups;
+  }
+
+  /**
+   * @brief Get the number of messages whose route was at the front of its list
+   *
+   * @return std::uint32_t - number of hits
+   */
+  [[nodiscard]] std::uint32_t hits() const
+  {
+    return m_hits;
+  }
+
+  /**
+   * @brief Get the total number of route IDs compared
+   *
+   * @return std::uint64_t - number of comparisons
+   */
+  [[nodiscard]] std::uint64_t comparisons() const
+  {
+    return m_comparisons;
+  }
+
+  /**
+   * @brief Get the fraction of lookups that were hits
+   *
+   * @return float - hit rate between 0.0 and 1.0. 0.0 if nothing has been
+   * looked up.
+   */
+  [[nodiscard]] float hit_rate() const
+  {
+    if (m_lookups == 0) {
+      return 0.0f;
+    }
+    return static_cast<float>(m_hits) / static_cast<float>(m_lookups);
+  }
+
+  /**
+   * @brief Get the average number of comparisons per lookup
+   *
+   * @return float - average comparisons. 0.0 if nothing has been looked up.
+   */
+  [[nodiscard]] float average_comparisons() const
+  {
+    if (m_lookups == 0) {
+      return 0.0f;
+    }
+    return static_cast<float>(m_comparisons) / static_cast<float>(m_lookups);
+  }
+
+  /**
+   * @brief Clear the counters
+   *
+   */
+  void reset()
+  {
+    m_lookups = 0;
+    m_hits = 0;
+    m_comparisons = 0;
+  }
+
+private:
+  std::uint32_t m_lookups = 0;
+  std::uint32_t m_hits = 0;
+  std::uint64_t m_comparisons = 0;
+};
+
+/**
+ * @brief Receive handling shared by every CAN router
+ *
+ * Owns the receive handler registration, the optional can_receive_queue, the
+ * monitor and unmatched callbacks and the timestamp source. Routers derive
+ * from it and only implement the lookup of a message's route:
+ *
+ *     // Calls the route's callback and returns true, or returns false if no
+ *     // route matches the message
+ *     bool route_message(const can::message_t& p_message);
+ *
+ * @tparam Derived - router deriving from this class
+ */
+template<class Derived>
+class can_router_base
+{
+public:
+  static constexpr auto noop =
+    []([[maybe_unused]] const can::message_t& p_message) {};
+
+  using message_handler = hal::callback<hal::can::handler>;
+
+  can_router_base() = delete;
+  can_router_base(can_router_base& p_other_self) = delete;
+  can_router_base& operator=(can_router_base& p_other_self) = delete;
+
+  /**
+   * @brief Get a reference to the can peripheral driver
+   *
+   * Used to send can messages through the same port that the router is
+   * using.
+   *
+   * @return can& reference to the can peripheral driver
+   */
+  [[nodiscard]] hal::can& bus()
+  {
+    return *m_can;
+  }
+
+  /**
+   * @brief Set the callback for messages that do not match any route
+   *
+   * Useful for forwarding messages to a `can_filter_table` which can match
+   * messages by mask or range.
+   *
+   *     auto router = hal::can_router::create(can).value();
+   *     hal::can_filter_table<16> filters;
+   *     router.on_unmatched(std::ref(filters));
+   *
+   * @param p_handler - callback to be executed when a message is received that
+   * does not match any route. The default handler drops the message.
+   */
+  void on_unmatched(message_handler p_handler)
+  {
+    m_unmatched = p_handler;
+  }
+
+  /**
+   * @brief Set a callback that sees every message before it is routed
+   *
+   * Meant for observers of the whole bus, such as `can_bus_load_meter`.
+   * Costs nothing beyond a check for an empty callback if left unset.
+   *
+   * @param p_handler - callback to be executed for every routed message
+   */
+  void on_message(message_handler p_handler)
+  {
+    m_monitor = p_handler;
+  }
+
+  /**
+   * @brief Route queued messages to their callbacks
+   *
+   * Only does work for routers created with a can_receive_queue. Must be
+   * called from task code, never from the receive interrupt.
+   *
+   * @param p_max_messages - maximum number of messages to route in this call
+   * @return std::size_t - number of messages routed
+   */
+  std::size_t process(
+    std::size_t p_max_messages = std::numeric_limits<std::size_t>::max())
+  {
+    if (m_queue == nullptr) {
+      return 0;
+    }
+    return m_queue->drain(
+      [this](const can::message_t& p_message, std::uint64_t p_timestamp) {
+        m_timestamp = p_timestamp;
+        dispatch(p_message);
+      },
+      p_max_messages);
+  }
+
+  /**
+   * @brief Message receive interrupt service handler
+   *
+   * Routes the message immediately or, if the router was created with a
+   * can_receive_queue, stores the message in the queue to be routed by
+   * `process()`.
+   *
+   * @param p_message - message received from the bus
+   */
+  void operator()(const can::message_t& p_message)
+  {
+    const auto timestamp = m_timestamp_source ? m_timestamp_source() : 0;
+    if (m_queue != nullptr) {
+      (void)m_queue->push(p_message, timestamp);
+      return;
+    }
+    m_timestamp = timestamp;
+    dispatch(p_message);
+  }
+
+  /**
+   * @brief Timestamp each message as soon as it is received
+   *
+   * The source is called at the start of the receive interrupt, before the
+   * message is queued or routed. Callbacks read the timestamp of the message
+   * they are handling with `timestamp()`. Routers created with a
+   * can_receive_queue only keep timestamps if the queue has timestamp storage.
+   *
+   *     hal::can_counter_timestamp counter(TIM2->CNT);
+   *     router.timestamp_with(std::ref(counter));
+   *     auto route = router.add_message_callback(
+   *       0x100, [&router](const hal::can::message_t& p_message) {
+   *         latency.record(router.timestamp());
+   *       });
+   *
+   * @param p_source - callable returning the current time, such as
+   * `can_steady_clock_timestamp` or `can_counter_timestamp`
+   */
+  void timestamp_with(hal::callback<std::uint64_t()> p_source)
+  {
+    m_timestamp_source = p_source;
+  }
+
+  /**
+   * @brief Get the timestamp of the message being routed
+   *
+   * Only meaningful within a callback and when a timestamp source has been
+   * set, otherwise returns 0.
+   *
+   * @return std::uint64_t - time the message was received, in the units of
+   * the timestamp source
+   */
+  [[nodiscard]] std::uint64_t timestamp() const
+  {
+    return m_timestamp;
+  }
+
+  /**
+   * @brief Route a message to its callback
+   *
+   * Passes the message to the `on_message()` callback, then to the callback
+   * of its route. If no route matches, the message is passed to the unmatched
+   * handler.
+   *
+   * @param p_message - message to route
+   */
+  void dispatch(const can::message_t& p_message)
+  {
+    if (m_monitor) {
+      m_monitor(p_message);
+    }
+    if (!static_cast<Derived&>(*this).route_message(p_message)) {
+      m_unmatched(p_message);
+    }
+  }
+
+protected:
+  /**
+   * @brief Construct a router that is not yet receiving messages
+   *
+   * @param p_can - can peripheral to route messages for
+   */
+  explicit can_router_base(hal::can& p_can)
+    : m_can(&p_can)
+  {
+  }
+
+  can_router_base(can_router_base&& p_other_self)
+    : m_unmatched(std::move(p_other_self.m_unmatched))
+    , m_monitor(std::move(p_other_self.m_monitor))
+    , m_timestamp_source(std::move(p_other_self.m_timestamp_source))
+    , m_timestamp(p_other_self.m_timestamp)
+    , m_queue(p_other_self.m_queue)
+    , m_can(std::exchange(p_other_self.m_can, nullptr))
+  {
+    attach_self();
+  }
+
+  can_router_base& operator=(can_router_base&& p_other_self)
+  {
+    if (this == &p_other_self) {
+      return *this;
+    }
+    release();
+    m_unmatched = std::move(p_other_self.m_unmatched);
+    m_monitor = std::move(p_other_self.m_monitor);
+    m_timestamp_source = std::move(p_other_self.m_timestamp_source);
+    m_timestamp = p_other_self.m_timestamp;
+    m_queue = p_other_self.m_queue;
+    m_can = std::exchange(p_other_self.m_can, nullptr);
+    attach_self();
+    return *this;
+  }
+
+  ~can_router_base()
+  {
+    release();
+  }
+
+  /**
+   * @brief Start receiving messages, used by the routers' create functions
+   *
+   * @param p_router - newly constructed router
+   * @param p_queue - queue to defer routing to or nullptr to route within the
+   * receive interrupt
+   * @return result<Derived> - the router or an error if the receive handler
+   * could not be set.
+   */
+  static result<Derived> attach(Derived p_router, can_receive_queue* p_queue)
+  {
+    auto& base = static_cast<can_router_base&>(p_router);
+    base.m_queue = p_queue;
+    HAL_CHECK(base.m_can->on_receive(std::ref(base)));
+    return p_router;
+  }
+
+private:
+  /**
+   * @brief Receive messages at this router's new address after a move
+   *
+   * Routers moved from a router that had itself been moved from have no can
+   * peripheral and are left detached.
+   */
+  void attach_self()
+  {
+    if (m_can == nullptr) {
+      return;
+    }
+    // Assume that if this succeeded in the create factory function, that it
+    // will work this time
+    (void)m_can->on_receive(std::ref(*this));
+  }
+
+  /**
+   * @brief Stop receiving messages from the can peripheral
+   *
+   * Routers that have been moved from no longer own the receive handler and
+   * must not reset it.
+   */
+  void release()
+  {
+    if (m_can == nullptr) {
+      return;
+    }
+    // Assume that if this succeeded in the create factory function, that it
+    // will work this time
+    (void)m_can->on_receive(
+      []([[maybe_unused]] const can::message_t& p_message) {});
+  }
+
+  message_handler m_unmatched = noop;
+  message_handler m_monitor{};
+  hal::callback<std::uint64_t()> m_timestamp_source{};
+  std::uint64_t m_timestamp = 0;
+  can_receive_queue* m_queue = nullptr;
+  hal::can* m_can;
+};
+
+/**
+ * @brief Route CAN messages received on the can bus to callbacks based on ID.
+ *
+ * Routes are distributed across `BucketCount` static lists based on a hash of
+ * their ID. When a message is received, only the bucket associated with the
+ * message's ID is searched, thus the cost of finding a route does not grow
+ * with the number of routes so long as the number of buckets is large enough
+ * to spread the routes out. With a `BucketCount` of 1, all routes are placed
+ * in a single list and searched linearly.
+ *
+ * No memory is allocated by the router. Each bucket is a static_list, thus
+ * routes are still removed automatically when their route item is destroyed.
+ *
+ * The Statistics policy determines what is recorded about each route as
+ * messages are routed. By default nothing is recorded and no space is used.
+ * Use `can_router_statistics` to count messages and time handlers.
+ *
+ * The Ordering policy determines how routes are arranged within a bucket as
+ * they are matched. By default routes stay in insertion order. Use
+ * `can_route_move_to_front` when a few IDs dominate the bus's traffic:
+ *
+ *     using hot_can_router = hal::basic_can_router<
+ *       1, hal::can_router_no_statistics, hal::can_route_move_to_front>;
+ *     auto router = hot_can_router::create(can, queue).value();
+ *
+ * Orderings that reorder routes modify the route lists while routing, which
+ * would race with routes being added or removed in task code if routing ran
+ * in the receive interrupt. Such routers must be created with a
+ * can_receive_queue; creating one that routes within the interrupt fails to
+ * compile.
+ *
+ * @tparam BucketCount - number of route lists to hash IDs into. Must be a
+ * power of 2.
+ * @tparam Statistics - statistics policy such as `can_router_no_statistics`
+ * or `can_router_statistics`.
+ * @tparam Ordering - ordering policy such as `can_route_insertion_order` or
+ * `can_route_move_to_front`.
+ */
+template<std::size_t BucketCount = 1,
+         class Statistics = can_router_no_statistics,
+         class Ordering = can_route_insertion_order>
+class basic_can_router
+  : public can_router_base<basic_can_router<BucketCount, Statistics, Ordering>>
+{
+  using base = can_router_base<basic_can_router>;
+  friend base;
+
+public:
+  static_assert(std::has_single_bit(BucketCount),
+                "BucketCount must be a power of 2");
+
+  using base::noop;
+  using typename base::message_handler;
+
+  using route_statistics = typename Statistics::route_statistics;
+
+  struct route
+  {
+    hal::can::id_t id = 0;
+    message_handler handler = noop;
+    [[no_unique_address]] route_statistics statistics{};
+  };
+
+  /// Copy of a route's statistics, see `snapshot()`
+  struct route_snapshot
+  {
+    hal::can::id_t id = 0;
+    route_statistics statistics{};
+  };
+
+  using route_item = typename static_list<route>::item;
+
+  /**
+   * @brief Create a can router that routes messages within the receive
+   * interrupt
+   *
+   * @param p_can - can peripheral to route messages for
+   * @param p_statistics - statistics policy object
+   * @return result<basic_can_router> - the router or an error if the receive
+   * handler could not be set.
+   */
+  static result<basic_can_router> create(hal::can& p_can,
+                                         Statistics p_statistics = Statistics{})
+  {
+    static_assert(!Ordering::reorders_routes,
+                  "Orderings that reorder routes must route from task code, "
+                  "create the router with a can_receive_queue.");
+    return base::attach(basic_can_router(p_can, p_statistics), nullptr);
+  }
+
+  /**
+   * @brief Create a can router that defers routing to task code
+   *
+   * Received messages are copied into the queue within the receive interrupt
+   * and are only routed to their callbacks when `process()` is called. This
+   * keeps the time spent in the interrupt constant and allows callbacks to
+   * perform heavy work outside of interrupt context.
+   *
+   * @param p_can - can peripheral to route messages for
+   * @param p_queue - queue to hold messages until they are processed. Must
+   * outlive the router.
+   * @param p_statistics - statistics policy object
+   * @return result<basic_can_router> - the router or an error if the receive
+   * handler could not be set.
+   */
+  static result<basic_can_router> create(hal::can& p_can,
+                                         can_receive_queue& p_queue,
+                                         Statistics p_statistics = Statistics{})
+  {
+    return base::attach(basic_can_router(p_can, p_statistics), &p_queue);
+  }
+
+  /**
+   * @brief Determine which bucket messages with this ID are routed through
+   *
+   * Uses fibonacci hashing, keeping the upper bits of the product of the ID
+   * and 2^32/phi. This spreads out IDs that only differ in their upper bits,
+   * such as J1939 messages sent from the same source address.
+   *
+   * @param p_id - message ID
+   * @return constexpr std::size_t - index of the bucket
+   */
+  [[nodiscard]] static constexpr std::size_t bucket_index(hal::can::id_t p_id)
+  {
+    if constexpr (BucketCount == 1) {
+      return 0;
+    } else {
+      constexpr std::uint32_t golden_ratio = 2654435769U;
+      constexpr auto shift = 32U - std::countr_zero(BucketCount);
+      const auto product = static_cast<std::uint32_t>(p_id * golden_ratio);
+      return product >> shift;
+    }
+  }
+
+  basic_can_router() = delete;
+  basic_can_router(basic_can_router& p_other_self) = delete;
+  basic_can_router& operator=(basic_can_router& p_other_self) = delete;
+  basic_can_router(basic_can_router&& p_other_self) = default;
+  basic_can_router& operator=(basic_can_router&& p_other_self) = default;
+  ~basic_can_router() = default;
+
+  /**
+   * @brief Add a message route without setting the callback
+   *
+   * The default callback will do nothing and will drop the message.
+   *
+   * @param p_id - Associated ID of messages to be stored.
+   * @return auto - route item from the linked list that must be stored stored
+   * in a variable
+   */
+  [[nodiscard]] auto add_message_callback(hal::can::id_t p_id)
+  {
+    return m_buckets[bucket_index(p_id)].push_back(route{
+      .id = p_id,
+    });
+  }
+
+  /**
+   * @brief Set a callback for when messages with a specific ID is received
+   *
+   * @param p_id - Associated ID of messages to be stored.
+   * @param p_handler - callback to be executed when a p_id message is received.
+   * @return auto - route item from the linked list that must be stored stored
+   * in a variable
+   */
+  [[nodiscard]] auto add_message_callback(hal::can::id_t p_id,
+                                          message_handler p_handler)
+  {
+    return m_buckets[bucket_index(p_id)].push_back(route{
+      .id = p_id,
+      .handler = p_handler,
+    });
+  }
+
+  /**
+   * @brief Get the list of handlers
+   *
+   * Meant for testing purposes or when direct inspection of the map is useful
+   * in userspace. Should not be used in by libraries.
+   *
+   * Only available when all routes are stored in a single bucket. Use
+   * `bucket()` to inspect the routes of a multi-bucket router.
+   *
+   * @return const auto& map of all of the can message handlers.
+   */
+  [[nodiscard]] const auto& handlers()
+    requires(BucketCount == 1)
+  {
+    return m_buckets[0];
+  }
+
+  /**
+   * @brief Get the list of handlers that messages with this ID are searched in
+   *
+   * Meant for testing purposes or when direct inspection of the map is useful
+   * in userspace. Should not be used in by libraries.
+   *
+   * @param p_id - message ID
+   * @return const auto& list of the handlers that share a bucket with p_id
+   */
+  [[nodiscard]] const auto& bucket(hal::can::id_t p_id)
+  {
+    return m_buckets[bucket_index(p_id)];
+  }
+
+  /**
+   * @brief Get the total number of routes across every bucket
+   *
+   * @return std::size_t - number of routes
+   */
+  [[nodiscard]] std::size_t size() const
+  {
+    std::size_t total = 0;
+    for (const auto& list : m_buckets) {
+      total += list.size();
+    }
+    return total;
+  }
+
+  /**
+   * @brief Get the statistics policy object
+   *
+   * @return Statistics& - statistics policy object
+   */
+  [[nodiscard]] Statistics& statistics()
+  {
+    return m_statistics;
+  }
+
+  /**
+   * @brief Get the ordering policy object
+   *
+   * @return Ordering& - ordering policy object
+   */
+  [[nodiscard]] Ordering& ordering()
+  {
+    return m_ordering;
+  }
+
+  /**
+   * @brief Copy the ID and statistics of each route into a buffer
+   *
+   * Meant for exporting statistics, for example, by writing
+   * `hal::as_bytes(snapshot)` to a serial port. Statistics may be updated by
+   * the receive interrupt while the snapshot is being taken; disable the
+   * interrupt beforehand if a consistent snapshot is required.
+   *
+   * @param p_buffer - buffer to copy route snapshots into
+   * @return std::span<route_snapshot> - the portion of p_buffer that was
+   * filled. If the buffer is too small, only the routes that fit are copied.
+   */
+  std::span<route_snapshot> snapshot(std::span<route_snapshot> p_buffer) const
+  {
+    std::size_t count = 0;
+    for (const auto& list : m_buckets) {
+      for (const auto& list_route : list) {
+        if (count == p_buffer.size()) {
+          return p_buffer;
+        }
+        p_buffer[count++] = route_snapshot{
+          .id = list_route.id,
+          .statistics = list_route.statistics,
+        };
+      }
+    }
+    return p_buffer.first(count);
+  }
+
+private:
+  /**
+   * @brief Call the callback of a message's route
+   *
+   * Searches the bucket associated with the message's ID and runs the
+   * callback of the first route with a matching ID.
+   *
+   * @param p_message - message to route
+   * @return true - a route matched the message
+   */
+  bool route_message(const can::message_t& p_message)
+  {
+    auto& list = m_buckets[bucket_index(p_message.id)];
+    std::size_t comparisons = 0;
+    for (auto position = list.begin(); position != list.end(); ++position) {
+      comparisons++;
+      auto& list_handler = *position;
+      if (p_message.id == list_handler.id) {
+        m_ordering.found(list, position, comparisons);
+        m_statistics.record(list_handler.statistics,
+                            [&list_handler, &p_message]() {
+                              list_handler.handler(p_message);
+                            });
+        return true;
+      }
+    }
+    m_ordering.missed(comparisons);
+    m_statistics.record_unmatched();
+    return false;
+  }
+
+  /**
+   * @brief Construct a new can message router
+   *
+   * @param p_can - can peripheral to route messages for
+   * @param p_statistics - statistics policy object
+   */
+  basic_can_router(hal::can& p_can, Statistics p_statistics)
+    : base(p_can)
+    , m_statistics(p_statistics)
+  {
+  }
+
+  std::array<static_list<route>, BucketCount> m_buckets;
+  [[no_unique_address]] Statistics m_statistics;
+  [[no_unique_address]] Ordering m_ordering{};
+};
+
+/**
+ * @brief CAN router that searches every route linearly
+ *
+ * Suitable for busses with a small number of routes. For larger route tables
+ * use `basic_can_router` with more buckets.
+ */
+using can_router = basic_can_router<>;
+
+/**
+ * @brief Perfect hash from CAN IDs to their index in an array of IDs
+ *
+ * Built at compile time by `static_can_router`. The table is kept at most
+ * half full so that a perfect hash is found quickly.
+ *
+ * @tparam Count - number of IDs
+ */
+template<std::size_t Count>
+struct can_id_hash_table
+{
+  static constexpr std::size_t table_size =
+    std::bit_ceil(std::max<std::size_t>(2, Count * 2));
+  static constexpr auto shift = 32U - std::countr_zero(table_size);
+  static constexpr std::uint16_t empty_slot = Count;
+
+  /// True if every ID maps to its own slot
+  bool found = false;
+  std::uint32_t multiplier = 0;
+  /// Index of the ID that hashes to each slot or empty_slot
+  std::array<std::uint16_t, table_size> slots{};
+
+  /**
+   * @brief Get the slot an ID hashes to
+   *
+   * @param p_id - message ID
+   * @return constexpr std::size_t - index into `slots`
+   */
+  [[nodiscard]] constexpr std::size_t slot(hal::can::id_t p_id) const
+  {
+    return static_cast<std::uint32_t>(p_id * multiplier) >> shift;
+  }
+
+  /**
+   * @brief Search for a multiplier that maps every ID to its own slot
+   *
+   * Odd multipliers starting from 2^32/phi are tried in turn, the same
+   * fibonacci hashing used by `basic_can_router::bucket_index()`.
+   *
+   * @param p_ids - unique IDs to hash
+   * @return constexpr can_id_hash_table - table where `found` is false if no
+   * perfect hash was found.
+   */
+  static constexpr can_id_hash_table search(
+    const std::array<hal::can::id_t, Count>& p_ids)
+  {
+    constexpr std::uint32_t golden_ratio = 2654435769U;
+    constexpr std::uint32_t max_attempts = 1024;
+
+    for (std::uint32_t attempt = 0; attempt < max_attempts; attempt++) {
+      can_id_hash_table table{ .multiplier = golden_ratio + attempt * 2 };
+      table.slots.fill(empty_slot);
+
+      bool collision = false;
+      for (std::size_t index = 0; index < Count && !collision; index++) {
+        auto& entry = table.slots[table.slot(p_ids[index])];
+        collision = entry != empty_slot;
+        entry = static_cast<std::uint16_t>(index);
+      }
+
+      if (!collision) {
+        table.found = true;
+        return table;
+      }
+    }
+
+    return can_id_hash_table{};
+  }
+};
+
+/**
+ * @brief Route CAN messages to callbacks using a route table generated at
+ * compile time
+ *
+ * For route tables that are known at compile time. The IDs are sorted and a
+ * perfect hash from ID to route index is searched for while compiling, both
+ * stored as `static constexpr` tables, which places them in flash. Routing a
+ * message then costs a multiply, a shift, and one comparison to confirm the
+ * ID. If no perfect hash is found, a binary search over the sorted IDs is
+ * used instead. Callbacks are stored in a single contiguous array indexed by
+ * route.
+ *
+ *     auto router = hal::static_can_router<0x100, 0x111, 0x7E8>::create(can)
+ *                     .value();
+ *     router.set<0x111>([](const hal::can::message_t& p_message) { ... });
+ *
+ * @tparam Ids - message IDs to route. Must be unique.
+ */
+template<hal::can::id_t... Ids>
+class static_can_router : public can_router_base<static_can_router<Ids...>>
+{
+  using base = can_router_base<static_can_router>;
+  friend base;
+
+public:
+  static constexpr std::size_t route_count = sizeof...(Ids);
+
+  static_assert(route_count > 0, "At least one ID must be routed");
+  static_assert(route_count < std::numeric_limits<std::uint16_t>::max(),
+                "Too many IDs for a static_can_router");
+
+  using base::noop;
+  using typename base::message_handler;
+
+  /// Routed IDs in ascending order. A route's index is its position here.
+  static constexpr std::array<hal::can::id_t, route_count> ids = []() {
+    std::array<hal::can::id_t, route_count> sorted{ Ids... };
+    std::sort(sorted.begin(), sorted.end());
+    return sorted;
+  }();
+
+  static_assert(std::adjacent_find(ids.begin(), ids.end()) == ids.end(),
+                "IDs must be unique");
+
+private:
+  using hash_table = can_id_hash_table<route_count>;
+
+  static constexpr hash_table table = hash_table::search(ids);
+
+public:
+  /// True if routing uses a perfect hash, false if it uses a binary search
+  static constexpr bool perfect_hash = table.found;
+
+  /**
+   * @brief Find the route index of an ID
+   *
+   * @param p_id - message ID
+   * @return constexpr std::optional<std::size_t> - index of the route in
+   * `ids` or std::nullopt if the ID is not routed.
+   */
+  [[nodiscard]] static constexpr std::optional<std::size_t> index_of(
+    hal::can::id_t p_id)
+  {
+    if constexpr (perfect_hash) {
+      const std::size_t index = table.slots[table.slot(p_id)];
+      if (index != hash_table::empty_slot && ids[index] == p_id) {
+        return index;
+      }
+    } else {
+      const auto position = std::lower_bound(ids.begin(), ids.end(), p_id);
+      if (position != ids.end() && *position == p_id) {
+        return static_cast<std::size_t>(position - ids.begin());
+      }
+    }
+    return std::nullopt;
+  }
+
+  /**
+   * @brief Create a static can router that routes messages within the receive
+   * interrupt
+   *
+   * @param p_can - can peripheral to route messages for
+   * @return result<static_can_router> - the router or an error if the receive
+   * handler could not be set.
+   */
+  static result<static_can_router> create(hal::can& p_can)
+  {
+    return base::attach(static_can_router(p_can), nullptr);
+  }
+
+  /**
+   * @brief Create a static can router that defers routing to task code
+   *
+   * See `basic_can_router::create(hal::can&, can_receive_queue&)`.
+   *
+   * @param p_can - can peripheral to route messages for
+   * @param p_queue - queue to hold messages until they are processed. Must
+   * outlive the router.
+   * @return result<static_can_router> - the router or an error if the receive
+   * handler could not be set.
+   */
+  static result<static_can_router> create(hal::can& p_can,
+                                          can_receive_queue& p_queue)
+  {
+    return base::attach(static_can_router(p_can), &p_queue);
+  }
+
+  static_can_router() = delete;
+  static_can_router(static_can_router& p_other_self) = delete;
+  static_can_router& operator=(static_can_router& p_other_self) = delete;
+  static_can_router(static_can_router&& p_other_self) = default;
+  static_can_router& operator=(static_can_router&& p_other_self) = default;
+  ~static_can_router() = default;
+
+  /**
+   * @brief Set the callback for messages with ID `Id`
+   *
+   * Fails to compile if `Id` is not one of the router's IDs.
+   *
+   * @tparam Id - message ID
+   * @param p_handler - callback to be executed when an `Id` message is
+   * received
+   */
+  template<hal::can::id_t Id>
+  void set(message_handler p_handler)
+  {
+    constexpr auto index = index_of(Id);
+    static_assert(index.has_value(), "Id is not routed by this router");
+    m_handlers[*index] = p_handler;
+  }
+
+  /**
+   * @brief Set the callback for messages with a specific ID
+   *
+   * @param p_id - message ID
+   * @param p_handler - callback to be executed when a p_id message is received
+   * @return status - success or failure
+   * @throws std::errc::invalid_argument - if p_id is not routed by this router
+   */
+  [[nodiscard]] status set(hal::can::id_t p_id, message_handler p_handler)
+  {
+    const auto index = index_of(p_id);
+    if (!index) {
+      return hal::new_error(std::errc::invalid_argument);
+    }
+    m_handlers[*index] = p_handler;
+    return success();
+  }
+
+  /**
+   * @brief Get the callbacks, in the same order as `ids`
+   *
+   * Meant for testing purposes or when direct inspection of the table is
+   * useful in userspace. Should not be used in by libraries.
+   *
+   * @return std::span<const message_handler> - every route's callback
+   */
+  [[nodiscard]] std::span<const message_handler> handlers() const
+  {
+    return m_handlers;
+  }
+
+private:
+  /**
+   * @brief Call the callback of a message's route
+   *
+   * @param p_message - message to route
+   * @return true - a route matched the message
+   */
+  bool route_message(const can::message_t& p_message)
+  {
+    const auto index = index_of(p_message.id);
+    if (!index) {
+      return false;
+    }
+    m_handlers[*index](p_message);
+    return true;
+  }
+
+  explicit static_can_router(hal::can& p_can)
+    : base(p_can)
+  {
+    m_handlers.fill(noop);
+  }
+
+  std::array<message_handler, route_count> m_handlers;
+};
+
+/**
+ * @brief Matches messages whose ID is equal to `id` for every bit set in
+ * `mask`.
+ *
+ * For example, to match every J1939 message sent from source address 0x25,
+ * use `{ .id = 0x25, .mask = 0xFF }`.
+ */
+struct can_mask_filter
+{
+  hal::can::id_t id = 0;
+  hal::can::id_t mask = 0;
+};
+
+/**
+ * @brief Matches messages whose ID is within the inclusive range [first, last]
+ */
+struct can_range_filter
+{
+  hal::can::id_t first = 0;
+  hal::can::id_t last = 0;
+};
+
+/**
+ * @brief Fixed capacity table of mask and range filters with callbacks
+ *
+ * Filters are kept sorted as they are added such that finding the callback
+ * for a message takes bounded time:
+ *
+ * - Range filters may not overlap and are searched with a single binary
+ *   search.
+ * - Mask filters are grouped by mask. Each group is searched with a binary
+ *   search on the masked ID. Groups with more bits set in their mask are
+ *   searched first, thus the most specific mask filter wins.
+ *
+ * Finding a callback costs O(log(R) + G * log(M)) where R is the number of
+ * range filters, M is the number of mask filters, and G is the number of
+ * distinct masks, which, like hardware acceptance filters, tends to be small.
+ * Range filters take precedence over mask filters.
+ *
+ * Filters must not be added while messages are being dispatched through the
+ * table.
+ *
+ * @tparam Capacity - maximum number of filters that can be stored
+ */
+template<std::size_t Capacity>
+class can_filter_table
+{
+public:
+  using message_handler = hal::callback<hal::can::handler>;
+
+  /**
+   * @brief Add a mask filter to the table
+   *
+   * @param p_filter - mask filter
+   * @param p_handler - callback to be executed when a message matches
+   * @return status - success or failure
+   * @throws std::errc::not_enough_memory - if the table is full
+   * @throws std::errc::invalid_argument - if a filter with the same mask and
+   * masked ID already exists
+   */
+  [[nodiscard]] status add(can_mask_filter p_filter, message_handler p_handler)
+  {
+    if (size() == Capacity) {
+      return hal::new_error(std::errc::not_enough_memory);
+    }
+
+    const entry new_entry{
+      .first = p_filter.id & p_filter.mask,
+      .second = p_filter.mask,
+      .handler = p_handler,
+    };
+
+    auto masks = mask_entries();
+    auto position =
+      std::upper_bound(masks.begin(), masks.end(), new_entry, mask_order);
+
+    if (position != masks.begin()) {
+      const auto& previous = *(position - 1);
+      if (previous.second == new_entry.second &&
+          previous.first == new_entry.first) {
+        return hal::new_error(std::errc::invalid_argument);
+      }
+    }
+
+    insert(m_range_count + (position - masks.begin()), new_entry);
+    m_mask_count++;
+    return success();
+  }
+
+  /**
+   * @brief Add a range filter to the table
+   *
+   * @param p_filter - range filter
+   * @param p_handler - callback to be executed when a message matches
+   * @return status - success or failure
+   * @throws std::errc::not_enough_memory - if the table is full
+   * @throws std::errc::invalid_argument - if the range is inverted or
+   * overlaps a range already in the table
+   */
+  [[nodiscard]] status add(can_range_filter p_filter, message_handler p_handler)
+  {
+    if (size() == Capacity) {
+      return hal::new_error(std::errc::not_enough_memory);
+    }
+
+    if (p_filter.first > p_filter.last) {
+      return hal::new_error(std::errc::invalid_argument);
+    }
+
+    auto ranges = range_entries();
+    auto position = std::upper_bound(
+      ranges.begin(),
+      ranges.end(),
+      p_filter.first,
+      [](hal::can::id_t p_id, const entry& p_entry) {
+        return p_id < p_entry.first;
+      });
+
+    // Ranges are sorted and never overlap, thus only the neighbors of the new
+    // range need to be checked.
+    if (position != ranges.begin() &&
+        (position - 1)->second >= p_filter.first) {
+      return hal::new_error(std::errc::invalid_argument);
+    }
+    if (position != ranges.end() && position->first <= p_filter.last) {
+      return hal::new_error(std::errc::invalid_argument);
+    }
+
+    insert(position - ranges.begin(),
+           entry{
+             .first = p_filter.first,
+             .second = p_filter.last,
+             .handler = p_handler,
+           });
+    m_range_count++;
+    return success();
+  }
+
+  /**
+   * @brief Find the callback for a message ID
+   *
+   * @param p_id - message ID
+   * @return const message_handler* - the callback of the matching filter or
+   * nullptr if no filter matches.
+   */
+  [[nodiscard]] const message_handler* find(hal::can::id_t p_id) const
+  {
+    auto ranges = range_entries();
+    auto range = std::upper_bound(
+      ranges.begin(),
+      ranges.end(),
+      p_id,
+      [](hal::can::id_t p_id_value, const entry& p_entry) {
+        return p_id_value < p_entry.first;
+      });
+
+    if (range != ranges.begin() && p_id <= (range - 1)->second) {
+      return &(range - 1)->handler;
+    }
+
+    auto masks = mask_entries();
+    for (auto group = masks.begin(); group != masks.end();) {
+      const auto mask = group->second;
+      const auto masked_id = p_id & mask;
+      auto group_end =
+        std::partition_point(group, masks.end(), [mask](const entry& p_entry) {
+          return p_entry.second == mask;
+        });
+      auto match = std::lower_bound(
+        group,
+        group_end,
+        masked_id,
+        [](const entry& p_entry, hal::can::id_t p_id_value) {
+          return p_entry.first < p_id_value;
+        });
+
+      if (match != group_end && match->first == masked_id) {
+        return &match->handler;
+      }
+
+      group = group_end;
+    }
+
+    return nullptr;
+  }
+
+  /**
+   * @brief Dispatch a message to the callback of the matching filter
+   *
+   * Can be used directly as a can handler or as the unmatched handler of a
+   * can_router.
+   *
+   * @param p_message - message received from the bus
+   * @return true - a filter matched the message
+   * @return false - no filter matched and the message was dropped
+   */
+  bool operator()(const can::message_t& p_message)
+  {
+    const auto* handler = find(p_message.id);
+    if (handler == nullptr) {
+      return false;
+    }
+    (*handler)(p_message);
+    return true;
+  }
+
+  /**
+   * @brief Get the number of filters in the table
+   *
+   * @return std::size_t - number of filters
+   */
+  [[nodiscard]] std::size_t size() const
+  {
+    return m_range_count + m_mask_count;
+  }
+
+  /**
+   * @brief Remove every filter from the table
+   *
+   */
+  void clear()
+  {
+    for (auto& table_entry : m_entries) {
+      table_entry = entry{};
+    }
+    m_range_count = 0;
+    m_mask_count = 0;
+  }
+
+private:
+  struct entry
+  {
+    /// Lower bound of a range or the masked ID of a mask filter
+    hal::can::id_t first = 0;
+    /// Upper bound of a range or the mask of a mask filter
+    hal::can::id_t second = 0;
+    message_handler handler = [](const can::message_t&) {};
+  };
+
+  /**
+   * @brief Ordering of mask entries: most specific mask first, then grouped by
+   * mask, then sorted by masked ID.
+   */
+  static constexpr bool mask_order(const entry& p_lhs, const entry& p_rhs)
+  {
+    const auto lhs_bits = std::popcount(p_lhs.second);
+    const auto rhs_bits = std::popcount(p_rhs.second);
+    if (lhs_bits != rhs_bits) {
+      return lhs_bits > rhs_bits;
+    }
+    if (p_lhs.second != p_rhs.second) {
+      return p_lhs.second < p_rhs.second;
+    }
+    return p_lhs.first < p_rhs.first;
+  }
+
+  std::span<entry> range_entries()
+  {
+    return std::span(m_entries).first(m_range_count);
+  }
+
+  std::span<const entry> range_entries() const
+  {
+    return std::span(m_entries).first(m_range_count);
+  }
+
+  std::span<entry> mask_entries()
+  {
+    return std::span(m_entries).subspan(m_range_count, m_mask_count);
+  }
+
+  std::span<const entry> mask_entries() const
+  {
+    return std::span(m_entries).subspan(m_range_count, m_mask_count);
+  }
+
+  void insert(std::size_t p_index, entry p_entry)
+  {
+    auto first = m_entries.begin() + p_index;
+    auto last = m_entries.begin() + size();
+    std::move_backward(first, last, last + 1);
+    *first = std::move(p_entry);
+  }
+
+  std::array<entry, Capacity> m_entries{};
+  std::size_t m_range_count = 0;
+  std::size_t m_mask_count = 0;
+};
+
+/**
+ * @brief Fixed capacity transmit queue that sends the highest priority
+ * message first
+ *
+ * On the bus, the message with the lowest ID wins arbitration. Sending
+ * messages in the order they were produced defeats this, as a low priority
+ * message that is blocked in `can::send()` delays every message behind it.
+ * This queue instead holds outbound messages in a binary heap ordered by ID,
+ * so `flush()` always sends the lowest ID first. Messages with the same ID are
+ * sent in the order they were pushed.
+ *
+ * When the queue is full, pushing a message evicts the lowest priority queued
+ * message if the new message has a higher priority, otherwise the new message
+ * is dropped. Either way, the drop counter is incremented.
+ *
+ * The queue is not thread safe. Messages must be pushed and flushed from the
+ * same execution context.
+ *
+ * @tparam Capacity - maximum number of queued messages
+ */
+template<std::size_t Capacity>
+class can_transmit_queue
+{
+public:
+  static_assert(Capacity > 0, "Capacity must be greater than 0");
+
+  /**
+   * @brief Construct a new can transmit queue
+   *
+   * @param p_can - can peripheral to send messages with. Must outlive this
+   * object.
+   */
+  explicit can_transmit_queue(hal::can& p_can)
+    : m_can(&p_can)
+  {
+  }
+
+  /**
+   * @brief Add a message to the queue
+   *
+   * @param p_message - message to send
+   * @return true - message was queued, possibly evicting a lower priority
+   * message
+   * @return false - queue was full of higher priority messages and this
+   * message was dropped
+   */
+  bool push(const can::message_t& p_message)
+  {
+    const entry new_entry{ .message = p_message, .sequence = m_sequence++ };
+
+    if (m_size == Capacity) {
+      m_dropped++;
+
+      // The lowest priority entry is always a leaf of the heap
+      const auto leaves = m_entries.begin() + m_size / 2;
+      const auto end = m_entries.begin() + m_size;
+      auto lowest = std::max_element(leaves, end, sends_first);
+      if (!sends_first(new_entry, *lowest)) {
+        return false;
+      }
+
+      // Every prefix of a heap is also a heap, so the replacement only needs
+      // to be sifted up towards the root.
+      *lowest = new_entry;
+      std::push_heap(m_entries.begin(), lowest + 1, sends_later);
+      return true;
+    }
+
+    m_entries[m_size++] = new_entry;
+    std::push_heap(m_entries.begin(), m_entries.begin() + m_size, sends_later);
+    m_peak_size = std::max(m_peak_size, m_size);
+    return true;
+  }
+
+  /**
+   * @brief Send queued messages, lowest ID first
+   *
+   * If sending a message fails, the message stays at the front of the queue
+   * and the error is returned. Messages sent before the failure are removed
+   * from the queue and counted by `sent()`.
+   *
+   * @param p_max_messages - maximum number of messages to send in this burst
+   * @return result<std::size_t> - number of messages sent
+   */
+  result<std::size_t> flush(
+    std::size_t p_max_messages = std::numeric_limits<std::size_t>::max())
+  {
+    std::size_t count = 0;
+
+    while (m_size > 0 && count < p_max_messages) {
+      HAL_CHECK(m_can->send(m_entries[0].message));
+      std::pop_heap(m_entries.begin(), m_entries.begin() + m_size, sends_later);
+      m_size--;
+      m_sent++;
+      count++;
+    }
+
+    return count;
+  }
+
+  /**
+   * @brief Get the message that will be sent next
+   *
+   * @return const can::message_t* - message with the lowest ID or nullptr if
+   * the queue is empty.
+   */
+  [[nodiscard]] const can::message_t* front() const
+  {
+    if (m_size == 0) {
+      return nullptr;
+    }
+    return &m_entries[0].message;
+  }
+
+  /**
+   * @brief Get the number of queued messages
+   *
+   * @return std::size_t - current queue depth
+   */
+  [[nodiscard]] std::size_t size() const
+  {
+    return m_size;
+  }
+
+  /**
+   * @brief Get the maximum number of messages that can be queued
+   *
+   * @return constexpr std::size_t - capacity of the queue
+   */
+  [[nodiscard]] static constexpr std::size_t capacity()
+  {
+    return Capacity;
+  }
+
+  /**
+   * @brief Get the largest queue depth seen since construction
+   *
+   * Useful to size the queue's capacity.
+   *
+   * @return std::size_t - peak queue depth
+   */
+  [[nodiscard]] std::size_t peak_size() const
+  {
+    return m_peak_size;
+  }
+
+  /**
+   * @brief Get the number of messages dropped or evicted because the queue
+   * was full
+   *
+   * @return std::uint32_t - number of dropped messages
+   */
+  [[nodiscard]] std::uint32_t dropped() const
+  {
+    return m_dropped;
+  }
+
+  /**
+   * @brief Get the number of messages sent through this queue
+   *
+   * @return std::uint32_t - number of sent messages
+   */
+  [[nodiscard]] std::uint32_t sent() const
+  {
+    return m_sent;
+  }
+
+private:
+  struct entry
+  {
+    can::message_t message{};
+    std::uint32_t sequence = 0;
+  };
+
+  /// Arbitration order: lower IDs first, then the order they were pushed in.
+  /// The sequence comparison tolerates the counter wrapping around.
+  static constexpr bool sends_first(const entry& p_lhs, const entry& p_rhs)
+  {
+    if (p_lhs.message.id != p_rhs.message.id) {
+      return p_lhs.message.id < p_rhs.message.id;
+    }
+    return static_cast<std::int32_t>(p_lhs.sequence - p_rhs.sequence) < 0;
+  }
+
+  /// Heap comparator, std heap algorithms keep the "largest" at the front
+  static constexpr bool sends_later(const entry& p_lhs, const entry& p_rhs)
+  {
+    return sends_first(p_rhs, p_lhs);
+  }
+
+  std::array<entry, Capacity> m_entries{};
+  hal::can* m_can;
+  std::size_t m_size = 0;
+  std::size_t m_peak_size = 0;
+  std::uint32_t m_sequence = 0;
+  std::uint32_t m_dropped = 0;
+  std::uint32_t m_sent = 0;
+};
+
+/**
+ * @brief Holds the most recently received message for a single ID
+ *
+ * For consumers that only care about the newest value of a message, such as
+ * periodic sensor broadcasts, and would rather poll than handle every message
+ * in a callback. Register the mailbox as a route's callback:
+ *
+ *     hal::can_mailbox speed;
+ *     auto route = router.add_message_callback(0x100, std::ref(speed));
+ *     // ... later, in task code
+ *     auto [message, sequence] = speed.read();
+ *
+ * Writes and reads are synchronized with a sequence lock. The writer bumps
+ * the sequence number to an odd value, stores the message, then bumps it to
+ * an even value. Readers retry if the sequence number was odd or changed
+ * while they were copying the message, so a read never returns a message
+ * that is half old and half new. Neither side ever blocks the writer.
+ *
+ * There must only be one writer, and reads must not preempt the writer. Reads
+ * from task code with the writer in the receive interrupt satisfy this.
+ */
+class can_mailbox
+{
+public:
+  /// Copy of a mailbox's contents
+  struct sample
+  {
+    /// Most recent message, zero initialized if nothing has been received
+    can::message_t message{};
+    /// Number of messages written to the mailbox, wraps around
+    std::uint32_t sequence = 0;
+  };
+
+  can_mailbox() = default;
+  can_mailbox(can_mailbox& p_other) = delete;
+  can_mailbox& operator=(can_mailbox& p_other) = delete;
+  can_mailbox(can_mailbox&& p_other) = delete;
+  can_mailbox& operator=(can_mailbox&& p_other) = delete;
+
+  /**
+   * @brief Replace the message in the mailbox
+   *
+   * @param p_message - most recently received message
+   */
+  void operator()(const can::message_t& p_message)
+  {
+    const auto message_words = pack(p_message);
+
+    // Only the writer modifies the sequence number, so a read-modify-write is
+    // not necessary.
+    const auto sequence = m_sequence.load(std::memory_order_relaxed);
+    m_sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    for (std::size_t i = 0; i < word_count; i++) {
+      m_words[i].store(message_words[i], std::memory_order_relaxed);
+    }
+
+    m_sequence.store(sequence + 2, std::memory_order_release);
+  }
+
+  /**
+   * @brief Copy the most recent message out of the mailbox
+   *
+   * @return sample - the message and the number of messages written so far
+   */
+  [[nodiscard]] sample read() const
+  {
+    words message_words{};
+
+    while (true) {
+      const auto before = m_sequence.load(std::memory_order_acquire);
+      if (before & 1U) {
+        continue;
+      }
+
+      for (std::size_t i = 0; i < word_count; i++) {
+        message_words[i] = m_words[i].load(std::memory_order_relaxed);
+      }
+
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (m_sequence.load(std::memory_order_relaxed) == before) {
+        return sample{ .message = unpack(message_words),
+                       .sequence = before / 2 };
+      }
+    }
+  }
+
+  /**
+   * @brief Get the number of messages written to the mailbox
+   *
+   * Cheaper than `read()` for checking if a new message has arrived.
+   *
+   * @return std::uint32_t - number of messages written, wraps around
+   */
+  [[nodiscard]] std::uint32_t sequence() const
+  {
+    return m_sequence.load(std::memory_order_acquire) / 2;
+  }
+
+private:
+  // ID, 2 words of payload, then length and remote request flag
+  static constexpr std::size_t word_count = 4;
+  using words = std::array<std::uint32_t, word_count>;
+
+  static words pack(const can::message_t& p_message)
+  {
+    words result{ p_message.id };
+    std::memcpy(
+      result.data() + 1, p_message.payload.data(), p_message.payload.size());
+    result[3] = p_message.length |
+                (static_cast<std::uint32_t>(p_message.is_remote_request) << 8);
+    return result;
+  }
+
+  static can::message_t unpack(const words& p_words)
+  {
+    can::message_t result{ .id = p_words[0] };
+    std::memcpy(
+      result.payload.data(), p_words.data() + 1, result.payload.size());
+    result.length = static_cast<std::uint8_t>(p_words[3] & 0xFF);
+    result.is_remote_request = (p_words[3] >> 8) & 1U;
+    return result;
+  }
+
+  std::atomic<std::uint32_t> m_sequence = 0;
+  std::array<std::atomic<std::uint32_t>, word_count> m_words{};
+};
+
+/**
+ * @brief Fixed capacity table of mailboxes populated by a can router
+ *
+ * Each subscribed ID gets a `can_mailbox` registered as a route with the
+ * router, so the router's own lookup finds the mailbox and no additional
+ * search is done in the receive interrupt.
+ *
+ * @tparam Router - can router type such as `hal::can_router`
+ * @tparam Capacity - maximum number of IDs that can be subscribed to
+ */
+template<class Router, std::size_t Capacity>
+class can_mailbox_table
+{
+public:
+  /**
+   * @brief Construct a new can mailbox table
+   *
+   * @param p_router - router to receive messages from. Must outlive this
+   * object.
+   */
+  explicit can_mailbox_table(Router& p_router)
+    : m_router(&p_router)
+  {
+  }
+
+  can_mailbox_table(can_mailbox_table& p_other) = delete;
+  can_mailbox_table& operator=(can_mailbox_table& p_other) = delete;
+  can_mailbox_table(can_mailbox_table&& p_other) = delete;
+  can_mailbox_table& operator=(can_mailbox_table&& p_other) = delete;
+
+  /**
+   * @brief Keep the most recent message with this ID
+   *
+   * Must not be called while messages are being dispatched by the router.
+   *
+   * @param p_id - message ID
+   * @return status - success or failure
+   * @throws std::errc::not_enough_memory - if the table is full
+   * @throws std::errc::invalid_argument - if p_id is already subscribed to
+   */
+  [[nodiscard]] status subscribe(hal::can::id_t p_id)
+  {
+    if (find(p_id) != nullptr) {
+      return hal::new_error(std::errc::invalid_argument);
+    }
+
+    if (m_size == Capacity) {
+      return hal::new_error(std::errc::not_enough_memory);
+    }
+
+    m_ids[m_size] = p_id;
+    m_routes[m_size].emplace(
+      m_router->add_message_callback(p_id, std::ref(m_mailboxes[m_size])));
+    m_size++;
+    return success();
+  }
+
+  /**
+   * @brief Get the mailbox for an ID
+   *
+   * Pollers should keep the returned pointer rather than searching for the
+   * mailbox every time they read it.
+   *
+   * @param p_id - message ID
+   * @return const can_mailbox* - the mailbox or nullptr if p_id has not been
+   * subscribed to.
+   */
+  [[nodiscard]] const can_mailbox* find(hal::can::id_t p_id) const
+  {
+    const auto ids = std::span(m_ids).first(m_size);
+    const auto position = std::find(ids.begin(), ids.end(), p_id);
+    if (position == ids.end()) {
+      return nullptr;
+    }
+    return &m_mailboxes[static_cast<std::size_t>(position - ids.begin())];
+  }
+
+  /**
+   * @brief Read the most recent message with this ID
+   *
+   * @param p_id - message ID
+   * @return std::optional<can_mailbox::sample> - the mailbox's contents or
+   * std::nullopt if p_id has not been subscribed to.
+   */
+  [[nodiscard]] std::optional<can_mailbox::sample> read(
+    hal::can::id_t p_id) const
+  {
+    const auto* mailbox = find(p_id);
+    if (mailbox == nullptr) {
+      return std::nullopt;
+    }
+    return mailbox->read();
+  }
+
+  /**
+   * @brief Get the number of subscribed IDs
+   *
+   * @return std::size_t - number of subscribed IDs
+   */
+  [[nodiscard]] std::size_t size() const
+  {
+    return m_size;
+  }
+
+private:
+  Router* m_router;
+  std::array<hal::can::id_t, Capacity> m_ids{};
+  std::array<can_mailbox, Capacity> m_mailboxes{};
+  // Declared after the mailboxes so that routes are removed before the
+  // mailboxes they reference are destroyed.
+  std::array<std::optional<typename Router::route_item>, Capacity> m_routes{};
+  std::size_t m_size = 0;
 };
-}  // namespace hal
\ No newline at end of file
+}  // namespace hal
@@ -0,0 +1,683 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <limits>
+#include <span>
+#include <string_view>
+#include <system_error>
+
+#include <libhal/can.hpp>
+#include <libhal/error.hpp>
+#include <libhal/functional.hpp>
+#include <libhal/steady_clock.hpp>
+#include <libhal/timeout.hpp>
+#include <libhal/units.hpp>
+
+#include "can.hpp"
+
+namespace hal {
+/**
+ * @brief A CAN message and the time it was seen on the bus
+ *
+ */
+struct can_log_record
+{
+  /// Time since an arbitrary epoch, such as the start of the capture
+  std::chrono::microseconds timestamp{ 0 };
+  can::message_t message{};
+};
+
+/**
+ * @brief Encode CAN log records into the compact binary log format
+ *
+ * Each record is stored as:
+ *
+ * 1. A flags byte: bits [3:0] hold the payload length and bit 7 is set for
+ *    remote requests.
+ * 2. The time since the previous record in microseconds as an unsigned
+ *    LEB128 varint.
+ * 3. The message ID as an unsigned LEB128 varint.
+ * 4. The payload bytes. Remote requests have no payload bytes.
+ *
+ * A standard ID message with 8 bytes of payload, received within 16ms of the
+ * previous one, takes 13 bytes. The first record's time is relative to 0.
+ *
+ * Records must be written in time order.
+ */
+class can_log_writer
+{
+public:
+  /// Largest number of bytes a single record can take
+  static constexpr std::size_t max_record_size = 1 + 10 + 5 + 8;
+
+  /**
+   * @brief Encode a record
+   *
+   * @param p_record - record to encode
+   * @param p_buffer - buffer to encode the record into
+   * @return result<std::span<hal::byte>> - the portion of p_buffer that holds
+   * the record
+   * @throws std::errc::no_buffer_space - if p_buffer is too small for the
+   * record
+   * @throws std::errc::invalid_argument - if p_record is older than the
+   * previous record
+   */
+  result<std::span<hal::byte>> write(const can_log_record& p_record,
+                                     std::span<hal::byte> p_buffer)
+  {
+    if (p_record.timestamp < m_previous) {
+      return hal::new_error(std::errc::invalid_argument);
+    }
+
+    const auto& message = p_record.message;
+    const auto length = std::min<std::size_t>(message.length, 8);
+    const auto payload_length = message.is_remote_request ? 0 : length;
+    const auto delta =
+      static_cast<std::uint64_t>((p_record.timestamp - m_previous).count());
+
+    const auto size = 1 + varint_size(delta) + varint_size(message.id) +
+                      payload_length;
+    if (p_buffer.size() < size) {
+      return hal::new_error(std::errc::no_buffer_space);
+    }
+
+    auto position = p_buffer.begin();
+    *position++ = static_cast<hal::byte>(
+      length | (message.is_remote_request ? remote_request_flag : 0));
+    position = put_varint(position, delta);
+    position = put_varint(position, message.id);
+    std::copy_n(message.payload.begin(), payload_length, position);
+
+    m_previous = p_record.timestamp;
+    return p_buffer.first(size);
+  }
+
+  /**
+   * @brief Start a new log, making the next record relative to 0
+   *
+   */
+  void reset()
+  {
+    m_previous = std::chrono::microseconds{ 0 };
+  }
+
+  /// Set in the flags byte for remote request records
+  static constexpr hal::byte remote_request_flag = 0x80;
+
+private:
+  static constexpr std::size_t varint_size(std::uint64_t p_value)
+  {
+    std::size_t size = 1;
+    while (p_value >= 0x80) {
+      p_value >>= 7;
+      size++;
+    }
+    return size;
+  }
+
+  static std::span<hal::byte>::iterator put_varint(
+    std::span<hal::byte>::iterator p_position,
+    std::uint64_t p_value)
+  {
+    while (p_value >= 0x80) {
+      *p_position++ = static_cast<hal::byte>((p_value & 0x7F) | 0x80);
+      p_value >>= 7;
+    }
+    *p_position++ = static_cast<hal::byte>(p_value);
+    return p_position;
+  }
+
+  std::chrono::microseconds m_previous{ 0 };
+};
+
+/**
+ * @brief Decode records from the compact binary log format
+ *
+ * See `can_log_writer` for the format. Logs can be decoded in chunks: if a
+ * chunk ends part way through a record, `read()` reports that no bytes were
+ * consumed and the caller should retry with more data appended.
+ */
+class can_log_reader
+{
+public:
+  /**
+   * @brief Decode the record at the start of a buffer
+   *
+   * @param p_data - encoded log data
+   * @param p_record - record to decode into, only modified if a record was
+   * decoded
+   * @return result<std::size_t> - number of bytes consumed, 0 if p_data does
+   * not yet hold a whole record
+   * @throws std::errc::bad_message - if the data is not a valid record
+   */
+  result<std::size_t> read(std::span<const hal::byte> p_data,
+                           can_log_record& p_record)
+  {
+    if (p_data.empty()) {
+      return 0;
+    }
+
+    const auto flags = p_data[0];
+    const std::size_t length = flags & 0x0F;
+    const bool remote_request = flags & can_log_writer::remote_request_flag;
+
+    if (length > 8 || (flags & 0x70) != 0) {
+      return hal::new_error(std::errc::bad_message);
+    }
+
+    std::size_t position = 1;
+    std::uint64_t delta = 0;
+    std::uint64_t id = 0;
+
+    auto decoded = get_varint(p_data, position, delta);
+    if (decoded == varint_status::complete) {
+      decoded = get_varint(p_data, position, id);
+    }
+    if (decoded == varint_status::incomplete) {
+      return 0;
+    }
+    if (decoded == varint_status::malformed) {
+      return hal::new_error(std::errc::bad_message);
+    }
+
+    if (id > std::numeric_limits<can::id_t>::max()) {
+      return hal::new_error(std::errc::bad_message);
+    }
+
+    const auto payload_length = remote_request ? 0 : length;
+    if (p_data.size() - position < payload_length) {
+      return 0;
+    }
+
+    can::message_t message{
+      .id = static_cast<can::id_t>(id),
+      .length = static_cast<std::uint8_t>(length),
+      .is_remote_request = remote_request,
+    };
+    std::copy_n(
+      p_data.begin() + position, payload_length, message.payload.begin());
+    position += payload_length;
+
+    m_previous += std::chrono::microseconds(delta);
+    p_record = can_log_record{ .timestamp = m_previous, .message = message };
+    return position;
+  }
+
+  /**
+   * @brief Start reading a new log, making the next record relative to 0
+   *
+   */
+  void reset()
+  {
+    m_previous = std::chrono::microseconds{ 0 };
+  }
+
+private:
+  static constexpr std::size_t max_varint_size = 10;
+
+  enum class varint_status : std::uint8_t
+  {
+    complete,
+    /// The data ends before the last byte of the varint
+    incomplete,
+    /// The varint does not fit in 64 bits or is not minimally encoded, so
+    /// more data cannot fix it
+    malformed,
+  };
+
+  static varint_status get_varint(std::span<const hal::byte> p_data,
+                                  std::size_t& p_position,
+                                  std::uint64_t& p_value)
+  {
+    p_value = 0;
+    for (std::size_t i = 0; i < max_varint_size; i++) {
+      if (p_position == p_data.size()) {
+        return varint_status::incomplete;
+      }
+      const auto octet = p_data[p_position++];
+      // The last byte only holds bit 63
+      if (i == max_varint_size - 1 && octet > 0x01) {
+        return varint_status::malformed;
+      }
+      p_value |= static_cast<std::uint64_t>(octet & 0x7F) << (7 * i);
+      if ((octet & 0x80) == 0) {
+        // A trailing zero byte adds nothing, the writer never emits one
+        if (octet == 0 && i > 0) {
+          return varint_status::malformed;
+        }
+        return varint_status::complete;
+      }
+    }
+    return varint_status::malformed;
+  }
+
+  std::chrono::microseconds m_previous{ 0 };
+};
+
+/**
+ * @brief Convert steady clock ticks into microseconds without losing
+ * precision for large tick counts
+ *
+ * @param p_ticks - number of ticks
+ * @param p_frequency - frequency of the clock, truncated to whole hertz
+ * @return std::chrono::microseconds - time since the clock started
+ */
+[[nodiscard]] constexpr std::chrono::microseconds can_log_timestamp(
+  std::uint64_t p_ticks,
+  hertz p_frequency)
+{
+  constexpr std::uint64_t microseconds_per_second = 1'000'000;
+  const auto frequency =
+    std::max<std::uint64_t>(static_cast<std::uint64_t>(p_frequency), 1);
+  const auto seconds = p_ticks / frequency;
+  const auto remainder = p_ticks % frequency;
+  return std::chrono::microseconds(static_cast<std::int64_t>(
+    seconds * microseconds_per_second +
+    (remainder * microseconds_per_second) / frequency));
+}
+
+/**
+ * @brief Capture messages into a binary log buffer
+ *
+ * Timestamps each message with a steady clock and appends it to a caller
+ * provided buffer. Register it to see every message with
+ * `basic_can_router::on_message()`. Periodically write `data()` out, for
+ * example to a file or serial port, then call `clear()`.
+ *
+ * Messages and `clear()` must not preempt each other. When capturing from the
+ * receive interrupt, use a router created with a can_receive_queue.
+ */
+class can_log_capture
+{
+public:
+  /**
+   * @brief Construct a new can log capture
+   *
+   * @param p_steady_clock - clock used to timestamp messages. Must outlive
+   * this object.
+   * @param p_buffer - buffer to hold the log. Must outlive this object.
+   */
+  can_log_capture(hal::steady_clock& p_steady_clock,
+                  std::span<hal::byte> p_buffer)
+    : m_steady_clock(&p_steady_clock)
+    , m_buffer(p_buffer)
+  {
+  }
+
+  /**
+   * @brief Timestamp a message and append it to the log
+   *
+   * Messages that do not fit in the buffer, or that cannot be timestamped,
+   * are dropped and counted.
+   *
+   * @param p_message - message seen on the bus
+   */
+  void operator()(const can::message_t& p_message)
+  {
+    auto uptime = m_steady_clock->uptime();
+    if (!uptime) {
+      m_dropped++;
+      return;
+    }
+
+    const can_log_record record{
+      .timestamp =
+        can_log_timestamp(uptime.value(), m_steady_clock->frequency()),
+      .message = p_message,
+    };
+
+    auto written = m_writer.write(record, m_buffer.subspan(m_size));
+    if (!written) {
+      m_dropped++;
+      return;
+    }
+    m_size += written.value().size();
+  }
+
+  /**
+   * @brief Get the encoded log
+   *
+   * @return std::span<const hal::byte> - records captured since the last
+   * call to `clear()`
+   */
+  [[nodiscard]] std::span<const hal::byte> data() const
+  {
+    return m_buffer.first(m_size);
+  }
+
+  /**
+   * @brief Empty the buffer after its data has been written out
+   *
+   * The log continues from the last record, so the data from each call to
+   * `data()` can be concatenated into a single log.
+   */
+  void clear()
+  {
+    m_size = 0;
+  }
+
+  /**
+   * @brief Get the number of messages that were dropped
+   *
+   * @return std::uint32_t - number of dropped messages
+   */
+  [[nodiscard]] std::uint32_t dropped() const
+  {
+    return m_dropped;
+  }
+
+private:
+  hal::steady_clock* m_steady_clock;
+  std::span<hal::byte> m_buffer;
+  can_log_writer m_writer{};
+  std::size_t m_size = 0;
+  std::uint32_t m_dropped = 0;
+};
+
+/**
+ * @brief Format a record as a line of candump log text
+ *
+ * Produces the format written by `candump -l`, without a trailing newline:
+ *
+ *     (1436509052.249713) can0 123#11223344
+ *
+ * Extended IDs, those that do not fit in 11 bits, are written with 8 hex
+ * digits. Remote requests are written as `123#R`.
+ *
+ * @param p_record - record to format
+ * @param p_buffer - buffer to write the text into
+ * @param p_interface - interface name to write
+ * @return result<std::string_view> - the portion of p_buffer holding the text
+ * @throws std::errc::no_buffer_space - if p_buffer is too small
+ */
+inline result<std::string_view> format_candump(
+  const can_log_record& p_record,
+  std::span<char> p_buffer,
+  std::string_view p_interface = "can0")
+{
+  constexpr std::string_view hex_digits = "0123456789ABCDEF";
+  std::array<char, 80> text{};
+  auto position = text.begin();
+
+  const auto put_hex = [&position, hex_digits](std::uint32_t p_value,
+                                               int p_digits) {
+    for (int i = p_digits - 1; i >= 0; i--) {
+      *position++ = hex_digits[(p_value >> (4 * i)) & 0xF];
+    }
+  };
+
+  const auto microseconds =
+    std::max<std::int64_t>(p_record.timestamp.count(), 0);
+  *position++ = '(';
+  position = std::to_chars(position, text.end(), microseconds / 1'000'000).ptr;
+  *position++ = '.';
+  auto fraction = microseconds % 1'000'000;
+  for (int divisor = 100'000; divisor > 0; divisor /= 10) {
+    *position++ = static_cast<char>('0' + (fraction / divisor) % 10);
+  }
+  *position++ = ')';
+  *position++ = ' ';
+
+  const auto& message = p_record.message;
+  const auto interface = p_interface.substr(0, 16);
+  position = std::copy(interface.begin(), interface.end(), position);
+  *position++ = ' ';
+
+  const bool extended =
+    can_id_format_of(message.id) == can_id_format::extended;
+  put_hex(message.id, extended ? 8 : 3);
+  *position++ = '#';
+
+  if (message.is_remote_request) {
+    *position++ = 'R';
+  } else {
+    const auto length = std::min<std::size_t>(message.length, 8);
+    for (std::size_t i = 0; i < length; i++) {
+      put_hex(message.payload[i], 2);
+    }
+  }
+
+  const auto size = static_cast<std::size_t>(position - text.begin());
+  if (p_buffer.size() < size) {
+    return hal::new_error(std::errc::no_buffer_space);
+  }
+  std::copy_n(text.begin(), size, p_buffer.begin());
+  return std::string_view(p_buffer.data(), size);
+}
+
+/**
+ * @brief Parse a line of candump log text
+ *
+ * Accepts the format written by `format_candump()` and `candump -l`, with or
+ * without a trailing newline. Remote requests may be followed by a length
+ * digit, as in `123#R4`.
+ *
+ * @param p_line - line of text
+ * @return result<can_log_record> - the record
+ * @throws std::errc::invalid_argument - if the line is not valid candump text
+ */
+inline result<can_log_record> parse_candump(std::string_view p_line)
+{
+  while (!p_line.empty() && (p_line.back() == '\n' || p_line.back() == '\r')) {
+    p_line.remove_suffix(1);
+  }
+
+  const auto close = p_line.find(')');
+  const auto dot = p_line.find('.');
+  if (p_line.size() < 2 || p_line[0] != '(' || close == p_line.npos ||
+      dot == p_line.npos || dot > close) {
+    return hal::new_error(std::errc::invalid_argument);
+  }
+
+  const auto parse_number = [](std::string_view p_text,
+                               std::uint64_t& p_value,
+                               int p_base = 10) {
+    const auto* end = p_text.data() + p_text.size();
+    auto [pointer, error] =
+      std::from_chars(p_text.data(), end, p_value, p_base);
+    return !p_text.empty() && error == std::errc{} && pointer == end;
+  };
+
+  std::uint64_t seconds = 0;
+  std::uint64_t microseconds = 0;
+  const auto fraction = p_line.substr(dot + 1, close - dot - 1);
+  if (!parse_number(p_line.substr(1, dot - 1), seconds) ||
+      fraction.size() != 6 || !parse_number(fraction, microseconds)) {
+    return hal::new_error(std::errc::invalid_argument);
+  }
+
+  // Skip the interface name
+  auto frame = p_line.substr(close + 1);
+  const auto interface_start = frame.find_first_not_of(' ');
+  const auto interface_end = frame.find(' ', interface_start);
+  if (interface_start == frame.npos || interface_end == frame.npos) {
+    return hal::new_error(std::errc::invalid_argument);
+  }
+  frame = frame.substr(interface_end + 1);
+
+  const auto hash = frame.find('#');
+  std::uint64_t id = 0;
+  if (hash == frame.npos || !parse_number(frame.substr(0, hash), id, 16) ||
+      id > 0x1FFF'FFFF) {
+    return hal::new_error(std::errc::invalid_argument);
+  }
+
+  can::message_t message{ .id = static_cast<can::id_t>(id) };
+  auto data = frame.substr(hash + 1);
+
+  if (!data.empty() && data[0] == 'R') {
+    std::uint64_t length = 0;
+    if (data.size() > 1 && (!parse_number(data.substr(1), length) ||
+                            length > message.payload.size())) {
+      return hal::new_error(std::errc::invalid_argument);
+    }
+    message.is_remote_request = true;
+    message.length = static_cast<std::uint8_t>(length);
+  } else {
+    if (data.size() % 2 != 0 || data.size() / 2 > message.payload.size()) {
+      return hal::new_error(std::errc::invalid_argument);
+    }
+    for (std::size_t i = 0; i < data.size() / 2; i++) {
+      std::uint64_t value = 0;
+      if (!parse_number(data.substr(i * 2, 2), value, 16)) {
+        return hal::new_error(std::errc::invalid_argument);
+      }
+      message.payload[i] = static_cast<hal::byte>(value);
+    }
+    message.length = static_cast<std::uint8_t>(data.size() / 2);
+  }
+
+  return can_log_record{
+    .timestamp = std::chrono::microseconds(
+      static_cast<std::int64_t>(seconds * 1'000'000 + microseconds)),
+    .message = message,
+  };
+}
+
+/**
+ * @brief CAN driver that replays a binary log into its receive handler
+ *
+ * For benchmarking and testing code that uses `hal::can`, such as
+ * `can_router`, on a host without a CAN bus. Call the replay as a worker, and
+ * each call delivers every record that is due to the receive handler.
+ *
+ * Records are due when the time since the first call to the worker, multiplied
+ * by the speed, reaches the time between the record and the first record.
+ * A speed of 2.0 replays twice as fast as recorded. A speed of 0.0 delivers
+ * every record as fast as possible.
+ *
+ * Messages sent through this driver are counted and otherwise dropped.
+ */
+class can_log_replay : public hal::can
+{
+public:
+  /**
+   * @brief Construct a new can log replay
+   *
+   * @param p_log - binary log to replay. Must outlive this object.
+   * @param p_steady_clock - clock used to pace the replay. Must outlive this
+   * object.
+   * @param p_speed - replay speed relative to the recorded timing, 0.0 to
+   * replay without delays
+   */
+  can_log_replay(std::span<const hal::byte> p_log,
+                 hal::steady_clock& p_steady_clock,
+                 float p_speed = 1.0f)
+    : m_log(p_log)
+    , m_steady_clock(&p_steady_clock)
+    , m_speed(p_speed)
+  {
+  }
+
+  /**
+   * @brief Deliver records that are due to the receive handler
+   *
+   * @return result<work_state> - finished once every record has been
+   * delivered, otherwise in_progress
+   * @throws std::errc::bad_message - if the log is malformed or truncated
+   */
+  result<work_state> operator()()
+  {
+    const auto now = HAL_CHECK(m_steady_clock->uptime());
+    const auto elapsed =
+      can_log_timestamp(now, m_steady_clock->frequency());
+
+    while (true) {
+      if (!m_pending) {
+        if (m_log.empty()) {
+          return work_state::finished;
+        }
+        const auto consumed = HAL_CHECK(m_reader.read(m_log, m_record));
+        if (consumed == 0) {
+          return hal::new_error(std::errc::bad_message);
+        }
+        m_log = m_log.subspan(consumed);
+        m_pending = true;
+      }
+
+      if (!m_started) {
+        m_started = true;
+        m_start = elapsed;
+        m_first = m_record.timestamp;
+      }
+
+      if (!due(elapsed - m_start)) {
+        return work_state::in_progress;
+      }
+
+      m_pending = false;
+      m_delivered++;
+      m_handler(m_record.message);
+    }
+  }
+
+  /**
+   * @brief Get the number of records delivered to the receive handler
+   *
+   * @return std::uint32_t - number of delivered records
+   */
+  [[nodiscard]] std::uint32_t delivered() const
+  {
+    return m_delivered;
+  }
+
+  /**
+   * @brief Get the number of messages sent through this driver
+   *
+   * @return std::uint32_t - number of sent messages
+   */
+  [[nodiscard]] std::uint32_t sent() const
+  {
+    return m_sent;
+  }
+
+private:
+  bool due(std::chrono::microseconds p_elapsed) const
+  {
+    if (m_speed <= 0.0f) {
+      return true;
+    }
+    // float only holds whole microseconds up to 2^24 us, about 16.7 s, so
+    // compare in double to keep long replays on time
+    const auto recorded = m_record.timestamp - m_first;
+    return static_cast<double>(p_elapsed.count()) *
+             static_cast<double>(m_speed) >=
+           static_cast<double>(recorded.count());
+  }
+
+  status driver_configure([[maybe_unused]] const settings& p_settings) override
+  {
+    return success();
+  }
+
+  status driver_send([[maybe_unused]] const message_t& p_message) override
+  {
+    m_sent++;
+    return success();
+  }
+
+  status driver_on_receive(hal::callback<handler> p_handler) override
+  {
+    m_handler = p_handler;
+    return success();
+  }
+
+  std::span<const hal::byte> m_log;
+  hal::steady_clock* m_steady_clock;
+  float m_speed;
+  can_log_reader m_reader{};
+  can_log_record m_record{};
+  hal::callback<handler> m_handler =
+    []([[maybe_unused]] const message_t& p_message) {};
+  std::chrono::microseconds m_start{ 0 };
+  std::chrono::microseconds m_first{ 0 };
+  std::uint32_t m_delivered = 0;
+  std::uint32_t m_sent = 0;
+  bool m_pending = false;
+  bool m_started = false;
+};
+}  // namespace hal
@@ -0,0 +1,510 @@
+#pragma once
+
+#include <algorithm>
+#include <concepts>
+#include <cstdint>
+#include <tuple>
+#include <type_traits>
+
+#include <libhal/can.hpp>
+
+#include "bit.hpp"
+
+namespace hal {
+/**
+ * @brief Byte order of a signal within a CAN payload, as used by DBC files
+ *
+ */
+enum class can_byte_order : std::uint8_t
+{
+  /// Intel byte order, `@1` in DBC files. The start bit is the signal's least
+  /// significant bit.
+  little_endian,
+  /// Motorola byte order, `@0` in DBC files. The start bit is the signal's
+  /// most significant bit.
+  big_endian,
+};
+
+/**
+ * @brief A CAN payload loaded into 64-bit words, one per byte order
+ *
+ * Loading the payload once lets every signal in a message be extracted with a
+ * single shift and mask, regardless of its byte order.
+ */
+struct can_payload_words
+{
+  /// Payload byte 0 in bits [7:0], byte 7 in bits [63:56]
+  std::uint64_t little_endian = 0;
+  /// Payload byte 0 in bits [63:56], byte 7 in bits [7:0]
+  std::uint64_t big_endian = 0;
+
+  /**
+   * @brief Load a message's payload
+   *
+   * All 8 payload bytes are loaded regardless of the message's length.
+   *
+   * @param p_message - message to load
+   * @return constexpr can_payload_words - payload in both byte orders
+   */
+  [[nodiscard]] static constexpr can_payload_words load(
+    const can::message_t& p_message)
+  {
+    can_payload_words words;
+    for (std::size_t i = 0; i < p_message.payload.size(); i++) {
+      const auto byte_value = static_cast<std::uint64_t>(p_message.payload[i]);
+      words.little_endian |= byte_value << (8 * i);
+      words.big_endian |= byte_value << (8 * (7 - i));
+    }
+    return words;
+  }
+
+  /**
+   * @brief Store the words into a message's payload
+   *
+   * Each payload byte is the bitwise OR of the matching byte of both words,
+   * thus each word should only hold the signals of its own byte order.
+   *
+   * @param p_message - message to store the payload into
+   */
+  constexpr void store(can::message_t& p_message) const
+  {
+    for (std::size_t i = 0; i < p_message.payload.size(); i++) {
+      p_message.payload[i] =
+        static_cast<hal::byte>((little_endian >> (8 * i)) |
+                               (big_endian >> (8 * (7 - i))));
+    }
+  }
+};
+
+/**
+ * @brief Description of a signal within a CAN payload, as found in a DBC file
+ *
+ * For example, the DBC line:
+ *
+ *     SG_ EngineSpeed : 24|16@1+ (0.125,0) [0|8031.875] "rpm" Vector__XXX
+ *
+ * is declared as:
+ *
+ *     constexpr hal::can_signal engine_speed{
+ *       .start_bit = 24, .length = 16, .scale = 0.125f };
+ *
+ * Bits are numbered as in DBC files: bit `n` is bit `n % 8` of payload byte
+ * `n / 8`.
+ *
+ * A signal that does not fit within the 64-bit payload is invalid, see
+ * `is_valid()`. Invalid signals decode as 0 and are never encoded.
+ */
+struct can_signal
+{
+  /// Least significant bit for little endian signals, most significant bit
+  /// for big endian signals
+  std::uint32_t start_bit = 0;
+  /// Number of bits, 1 to 64
+  std::uint32_t length = 1;
+  can_byte_order byte_order = can_byte_order::little_endian;
+  /// True if the raw value is two's complement
+  bool is_signed = false;
+  float scale = 1.0f;
+  float offset = 0.0f;
+
+  /**
+   * @brief Determine if the signal fits within the payload
+   *
+   * @return true - length is 1 to 64 and every bit of the signal lies within
+   * the 64 bits of the payload
+   */
+  [[nodiscard]] constexpr bool is_valid() const
+  {
+    if (length == 0 || length > 64 || start_bit > 63) {
+      return false;
+    }
+    if (byte_order == can_byte_order::little_endian) {
+      return start_bit + length <= 64;
+    }
+    // The signal runs from its most significant bit down to bit 0 of the big
+    // endian word
+    const auto most_significant = (7 - start_bit / 8) * 8 + start_bit % 8;
+    return length <= most_significant + 1;
+  }
+
+  /**
+   * @brief Get the signal's field within the word of its byte order
+   *
+   * Only meaningful for valid signals.
+   *
+   * @return constexpr bit::mask - position and width of the signal within
+   * `can_payload_words::little_endian` or `can_payload_words::big_endian`
+   */
+  [[nodiscard]] constexpr bit::mask field() const
+  {
+    if (byte_order == can_byte_order::little_endian) {
+      return bit::mask{ .position = start_bit, .width = length };
+    }
+    const auto most_significant = (7 - start_bit / 8) * 8 + start_bit % 8;
+    return bit::mask{ .position = most_significant + 1 - length,
+                      .width = length };
+  }
+
+  /**
+   * @brief Get the number of payload bytes needed to hold the signal
+   *
+   * @return constexpr std::uint8_t - index of the last byte holding the signal
+   * plus 1
+   */
+  [[nodiscard]] constexpr std::uint8_t bytes_used() const
+  {
+    if (!is_valid()) {
+      return 0;
+    }
+    if (byte_order == can_byte_order::little_endian) {
+      return static_cast<std::uint8_t>((start_bit + length - 1) / 8 + 1);
+    }
+    return static_cast<std::uint8_t>(8 - field().position / 8);
+  }
+
+  /**
+   * @brief Extract the raw value of the signal
+   *
+   * @param p_words - loaded payload
+   * @return constexpr std::int64_t - raw value, sign extended if the signal is
+   * signed. 0 if the signal is invalid.
+   */
+  [[nodiscard]] constexpr std::int64_t decode_raw(
+    const can_payload_words& p_words) const
+  {
+    if (!is_valid()) {
+      return 0;
+    }
+    const auto word = byte_order == can_byte_order::little_endian
+                        ? p_words.little_endian
+                        : p_words.big_endian;
+    const auto raw = bit::extract(field(), word);
+
+    // Branch-free sign extension: flips the sign bit then subtracts it. For
+    // unsigned signals the sign bit is placed beyond the field, which leaves
+    // the value untouched.
+    const auto sign_position = is_signed ? length - 1 : 63;
+    const auto sign = static_cast<std::uint64_t>(is_signed) << sign_position;
+    return static_cast<std::int64_t>((raw ^ sign) - sign);
+  }
+
+  /**
+   * @brief Extract the physical value of the signal
+   *
+   * @tparam T - floating point type to compute the value in
+   * @param p_words - loaded payload
+   * @return constexpr T - raw * scale + offset
+   */
+  template<std::floating_point T = float>
+  [[nodiscard]] constexpr T decode(const can_payload_words& p_words) const
+  {
+    return static_cast<T>(decode_raw(p_words)) * static_cast<T>(scale) +
+           static_cast<T>(offset);
+  }
+
+  /**
+   * @brief Insert a raw value into the signal's field
+   *
+   * Bits of p_raw beyond the signal's length are discarded. Nothing is
+   * inserted if the signal is invalid.
+   *
+   * @param p_words - payload to insert the value into
+   * @param p_raw - raw value
+   */
+  constexpr void encode_raw(can_payload_words& p_words,
+                            std::int64_t p_raw) const
+  {
+    if (!is_valid()) {
+      return;
+    }
+    auto& word = byte_order == can_byte_order::little_endian
+                   ? p_words.little_endian
+                   : p_words.big_endian;
+    word = bit::value<std::uint64_t>(word)
+             .insert(field(), static_cast<std::uint64_t>(p_raw))
+             .get();
+  }
+
+  /**
+   * @brief Insert a physical value into the signal's field
+   *
+   * The value is converted to raw with (value - offset) / scale, rounded to
+   * the nearest integer and saturated to the range of the signal.
+   *
+   * @tparam T - floating point type of the value
+   * @param p_words - payload to insert the value into
+   * @param p_value - physical value
+   */
+  template<std::floating_point T>
+  constexpr void encode(can_payload_words& p_words, T p_value) const
+  {
+    const auto scaled =
+      (p_value - static_cast<T>(offset)) / static_cast<T>(scale);
+    encode_raw(p_words, saturate(scaled));
+  }
+
+  /**
+   * @brief Get the smallest raw value the signal can hold
+   *
+   * @return constexpr std::int64_t - smallest raw value
+   */
+  [[nodiscard]] constexpr std::int64_t min_raw() const
+  {
+    if (!is_signed || !is_valid()) {
+      return 0;
+    }
+    return -max_raw() - 1;
+  }
+
+  /**
+   * @brief Get the largest raw value the signal can hold
+   *
+   * @return constexpr std::int64_t - largest raw value, 0 if the signal is
+   * invalid
+   */
+  [[nodiscard]] constexpr std::int64_t max_raw() const
+  {
+    if (!is_valid()) {
+      return 0;
+    }
+    const auto value_bits = is_signed ? length - 1 : std::min(length, 63U);
+    return static_cast<std::int64_t>((std::uint64_t{ 1 } << value_bits) - 1);
+  }
+
+private:
+  /// Round a scaled value to the nearest raw value within the signal's range
+  template<std::floating_point T>
+  constexpr std::int64_t saturate(T p_scaled) const
+  {
+    if (p_scaled != p_scaled) {
+      return 0;
+    }
+    // The limits are only approximate once converted to T, e.g. a 32-bit
+    // limit becomes 2^32 as a float, so the final clamp is done on integers
+    if (p_scaled >= static_cast<T>(max_raw())) {
+      return max_raw();
+    }
+    if (p_scaled <= static_cast<T>(min_raw())) {
+      return min_raw();
+    }
+    const auto rounded =
+      p_scaled < 0 ? p_scaled - T{ 0.5 } : p_scaled + T{ 0.5 };
+    return std::clamp(static_cast<std::int64_t>(rounded), min_raw(), max_raw());
+  }
+};
+
+/**
+ * @brief Reports an invalid signal bound at compile time
+ *
+ * Not constexpr, thus reaching it while constant evaluating a binding or
+ * codec fails to compile. Does nothing at run time.
+ */
+inline void can_signal_is_invalid()
+{
+}
+
+/**
+ * @brief Check that a signal is valid when constant evaluated
+ *
+ * @param p_signal - signal to check
+ */
+constexpr void check_can_signal(const can_signal& p_signal)
+{
+  if (!p_signal.is_valid()) {
+    can_signal_is_invalid();
+  }
+}
+
+/**
+ * @brief Binds a signal to a member of a struct
+ *
+ * Create with `can_field()`.
+ *
+ * @tparam Struct - struct the message is decoded into
+ * @tparam Member - type of the member
+ */
+template<class Struct, class Member>
+struct can_field_binding
+{
+  Member Struct::*member;
+  can_signal signal;
+
+  /**
+   * @brief Decode the signal into the member
+   *
+   * Floating point members receive the physical value. Integral, bool and
+   * enum members receive the raw value.
+   *
+   * @param p_words - loaded payload
+   * @param p_object - object to decode into
+   */
+  constexpr void decode(const can_payload_words& p_words,
+                        Struct& p_object) const
+  {
+    if constexpr (std::is_floating_point_v<Member>) {
+      p_object.*member = signal.template decode<Member>(p_words);
+    } else if constexpr (std::is_same_v<Member, bool>) {
+      p_object.*member = signal.decode_raw(p_words) != 0;
+    } else {
+      p_object.*member = static_cast<Member>(signal.decode_raw(p_words));
+    }
+  }
+
+  /**
+   * @brief Encode the member into the signal
+   *
+   * @param p_words - payload to encode into
+   * @param p_object - object to encode
+   */
+  constexpr void encode(can_payload_words& p_words,
+                        const Struct& p_object) const
+  {
+    if constexpr (std::is_floating_point_v<Member>) {
+      signal.encode(p_words, p_object.*member);
+    } else {
+      signal.encode_raw(p_words, static_cast<std::int64_t>(p_object.*member));
+    }
+  }
+};
+
+/**
+ * @brief Bind a signal to a member of a struct
+ *
+ * An invalid signal fails to compile when the binding is constant evaluated,
+ * such as when it initializes a `constexpr` codec.
+ *
+ * @param p_member - pointer to the member
+ * @param p_signal - signal description
+ * @return constexpr can_field_binding<Struct, Member> - the binding
+ */
+template<class Struct, class Member>
+[[nodiscard]] constexpr can_field_binding<Struct, Member> can_field(
+  Member Struct::*p_member,
+  can_signal p_signal)
+{
+  check_can_signal(p_signal);
+  return { .member = p_member, .signal = p_signal };
+}
+
+/**
+ * @brief Decode a whole message into a struct, and encode it back
+ *
+ * The payload is loaded once, then every field is extracted with shifts and
+ * masks in a single pass without branches. Declare codecs as `constexpr` so
+ * the signal descriptions are folded into the generated code:
+ *
+ *     struct engine_status {
+ *       float speed;
+ *       float coolant_temperature;
+ *       bool running;
+ *     };
+ *
+ *     constexpr hal::can_message_codec engine_status_codec{
+ *       hal::can_field(&engine_status::speed,
+ *                      { .start_bit = 24, .length = 16, .scale = 0.125f }),
+ *       hal::can_field(&engine_status::coolant_temperature,
+ *                      { .start_bit = 0, .length = 8, .offset = -40.0f }),
+ *       hal::can_field(&engine_status::running, { .start_bit = 63 }),
+ *     };
+ *
+ *     auto status = engine_status_codec.decode(message);
+ *
+ * @tparam Struct - struct the message is decoded into
+ * @tparam Fields - can_field_binding types
+ */
+template<class Struct, class... Fields>
+class can_message_codec
+{
+public:
+  /**
+   * @brief Construct a new can message codec
+   *
+   * A `constexpr` codec with an invalid signal fails to compile.
+   *
+   * @param p_fields - signal bindings created with `can_field()`
+   */
+  constexpr explicit can_message_codec(Fields... p_fields)
+    : m_fields(p_fields...)
+  {
+    (check_can_signal(p_fields.signal), ...);
+  }
+
+  /**
+   * @brief Decode a message into an existing object
+   *
+   * Members without a signal are left untouched.
+   *
+   * @param p_message - message to decode
+   * @param p_object - object to decode into
+   */
+  constexpr void decode(const can::message_t& p_message,
+                        Struct& p_object) const
+  {
+    const auto words = can_payload_words::load(p_message);
+    std::apply(
+      [&words, &p_object](const auto&... p_field) {
+        (p_field.decode(words, p_object), ...);
+      },
+      m_fields);
+  }
+
+  /**
+   * @brief Decode a message into a new object
+   *
+   * @param p_message - message to decode
+   * @return constexpr Struct - decoded object, members without a signal are
+   * value initialized
+   */
+  [[nodiscard]] constexpr Struct decode(const can::message_t& p_message) const
+  {
+    Struct object{};
+    decode(p_message, object);
+    return object;
+  }
+
+  /**
+   * @brief Encode an object into a message
+   *
+   * @param p_object - object to encode
+   * @param p_id - ID of the message
+   * @return constexpr can::message_t - message whose length covers every
+   * signal
+   */
+  [[nodiscard]] constexpr can::message_t encode(const Struct& p_object,
+                                                can::id_t p_id) const
+  {
+    can_payload_words words;
+    std::apply(
+      [&words, &p_object](const auto&... p_field) {
+        (p_field.encode(words, p_object), ...);
+      },
+      m_fields);
+
+    can::message_t message{ .id = p_id, .length = length() };
+    words.store(message);
+    return message;
+  }
+
+  /**
+   * @brief Get the number of payload bytes needed to hold every signal
+   *
+   * @return constexpr std::uint8_t - message length
+   */
+  [[nodiscard]] constexpr std::uint8_t length() const
+  {
+    return std::apply(
+      [](const auto&... p_field) {
+        return std::max<std::uint8_t>({ std::uint8_t{ 0 },
+                                        p_field.signal.bytes_used()... });
+      },
+      m_fields);
+  }
+
+private:
+  std::tuple<Fields...> m_fields;
+};
+
+template<class Struct, class... Members>
+can_message_codec(can_field_binding<Struct, Members>...)
+  -> can_message_codec<Struct, can_field_binding<Struct, Members>...>;
+}  // namespace hal
@@ -1,12 +1,22 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <chrono>
+#include <cstdint>
 #include <functional>
+#include <limits>
+#include <span>
+#include <system_error>
 
 #include <libhal/error.hpp>
 #include <libhal/i2c.hpp>
+#include <libhal/steady_clock.hpp>
 #include <libhal/units.hpp>
 
 #include "math.hpp"
+#include "steady_clock.hpp"
 
 namespace hal {
 [[nodiscard]] constexpr auto operator==(const i2c::settings& p_lhs,
@@ -140,4 +150,324 @@ template<size_t BytesToRead>
 
   return p_i2c.transaction(p_address, std::span<hal::byte>{}, data_in, timeout);
 }
+
+/**
+ * @brief probe the i2c bus to see if a device exists, giving up after a
+ * timeout
+ *
+ * @param p_i2c - i2c driver
+ * @param p_address - target address to probe for
+ * @param p_timeout - amount of time to execute the transaction
+ * @return status - success or failure
+ */
+[[nodiscard]] inline status probe(i2c& p_i2c,
+                                  hal::byte p_address,
+                                  timeout auto p_timeout)
+{
+  std::array<hal::byte, 1> data_in;
+  return p_i2c.transaction(
+    p_address, std::span<hal::byte>{}, data_in, p_timeout);
+}
+
+/**
+ * @brief Set of 7-bit i2c addresses stored as a 128-bit bitmap
+ *
+ */
+struct i2c_address_set
+{
+  /// Bit N of word N / 64 is set when address N is in the set
+  std::array<std::uint64_t, 2> words{};
+
+  /**
+   * @brief Add an address to the set
+   *
+   * @param p_address - 7-bit address, the upper bit is ignored
+   */
+  constexpr void insert(hal::byte p_address)
+  {
+    const auto address = p_address & 0x7FU;
+    words[address / 64] |= std::uint64_t{ 1 } << (address % 64);
+  }
+
+  /**
+   * @brief Determine if an address is in the set
+   *
+   * @param p_address - 7-bit address, the upper bit is ignored
+   * @return true - address is in the set
+   */
+  [[nodiscard]] constexpr bool contains(hal::byte p_address) const
+  {
+    const auto address = p_address & 0x7FU;
+    return (words[address / 64] >> (address % 64)) & 1U;
+  }
+
+  /**
+   * @brief Get the number of addresses in the set
+   *
+   * @return std::size_t - number of addresses
+   */
+  [[nodiscard]] constexpr std::size_t size() const
+  {
+    return static_cast<std::size_t>(std::popcount(words[0]) +
+                                    std::popcount(words[1]));
+  }
+
+  [[nodiscard]] constexpr bool operator==(const i2c_address_set&) const =
+    default;
+};
+
+/**
+ * @brief Settings for `scan()`
+ *
+ * The default range skips the addresses reserved by the i2c specification,
+ * 0x00 to 0x07 and 0x78 to 0x7F.
+ */
+struct i2c_scan_settings
+{
+  /// Maximum amount of time to spend probing each address
+  hal::time_duration probe_timeout = std::chrono::milliseconds(1);
+  /// First address to probe
+  hal::byte first = 0x08;
+  /// Last address to probe
+  hal::byte last = 0x77;
+  /// Addresses within the range that must not be probed
+  i2c_address_set skip{};
+};
+
+/**
+ * @brief Devices found by `scan()`
+ *
+ */
+struct i2c_scan_result
+{
+  /// Addresses that acknowledged the probe
+  i2c_address_set present{};
+  /// Addresses whose probe did not finish before the probe timeout. Usually
+  /// indicates a device holding the clock low or a stuck bus.
+  i2c_address_set timed_out{};
+  /// Duration of each probe in steady clock ticks, 0 for addresses that were
+  /// not probed
+  std::array<std::uint32_t, 128> latency{};
+  /// Frequency of the ticks in `latency`
+  hertz frequency = 0.0f;
+};
+
+/**
+ * @brief Probe every address in a range of the i2c bus
+ *
+ * Each probe is bounded by `p_settings.probe_timeout`, thus the scan completes
+ * within a known amount of time even if a device stretches the clock
+ * indefinitely. Devices are probed in the same way as `probe()`.
+ *
+ *     auto devices = HAL_CHECK(hal::scan(i2c, steady_clock));
+ *     if (devices.present.contains(0x68)) {
+ *       // IMU found
+ *     }
+ *
+ * @param p_i2c - i2c driver
+ * @param p_steady_clock - clock used for the probe timeout and latency
+ * @param p_settings - range of addresses to probe and timeout of each probe
+ * @return result<i2c_scan_result> - devices found, or an error if the steady
+ * clock failed
+ */
+[[nodiscard]] inline result<i2c_scan_result> scan(
+  i2c& p_i2c,
+  hal::steady_clock& p_steady_clock,
+  const i2c_scan_settings& p_settings = {})
+{
+  i2c_scan_result scan_result{ .frequency = p_steady_clock.frequency() };
+  const auto last = std::min<hal::byte>(p_settings.last, 0x7F);
+
+  for (unsigned address = p_settings.first; address <= last; address++) {
+    const auto target = static_cast<hal::byte>(address);
+    if (p_settings.skip.contains(target)) {
+      continue;
+    }
+
+    auto deadline =
+      HAL_CHECK(create_timeout(p_steady_clock, p_settings.probe_timeout));
+    bool expired = false;
+    auto probe_timeout = [&deadline, &expired]() -> status {
+      auto remaining = deadline();
+      expired = expired || !remaining;
+      return remaining;
+    };
+
+    const auto start = HAL_CHECK(p_steady_clock.uptime());
+    const auto acknowledged =
+      static_cast<bool>(probe(p_i2c, target, probe_timeout));
+    const auto end = HAL_CHECK(p_steady_clock.uptime());
+
+    constexpr auto max_latency = std::numeric_limits<std::uint32_t>::max();
+    scan_result.latency[target] = static_cast<std::uint32_t>(
+      std::min<std::uint64_t>(end - start, max_latency));
+    if (acknowledged) {
+      scan_result.present.insert(target);
+    } else if (expired) {
+      scan_result.timed_out.insert(target);
+    }
+  }
+
+  return scan_result;
+}
+
+/**
+ * @brief A portion of an i2c transaction
+ *
+ * A segment writes its data_out then reads into its data_in. Normally only
+ * one of the two is used, see `i2c_write()` and `i2c_read()`.
+ */
+struct i2c_segment
+{
+  /// Bytes to write to the target device
+  std::span<const hal::byte> data_out{};
+  /// Buffer to read bytes into from the target device
+  std::span<hal::byte> data_in{};
+};
+
+/**
+ * @brief Make a write segment
+ *
+ * @param p_data_out - bytes to write to the target device
+ * @return constexpr i2c_segment - write segment
+ */
+[[nodiscard]] constexpr i2c_segment i2c_write(
+  std::span<const hal::byte> p_data_out)
+{
+  return { .data_out = p_data_out };
+}
+
+/**
+ * @brief Make a read segment
+ *
+ * @param p_data_in - buffer to read bytes into from the target device
+ * @return constexpr i2c_segment - read segment
+ */
+[[nodiscard]] constexpr i2c_segment i2c_read(std::span<hal::byte> p_data_in)
+{
+  return { .data_in = p_data_in };
+}
+
+/**
+ * @brief Perform a list of write and read segments with as few transactions as
+ * possible
+ *
+ * Consecutive writes followed by consecutive reads are performed as a single
+ * `i2c::transaction()`, thus the reads follow the writes with a repeated start.
+ * A write that follows a read begins a new transaction as `hal::i2c` can only
+ * write then read within one transaction.
+ *
+ * Segments whose buffers are next to each other in memory are joined without
+ * copying. For example, a register address and payload stored in the same
+ * struct or array. Otherwise the segments are gathered into, or scattered
+ * from, a staging buffer of StagingCapacity bytes on the stack.
+ *
+ *     std::array<hal::byte, 1> address{ 0x10 };
+ *     std::array<hal::byte, 6> payload{};
+ *     std::array<hal::byte, 2> status{};
+ *     std::array segments{
+ *       hal::i2c_write(address),
+ *       hal::i2c_write(payload),
+ *       hal::i2c_read(status),
+ *     };
+ *     HAL_CHECK(hal::segmented_transaction<8>(
+ *       i2c, 0x42, segments, hal::never_timeout()));
+ *
+ * @tparam StagingCapacity - number of bytes available for joining segments
+ * that are not next to each other in memory
+ * @param p_i2c - i2c driver
+ * @param p_address - target address
+ * @param p_segments - segments to perform in order
+ * @param p_timeout - amount of time to execute each transaction
+ * @return status - success or failure
+ * @throws std::errc::no_buffer_space - the segments of a transaction could
+ * not be joined without more than StagingCapacity bytes of staging. Nothing is
+ * sent for the transaction.
+ */
+template<std::size_t StagingCapacity = 0>
+[[nodiscard]] status segmented_transaction(
+  i2c& p_i2c,
+  hal::byte p_address,
+  std::span<const i2c_segment> p_segments,
+  timeout auto p_timeout = hal::never_timeout())
+{
+  std::array<hal::byte, StagingCapacity> staging;
+  std::span<hal::byte> free_staging(staging);
+
+  // Join `p_next` onto `p_joined`, staging both if they are not contiguous
+  auto join = [&free_staging](auto& p_joined, auto p_next, bool& p_staged) {
+    if (p_next.empty()) {
+      return true;
+    }
+    if (p_joined.empty()) {
+      p_joined = p_next;
+      return true;
+    }
+    if (p_joined.data() + p_joined.size() == p_next.data()) {
+      p_joined = { p_joined.data(), p_joined.size() + p_next.size() };
+      return true;
+    }
+    // Once staged, p_joined always starts at the front of free_staging
+    const auto size = p_joined.size() + p_next.size();
+    if (size > free_staging.size()) {
+      return false;
+    }
+    if (!p_staged) {
+      std::copy(p_joined.begin(), p_joined.end(), free_staging.begin());
+      p_staged = true;
+    }
+    std::copy(
+      p_next.begin(), p_next.end(), free_staging.begin() + p_joined.size());
+    p_joined = free_staging.first(size);
+    return true;
+  };
+
+  auto remaining = p_segments;
+  while (!remaining.empty()) {
+    // A transaction is a run of writes followed by a run of reads
+    std::size_t count = 0;
+    bool reading = false;
+    for (; count < remaining.size(); count++) {
+      if (reading && !remaining[count].data_out.empty()) {
+        break;
+      }
+      reading = reading || !remaining[count].data_in.empty();
+    }
+    const auto run = remaining.first(count);
+    remaining = remaining.subspan(count);
+
+    free_staging = std::span<hal::byte>(staging);
+    std::span<const hal::byte> data_out{};
+    bool out_staged = false;
+    for (const auto& segment : run) {
+      if (!join(data_out, segment.data_out, out_staged)) {
+        return hal::new_error(std::errc::no_buffer_space);
+      }
+    }
+
+    if (out_staged) {
+      free_staging = free_staging.subspan(data_out.size());
+    }
+    std::span<hal::byte> data_in{};
+    bool in_staged = false;
+    for (const auto& segment : run) {
+      if (!join(data_in, segment.data_in, in_staged)) {
+        return hal::new_error(std::errc::no_buffer_space);
+      }
+    }
+
+    HAL_CHECK(p_i2c.transaction(p_address, data_out, data_in, p_timeout));
+
+    if (in_staged) {
+      auto staged = data_in;
+      for (const auto& segment : run) {
+        std::copy_n(
+          staged.begin(), segment.data_in.size(), segment.data_in.begin());
+        staged = staged.subspan(segment.data_in.size());
+      }
+    }
+  }
+
+  return success();
+}
 }  // namespace hal
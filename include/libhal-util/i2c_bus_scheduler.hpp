@@ -0,0 +1,358 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+#include <libhal/error.hpp>
+#include <libhal/i2c.hpp>
+#include <libhal/steady_clock.hpp>
+#include <libhal/timeout.hpp>
+
+#include "i2c.hpp"
+#include "static_list.hpp"
+#include "units.hpp"
+
+namespace hal {
+/**
+ * @brief How an i2c_bus_scheduler::client competes for the bus
+ *
+ */
+struct i2c_bus_client_settings
+{
+  /// Clients with a higher priority are granted the bus first
+  std::uint8_t priority = 0;
+  /// Amount of time after a transaction is requested that it should start.
+  /// Among clients of equal priority, the earliest deadline goes first.
+  hal::time_duration deadline = std::chrono::milliseconds(10);
+  /// Number of leading bytes of each write that hold the target's big endian
+  /// memory or register address. Required for splitting writes, see
+  /// `i2c_bus_scheduler::client`.
+  std::size_t address_bytes = 0;
+};
+
+/**
+ * @brief Time a client spent waiting for the bus
+ *
+ * All durations are in ticks of the scheduler's steady clock.
+ */
+struct i2c_bus_client_statistics
+{
+  /// Number of transactions performed, counting each split chunk
+  std::uint32_t transactions = 0;
+  /// Number of transactions that started after their deadline
+  std::uint32_t deadline_misses = 0;
+  /// Ticks spent waiting for the bus by the last transaction
+  std::uint64_t last_wait = 0;
+  /// Most ticks spent waiting for the bus by a transaction
+  std::uint64_t max_wait = 0;
+  /// Total ticks spent waiting for the bus
+  std::uint64_t total_wait = 0;
+};
+
+/**
+ * @brief Share one i2c bus between drivers by priority and deadline
+ *
+ * Each driver is given its own `i2c_bus_scheduler::client`, which implements
+ * `hal::i2c`. When a client requests a transaction while the bus is busy or
+ * while a more urgent client is waiting, the request waits by calling its
+ * timeout function until it is the most urgent request and the bus is free.
+ * The timeout function is where an RTOS thread yields, thus a waiting low
+ * priority thread does not hold back a higher priority one. Requests are
+ * ranked by priority, then by deadline.
+ *
+ * Long writes can be split so that more urgent clients can use the bus
+ * between chunks. Give the client a split buffer and the number of address
+ * bytes at the start of each write. Each chunk is sent with the address
+ * advanced by the number of bytes already written. Each chunk is a complete
+ * write to the target, thus targets with internal write cycles, such as
+ * EEPROMs, must be given time to finish each chunk; the timeout function is a
+ * natural place to poll for this.
+ *
+ *     hal::i2c_bus_scheduler scheduler(i2c, steady_clock);
+ *     hal::i2c_bus_scheduler::client imu_bus(scheduler, { .priority = 10 });
+ *     std::array<hal::byte, 34> page{};
+ *     hal::i2c_bus_scheduler::client eeprom_bus(
+ *       scheduler, { .address_bytes = 2 }, page);
+ *
+ * When no other client is waiting, a transaction starts immediately and the
+ * scheduler only adds a few clock reads. If clients run in threads, the
+ * bus is claimed with an atomic flag, but clients must be constructed and
+ * destroyed while no transactions are in progress.
+ */
+class i2c_bus_scheduler
+{
+public:
+  class client;
+
+  /**
+   * @brief Construct a new i2c bus scheduler
+   *
+   * @param p_i2c - bus to share. Must outlive this object.
+   * @param p_steady_clock - clock used for deadlines and statistics. Must
+   * outlive this object.
+   */
+  i2c_bus_scheduler(hal::i2c& p_i2c, hal::steady_clock& p_steady_clock)
+    : m_i2c(&p_i2c)
+    , m_steady_clock(&p_steady_clock)
+  {
+  }
+
+  i2c_bus_scheduler(i2c_bus_scheduler&) = delete;
+  i2c_bus_scheduler& operator=(i2c_bus_scheduler&) = delete;
+  i2c_bus_scheduler(i2c_bus_scheduler&&) = delete;
+  i2c_bus_scheduler& operator=(i2c_bus_scheduler&&) = delete;
+
+  /**
+   * @brief Get the number of clients sharing the bus
+   *
+   * @return std::size_t - number of clients
+   */
+  [[nodiscard]] std::size_t clients() const
+  {
+    return m_clients.size();
+  }
+
+private:
+  friend class client;
+
+  bool outranks(const client& p_lhs, const client& p_rhs) const;
+  bool try_acquire(client& p_client);
+  status perform(client& p_client,
+                 hal::byte p_address,
+                 std::span<const hal::byte> p_data_out,
+                 std::span<hal::byte> p_data_in,
+                 hal::function_ref<hal::timeout_function> p_timeout);
+
+  void release()
+  {
+    m_busy.store(false, std::memory_order_release);
+  }
+
+  static_list<client*> m_clients{};
+  hal::i2c* m_i2c;
+  hal::steady_clock* m_steady_clock;
+  /// Settings last applied to the bus, only accessed while it is owned
+  i2c::settings m_bus_settings{};
+  bool m_bus_configured = false;
+  std::atomic<bool> m_busy = false;
+};
+
+/**
+ * @brief A driver's handle to an i2c bus shared through an
+ * i2c_bus_scheduler
+ *
+ */
+class i2c_bus_scheduler::client : public hal::i2c
+{
+public:
+  /**
+   * @brief Construct a new client of a shared bus
+   *
+   * @param p_scheduler - scheduler of the shared bus. Must outlive this object.
+   * @param p_settings - priority and deadline of this client's transactions
+   * @param p_split_buffer - buffer used to split writes that do not fit in it.
+   * Writes are not split if empty or if it is not larger than
+   * `p_settings.address_bytes`.
+   */
+  client(i2c_bus_scheduler& p_scheduler,
+         i2c_bus_client_settings p_settings = {},
+         std::span<hal::byte> p_split_buffer = {})
+    : m_scheduler(&p_scheduler)
+    , m_settings(p_settings)
+    , m_split_buffer(p_split_buffer)
+    , m_item(p_scheduler.m_clients.push_back(this))
+  {
+  }
+
+  client(client&) = delete;
+  client& operator=(client&) = delete;
+  client(client&&) = delete;
+  client& operator=(client&&) = delete;
+
+  /**
+   * @brief Get this client's statistics
+   *
+   * @return const i2c_bus_client_statistics& - time spent waiting for the bus
+   */
+  [[nodiscard]] const i2c_bus_client_statistics& statistics() const
+  {
+    return m_statistics;
+  }
+
+  /**
+   * @brief Get this client's settings
+   *
+   * @return const i2c_bus_client_settings& - priority and deadline
+   */
+  [[nodiscard]] const i2c_bus_client_settings& client_settings() const
+  {
+    return m_settings;
+  }
+
+private:
+  friend class i2c_bus_scheduler;
+
+  status driver_configure(const i2c::settings& p_settings) override
+  {
+    // Applied to the bus by this client's next transaction if the bus is
+    // configured differently
+    m_bus_settings = p_settings;
+    return success();
+  }
+
+  status driver_transaction(
+    hal::byte p_address,
+    std::span<const hal::byte> p_data_out,
+    std::span<hal::byte> p_data_in,
+    hal::function_ref<hal::timeout_function> p_timeout) override
+  {
+    const auto prefix = m_settings.address_bytes;
+    const bool split = p_data_in.empty() && m_split_buffer.size() > prefix &&
+                       p_data_out.size() > m_split_buffer.size();
+    if (!split) {
+      return request(p_address, p_data_out, p_data_in, p_timeout);
+    }
+
+    const auto address = p_data_out.first(prefix);
+    auto payload = p_data_out.subspan(prefix);
+    const auto chunk_size = m_split_buffer.size() - prefix;
+    std::size_t offset = 0;
+
+    while (!payload.empty()) {
+      const auto chunk = payload.first(std::min(chunk_size, payload.size()));
+      // Write the address advanced by offset in big endian order
+      auto carry = offset;
+      for (std::size_t i = prefix; i-- > 0;) {
+        carry += address[i];
+        m_split_buffer[i] = static_cast<hal::byte>(carry);
+        carry >>= 8;
+      }
+      std::copy(chunk.begin(), chunk.end(), m_split_buffer.begin() + prefix);
+      HAL_CHECK(request(p_address,
+                        m_split_buffer.first(prefix + chunk.size()),
+                        std::span<hal::byte>{},
+                        p_timeout));
+      offset += chunk.size();
+      payload = payload.subspan(chunk.size());
+    }
+
+    return success();
+  }
+
+  status request(hal::byte p_address,
+                 std::span<const hal::byte> p_data_out,
+                 std::span<hal::byte> p_data_in,
+                 hal::function_ref<hal::timeout_function> p_timeout)
+  {
+    auto& clock = *m_scheduler->m_steady_clock;
+    const auto requested = HAL_CHECK(clock.uptime());
+    const auto deadline_ticks =
+      std::max<std::int64_t>(cycles_per(clock.frequency(), m_settings.deadline),
+                             0);
+    const auto deadline =
+      requested + static_cast<std::uint64_t>(deadline_ticks);
+    // Published to other clients by the release store of m_waiting
+    m_deadline.store(deadline, std::memory_order_relaxed);
+    m_waiting.store(true, std::memory_order_release);
+
+    while (!m_scheduler->try_acquire(*this)) {
+      auto waited = p_timeout();
+      if (!waited) {
+        m_waiting.store(false, std::memory_order_release);
+        return waited;
+      }
+    }
+    m_waiting.store(false, std::memory_order_release);
+
+    auto granted = clock.uptime();
+    if (!granted) {
+      m_scheduler->release();
+      return granted.error();
+    }
+    const auto wait = granted.value() - requested;
+    m_statistics.transactions++;
+    m_statistics.last_wait = wait;
+    m_statistics.max_wait = std::max(m_statistics.max_wait, wait);
+    m_statistics.total_wait += wait;
+    if (granted.value() > deadline) {
+      m_statistics.deadline_misses++;
+    }
+
+    auto performed = m_scheduler->perform(
+      *this, p_address, p_data_out, p_data_in, p_timeout);
+    m_scheduler->release();
+    return performed;
+  }
+
+  i2c_bus_scheduler* m_scheduler;
+  i2c_bus_client_settings m_settings;
+  std::span<hal::byte> m_split_buffer;
+  i2c::settings m_bus_settings{};
+  i2c_bus_client_statistics m_statistics{};
+  std::atomic<std::uint64_t> m_deadline = 0;
+  std::atomic<bool> m_waiting = false;
+  static_list<client*>::item m_item;
+};
+
+/**
+ * @brief Determine if p_lhs's request is more urgent than p_rhs's
+ *
+ * @param p_lhs - waiting client
+ * @param p_rhs - waiting client
+ * @return true - p_lhs must be granted the bus before p_rhs
+ */
+inline bool i2c_bus_scheduler::outranks(const client& p_lhs,
+                                        const client& p_rhs) const
+{
+  if (p_lhs.m_settings.priority != p_rhs.m_settings.priority) {
+    return p_lhs.m_settings.priority > p_rhs.m_settings.priority;
+  }
+  return p_lhs.m_deadline.load(std::memory_order_relaxed) <
+         p_rhs.m_deadline.load(std::memory_order_relaxed);
+}
+
+/**
+ * @brief Claim the bus if no waiting client is more urgent
+ *
+ * @param p_client - client requesting the bus
+ * @return true - p_client now owns the bus and must call `release()`
+ */
+inline bool i2c_bus_scheduler::try_acquire(client& p_client)
+{
+  for (const auto* other : m_clients) {
+    if (other != &p_client &&
+        other->m_waiting.load(std::memory_order_acquire) &&
+        outranks(*other, p_client)) {
+      return false;
+    }
+  }
+  bool expected = false;
+  return m_busy.compare_exchange_strong(
+    expected, true, std::memory_order_acquire);
+}
+
+/**
+ * @brief Perform a client's transaction on the bus
+ *
+ * The bus is reconfigured if it was last configured with different settings.
+ */
+inline status i2c_bus_scheduler::perform(
+  client& p_client,
+  hal::byte p_address,
+  std::span<const hal::byte> p_data_out,
+  std::span<hal::byte> p_data_in,
+  hal::function_ref<hal::timeout_function> p_timeout)
+{
+  if (!m_bus_configured || !(m_bus_settings == p_client.m_bus_settings)) {
+    m_bus_configured = false;
+    HAL_CHECK(m_i2c->configure(p_client.m_bus_settings));
+    m_bus_settings = p_client.m_bus_settings;
+    m_bus_configured = true;
+  }
+  return m_i2c->transaction(p_address, p_data_out, p_data_in, p_timeout);
+}
+}  // namespace hal
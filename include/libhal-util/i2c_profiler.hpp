@@ -0,0 +1,290 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <system_error>
+
+#include <libhal/error.hpp>
+#include <libhal/i2c.hpp>
+#include <libhal/steady_clock.hpp>
+
+namespace hal {
+/**
+ * @brief Transactions with one i2c address recorded by an i2c_profiler
+ *
+ * Latencies are in ticks of the profiler's steady clock. Bucket 0 of the
+ * histogram counts transactions that took 0 ticks and bucket N counts
+ * transactions that took [2^(N-1), 2^N) ticks. The last bucket also counts
+ * every longer transaction.
+ *
+ * @tparam BucketCount - number of histogram buckets
+ */
+template<std::size_t BucketCount>
+struct i2c_address_profile
+{
+  /// Address of the target device
+  hal::byte address = 0;
+  /// Number of transactions, including failed ones
+  std::uint32_t transactions = 0;
+  /// Number of failed transactions
+  std::uint32_t errors = 0;
+  /// Number of bytes written to the target
+  std::uint64_t bytes_written = 0;
+  /// Number of bytes read from the target
+  std::uint64_t bytes_read = 0;
+  /// Longest transaction in ticks
+  std::uint64_t max_latency = 0;
+  /// Total time spent in transactions in ticks
+  std::uint64_t total_latency = 0;
+  /// Number of transactions by latency
+  std::array<std::uint32_t, BucketCount> histogram{};
+
+  /**
+   * @brief Get the histogram bucket that a latency is counted in
+   *
+   * @param p_ticks - latency in ticks
+   * @return constexpr std::size_t - bucket index
+   */
+  [[nodiscard]] static constexpr std::size_t bucket_of(std::uint64_t p_ticks)
+  {
+    return std::min<std::size_t>(std::bit_width(p_ticks), BucketCount - 1);
+  }
+};
+
+/**
+ * @brief Number of failed transactions that reported one error code
+ *
+ */
+struct i2c_error_count
+{
+  /// Error code, a default constructed std::errc for errors without a code
+  std::errc error{};
+  /// Number of failed transactions that reported this code
+  std::uint32_t count = 0;
+};
+
+/**
+ * @brief i2c driver that profiles the transactions of another i2c driver
+ *
+ * Wraps an existing i2c driver and records, for each target address, the
+ * number of transactions, bytes transferred, errors and a latency histogram.
+ * Failed transactions are also counted by their std::errc. Drivers use the
+ * profiler in place of the i2c driver it wraps without any changes.
+ *
+ *     hal::i2c_profiler profiler(i2c, steady_clock);
+ *     auto imu = HAL_CHECK(imu_driver::create(profiler));
+ *     // ... later
+ *     for (const auto& profile : profiler.addresses()) {
+ *       hal::print<64>(console, "%02X: %u\n", profile.address,
+ *                      profile.max_latency);
+ *     }
+ *
+ * Errors are passed on to the caller with their std::errc preserved. Errors
+ * that do not carry a std::errc are passed on as an error without a code.
+ *
+ * @tparam AddressCapacity - number of addresses to profile. Transactions with
+ * further addresses are counted by `untracked()`.
+ * @tparam BucketCount - number of latency histogram buckets
+ */
+template<std::size_t AddressCapacity = 8, std::size_t BucketCount = 16>
+class i2c_profiler : public hal::i2c
+{
+public:
+  static_assert(BucketCount > 0, "BucketCount must be at least 1");
+
+  using address_profile = i2c_address_profile<BucketCount>;
+
+  /// Number of distinct error codes counted, see `errors()`
+  static constexpr std::size_t error_capacity = 8;
+
+  /**
+   * @brief Construct a new i2c profiler
+   *
+   * @param p_i2c - i2c driver to profile. Must outlive this object.
+   * @param p_steady_clock - clock used to time transactions. Must outlive
+   * this object.
+   */
+  i2c_profiler(hal::i2c& p_i2c, hal::steady_clock& p_steady_clock)
+    : m_i2c(&p_i2c)
+    , m_steady_clock(&p_steady_clock)
+  {
+  }
+
+  /**
+   * @brief Get the profile of each address seen so far
+   *
+   * @return std::span<const address_profile> - profiles in the order their
+   * address was first seen
+   */
+  [[nodiscard]] std::span<const address_profile> addresses() const
+  {
+    return std::span(m_profiles).first(m_profile_count);
+  }
+
+  /**
+   * @brief Find the profile of an address
+   *
+   * @param p_address - target address
+   * @return const address_profile* - the profile or nullptr if the address
+   * has not been seen or was not tracked
+   */
+  [[nodiscard]] const address_profile* find(hal::byte p_address) const
+  {
+    for (const auto& profile : addresses()) {
+      if (profile.address == p_address) {
+        return &profile;
+      }
+    }
+    return nullptr;
+  }
+
+  /**
+   * @brief Get the number of failed transactions for each error code
+   *
+   * @return std::span<const i2c_error_count> - counts in the order the error
+   * code was first seen
+   */
+  [[nodiscard]] std::span<const i2c_error_count> errors() const
+  {
+    return std::span(m_errors).first(m_error_count);
+  }
+
+  /**
+   * @brief Get the number of transactions with addresses that did not fit
+   * in the profile table
+   *
+   * @return std::uint32_t - number of untracked transactions
+   */
+  [[nodiscard]] std::uint32_t untracked() const
+  {
+    return m_untracked;
+  }
+
+  /**
+   * @brief Get the frequency of the latency ticks
+   *
+   * @return hertz - frequency of the steady clock
+   */
+  [[nodiscard]] hertz frequency()
+  {
+    return m_steady_clock->frequency();
+  }
+
+  /**
+   * @brief Clear every profile and count
+   *
+   */
+  void reset()
+  {
+    m_profiles = {};
+    m_profile_count = 0;
+    m_errors = {};
+    m_error_count = 0;
+    m_untracked = 0;
+  }
+
+private:
+  status driver_configure(const settings& p_settings) override
+  {
+    return m_i2c->configure(p_settings);
+  }
+
+  status driver_transaction(
+    hal::byte p_address,
+    std::span<const hal::byte> p_data_out,
+    std::span<hal::byte> p_data_in,
+    hal::function_ref<hal::timeout_function> p_timeout) override
+  {
+    auto start = m_steady_clock->uptime();
+
+    bool failed = false;
+    std::errc error{};
+    hal::attempt_all(
+      [this, p_address, p_data_out, p_data_in, &p_timeout]() -> status {
+        return m_i2c->transaction(p_address, p_data_out, p_data_in, p_timeout);
+      },
+      [&failed, &error](std::errc p_error) {
+        failed = true;
+        error = p_error;
+      },
+      [&failed]() { failed = true; });
+
+    auto end = m_steady_clock->uptime();
+    std::uint64_t latency = 0;
+    if (start && end) {
+      latency = end.value() - start.value();
+    }
+
+    record(p_address, p_data_out.size(), p_data_in.size(), latency, failed);
+
+    if (!failed) {
+      return success();
+    }
+    count_error(error);
+    if (error == std::errc{}) {
+      return hal::new_error();
+    }
+    return hal::new_error(error);
+  }
+
+  void record(hal::byte p_address,
+              std::size_t p_written,
+              std::size_t p_read,
+              std::uint64_t p_latency,
+              bool p_failed)
+  {
+    auto* profile = profile_of(p_address);
+    if (profile == nullptr) {
+      m_untracked++;
+      return;
+    }
+    profile->transactions++;
+    profile->errors += p_failed ? 1 : 0;
+    profile->bytes_written += p_written;
+    profile->bytes_read += p_read;
+    profile->max_latency = std::max(profile->max_latency, p_latency);
+    profile->total_latency += p_latency;
+    profile->histogram[address_profile::bucket_of(p_latency)]++;
+  }
+
+  address_profile* profile_of(hal::byte p_address)
+  {
+    for (auto& profile : std::span(m_profiles).first(m_profile_count)) {
+      if (profile.address == p_address) {
+        return &profile;
+      }
+    }
+    if (m_profile_count == AddressCapacity) {
+      return nullptr;
+    }
+    auto& profile = m_profiles[m_profile_count++];
+    profile.address = p_address;
+    return &profile;
+  }
+
+  void count_error(std::errc p_error)
+  {
+    for (auto& entry : std::span(m_errors).first(m_error_count)) {
+      if (entry.error == p_error) {
+        entry.count++;
+        return;
+      }
+    }
+    if (m_error_count < error_capacity) {
+      m_errors[m_error_count++] = { .error = p_error, .count = 1 };
+    }
+  }
+
+  hal::i2c* m_i2c;
+  hal::steady_clock* m_steady_clock;
+  std::array<address_profile, AddressCapacity> m_profiles{};
+  std::array<i2c_error_count, error_capacity> m_errors{};
+  std::size_t m_profile_count = 0;
+  std::size_t m_error_count = 0;
+  std::uint32_t m_untracked = 0;
+};
+}  // namespace hal
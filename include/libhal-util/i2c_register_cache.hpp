@@ -0,0 +1,412 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bitset>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <system_error>
+
+#include <libhal/error.hpp>
+#include <libhal/i2c.hpp>
+#include <libhal/timeout.hpp>
+
+#include "bit.hpp"
+
+namespace hal {
+/**
+ * @brief When writes to an i2c_register_cache reach the device
+ *
+ */
+enum class i2c_write_policy : std::uint8_t
+{
+  /// Every write is sent to the device immediately
+  write_through,
+  /// Writes only update the shadow copy until `flush()` is called
+  write_back,
+};
+
+/**
+ * @brief Shadow copy of the registers of an i2c device
+ *
+ * Drivers that read-modify-write configuration registers normally read the
+ * register from the device each time. The cache keeps the last known value of
+ * each register so that only the write reaches the bus, and with the
+ * write_back policy, modified registers are sent together in as few burst
+ * writes as possible when `flush()` is called.
+ *
+ * Supports devices with 8-bit register addresses and 8-bit registers that
+ * auto-increment the register address during multi-byte reads and writes.
+ * Registers that the device changes on its own, such as status or data
+ * registers, must be marked volatile so that they are always read from the
+ * device and never written as part of a burst.
+ *
+ *     hal::i2c_register_cache<0x20> registers(i2c, 0x68);
+ *     registers.set_volatile(0x1A);
+ *     // Set the 3-bit sample rate field of register 0x10 without reading it
+ *     // from the device more than once
+ *     HAL_CHECK(registers.modify(0x10, hal::bit::mask::from<2, 4>(), 5U));
+ *
+ * @tparam RegisterCount - number of consecutive registers to shadow
+ */
+template<std::size_t RegisterCount>
+class i2c_register_cache
+{
+public:
+  static_assert(RegisterCount > 0 && RegisterCount <= 256,
+                "RegisterCount must be between 1 and 256");
+
+  /**
+   * @brief Construct a new i2c register cache
+   *
+   * No registers are known until they are read or written.
+   *
+   * @param p_i2c - i2c bus the device is on. Must outlive this object.
+   * @param p_address - device address
+   * @param p_policy - when writes are sent to the device
+   * @param p_first_register - address of the first shadowed register
+   */
+  i2c_register_cache(
+    hal::i2c& p_i2c,
+    hal::byte p_address,
+    i2c_write_policy p_policy = i2c_write_policy::write_through,
+    hal::byte p_first_register = 0)
+    : m_i2c(&p_i2c)
+    , m_address(p_address)
+    , m_first_register(p_first_register)
+    , m_policy(p_policy)
+  {
+  }
+
+  /**
+   * @brief Read a register
+   *
+   * Only volatile registers and registers whose value is not yet known are
+   * read from the device.
+   *
+   * @param p_register - register address
+   * @return result<hal::byte> - value of the register
+   * @throws std::errc::invalid_argument - register is not shadowed
+   */
+  [[nodiscard]] result<hal::byte> read(hal::byte p_register)
+  {
+    const auto index = HAL_CHECK(index_of(p_register));
+    if (!m_valid[index] || m_volatile[index]) {
+      HAL_CHECK(load(index, 1));
+    }
+    return m_shadow[index];
+  }
+
+  /**
+   * @brief Read a field within a register
+   *
+   * @param p_register - register address
+   * @param p_field - bits of the register to read
+   * @return result<hal::byte> - value of the field shifted down to bit 0
+   * @throws std::errc::invalid_argument - register is not shadowed
+   */
+  [[nodiscard]] result<hal::byte> read(hal::byte p_register,
+                                       bit::mask p_field)
+  {
+    const auto value = HAL_CHECK(read(p_register));
+    return bit::extract(p_field, value);
+  }
+
+  /**
+   * @brief Write a register
+   *
+   * With the write_through policy, the register is written to the device
+   * unless the device is already known to hold the value. With the write_back
+   * policy, the register is marked dirty and written by `flush()`. Volatile
+   * registers are always written immediately.
+   *
+   * @param p_register - register address
+   * @param p_value - new value of the register
+   * @return status - success or failure
+   * @throws std::errc::invalid_argument - register is not shadowed
+   */
+  [[nodiscard]] status write(hal::byte p_register, hal::byte p_value)
+  {
+    const auto index = HAL_CHECK(index_of(p_register));
+    const bool unchanged = m_valid[index] && !m_volatile[index] &&
+                           m_shadow[index] == p_value;
+
+    m_shadow[index] = p_value;
+    m_valid[index] = !m_volatile[index];
+
+    if (m_volatile[index]) {
+      return store(index, 1);
+    }
+    if (unchanged) {
+      return success();
+    }
+    if (m_policy == i2c_write_policy::write_back) {
+      m_dirty[index] = true;
+      return success();
+    }
+    auto stored = store(index, 1);
+    if (!stored) {
+      // The device may still hold the previous value, so a retry with the
+      // same value must not be skipped
+      m_valid[index] = false;
+    }
+    return stored;
+  }
+
+  /**
+   * @brief Update a field within a register
+   *
+   * The register is read from the device only if its value is not yet known
+   * or it is volatile. The result is then written according to the write
+   * policy.
+   *
+   * @param p_register - register address
+   * @param p_field - bits of the register to update
+   * @param p_value - new value of the field
+   * @return status - success or failure
+   * @throws std::errc::invalid_argument - register is not shadowed
+   */
+  [[nodiscard]] status modify(hal::byte p_register,
+                              bit::mask p_field,
+                              std::unsigned_integral auto p_value)
+  {
+    const auto current = HAL_CHECK(read(p_register));
+    const auto updated = bit::value<hal::byte>(current)
+                           .insert(p_field, p_value)
+                           .get();
+    return write(p_register, updated);
+  }
+
+  /**
+   * @brief Read a range of registers from the device in burst reads
+   *
+   * Useful for populating the cache at startup. Each burst reads up to
+   * `max_burst_size` registers. Dirty registers keep their pending value.
+   *
+   * @param p_register - first register address
+   * @param p_count - number of registers to read
+   * @return status - success or failure. On failure, registers of the failed
+   * burst keep their previous state.
+   * @throws std::errc::invalid_argument - range is not shadowed
+   */
+  [[nodiscard]] status refresh(hal::byte p_register, std::size_t p_count)
+  {
+    const auto index = HAL_CHECK(index_of(p_register));
+    if (p_count > RegisterCount - index) {
+      return hal::new_error(std::errc::invalid_argument);
+    }
+    return load(index, p_count);
+  }
+
+  /**
+   * @brief Write every dirty register to the device
+   *
+   * Runs of dirty registers are written in a single burst. Runs separated by
+   * a small number of clean, non-volatile registers are joined into one burst
+   * as rewriting a known value costs less than the start condition, address
+   * and register bytes of another transaction. Bursts are split every
+   * `max_burst_size` registers.
+   *
+   * @return status - success or failure. On failure, registers that were not
+   * written remain dirty.
+   */
+  [[nodiscard]] status flush()
+  {
+    std::size_t index = 0;
+    while (index < RegisterCount) {
+      if (!m_dirty[index]) {
+        index++;
+        continue;
+      }
+
+      auto end = index + 1;
+      auto last_dirty = index;
+      while (end < RegisterCount) {
+        if (m_dirty[end]) {
+          last_dirty = end;
+        } else if (!m_valid[end] || m_volatile[end] ||
+                   end - last_dirty > max_bridged_registers) {
+          break;
+        }
+        end++;
+      }
+
+      const auto count =
+        std::min<std::size_t>(last_dirty + 1 - index, max_burst_size);
+      HAL_CHECK(store(index, count));
+      for (auto i = index; i < index + count; i++) {
+        m_dirty[i] = false;
+      }
+      index += count;
+    }
+    return success();
+  }
+
+  /**
+   * @brief Mark a register as volatile or not
+   *
+   * Volatile registers are always read from the device and written
+   * immediately, regardless of the write policy. A pending write to the
+   * register is sent to the device first.
+   *
+   * @param p_register - register address
+   * @param p_volatile - true to mark the register volatile
+   * @return status - success or failure. On failure, the register is left
+   * unchanged and still dirty.
+   * @throws std::errc::invalid_argument - register is not shadowed
+   */
+  status set_volatile(hal::byte p_register, bool p_volatile = true)
+  {
+    const auto index = HAL_CHECK(index_of(p_register));
+    if (m_dirty[index]) {
+      HAL_CHECK(store(index, 1));
+    }
+    m_volatile[index] = p_volatile;
+    m_valid[index] = false;
+    m_dirty[index] = false;
+    return success();
+  }
+
+  /**
+   * @brief Forget the value of every register
+   *
+   * Call after the device has been reset. Dirty registers are discarded.
+   */
+  void invalidate()
+  {
+    m_valid.reset();
+    m_dirty.reset();
+  }
+
+  /**
+   * @brief Change the write policy
+   *
+   * Switching to write_through does not flush dirty registers, call `flush()`
+   * beforehand.
+   *
+   * @param p_policy - new write policy
+   */
+  void policy(i2c_write_policy p_policy)
+  {
+    m_policy = p_policy;
+  }
+
+  /**
+   * @brief Get the write policy
+   *
+   * @return i2c_write_policy - the write policy
+   */
+  [[nodiscard]] i2c_write_policy policy() const
+  {
+    return m_policy;
+  }
+
+  /**
+   * @brief Determine if a register has been written but not flushed
+   *
+   * @param p_register - register address
+   * @return true - register is dirty
+   * @return false - register is clean or not shadowed
+   */
+  [[nodiscard]] bool dirty(hal::byte p_register) const
+  {
+    const auto index = static_cast<std::size_t>(p_register - m_first_register);
+    return p_register >= m_first_register && index < RegisterCount &&
+           m_dirty[index];
+  }
+
+  /**
+   * @brief Get the number of registers waiting to be flushed
+   *
+   * @return std::size_t - number of dirty registers
+   */
+  [[nodiscard]] std::size_t dirty_count() const
+  {
+    return m_dirty.count();
+  }
+
+  /**
+   * @brief Get the number of transactions performed on the bus
+   *
+   * @return std::uint32_t - number of transactions, including failed ones
+   */
+  [[nodiscard]] std::uint32_t transactions() const
+  {
+    return m_transactions;
+  }
+
+  /// Most registers read or written by one transaction, bounds the staging
+  /// buffer placed on the stack
+  static constexpr std::size_t max_burst_size =
+    std::min<std::size_t>(RegisterCount, 16);
+
+private:
+  /// Clean registers rewritten to join two bursts, see `flush()`
+  static constexpr std::size_t max_bridged_registers = 2;
+
+  result<std::size_t> index_of(hal::byte p_register) const
+  {
+    if (p_register < m_first_register ||
+        static_cast<std::size_t>(p_register - m_first_register) >=
+          RegisterCount) {
+      return hal::new_error(std::errc::invalid_argument);
+    }
+    return static_cast<std::size_t>(p_register - m_first_register);
+  }
+
+  hal::byte register_at(std::size_t p_index) const
+  {
+    return static_cast<hal::byte>(m_first_register + p_index);
+  }
+
+  status load(std::size_t p_index, std::size_t p_count)
+  {
+    // Read into a staging buffer so that a failed read cannot corrupt known
+    // or pending values
+    std::array<hal::byte, max_burst_size> burst;
+    const auto end = p_index + p_count;
+    while (p_index < end) {
+      const auto count = std::min(end - p_index, max_burst_size);
+      const std::array<hal::byte, 1> register_address{ register_at(p_index) };
+      m_transactions++;
+      HAL_CHECK(m_i2c->transaction(m_address,
+                                   register_address,
+                                   std::span(burst).first(count),
+                                   hal::never_timeout()));
+      for (std::size_t i = 0; i < count; i++) {
+        const auto index = p_index + i;
+        if (!m_dirty[index]) {
+          m_shadow[index] = burst[i];
+          m_valid[index] = !m_volatile[index];
+        }
+      }
+      p_index += count;
+    }
+    return success();
+  }
+
+  status store(std::size_t p_index, std::size_t p_count)
+  {
+    std::array<hal::byte, max_burst_size + 1> burst;
+    burst[0] = register_at(p_index);
+    std::copy_n(m_shadow.begin() + p_index, p_count, burst.begin() + 1);
+    m_transactions++;
+    return m_i2c->transaction(m_address,
+                              std::span(burst).first(p_count + 1),
+                              std::span<hal::byte>{},
+                              hal::never_timeout());
+  }
+
+  hal::i2c* m_i2c;
+  std::array<hal::byte, RegisterCount> m_shadow{};
+  std::bitset<RegisterCount> m_valid{};
+  std::bitset<RegisterCount> m_dirty{};
+  std::bitset<RegisterCount> m_volatile{};
+  std::uint32_t m_transactions = 0;
+  hal::byte m_address;
+  hal::byte m_first_register;
+  i2c_write_policy m_policy;
+};
+}  // namespace hal
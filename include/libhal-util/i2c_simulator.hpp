@@ -0,0 +1,452 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <system_error>
+
+#include <libhal/error.hpp>
+#include <libhal/i2c.hpp>
+#include <libhal/steady_clock.hpp>
+#include <libhal/units.hpp>
+
+#include "static_list.hpp"
+#include "units.hpp"
+
+namespace hal {
+/**
+ * @brief steady_clock whose time only moves when it is advanced
+ *
+ * Meant for host tests where timing must be deterministic. Simulated
+ * peripherals, such as `simulated_i2c_bus`, advance the clock by the amount of
+ * time their operations would take on real hardware.
+ */
+class simulated_steady_clock : public hal::steady_clock
+{
+public:
+  /**
+   * @brief Construct a new simulated steady clock
+   *
+   * @param p_frequency - tick frequency of the clock
+   */
+  explicit simulated_steady_clock(hertz p_frequency = 1.0_MHz)
+    : m_frequency(p_frequency)
+  {
+  }
+
+  /**
+   * @brief Move time forward by a number of ticks
+   *
+   * @param p_ticks - number of ticks
+   */
+  void advance(std::uint64_t p_ticks)
+  {
+    m_uptime += p_ticks;
+  }
+
+  /**
+   * @brief Move time forward by a duration
+   *
+   * @param p_duration - amount of time, negative durations are ignored
+   */
+  void advance(hal::time_duration p_duration)
+  {
+    advance(ticks(p_duration));
+  }
+
+  /**
+   * @brief Convert a duration into ticks of this clock
+   *
+   * @param p_duration - amount of time
+   * @return std::uint64_t - number of ticks, 0 for negative durations
+   */
+  [[nodiscard]] std::uint64_t ticks(hal::time_duration p_duration) const
+  {
+    const auto cycles = cycles_per(m_frequency, p_duration);
+    return static_cast<std::uint64_t>(std::max<std::int64_t>(cycles, 0));
+  }
+
+private:
+  hertz driver_frequency() override
+  {
+    return m_frequency;
+  }
+
+  result<std::uint64_t> driver_uptime() override
+  {
+    return m_uptime;
+  }
+
+  hertz m_frequency;
+  std::uint64_t m_uptime = 0;
+};
+
+class simulated_i2c_target;
+
+/**
+ * @brief Simulated i2c bus with targets and a timing model
+ *
+ * Transactions are routed to the `simulated_i2c_target` with a matching
+ * address. Each transaction advances a `simulated_steady_clock` by the time it
+ * would take on a real bus at the configured clock rate. This includes the
+ * start condition, the address byte, 9 clock cycles for each byte and its
+ * acknowledge, any repeated start, the stop condition, and the time the target
+ * stretches the clock. The timeout function is called after every byte and
+ * after clock stretching, so drivers' timeout handling can be tested
+ * deterministically.
+ *
+ *     hal::simulated_steady_clock clock(1.0_MHz);
+ *     hal::simulated_i2c_bus bus(clock);
+ *     hal::simulated_i2c_register_target<128> imu(bus, 0x68);
+ *     imu.registers()[0x75] = 0x71;  // WHO_AM_I
+ *     auto driver = HAL_CHECK(mpu6050::create(bus));
+ *     // clock.uptime() now reflects the bus time used by create()
+ *
+ * If no target acknowledges the address, the transaction fails with
+ * std::errc::no_such_device_or_address.
+ */
+class simulated_i2c_bus : public hal::i2c
+{
+public:
+  /**
+   * @brief Construct a new simulated i2c bus
+   *
+   * @param p_clock - clock advanced by bus activity. Must outlive this object.
+   */
+  explicit simulated_i2c_bus(simulated_steady_clock& p_clock)
+    : m_clock(&p_clock)
+  {
+  }
+
+  simulated_i2c_bus(simulated_i2c_bus&) = delete;
+  simulated_i2c_bus& operator=(simulated_i2c_bus&) = delete;
+  simulated_i2c_bus(simulated_i2c_bus&&) = delete;
+  simulated_i2c_bus& operator=(simulated_i2c_bus&&) = delete;
+
+  /**
+   * @brief Get the clock rate of the bus
+   *
+   * @return hertz - SCL frequency set by the last call to configure()
+   */
+  [[nodiscard]] hertz clock_rate() const
+  {
+    return m_settings.clock_rate;
+  }
+
+  /**
+   * @brief Get the number of transactions performed
+   *
+   * @return std::uint32_t - transactions, including failed ones
+   */
+  [[nodiscard]] std::uint32_t transactions() const
+  {
+    return m_transactions;
+  }
+
+  /**
+   * @brief Get the total time the bus has been busy
+   *
+   * @return std::uint64_t - ticks of the simulated clock
+   */
+  [[nodiscard]] std::uint64_t busy_ticks() const
+  {
+    return m_busy_ticks;
+  }
+
+private:
+  friend class simulated_i2c_target;
+
+  status driver_configure(const settings& p_settings) override
+  {
+    if (p_settings.clock_rate <= 0.0f) {
+      return hal::new_error(std::errc::invalid_argument);
+    }
+    m_settings = p_settings;
+    return success();
+  }
+
+  status driver_transaction(
+    hal::byte p_address,
+    std::span<const hal::byte> p_data_out,
+    std::span<hal::byte> p_data_in,
+    hal::function_ref<hal::timeout_function> p_timeout) override;
+
+  /**
+   * @brief Advance the clock by a number of SCL cycles then check the timeout
+   */
+  status clock_out(std::uint64_t p_cycles,
+                   hal::function_ref<hal::timeout_function> p_timeout)
+  {
+    const auto ticks_per_cycle =
+      static_cast<float>(m_clock->frequency()) / m_settings.clock_rate;
+    // Accumulate fractional ticks so long transactions do not drift
+    m_fractional_ticks += static_cast<float>(p_cycles) * ticks_per_cycle;
+    const auto whole_ticks = std::floor(m_fractional_ticks);
+    m_fractional_ticks -= whole_ticks;
+    m_clock->advance(static_cast<std::uint64_t>(whole_ticks));
+    m_busy_ticks += static_cast<std::uint64_t>(whole_ticks);
+    return p_timeout();
+  }
+
+  simulated_i2c_target* find(hal::byte p_address);
+
+  static_list<simulated_i2c_target*> m_targets{};
+  simulated_steady_clock* m_clock;
+  settings m_settings{};
+  float m_fractional_ticks = 0.0f;
+  std::uint64_t m_busy_ticks = 0;
+  std::uint32_t m_transactions = 0;
+};
+
+/**
+ * @brief Device attached to a simulated_i2c_bus
+ *
+ * Implement `driver_write()` and `driver_read()` to model a device's
+ * behaviour. Use `simulated_i2c_register_target` for the common case of a
+ * device with auto-incrementing 8-bit registers.
+ */
+class simulated_i2c_target
+{
+public:
+  /**
+   * @brief Attach a new target to a simulated bus
+   *
+   * @param p_bus - bus to attach to. Must outlive this object.
+   * @param p_address - 7-bit address of the target
+   */
+  simulated_i2c_target(simulated_i2c_bus& p_bus, hal::byte p_address)
+    : m_address(p_address)
+    , m_item(p_bus.m_targets.push_back(this))
+  {
+  }
+
+  simulated_i2c_target(simulated_i2c_target&) = delete;
+  simulated_i2c_target& operator=(simulated_i2c_target&) = delete;
+  simulated_i2c_target(simulated_i2c_target&&) = delete;
+  simulated_i2c_target& operator=(simulated_i2c_target&&) = delete;
+  virtual ~simulated_i2c_target() = default;
+
+  /**
+   * @brief Get the address of the target
+   *
+   * @return hal::byte - 7-bit address
+   */
+  [[nodiscard]] hal::byte address() const
+  {
+    return m_address;
+  }
+
+  /**
+   * @brief Hold the clock low after each address acknowledge
+   *
+   * @param p_duration - time the clock is stretched for in each transaction
+   */
+  void stretch(hal::time_duration p_duration)
+  {
+    m_stretch = p_duration;
+  }
+
+  /**
+   * @brief Refuse to acknowledge the address of the next transactions
+   *
+   * @param p_transactions - number of transactions to refuse
+   */
+  void nack(std::uint32_t p_transactions = 1)
+  {
+    m_nacks = p_transactions;
+  }
+
+  /**
+   * @brief Refuse to acknowledge written data after a number of bytes
+   *
+   * Models devices that reject writes, for example, an EEPROM during its write
+   * cycle. The transaction fails with std::errc::io_error. Applies to the next
+   * transaction that writes data only.
+   *
+   * @param p_bytes - number of bytes, not counting the address, acknowledged
+   * before the NACK
+   */
+  void nack_data_after(std::size_t p_bytes)
+  {
+    m_data_nack_after = p_bytes;
+    m_data_nack = true;
+  }
+
+  /**
+   * @brief Get the number of transactions this target acknowledged
+   *
+   * @return std::uint32_t - number of transactions
+   */
+  [[nodiscard]] std::uint32_t transactions() const
+  {
+    return m_transactions;
+  }
+
+private:
+  friend class simulated_i2c_bus;
+
+  /**
+   * @brief Receive bytes written by the controller
+   *
+   * @param p_data - bytes written in one transaction
+   */
+  virtual void driver_write(std::span<const hal::byte> p_data) = 0;
+
+  /**
+   * @brief Provide bytes read by the controller
+   *
+   * @param p_data - buffer to fill for one transaction
+   */
+  virtual void driver_read(std::span<hal::byte> p_data) = 0;
+
+  hal::time_duration m_stretch{ 0 };
+  std::size_t m_data_nack_after = 0;
+  std::uint32_t m_nacks = 0;
+  std::uint32_t m_transactions = 0;
+  hal::byte m_address;
+  bool m_data_nack = false;
+  static_list<simulated_i2c_target*>::item m_item;
+};
+
+/**
+ * @brief Simulated device with auto-incrementing 8-bit registers
+ *
+ * The first byte of a write selects the register. The remaining bytes are
+ * written to consecutive registers. Reads return consecutive registers
+ * starting at the selected register. The register address wraps at
+ * RegisterCount.
+ *
+ * @tparam RegisterCount - number of registers
+ */
+template<std::size_t RegisterCount = 256>
+class simulated_i2c_register_target : public simulated_i2c_target
+{
+public:
+  static_assert(RegisterCount > 0 && RegisterCount <= 256,
+                "RegisterCount must be between 1 and 256");
+
+  using simulated_i2c_target::simulated_i2c_target;
+
+  /**
+   * @brief Access the device's registers
+   *
+   * @return std::array<hal::byte, RegisterCount>& - registers
+   */
+  [[nodiscard]] std::array<hal::byte, RegisterCount>& registers()
+  {
+    return m_registers;
+  }
+
+  /**
+   * @brief Get the selected register
+   *
+   * @return hal::byte - register the next read or write begins at
+   */
+  [[nodiscard]] hal::byte selected() const
+  {
+    return m_selected;
+  }
+
+private:
+  void driver_write(std::span<const hal::byte> p_data) override
+  {
+    if (p_data.empty()) {
+      return;
+    }
+    m_selected = static_cast<hal::byte>(p_data[0] % RegisterCount);
+    for (auto value : p_data.subspan(1)) {
+      m_registers[m_selected] = value;
+      m_selected = static_cast<hal::byte>((m_selected + 1) % RegisterCount);
+    }
+  }
+
+  void driver_read(std::span<hal::byte> p_data) override
+  {
+    for (auto& value : p_data) {
+      value = m_registers[m_selected];
+      m_selected = static_cast<hal::byte>((m_selected + 1) % RegisterCount);
+    }
+  }
+
+  std::array<hal::byte, RegisterCount> m_registers{};
+  hal::byte m_selected = 0;
+};
+
+inline simulated_i2c_target* simulated_i2c_bus::find(hal::byte p_address)
+{
+  for (auto* target : m_targets) {
+    if (target->address() == p_address) {
+      return target;
+    }
+  }
+  return nullptr;
+}
+
+inline status simulated_i2c_bus::driver_transaction(
+  hal::byte p_address,
+  std::span<const hal::byte> p_data_out,
+  std::span<hal::byte> p_data_in,
+  hal::function_ref<hal::timeout_function> p_timeout)
+{
+  // Start condition and the stop condition each take about one SCL cycle
+  constexpr std::uint64_t condition_cycles = 1;
+  // 8 data bits and an acknowledge bit
+  constexpr std::uint64_t byte_cycles = 9;
+
+  m_transactions++;
+  auto* target = find(p_address);
+  const bool acknowledged = target != nullptr && target->m_nacks == 0;
+  if (target != nullptr && target->m_nacks > 0) {
+    target->m_nacks--;
+  }
+
+  HAL_CHECK(clock_out(condition_cycles + byte_cycles, p_timeout));
+  if (!acknowledged) {
+    HAL_CHECK(clock_out(condition_cycles, p_timeout));
+    return hal::new_error(std::errc::no_such_device_or_address);
+  }
+
+  target->m_transactions++;
+  if (target->m_stretch > hal::time_duration{ 0 }) {
+    const auto stretch = m_clock->ticks(target->m_stretch);
+    m_clock->advance(stretch);
+    m_busy_ticks += stretch;
+    HAL_CHECK(p_timeout());
+  }
+
+  if (!p_data_out.empty()) {
+    auto accepted = p_data_out;
+    const bool data_nack = target->m_data_nack && p_data_in.empty() &&
+                           target->m_data_nack_after < p_data_out.size();
+    if (data_nack) {
+      target->m_data_nack = false;
+      accepted = p_data_out.first(target->m_data_nack_after);
+    }
+    for (std::size_t i = 0; i < accepted.size(); i++) {
+      HAL_CHECK(clock_out(byte_cycles, p_timeout));
+    }
+    target->driver_write(accepted);
+    if (data_nack) {
+      // The rejected byte is still clocked out before the stop condition
+      HAL_CHECK(clock_out(byte_cycles + condition_cycles, p_timeout));
+      return hal::new_error(std::errc::io_error);
+    }
+  }
+
+  if (!p_data_in.empty()) {
+    if (!p_data_out.empty()) {
+      // Repeated start and the address byte with the read bit set
+      HAL_CHECK(clock_out(condition_cycles + byte_cycles, p_timeout));
+    }
+    target->driver_read(p_data_in);
+    for (std::size_t i = 0; i < p_data_in.size(); i++) {
+      HAL_CHECK(clock_out(byte_cycles, p_timeout));
+    }
+  }
+
+  return clock_out(condition_cycles, p_timeout);
+}
+}  // namespace hal
@@ -0,0 +1,721 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <system_error>
+
+#include <libhal/can.hpp>
+#include <libhal/error.hpp>
+#include <libhal/steady_clock.hpp>
+#include <libhal/timeout.hpp>
+#include <libhal/units.hpp>
+
+#include "can.hpp"
+#include "units.hpp"
+
+namespace hal {
+/**
+ * @brief Settings shared by ISO-TP (ISO 15765-2) senders and receivers
+ *
+ */
+struct iso_tp_settings
+{
+  /// Number of consecutive frames the sender may send before waiting for
+  /// another flow control frame. 0 means the sender never waits. Only used
+  /// by receivers.
+  std::uint8_t block_size = 0;
+  /// Minimum time between consecutive frames requested from the sender. Only
+  /// used by receivers.
+  std::chrono::microseconds separation_time{ 0 };
+  /// Maximum time to wait for the next frame from the other node. Covers
+  /// both N_Bs (waiting for flow control) and N_Cr (waiting for a
+  /// consecutive frame).
+  hal::time_duration timeout = std::chrono::milliseconds(1000);
+  /// Byte used to pad frames to 8 bytes. If std::nullopt, frames are sent
+  /// with the smallest length that fits their data.
+  std::optional<hal::byte> padding = hal::byte{ 0xCC };
+};
+
+/**
+ * @brief Encode a separation time into the STmin byte of a flow control
+ * frame
+ *
+ * Times that cannot be represented exactly are rounded up to the next
+ * representable value. Times above 127ms are clamped to 127ms.
+ *
+ * @param p_separation_time - minimum time between consecutive frames
+ * @return constexpr hal::byte - STmin byte
+ */
+[[nodiscard]] constexpr hal::byte iso_tp_encode_separation_time(
+  std::chrono::microseconds p_separation_time)
+{
+  const auto microseconds = p_separation_time.count();
+
+  if (microseconds <= 0) {
+    return 0x00;
+  }
+
+  // 0xF1 to 0xF9 represent 100us to 900us
+  if (microseconds <= 900) {
+    const auto hundreds = (microseconds + 99) / 100;
+    return static_cast<hal::byte>(0xF0 + hundreds);
+  }
+
+  // 0x01 to 0x7F represent 1ms to 127ms
+  const auto milliseconds = (microseconds + 999) / 1000;
+  return static_cast<hal::byte>(
+    std::min<decltype(milliseconds)>(milliseconds, 127));
+}
+
+/**
+ * @brief Decode the STmin byte of a flow control frame
+ *
+ * Reserved values are decoded as 127ms as required by ISO 15765-2.
+ *
+ * @param p_separation_time - STmin byte
+ * @return constexpr std::chrono::microseconds - minimum time between
+ * consecutive frames
+ */
+[[nodiscard]] constexpr std::chrono::microseconds
+iso_tp_decode_separation_time(hal::byte p_separation_time)
+{
+  if (p_separation_time <= 0x7F) {
+    return std::chrono::milliseconds(p_separation_time);
+  }
+  if (0xF1 <= p_separation_time && p_separation_time <= 0xF9) {
+    return std::chrono::microseconds((p_separation_time - 0xF0) * 100);
+  }
+  return std::chrono::milliseconds(127);
+}
+
+namespace iso_tp {
+/// Protocol control information frame types, the upper nibble of byte 0
+enum class frame_type : std::uint8_t
+{
+  single = 0x0,
+  first = 0x1,
+  consecutive = 0x2,
+  flow_control = 0x3,
+};
+
+/// Flow status of a flow control frame, the lower nibble of byte 0
+enum class flow_status : std::uint8_t
+{
+  clear_to_send = 0x0,
+  wait = 0x1,
+  overflow = 0x2,
+};
+
+/// Largest payload that fits within a single frame
+constexpr std::size_t single_frame_capacity = 7;
+/// Number of payload bytes carried by a first frame
+constexpr std::size_t first_frame_capacity = 6;
+/// Number of payload bytes carried by a consecutive frame
+constexpr std::size_t consecutive_frame_capacity = 7;
+/// Largest payload that can be described by a first frame
+constexpr std::size_t max_payload = 4095;
+
+/**
+ * @brief Build a frame from its protocol control information and data
+ *
+ * @param p_id - ID of the frame
+ * @param p_header - protocol control information bytes
+ * @param p_data - payload bytes placed after the header
+ * @param p_padding - byte used to pad the frame to 8 bytes, if any
+ * @return can::message_t - the frame
+ */
+inline can::message_t make_frame(can::id_t p_id,
+                                 std::span<const hal::byte> p_header,
+                                 std::span<const hal::byte> p_data,
+                                 std::optional<hal::byte> p_padding)
+{
+  can::message_t frame{ .id = p_id };
+  auto position =
+    std::copy(p_header.begin(), p_header.end(), frame.payload.begin());
+  position = std::copy(p_data.begin(), p_data.end(), position);
+  frame.length = static_cast<std::uint8_t>(position - frame.payload.begin());
+
+  if (p_padding) {
+    std::fill(position, frame.payload.end(), *p_padding);
+    frame.length = static_cast<std::uint8_t>(frame.payload.size());
+  }
+
+  return frame;
+}
+
+/**
+ * @brief Get the frame type of a frame
+ *
+ * @param p_frame - frame to inspect. Must have a length of at least 1.
+ * @return frame_type - frame type encoded in the upper nibble of byte 0
+ */
+constexpr frame_type type_of(const can::message_t& p_frame)
+{
+  return static_cast<frame_type>(p_frame.payload[0] >> 4);
+}
+
+/**
+ * @brief Convert a time duration into steady clock ticks
+ *
+ * @param p_steady_clock - steady clock
+ * @param p_duration - time duration
+ * @return std::uint64_t - number of ticks, never negative
+ */
+inline std::uint64_t to_ticks(hal::steady_clock& p_steady_clock,
+                              hal::time_duration p_duration)
+{
+  const auto cycles = cycles_per(p_steady_clock.frequency(), p_duration);
+  return static_cast<std::uint64_t>(std::max<std::int64_t>(cycles, 0));
+}
+}  // namespace iso_tp
+
+/**
+ * @brief Receive ISO-TP (ISO 15765-2) messages into a caller provided buffer
+ *
+ * Registers a route for the sender's ID with a can router. Single and first
+ * frames start a message and consecutive frames are copied directly into the
+ * caller's buffer. Flow control frames are sent back to the sender using the
+ * router's bus, with the block size and separation time from the settings.
+ *
+ * Call the receiver as a worker to check for timeouts and to find out when a
+ * message is complete. Once finished, the buffer belongs to the caller until
+ * `reset()` is called; frames received in the mean time are ignored.
+ *
+ * The route handler and the worker must not preempt each other. Create the
+ * router with a can_receive_queue and call `process()` in the same task as
+ * the worker, or call the worker from the receive interrupt.
+ *
+ * Multiple receivers and senders may be registered with a router at the same
+ * time, one per ID, to handle concurrent sessions.
+ *
+ * @tparam Router - can router type such as `hal::can_router`
+ */
+template<class Router>
+class iso_tp_receiver
+{
+public:
+  /**
+   * @brief Construct a new iso tp receiver
+   *
+   * @param p_router - router to receive frames from and send flow control
+   * frames through. Must outlive this object.
+   * @param p_steady_clock - clock used for timeouts. Must outlive this object.
+   * @param p_receive_id - ID of the frames sent by the sender
+   * @param p_transmit_id - ID used to send flow control frames
+   * @param p_buffer - buffer to reassemble messages into. Must outlive this
+   * object.
+   * @param p_settings - protocol settings
+   */
+  iso_tp_receiver(Router& p_router,
+                  hal::steady_clock& p_steady_clock,
+                  can::id_t p_receive_id,
+                  can::id_t p_transmit_id,
+                  std::span<hal::byte> p_buffer,
+                  iso_tp_settings p_settings = {})
+    : m_router(&p_router)
+    , m_steady_clock(&p_steady_clock)
+    , m_buffer(p_buffer)
+    , m_settings(p_settings)
+    , m_transmit_id(p_transmit_id)
+    , m_timeout_ticks(iso_tp::to_ticks(p_steady_clock, p_settings.timeout))
+    , m_route(p_router.add_message_callback(
+        p_receive_id,
+        [this](const can::message_t& p_frame) { receive(p_frame); }))
+  {
+  }
+
+  iso_tp_receiver(iso_tp_receiver& p_other) = delete;
+  iso_tp_receiver& operator=(iso_tp_receiver& p_other) = delete;
+  iso_tp_receiver(iso_tp_receiver&& p_other) = delete;
+  iso_tp_receiver& operator=(iso_tp_receiver&& p_other) = delete;
+
+  /**
+   * @brief Check the progress of the message being received
+   *
+   * @return result<work_state> - finished when a complete message is in the
+   * buffer, failed if reception was aborted (see `error()`), otherwise
+   * in_progress.
+   */
+  result<work_state> operator()()
+  {
+    if (m_state == state::receiving) {
+      const auto now = HAL_CHECK(m_steady_clock->uptime());
+      if (now - m_last_frame_ticks >= m_timeout_ticks) {
+        fail(std::errc::timed_out);
+      }
+    }
+
+    switch (m_state) {
+      case state::finished:
+        return work_state::finished;
+      case state::failed:
+        return work_state::failed;
+      default:
+        return work_state::in_progress;
+    }
+  }
+
+  /**
+   * @brief Get the received message
+   *
+   * @return std::span<hal::byte> - the message if the receiver has finished,
+   * otherwise an empty span.
+   */
+  [[nodiscard]] std::span<hal::byte> data() const
+  {
+    if (m_state != state::finished) {
+      return {};
+    }
+    return m_buffer.first(m_size);
+  }
+
+  /**
+   * @brief Get the reason reception failed
+   *
+   * - std::errc::timed_out - a consecutive frame did not arrive in time
+   * - std::errc::no_buffer_space - the message does not fit in the buffer
+   * - std::errc::bad_message - a consecutive frame arrived out of sequence
+   * - std::errc::io_error - a flow control frame could not be sent
+   *
+   * @return std::errc - reason for failure or std::errc{} if none
+   */
+  [[nodiscard]] std::errc error() const
+  {
+    return m_error;
+  }
+
+  /**
+   * @brief Release the buffer and wait for the next message
+   *
+   */
+  void reset()
+  {
+    m_state = state::idle;
+    m_error = std::errc{};
+    m_size = 0;
+    m_received = 0;
+  }
+
+private:
+  enum class state : std::uint8_t
+  {
+    idle,
+    receiving,
+    finished,
+    failed,
+  };
+
+  void receive(const can::message_t& p_frame)
+  {
+    if (p_frame.length == 0) {
+      return;
+    }
+
+    // The caller owns the buffer until reset() is called
+    if (m_state == state::finished || m_state == state::failed) {
+      return;
+    }
+
+    switch (iso_tp::type_of(p_frame)) {
+      case iso_tp::frame_type::single:
+        receive_single(p_frame);
+        break;
+      case iso_tp::frame_type::first:
+        receive_first(p_frame);
+        break;
+      case iso_tp::frame_type::consecutive:
+        receive_consecutive(p_frame);
+        break;
+      default:
+        break;
+    }
+  }
+
+  void receive_single(const can::message_t& p_frame)
+  {
+    const std::size_t length = p_frame.payload[0] & 0x0F;
+
+    if (length == 0 || length > iso_tp::single_frame_capacity ||
+        length + 1 > p_frame.length) {
+      return;
+    }
+
+    if (length > m_buffer.size()) {
+      fail(std::errc::no_buffer_space);
+      return;
+    }
+
+    auto data = std::span(p_frame.payload).subspan(1, length);
+    std::copy(data.begin(), data.end(), m_buffer.begin());
+    m_size = length;
+    m_received = length;
+    m_state = state::finished;
+  }
+
+  void receive_first(const can::message_t& p_frame)
+  {
+    if (p_frame.length < 8) {
+      return;
+    }
+
+    const std::size_t length =
+      ((p_frame.payload[0] & 0x0FU) << 8) | p_frame.payload[1];
+
+    // Messages that fit in a single frame must not be sent as a first frame
+    if (length <= iso_tp::single_frame_capacity) {
+      return;
+    }
+
+    if (length > m_buffer.size()) {
+      send_flow_control(iso_tp::flow_status::overflow);
+      fail(std::errc::no_buffer_space);
+      return;
+    }
+
+    auto data = std::span(p_frame.payload)
+                  .subspan(2, iso_tp::first_frame_capacity);
+    std::copy(data.begin(), data.end(), m_buffer.begin());
+    m_size = length;
+    m_received = data.size();
+    m_sequence = 1;
+    m_block_count = 0;
+    m_state = state::receiving;
+    record_frame_time();
+    send_flow_control(iso_tp::flow_status::clear_to_send);
+  }
+
+  void receive_consecutive(const can::message_t& p_frame)
+  {
+    if (m_state != state::receiving) {
+      return;
+    }
+
+    if ((p_frame.payload[0] & 0x0F) != m_sequence) {
+      fail(std::errc::bad_message);
+      return;
+    }
+
+    const std::size_t available = p_frame.length - 1U;
+    const auto length = std::min(
+      { iso_tp::consecutive_frame_capacity, available, m_size - m_received });
+    auto data = std::span(p_frame.payload).subspan(1, length);
+    std::copy(data.begin(), data.end(), m_buffer.begin() + m_received);
+    m_received += length;
+    m_sequence = (m_sequence + 1) & 0x0F;
+    record_frame_time();
+
+    if (m_received == m_size) {
+      m_state = state::finished;
+      return;
+    }
+
+    if (m_settings.block_size != 0 &&
+        ++m_block_count == m_settings.block_size) {
+      m_block_count = 0;
+      send_flow_control(iso_tp::flow_status::clear_to_send);
+    }
+  }
+
+  void send_flow_control(iso_tp::flow_status p_status)
+  {
+    const std::array<hal::byte, 3> header{
+      static_cast<hal::byte>(
+        (static_cast<std::uint8_t>(iso_tp::frame_type::flow_control) << 4) |
+        static_cast<std::uint8_t>(p_status)),
+      m_settings.block_size,
+      iso_tp_encode_separation_time(m_settings.separation_time),
+    };
+
+    auto frame = iso_tp::make_frame(
+      m_transmit_id, header, std::span<const hal::byte>{}, m_settings.padding);
+
+    if (!m_router->bus().send(frame)) {
+      fail(std::errc::io_error);
+    }
+  }
+
+  void record_frame_time()
+  {
+    // If the clock fails, keep the previous time. The worker will report the
+    // clock's error when it checks for timeouts.
+    if (auto uptime = m_steady_clock->uptime(); uptime) {
+      m_last_frame_ticks = uptime.value();
+    }
+  }
+
+  void fail(std::errc p_error)
+  {
+    m_error = p_error;
+    m_state = state::failed;
+  }
+
+  Router* m_router;
+  hal::steady_clock* m_steady_clock;
+  std::span<hal::byte> m_buffer;
+  iso_tp_settings m_settings;
+  can::id_t m_transmit_id;
+  std::uint64_t m_timeout_ticks;
+  std::uint64_t m_last_frame_ticks = 0;
+  std::size_t m_size = 0;
+  std::size_t m_received = 0;
+  std::uint8_t m_sequence = 0;
+  std::uint8_t m_block_count = 0;
+  state m_state = state::idle;
+  std::errc m_error{};
+  typename Router::route_item m_route;
+};
+
+/**
+ * @brief Send ISO-TP (ISO 15765-2) messages from a caller provided buffer
+ *
+ * Registers a route for the receiver's flow control ID with a can router.
+ * Messages of up to 7 bytes are sent as a single frame. Larger messages are
+ * sent as a first frame followed by consecutive frames, which are paced by
+ * the block size and separation time requested by the receiver's flow control
+ * frames. Data is read directly from the caller's buffer.
+ *
+ * After calling `send()`, call the sender as a worker until it reaches a
+ * terminal state. The worker sends consecutive frames once the receiver allows
+ * them and their separation time has passed, and it never blocks.
+ *
+ * The route handler and the worker must not preempt each other. See
+ * `iso_tp_receiver` for details.
+ *
+ * @tparam Router - can router type such as `hal::can_router`
+ */
+template<class Router>
+class iso_tp_sender
+{
+public:
+  /**
+   * @brief Construct a new iso tp sender
+   *
+   * @param p_router - router to send frames through and receive flow control
+   * frames from. Must outlive this object.
+   * @param p_steady_clock - clock used for timeouts and separation time. Must
+   * outlive this object.
+   * @param p_transmit_id - ID used to send data frames
+   * @param p_receive_id - ID of the flow control frames sent by the receiver
+   * @param p_settings - protocol settings
+   */
+  iso_tp_sender(Router& p_router,
+                hal::steady_clock& p_steady_clock,
+                can::id_t p_transmit_id,
+                can::id_t p_receive_id,
+                iso_tp_settings p_settings = {})
+    : m_router(&p_router)
+    , m_steady_clock(&p_steady_clock)
+    , m_settings(p_settings)
+    , m_transmit_id(p_transmit_id)
+    , m_timeout_ticks(iso_tp::to_ticks(p_steady_clock, p_settings.timeout))
+    , m_route(p_router.add_message_callback(
+        p_receive_id,
+        [this](const can::message_t& p_frame) { receive(p_frame); }))
+  {
+  }
+
+  iso_tp_sender(iso_tp_sender& p_other) = delete;
+  iso_tp_sender& operator=(iso_tp_sender& p_other) = delete;
+  iso_tp_sender(iso_tp_sender&& p_other) = delete;
+  iso_tp_sender& operator=(iso_tp_sender&& p_other) = delete;
+
+  /**
+   * @brief Start sending a message
+   *
+   * @param p_data - message to send. Must not be modified until the sender
+   * reaches a terminal state.
+   * @return status - success or failure
+   * @throws std::errc::device_or_resource_busy - if a message is being sent
+   * @throws std::errc::message_size - if the message is empty or larger than
+   * 4095 bytes
+   */
+  [[nodiscard]] status send(std::span<const hal::byte> p_data)
+  {
+    if (m_state == state::wait_for_flow_control || m_state == state::sending) {
+      return hal::new_error(std::errc::device_or_resource_busy);
+    }
+
+    if (p_data.empty() || p_data.size() > iso_tp::max_payload) {
+      return hal::new_error(std::errc::message_size);
+    }
+
+    m_data = p_data;
+    m_error = std::errc{};
+
+    if (p_data.size() <= iso_tp::single_frame_capacity) {
+      const std::array<hal::byte, 1> header{ static_cast<hal::byte>(
+        p_data.size()) };
+      HAL_CHECK(transmit(header, p_data));
+      m_sent = p_data.size();
+      m_state = state::finished;
+      return success();
+    }
+
+    const std::array<hal::byte, 2> header{
+      static_cast<hal::byte>(
+        (static_cast<std::uint8_t>(iso_tp::frame_type::first) << 4) |
+        (p_data.size() >> 8)),
+      static_cast<hal::byte>(p_data.size() & 0xFF),
+    };
+    auto data = p_data.first(iso_tp::first_frame_capacity);
+    HAL_CHECK(transmit(header, data));
+
+    m_sent = data.size();
+    m_sequence = 1;
+    HAL_CHECK(wait_for_flow_control());
+    return success();
+  }
+
+  /**
+   * @brief Send consecutive frames that are due
+   *
+   * @return result<work_state> - finished once the whole message has been
+   * sent, failed if the transfer was aborted (see `error()`), otherwise
+   * in_progress. Errors from the bus or clock are returned as is.
+   */
+  result<work_state> operator()()
+  {
+    while (true) {
+      switch (m_state) {
+        case state::idle:
+        case state::finished:
+          return work_state::finished;
+        case state::failed:
+          return work_state::failed;
+        case state::wait_for_flow_control: {
+          const auto now = HAL_CHECK(m_steady_clock->uptime());
+          if (now >= m_deadline_ticks) {
+            fail(std::errc::timed_out);
+            return work_state::failed;
+          }
+          return work_state::in_progress;
+        }
+        case state::sending:
+          break;
+      }
+
+      const auto now = HAL_CHECK(m_steady_clock->uptime());
+      if (now < m_next_frame_ticks) {
+        return work_state::in_progress;
+      }
+
+      const std::array<hal::byte, 1> header{ static_cast<hal::byte>(
+        (static_cast<std::uint8_t>(iso_tp::frame_type::consecutive) << 4) |
+        m_sequence) };
+      auto data = m_data.subspan(m_sent).first(
+        std::min(iso_tp::consecutive_frame_capacity, m_data.size() - m_sent));
+      HAL_CHECK(transmit(header, data));
+
+      m_sent += data.size();
+      m_sequence = (m_sequence + 1) & 0x0F;
+      m_next_frame_ticks = now + m_separation_ticks;
+
+      if (m_sent == m_data.size()) {
+        m_state = state::finished;
+        continue;
+      }
+
+      if (m_block_size != 0 && --m_block_remaining == 0) {
+        HAL_CHECK(wait_for_flow_control());
+      }
+    }
+  }
+
+  /**
+   * @brief Get the reason the transfer failed
+   *
+   * - std::errc::timed_out - a flow control frame did not arrive in time
+   * - std::errc::no_buffer_space - the receiver reported an overflow
+   * - std::errc::bad_message - an invalid flow control frame was received
+   *
+   * @return std::errc - reason for failure or std::errc{} if none
+   */
+  [[nodiscard]] std::errc error() const
+  {
+    return m_error;
+  }
+
+private:
+  enum class state : std::uint8_t
+  {
+    idle,
+    wait_for_flow_control,
+    sending,
+    finished,
+    failed,
+  };
+
+  void receive(const can::message_t& p_frame)
+  {
+    if (m_state != state::wait_for_flow_control || p_frame.length < 3 ||
+        iso_tp::type_of(p_frame) != iso_tp::frame_type::flow_control) {
+      return;
+    }
+
+    switch (static_cast<iso_tp::flow_status>(p_frame.payload[0] & 0x0F)) {
+      case iso_tp::flow_status::clear_to_send: {
+        const auto separation_time =
+          iso_tp_decode_separation_time(p_frame.payload[2]);
+        m_block_size = p_frame.payload[1];
+        m_block_remaining = m_block_size;
+        m_separation_ticks =
+          iso_tp::to_ticks(*m_steady_clock, separation_time);
+        m_next_frame_ticks = 0;
+        m_state = state::sending;
+        break;
+      }
+      case iso_tp::flow_status::wait:
+        // Restart the timeout, the receiver needs more time
+        (void)wait_for_flow_control();
+        break;
+      case iso_tp::flow_status::overflow:
+        fail(std::errc::no_buffer_space);
+        break;
+      default:
+        fail(std::errc::bad_message);
+        break;
+    }
+  }
+
+  status wait_for_flow_control()
+  {
+    m_state = state::wait_for_flow_control;
+    m_deadline_ticks = HAL_CHECK(m_steady_clock->uptime()) + m_timeout_ticks;
+    return success();
+  }
+
+  status transmit(std::span<const hal::byte> p_header,
+                  std::span<const hal::byte> p_data)
+  {
+    return m_router->bus().send(
+      iso_tp::make_frame(m_transmit_id, p_header, p_data, m_settings.padding));
+  }
+
+  void fail(std::errc p_error)
+  {
+    m_error = p_error;
+    m_state = state::failed;
+  }
+
+  Router* m_router;
+  hal::steady_clock* m_steady_clock;
+  iso_tp_settings m_settings;
+  can::id_t m_transmit_id;
+  std::uint64_t m_timeout_ticks;
+  std::uint64_t m_deadline_ticks = 0;
+  std::uint64_t m_separation_ticks = 0;
+  std::uint64_t m_next_frame_ticks = 0;
+  std::span<const hal::byte> m_data{};
+  std::size_t m_sent = 0;
+  std::uint8_t m_sequence = 0;
+  std::uint8_t m_block_size = 0;
+  std::uint8_t m_block_remaining = 0;
+  state m_state = state::idle;
+  std::errc m_error{};
+  typename Router::route_item m_route;
+};
+}  // namespace hal
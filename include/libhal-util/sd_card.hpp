@@ -0,0 +1,660 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <system_error>
+
+#include <libhal/error.hpp>
+#include <libhal/output_pin.hpp>
+#include <libhal/spi.hpp>
+#include <libhal/steady_clock.hpp>
+#include <libhal/timeout.hpp>
+
+#include "spi.hpp"
+#include "steady_clock.hpp"
+#include "timeout.hpp"
+
+namespace hal {
+namespace sd {
+/// CRC7 lookup table for the polynomial x^7 + x^3 + 1, shifted left by one
+inline constexpr std::array<hal::byte, 256> crc7_table = []() {
+  std::array<hal::byte, 256> table{};
+  for (std::size_t i = 0; i < table.size(); i++) {
+    auto crc = static_cast<hal::byte>(i);
+    for (int bit = 0; bit < 8; bit++) {
+      crc = static_cast<hal::byte>((crc & 0x80) ? (crc << 1) ^ (0x09 << 1)
+                                                : (crc << 1));
+    }
+    table[i] = crc;
+  }
+  return table;
+}();
+
+/// CRC16 lookup table for the CCITT polynomial x^16 + x^12 + x^5 + 1
+inline constexpr std::array<std::uint16_t, 256> crc16_table = []() {
+  std::array<std::uint16_t, 256> table{};
+  for (std::size_t i = 0; i < table.size(); i++) {
+    auto crc = static_cast<std::uint16_t>(i << 8);
+    for (int bit = 0; bit < 8; bit++) {
+      crc = static_cast<std::uint16_t>((crc & 0x8000) ? (crc << 1) ^ 0x1021
+                                                      : (crc << 1));
+    }
+    table[i] = crc;
+  }
+  return table;
+}();
+
+/**
+ * @brief Compute the CRC7 of an SD card command
+ *
+ * @param p_data - bytes to compute the CRC of
+ * @return constexpr hal::byte - 7-bit CRC in the lower 7 bits
+ */
+[[nodiscard]] constexpr hal::byte crc7(std::span<const hal::byte> p_data)
+{
+  hal::byte crc = 0;
+  for (const auto byte : p_data) {
+    crc = crc7_table[crc ^ byte];
+  }
+  return crc >> 1;
+}
+
+/**
+ * @brief Compute the CRC16 of an SD card data block
+ *
+ * @param p_data - bytes to compute the CRC of
+ * @return constexpr std::uint16_t - 16-bit CRC
+ */
+[[nodiscard]] constexpr std::uint16_t crc16(std::span<const hal::byte> p_data)
+{
+  std::uint16_t crc = 0;
+  for (const auto byte : p_data) {
+    crc = static_cast<std::uint16_t>((crc << 8) ^
+                                     crc16_table[(crc >> 8) ^ byte]);
+  }
+  return crc;
+}
+}  // namespace sd
+
+/**
+ * @brief Number of commands and blocks transferred by an sd_card
+ *
+ */
+struct sd_card_statistics
+{
+  /// Number of commands sent, counting both halves of application commands
+  std::uint32_t commands = 0;
+  /// Number of blocks read
+  std::uint32_t blocks_read = 0;
+  /// Number of blocks accepted by the card
+  std::uint32_t blocks_written = 0;
+  /// Number of blocks that failed a CRC check, in either direction
+  std::uint32_t crc_errors = 0;
+};
+
+/**
+ * @brief SD card block device over spi
+ *
+ * Reads and writes 512 byte blocks. Transfers of more than one block use the
+ * multiple block commands (CMD18 and CMD25), so the card streams blocks
+ * without a command per block, and multiple block writes tell the card how
+ * many blocks to pre-erase (ACMD23). CRC checking is enabled on the card and
+ * every data block is checked against its CRC16.
+ *
+ * Writes can also be streamed one block at a time with `begin_write()`,
+ * `write_next()` and `end_write()`. After each block the card is busy
+ * programming it. Rather than blocking, the caller can poll `busy()`, a
+ * worker compatible with `hal::try_until`, and do other work until the card is
+ * ready for the next block:
+ *
+ *     auto card = HAL_CHECK(hal::sd_card::create(spi, cs, steady_clock));
+ *     HAL_CHECK(card.begin_write(log_block, 64));
+ *     for (auto& block : blocks) {
+ *       auto busy = card.busy();
+ *       while (HAL_CHECK(busy()) == hal::work_state::in_progress) {
+ *         collect_samples();
+ *       }
+ *       HAL_CHECK(card.write_next(block));
+ *     }
+ *     HAL_CHECK(card.end_write());
+ *
+ * The spi bus must be configured at 400kHz or less before calling `create()`
+ * and may be configured for the card's full speed afterwards. The card holds
+ * the bus between `begin_write()` and `end_write()`.
+ */
+class sd_card
+{
+public:
+  /// Number of bytes in a block
+  static constexpr std::size_t block_size = 512;
+
+  /**
+   * @brief Worker that reports whether the card is still busy
+   *
+   * Reads one byte from the card each time it is called. The card holds its
+   * data out line low while it is busy.
+   */
+  class busy_worker
+  {
+  public:
+    /**
+     * @brief Construct a new busy worker
+     *
+     * @param p_spi - spi bus the card is on
+     */
+    explicit busy_worker(hal::spi& p_spi)
+      : m_spi(&p_spi)
+    {
+    }
+
+    /**
+     * @brief Check if the card is still busy
+     *
+     * @return result<work_state> - finished once the card is ready,
+     * otherwise in_progress
+     */
+    result<work_state> operator()()
+    {
+      const auto response = HAL_CHECK(hal::read<1>(*m_spi));
+      if (response[0] == 0xFF) {
+        return work_state::finished;
+      }
+      return work_state::in_progress;
+    }
+
+  private:
+    hal::spi* m_spi;
+  };
+
+  /**
+   * @brief Initialize an SD card and create a block device for it
+   *
+   * Puts the card into spi mode, enables CRC checking and waits for the card
+   * to finish its initialization.
+   *
+   * @param p_spi - spi bus the card is on. Must outlive this object.
+   * @param p_chip_select - active low chip select of the card. Must outlive
+   * this object.
+   * @param p_steady_clock - clock used for timeouts. Must outlive this object.
+   * @return result<sd_card> - the card
+   * @throws std::errc::no_such_device - no card responded
+   * @throws std::errc::not_supported - the card does not support the host's
+   * voltage range
+   * @throws std::errc::timed_out - the card did not finish its initialization
+   * within one second
+   */
+  [[nodiscard]] static result<sd_card> create(hal::spi& p_spi,
+                                              hal::output_pin& p_chip_select,
+                                              hal::steady_clock& p_steady_clock)
+  {
+    sd_card card(p_spi, p_chip_select, p_steady_clock);
+    // At least 74 clock cycles with chip select high to wake the card
+    HAL_CHECK(p_chip_select.level(true));
+    std::array<hal::byte, 10> wake{};
+    wake.fill(0xFF);
+    HAL_CHECK(hal::write(p_spi, wake));
+    HAL_CHECK(card.with_card_selected([&card]() { return card.initialize(); }));
+    return card;
+  }
+
+  /**
+   * @brief Determine if the card is block addressed
+   *
+   * @return true - the card is SDHC or SDXC
+   * @return false - the card is SDSC
+   */
+  [[nodiscard]] bool high_capacity() const
+  {
+    return m_high_capacity;
+  }
+
+  /**
+   * @brief Get the number of commands and blocks transferred
+   *
+   * @return const sd_card_statistics& - statistics of the card
+   */
+  [[nodiscard]] const sd_card_statistics& statistics() const
+  {
+    return m_statistics;
+  }
+
+  /**
+   * @brief Read one or more consecutive blocks
+   *
+   * @param p_block - first block to read
+   * @param p_data - buffer to read into, a multiple of block_size bytes
+   * @return status - success or failure
+   * @throws std::errc::invalid_argument - p_data is not a multiple of
+   * block_size bytes or the blocks are beyond the end of the card
+   * @throws std::errc::io_error - a block failed its CRC check or the card
+   * reported an error
+   * @throws std::errc::device_or_resource_busy - a streamed write is in
+   * progress
+   */
+  [[nodiscard]] status read(std::uint32_t p_block, std::span<hal::byte> p_data)
+  {
+    HAL_CHECK(check_transfer(p_data.size()));
+    return with_card_selected([this, p_block, p_data]() -> status {
+      if (p_data.size() == block_size) {
+        HAL_CHECK(checked_command(read_single_block, address(p_block)));
+        return receive_block(p_data);
+      }
+
+      HAL_CHECK(checked_command(read_multiple_block, address(p_block)));
+      auto received = [this, p_data]() -> status {
+        for (std::size_t i = 0; i < p_data.size(); i += block_size) {
+          HAL_CHECK(receive_block(p_data.subspan(i, block_size)));
+        }
+        return success();
+      }();
+      // Stop the transmission even if a block failed
+      auto stopped = [this]() -> status {
+        HAL_CHECK(checked_command(stop_transmission, 0));
+        return wait_while_busy();
+      }();
+      if (!received) {
+        return received;
+      }
+      return stopped;
+    });
+  }
+
+  /**
+   * @brief Write one or more consecutive blocks
+   *
+   * Multiple blocks are written with a single multiple block write, after
+   * telling the card how many blocks to pre-erase.
+   *
+   * @param p_block - first block to write
+   * @param p_data - bytes to write, a multiple of block_size bytes
+   * @return status - success or failure
+   * @throws std::errc::invalid_argument - p_data is not a multiple of
+   * block_size bytes or the blocks are beyond the end of the card
+   * @throws std::errc::io_error - a block was rejected by the card
+   * @throws std::errc::timed_out - the card stayed busy for too long
+   * @throws std::errc::device_or_resource_busy - a streamed write is in
+   * progress
+   */
+  [[nodiscard]] status write(std::uint32_t p_block,
+                             std::span<const hal::byte> p_data)
+  {
+    HAL_CHECK(check_transfer(p_data.size()));
+    if (p_data.size() == block_size) {
+      return with_card_selected([this, p_block, p_data]() -> status {
+        HAL_CHECK(checked_command(write_single_block, address(p_block)));
+        HAL_CHECK(send_block(start_block_token, p_data));
+        return wait_while_busy();
+      });
+    }
+
+    const auto blocks = static_cast<std::uint32_t>(p_data.size() / block_size);
+    HAL_CHECK(begin_write(p_block, blocks));
+    auto written = [this, p_data]() -> status {
+      for (std::size_t i = 0; i < p_data.size(); i += block_size) {
+        HAL_CHECK(write_next(p_data.subspan(i, block_size)));
+      }
+      return success();
+    }();
+    auto ended = end_write();
+    if (!written) {
+      return written;
+    }
+    return ended;
+  }
+
+  /**
+   * @brief Begin a multiple block write that is streamed with `write_next()`
+   *
+   * Chip select stays active until `end_write()`.
+   *
+   * @param p_block - first block to write
+   * @param p_pre_erase_blocks - number of blocks expected to be written, used
+   * by the card to pre-erase them. 0 to skip the hint.
+   * @return status - success or failure
+   * @throws std::errc::device_or_resource_busy - a streamed write is already
+   * in progress
+   */
+  [[nodiscard]] status begin_write(std::uint32_t p_block,
+                                   std::uint32_t p_pre_erase_blocks = 0)
+  {
+    if (m_writing) {
+      return hal::new_error(std::errc::device_or_resource_busy);
+    }
+    HAL_CHECK(m_chip_select->level(false));
+    auto started = [this, p_block, p_pre_erase_blocks]() -> status {
+      if (p_pre_erase_blocks > 0) {
+        const auto r1 = HAL_CHECK(app_command(set_write_block_erase_count,
+                                              p_pre_erase_blocks & 0x7F'FFFF));
+        HAL_CHECK(check(r1));
+      }
+      return checked_command(write_multiple_block, address(p_block));
+    }();
+    if (!started) {
+      (void)release();
+      return started;
+    }
+    m_writing = true;
+    return success();
+  }
+
+  /**
+   * @brief Write the next block of a streamed write
+   *
+   * Waits for the card to finish programming the previous block, then sends
+   * this block and returns once the card has accepted it. The card is then
+   * busy programming the block, see `busy()`.
+   *
+   * @param p_block - block_size bytes to write
+   * @return status - success or failure. After a failure, call `end_write()`.
+   * @throws std::errc::invalid_argument - p_block is not block_size bytes
+   * @throws std::errc::operation_not_permitted - no streamed write is in
+   * progress
+   * @throws std::errc::io_error - the block was rejected by the card
+   * @throws std::errc::timed_out - the card stayed busy for too long
+   */
+  [[nodiscard]] status write_next(std::span<const hal::byte> p_block)
+  {
+    if (!m_writing) {
+      return hal::new_error(std::errc::operation_not_permitted);
+    }
+    if (p_block.size() != block_size) {
+      return hal::new_error(std::errc::invalid_argument);
+    }
+    HAL_CHECK(wait_while_busy());
+    return send_block(write_multiple_token, p_block);
+  }
+
+  /**
+   * @brief End a streamed write
+   *
+   * Waits for the last block to be programmed and releases chip select. Does
+   * nothing if no streamed write is in progress.
+   *
+   * @return status - success or failure
+   * @throws std::errc::timed_out - the card stayed busy for too long
+   */
+  [[nodiscard]] status end_write()
+  {
+    if (!m_writing) {
+      return success();
+    }
+    m_writing = false;
+    auto ended = [this]() -> status {
+      HAL_CHECK(wait_while_busy());
+      const std::array<hal::byte, 2> stop{ stop_transmission_token, 0xFF };
+      HAL_CHECK(hal::write(*m_spi, stop));
+      return wait_while_busy();
+    }();
+    auto released = release();
+    if (!ended) {
+      return ended;
+    }
+    return released;
+  }
+
+  /**
+   * @brief Get a worker that reports whether the card is busy programming
+   *
+   * Only meaningful between `write_next()` calls. Compatible with
+   * `hal::try_until`.
+   *
+   * @return busy_worker - worker for the card
+   */
+  [[nodiscard]] busy_worker busy()
+  {
+    return busy_worker(*m_spi);
+  }
+
+private:
+  static constexpr hal::byte go_idle_state = 0;
+  static constexpr hal::byte send_if_cond = 8;
+  static constexpr hal::byte stop_transmission = 12;
+  static constexpr hal::byte set_blocklen = 16;
+  static constexpr hal::byte read_single_block = 17;
+  static constexpr hal::byte read_multiple_block = 18;
+  static constexpr hal::byte set_write_block_erase_count = 23;
+  static constexpr hal::byte write_single_block = 24;
+  static constexpr hal::byte write_multiple_block = 25;
+  static constexpr hal::byte sd_send_op_cond = 41;
+  static constexpr hal::byte app_cmd = 55;
+  static constexpr hal::byte read_ocr = 58;
+  static constexpr hal::byte crc_on_off = 59;
+
+  static constexpr hal::byte start_block_token = 0xFE;
+  static constexpr hal::byte write_multiple_token = 0xFC;
+  static constexpr hal::byte stop_transmission_token = 0xFD;
+
+  static constexpr hal::byte r1_idle = 1 << 0;
+  static constexpr hal::byte r1_illegal_command = 1 << 2;
+  static constexpr hal::byte r1_crc_error = 1 << 3;
+  static constexpr hal::byte r1_address_error = 1 << 5;
+  static constexpr hal::byte r1_parameter_error = 1 << 6;
+
+  /// Number of bytes the card may take to respond to a command
+  static constexpr std::size_t max_response_delay = 8;
+
+  static constexpr auto initialization_timeout = std::chrono::seconds(1);
+  static constexpr auto read_timeout = std::chrono::milliseconds(100);
+  static constexpr auto write_timeout = std::chrono::milliseconds(500);
+
+  sd_card(hal::spi& p_spi,
+          hal::output_pin& p_chip_select,
+          hal::steady_clock& p_steady_clock)
+    : m_spi(&p_spi)
+    , m_chip_select(&p_chip_select)
+    , m_steady_clock(&p_steady_clock)
+  {
+  }
+
+  status initialize()
+  {
+    auto r1 = HAL_CHECK(command(go_idle_state, 0));
+    if (r1 != r1_idle) {
+      return hal::new_error(std::errc::no_such_device);
+    }
+
+    // Version 1 cards do not recognize CMD8
+    std::array<hal::byte, 4> r7{};
+    r1 = HAL_CHECK(command(send_if_cond, 0x1AA, r7));
+    const bool version_2 = !(r1 & r1_illegal_command);
+    if (version_2 && ((r7[2] & 0x0F) != 0x01 || r7[3] != 0xAA)) {
+      return hal::new_error(std::errc::not_supported);
+    }
+
+    HAL_CHECK(checked_command(crc_on_off, 1));
+
+    auto timeout =
+      HAL_CHECK(create_timeout(*m_steady_clock, initialization_timeout));
+    const std::uint32_t host_capacity_support = version_2 ? 1UL << 30 : 0;
+    while (true) {
+      r1 = HAL_CHECK(app_command(sd_send_op_cond, host_capacity_support));
+      HAL_CHECK(check(r1));
+      if (r1 == 0) {
+        break;
+      }
+      HAL_CHECK(timeout());
+    }
+
+    if (version_2) {
+      std::array<hal::byte, 4> ocr{};
+      r1 = HAL_CHECK(command(read_ocr, 0, ocr));
+      HAL_CHECK(check(r1));
+      m_high_capacity = ocr[0] & 0x40;
+    }
+    if (!m_high_capacity) {
+      HAL_CHECK(checked_command(set_blocklen, block_size));
+    }
+    return success();
+  }
+
+  template<class Operation>
+  status with_card_selected(Operation&& p_operation)
+  {
+    if (m_writing) {
+      return hal::new_error(std::errc::device_or_resource_busy);
+    }
+    HAL_CHECK(m_chip_select->level(false));
+    status performed = p_operation();
+    auto released = release();
+    if (!performed) {
+      return performed;
+    }
+    return released;
+  }
+
+  status release()
+  {
+    HAL_CHECK(m_chip_select->level(true));
+    // One more byte lets the card release its data out line
+    const std::array<hal::byte, 1> idle{ 0xFF };
+    return hal::write(*m_spi, idle);
+  }
+
+  status check_transfer(std::size_t p_size) const
+  {
+    if (p_size == 0 || p_size % block_size != 0) {
+      return hal::new_error(std::errc::invalid_argument);
+    }
+    return success();
+  }
+
+  std::uint32_t address(std::uint32_t p_block) const
+  {
+    return m_high_capacity ? p_block : p_block * block_size;
+  }
+
+  static status check(hal::byte p_r1)
+  {
+    if (p_r1 & r1_illegal_command) {
+      return hal::new_error(std::errc::not_supported);
+    }
+    if (p_r1 & (r1_address_error | r1_parameter_error)) {
+      return hal::new_error(std::errc::invalid_argument);
+    }
+    if (p_r1 & ~r1_idle) {
+      return hal::new_error(std::errc::io_error);
+    }
+    return success();
+  }
+
+  result<hal::byte> command(hal::byte p_index,
+                            std::uint32_t p_argument,
+                            std::span<hal::byte> p_trailing = {})
+  {
+    std::array<hal::byte, 6> frame{
+      static_cast<hal::byte>(0x40 | p_index),
+      static_cast<hal::byte>(p_argument >> 24),
+      static_cast<hal::byte>(p_argument >> 16),
+      static_cast<hal::byte>(p_argument >> 8),
+      static_cast<hal::byte>(p_argument),
+    };
+    const auto crc = sd::crc7(std::span(frame).first(5));
+    frame[5] = static_cast<hal::byte>(crc << 1 | 1);
+    m_statistics.commands++;
+    HAL_CHECK(hal::write(*m_spi, frame));
+
+    if (p_index == stop_transmission) {
+      // Skip the stuff byte that follows CMD12
+      HAL_CHECK(hal::read<1>(*m_spi));
+    }
+
+    hal::byte r1 = 0xFF;
+    for (std::size_t i = 0; i < max_response_delay && (r1 & 0x80); i++) {
+      const auto response = HAL_CHECK(hal::read<1>(*m_spi));
+      r1 = response[0];
+    }
+    if (r1 & 0x80) {
+      return hal::new_error(std::errc::no_such_device);
+    }
+    if (!p_trailing.empty()) {
+      HAL_CHECK(hal::read(*m_spi, p_trailing));
+    }
+    return r1;
+  }
+
+  status checked_command(hal::byte p_index, std::uint32_t p_argument)
+  {
+    const auto r1 = HAL_CHECK(command(p_index, p_argument));
+    return check(r1);
+  }
+
+  result<hal::byte> app_command(hal::byte p_index, std::uint32_t p_argument)
+  {
+    HAL_CHECK(checked_command(app_cmd, 0));
+    return command(p_index, p_argument);
+  }
+
+  status wait_while_busy()
+  {
+    auto timeout = HAL_CHECK(create_timeout(*m_steady_clock, write_timeout));
+    HAL_CHECK(try_until(busy(), timeout));
+    return success();
+  }
+
+  status receive_block(std::span<hal::byte> p_block)
+  {
+    auto timeout = HAL_CHECK(create_timeout(*m_steady_clock, read_timeout));
+    hal::byte token = 0xFF;
+    while (token == 0xFF) {
+      const auto response = HAL_CHECK(hal::read<1>(*m_spi));
+      token = response[0];
+      if (token == 0xFF) {
+        HAL_CHECK(timeout());
+      }
+    }
+    if (token != start_block_token) {
+      return hal::new_error(std::errc::io_error);
+    }
+
+    std::array<hal::byte, 2> crc{};
+    HAL_CHECK(segmented_transfer(
+      *m_spi, std::array{ spi_read(p_block), spi_read(crc) }));
+    const auto expected = sd::crc16(p_block);
+    if (crc[0] != (expected >> 8) || crc[1] != (expected & 0xFF)) {
+      m_statistics.crc_errors++;
+      return hal::new_error(std::errc::io_error);
+    }
+    m_statistics.blocks_read++;
+    return success();
+  }
+
+  status send_block(hal::byte p_token, std::span<const hal::byte> p_block)
+  {
+    const auto crc = sd::crc16(p_block);
+    // At least one byte must separate the token from the previous response
+    const std::array<hal::byte, 2> start{ 0xFF, p_token };
+    const std::array<hal::byte, 2> crc_bytes{
+      static_cast<hal::byte>(crc >> 8),
+      static_cast<hal::byte>(crc),
+    };
+    const std::array segments{
+      spi_write(start),
+      spi_write(p_block),
+      spi_write(crc_bytes),
+    };
+    HAL_CHECK(segmented_transfer(*m_spi, segments));
+
+    const auto response = HAL_CHECK(hal::read<1>(*m_spi));
+    switch (response[0] & 0x1F) {
+      case 0x05:
+        m_statistics.blocks_written++;
+        return success();
+      case 0x0B:
+        m_statistics.crc_errors++;
+        return hal::new_error(std::errc::io_error);
+      default:
+        return hal::new_error(std::errc::io_error);
+    }
+  }
+
+  hal::spi* m_spi;
+  hal::output_pin* m_chip_select;
+  hal::steady_clock* m_steady_clock;
+  sd_card_statistics m_statistics{};
+  bool m_high_capacity = false;
+  bool m_writing = false;
+};
+}  // namespace hal
@@ -1,8 +1,12 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <cstddef>
 #include <span>
 
 #include <libhal/error.hpp>
+#include <libhal/output_pin.hpp>
 #include <libhal/spi.hpp>
 #include <libhal/units.hpp>
 
@@ -120,4 +124,212 @@ template<size_t BytesToRead>
   HAL_CHECK(write(p_spi, p_data_out));
   return read<BytesToRead>(p_spi, p_filler);
 }
+
+/**
+ * @brief A portion of a chip select framed spi transaction
+ *
+ * A segment clocks max(data_out.size(), data_in.size()) bytes, or dummy_bytes
+ * bytes if it is a dummy segment. Bytes past the end of data_out are sent as
+ * the filler. See `spi_write()`, `spi_read()`, `spi_full_duplex()` and
+ * `spi_dummy()`.
+ */
+struct spi_segment
+{
+  /// Bytes to write to the peripheral
+  std::span<const hal::byte> data_out{};
+  /// Buffer to read bytes into from the peripheral
+  std::span<hal::byte> data_in{};
+  /// Byte sent once data_out has been exhausted
+  hal::byte filler = spi::default_filler;
+  /// Number of bytes clocked with nothing written or read, such as the dummy
+  /// cycles between a flash memory's fast read command and its data
+  std::size_t dummy_bytes = 0;
+};
+
+/**
+ * @brief Make a write segment that ignores the read line
+ *
+ * @param p_data_out - bytes to write to the peripheral
+ * @return constexpr spi_segment - write segment
+ */
+[[nodiscard]] constexpr spi_segment spi_write(
+  std::span<const hal::byte> p_data_out)
+{
+  return { .data_out = p_data_out };
+}
+
+/**
+ * @brief Make a read segment that places filler bytes on the write line
+ *
+ * @param p_data_in - buffer to read bytes into from the peripheral
+ * @param p_filler - byte placed on the write line while reading
+ * @return constexpr spi_segment - read segment
+ */
+[[nodiscard]] constexpr spi_segment spi_read(
+  std::span<hal::byte> p_data_in,
+  hal::byte p_filler = spi::default_filler)
+{
+  return { .data_in = p_data_in, .filler = p_filler };
+}
+
+/**
+ * @brief Make a segment that writes and reads at the same time
+ *
+ * @param p_data_out - bytes to write to the peripheral
+ * @param p_data_in - buffer to read bytes into from the peripheral
+ * @param p_filler - byte sent if p_data_in is longer than p_data_out
+ * @return constexpr spi_segment - full duplex segment
+ */
+[[nodiscard]] constexpr spi_segment spi_full_duplex(
+  std::span<const hal::byte> p_data_out,
+  std::span<hal::byte> p_data_in,
+  hal::byte p_filler = spi::default_filler)
+{
+  return { .data_out = p_data_out, .data_in = p_data_in, .filler = p_filler };
+}
+
+/**
+ * @brief Make a segment of dummy cycles
+ *
+ * The write line holds spi::default_filler and the read line is ignored.
+ *
+ * @param p_bytes - number of bytes worth of clock cycles
+ * @return constexpr spi_segment - dummy segment
+ */
+[[nodiscard]] constexpr spi_segment spi_dummy(std::size_t p_bytes)
+{
+  return { .dummy_bytes = p_bytes };
+}
+
+/**
+ * @brief Perform a list of segments with as few transfers as possible
+ *
+ * Each segment is transferred directly to and from the caller's buffers, thus
+ * no staging buffer or copy is needed. Neighbouring segments are joined into
+ * a single `spi::transfer()` when their buffers are next to each other in
+ * memory, such as an opcode and address stored in the same array. Dummy
+ * segments are joined with each other.
+ *
+ * `hal::spi` performs one buffer pair per transfer, so a command followed by
+ * a response in separate buffers costs two transfers. To perform a command and
+ * its response in a single transfer, use one spi_full_duplex() segment whose
+ * data_in covers both and skip the bytes received during the command.
+ *
+ * Chip select is not controlled by this function. See the overload that takes
+ * an output_pin to hold chip select across every segment.
+ *
+ * @param p_spi - spi driver
+ * @param p_segments - segments to perform in order
+ * @return status - success or failure
+ */
+[[nodiscard]] inline status segmented_transfer(
+  spi& p_spi,
+  std::span<const spi_segment> p_segments)
+{
+  static constexpr std::array<hal::byte, 16> dummy_data = [] {
+    std::array<hal::byte, 16> data{};
+    data.fill(spi::default_filler);
+    return data;
+  }();
+
+  auto follows = [](auto p_joined, auto p_next) {
+    return p_joined.data() + p_joined.size() == p_next.data();
+  };
+
+  std::size_t index = 0;
+  while (index < p_segments.size()) {
+    const auto& first = p_segments[index++];
+
+    if (first.data_out.empty() && first.data_in.empty()) {
+      auto dummy_bytes = first.dummy_bytes;
+      while (index < p_segments.size() &&
+             p_segments[index].data_out.empty() &&
+             p_segments[index].data_in.empty()) {
+        dummy_bytes += p_segments[index++].dummy_bytes;
+      }
+      while (dummy_bytes > 0) {
+        const auto chunk = std::min(dummy_bytes, dummy_data.size());
+        HAL_CHECK(write(p_spi, std::span(dummy_data).first(chunk)));
+        dummy_bytes -= chunk;
+      }
+      continue;
+    }
+
+    auto data_out = first.data_out;
+    auto data_in = first.data_in;
+    // Bytes must line up with their segment, thus only segments without a
+    // trailing filler or a partial read can be joined
+    while (index < p_segments.size() && data_out.size() == data_in.size()) {
+      const auto& next = p_segments[index];
+      if (next.data_out.empty() ||
+          next.data_out.size() != next.data_in.size() ||
+          !follows(data_out, next.data_out) ||
+          !follows(data_in, next.data_in)) {
+        break;
+      }
+      data_out = { data_out.data(), data_out.size() + next.data_out.size() };
+      data_in = { data_in.data(), data_in.size() + next.data_in.size() };
+      index++;
+    }
+    while (index < p_segments.size() && data_in.empty()) {
+      const auto& next = p_segments[index];
+      if (next.data_out.empty() || !next.data_in.empty() ||
+          !follows(data_out, next.data_out)) {
+        break;
+      }
+      data_out = { data_out.data(), data_out.size() + next.data_out.size() };
+      index++;
+    }
+    while (index < p_segments.size() && data_out.empty()) {
+      const auto& next = p_segments[index];
+      if (next.data_in.empty() || !next.data_out.empty() ||
+          next.filler != first.filler || !follows(data_in, next.data_in)) {
+        break;
+      }
+      data_in = { data_in.data(), data_in.size() + next.data_in.size() };
+      index++;
+    }
+
+    HAL_CHECK(p_spi.transfer(data_out, data_in, first.filler));
+  }
+
+  return success();
+}
+
+/**
+ * @brief Perform a list of segments with chip select held active across all
+ * of them
+ *
+ * Chip select is driven low before the first segment and driven high after
+ * the last segment, even if a transfer fails. Useful for chaining a command,
+ * dummy cycles and a response into one transaction with the peripheral:
+ *
+ *     std::array<hal::byte, 4> command{ 0x0B, 0x00, 0x10, 0x00 };
+ *     std::array<hal::byte, 256> data{};
+ *     std::array segments{
+ *       hal::spi_write(command),
+ *       hal::spi_dummy(1),
+ *       hal::spi_read(data),
+ *     };
+ *     HAL_CHECK(hal::segmented_transfer(spi, chip_select, segments));
+ *
+ * @param p_spi - spi driver
+ * @param p_chip_select - active low chip select of the peripheral
+ * @param p_segments - segments to perform in order
+ * @return status - success or failure. A transfer error takes precedence over
+ * an error releasing chip select.
+ */
+[[nodiscard]] inline status segmented_transfer(
+  spi& p_spi,
+  output_pin& p_chip_select,
+  std::span<const spi_segment> p_segments)
+{
+  HAL_CHECK(p_chip_select.level(false));
+  auto transferred = segmented_transfer(p_spi, p_segments);
+  auto released = p_chip_select.level(true);
+  if (!transferred) {
+    return transferred;
+  }
+  return released;
+}
 }  // namespace hal
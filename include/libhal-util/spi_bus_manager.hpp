@@ -0,0 +1,409 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <span>
+#include <system_error>
+#include <utility>
+
+#include <libhal/error.hpp>
+#include <libhal/functional.hpp>
+#include <libhal/spi.hpp>
+#include <libhal/timeout.hpp>
+
+#include "spi.hpp"
+#include "static_list.hpp"
+
+namespace hal {
+/**
+ * @brief How an spi_bus_manager::device competes for the bus
+ *
+ */
+struct spi_device_settings
+{
+  /// Devices with a higher priority are granted the bus first. Devices of
+  /// equal priority are granted the bus in the order they requested it.
+  std::uint8_t priority = 0;
+};
+
+/**
+ * @brief Bus usage of one spi_bus_manager::device
+ *
+ */
+struct spi_device_statistics
+{
+  /// Number of transfers performed
+  std::uint32_t transfers = 0;
+  /// Number of times the driver called `configure()`
+  std::uint32_t configure_calls = 0;
+  /// Number of times the bus was actually reconfigured for this device
+  std::uint32_t reconfigurations = 0;
+  /// Number of times a transfer or `lock()` had to wait for the bus
+  std::uint32_t contentions = 0;
+};
+
+/**
+ * @brief Share one spi bus between devices with different settings
+ *
+ * Each device is given its own `spi_bus_manager::device`, which implements
+ * `hal::spi`. Calling `configure()` on a device only records its settings.
+ * The bus itself is configured before a transfer only if the settings of the
+ * device differ from the settings the bus currently has, thus drivers that
+ * call `configure()` before every transfer no longer pay for it.
+ *
+ *     hal::spi_bus_manager manager(spi);
+ *     hal::spi_bus_manager::device display_bus(manager, { .priority = 1 });
+ *     hal::spi_bus_manager::device flash_bus(manager);
+ *     auto display = HAL_CHECK(display_driver::create(display_bus, cs0));
+ *     auto flash = HAL_CHECK(flash_driver::create(flash_bus, cs1));
+ *
+ * When devices are used from multiple threads, a transfer requested while the
+ * bus is busy, or while a higher priority device is waiting, waits until it is
+ * the highest ranked request and the bus is free. Each device can be given a
+ * wait function, called repeatedly while waiting, which is where an RTOS
+ * thread yields. A device without a wait function spins.
+ *
+ * Each transfer is granted the bus on its own. A driver that holds its chip
+ * select across multiple transfers must lock the bus for the whole frame,
+ * otherwise another device's transfer could run while its chip select is
+ * active:
+ *
+ *     auto bus_lock = HAL_CHECK(flash_bus.lock());
+ *     cs1.level(false);
+ *     HAL_CHECK(hal::write(flash_bus, command));
+ *     HAL_CHECK(hal::read(flash_bus, data));
+ *     cs1.level(true);
+ *     // the bus is released when bus_lock is destroyed
+ *
+ * Devices must be constructed and destroyed while no transfers are in
+ * progress.
+ */
+class spi_bus_manager
+{
+public:
+  class device;
+
+  /**
+   * @brief Construct a new spi bus manager
+   *
+   * @param p_spi - bus to share. Must outlive this object.
+   */
+  explicit spi_bus_manager(hal::spi& p_spi)
+    : m_spi(&p_spi)
+  {
+  }
+
+  spi_bus_manager(spi_bus_manager&) = delete;
+  spi_bus_manager& operator=(spi_bus_manager&) = delete;
+  spi_bus_manager(spi_bus_manager&&) = delete;
+  spi_bus_manager& operator=(spi_bus_manager&&) = delete;
+
+  /**
+   * @brief Get the number of devices sharing the bus
+   *
+   * @return std::size_t - number of devices
+   */
+  [[nodiscard]] std::size_t devices() const
+  {
+    return m_devices.size();
+  }
+
+  /**
+   * @brief Get the number of times the bus has been configured
+   *
+   * @return std::uint32_t - number of calls to the bus's `configure()`
+   */
+  [[nodiscard]] std::uint32_t configurations() const
+  {
+    return m_configurations;
+  }
+
+private:
+  friend class device;
+
+  bool outranks(const device& p_lhs, const device& p_rhs) const;
+  bool try_acquire(device& p_device);
+  status perform(device& p_device,
+                 std::span<const hal::byte> p_data_out,
+                 std::span<hal::byte> p_data_in,
+                 hal::byte p_filler);
+
+  void release()
+  {
+    m_busy.store(false, std::memory_order_release);
+  }
+
+  static_list<device*> m_devices{};
+  hal::spi* m_spi;
+  spi::settings m_bus_settings{};
+  std::atomic<std::uint32_t> m_next_ticket = 0;
+  std::uint32_t m_configurations = 0;
+  bool m_bus_configured = false;
+  std::atomic<bool> m_busy = false;
+};
+
+/**
+ * @brief A driver's handle to an spi bus shared through an spi_bus_manager
+ *
+ */
+class spi_bus_manager::device : public hal::spi
+{
+public:
+  /**
+   * @brief Construct a new device on a shared bus
+   *
+   * The device uses the default `spi::settings` until `configure()` is called.
+   *
+   * @param p_manager - manager of the shared bus. Must outlive this object.
+   * @param p_settings - priority of this device's transfers
+   * @param p_wait - called while waiting for the bus. Returning an error
+   * abandons the transfer and passes the error to the caller.
+   */
+  device(spi_bus_manager& p_manager,
+         spi_device_settings p_settings = {},
+         hal::callback<hal::timeout_function> p_wait = {})
+    : m_manager(&p_manager)
+    , m_wait(p_wait)
+    , m_settings(p_settings)
+    , m_item(p_manager.m_devices.push_back(this))
+  {
+  }
+
+  device(device&) = delete;
+  device& operator=(device&) = delete;
+  device(device&&) = delete;
+  device& operator=(device&&) = delete;
+
+  /**
+   * @brief Holds the shared bus for one device until destroyed
+   *
+   */
+  class bus_lock
+  {
+  public:
+    bus_lock(bus_lock&) = delete;
+    bus_lock& operator=(bus_lock&) = delete;
+
+    bus_lock(bus_lock&& p_other) noexcept
+      : m_device(std::exchange(p_other.m_device, nullptr))
+    {
+    }
+
+    bus_lock& operator=(bus_lock&& p_other) noexcept
+    {
+      if (this != &p_other) {
+        unlock();
+        m_device = std::exchange(p_other.m_device, nullptr);
+      }
+      return *this;
+    }
+
+    ~bus_lock()
+    {
+      unlock();
+    }
+
+    /**
+     * @brief Release the bus before this object is destroyed
+     *
+     */
+    void unlock()
+    {
+      if (m_device != nullptr) {
+        std::exchange(m_device, nullptr)->release_lock();
+      }
+    }
+
+  private:
+    friend class device;
+
+    explicit bus_lock(device& p_device)
+      : m_device(&p_device)
+    {
+    }
+
+    device* m_device;
+  };
+
+  /**
+   * @brief Hold the bus across multiple transfers of this device
+   *
+   * Waits for the bus like a transfer does. Until the returned lock is
+   * destroyed, this device's transfers are performed without waiting and no
+   * other device is granted the bus.
+   *
+   * @return result<bus_lock> - lock that releases the bus when destroyed
+   * @throws std::errc::resource_deadlock_would_occur - this device already
+   * holds the bus
+   */
+  [[nodiscard]] result<bus_lock> lock()
+  {
+    if (m_locked) {
+      return hal::new_error(std::errc::resource_deadlock_would_occur);
+    }
+    HAL_CHECK(acquire());
+    m_locked = true;
+    return bus_lock(*this);
+  }
+
+  /**
+   * @brief Get this device's statistics
+   *
+   * @return const spi_device_statistics& - bus usage of this device
+   */
+  [[nodiscard]] const spi_device_statistics& statistics() const
+  {
+    return m_statistics;
+  }
+
+  /**
+   * @brief Get this device's settings
+   *
+   * @return const spi_device_settings& - priority of this device
+   */
+  [[nodiscard]] const spi_device_settings& device_settings() const
+  {
+    return m_settings;
+  }
+
+  /**
+   * @brief Get the bus settings this device's transfers are performed with
+   *
+   * @return const spi::settings& - settings last passed to `configure()`
+   */
+  [[nodiscard]] const spi::settings& bus_settings() const
+  {
+    return m_bus_settings;
+  }
+
+private:
+  friend class spi_bus_manager;
+
+  status driver_configure(const spi::settings& p_settings) override
+  {
+    m_statistics.configure_calls++;
+    m_bus_settings = p_settings;
+    return success();
+  }
+
+  status driver_transfer(std::span<const hal::byte> p_data_out,
+                         std::span<hal::byte> p_data_in,
+                         hal::byte p_filler) override
+  {
+    if (m_locked) {
+      m_statistics.transfers++;
+      return m_manager->perform(*this, p_data_out, p_data_in, p_filler);
+    }
+
+    HAL_CHECK(acquire());
+    m_statistics.transfers++;
+    auto performed =
+      m_manager->perform(*this, p_data_out, p_data_in, p_filler);
+    m_manager->release();
+    return performed;
+  }
+
+  /// Wait until this device is granted the bus
+  status acquire()
+  {
+    // Published to other devices by the release store of m_waiting
+    m_ticket.store(
+      m_manager->m_next_ticket.fetch_add(1, std::memory_order_relaxed),
+      std::memory_order_relaxed);
+    m_waiting.store(true, std::memory_order_release);
+
+    bool contended = false;
+    while (!m_manager->try_acquire(*this)) {
+      contended = true;
+      if (!m_wait) {
+        continue;
+      }
+      auto waited = m_wait();
+      if (!waited) {
+        m_waiting.store(false, std::memory_order_release);
+        return waited;
+      }
+    }
+    m_waiting.store(false, std::memory_order_release);
+
+    m_statistics.contentions += contended ? 1 : 0;
+    return success();
+  }
+
+  void release_lock()
+  {
+    m_locked = false;
+    m_manager->release();
+  }
+
+  spi_bus_manager* m_manager;
+  hal::callback<hal::timeout_function> m_wait;
+  spi_device_settings m_settings;
+  spi::settings m_bus_settings{};
+  spi_device_statistics m_statistics{};
+  std::atomic<std::uint32_t> m_ticket = 0;
+  std::atomic<bool> m_waiting = false;
+  bool m_locked = false;
+  static_list<device*>::item m_item;
+};
+
+/**
+ * @brief Determine if p_lhs's request is ranked ahead of p_rhs's
+ *
+ * @param p_lhs - waiting device
+ * @param p_rhs - waiting device
+ * @return true - p_lhs must be granted the bus before p_rhs
+ */
+inline bool spi_bus_manager::outranks(const device& p_lhs,
+                                      const device& p_rhs) const
+{
+  if (p_lhs.m_settings.priority != p_rhs.m_settings.priority) {
+    return p_lhs.m_settings.priority > p_rhs.m_settings.priority;
+  }
+  // Wrapping difference keeps the order correct when tickets overflow
+  const auto lhs_ticket = p_lhs.m_ticket.load(std::memory_order_relaxed);
+  const auto rhs_ticket = p_rhs.m_ticket.load(std::memory_order_relaxed);
+  return static_cast<std::int32_t>(lhs_ticket - rhs_ticket) < 0;
+}
+
+/**
+ * @brief Claim the bus if no waiting device is ranked ahead
+ *
+ * @param p_device - device requesting the bus
+ * @return true - p_device now owns the bus and must call `release()`
+ */
+inline bool spi_bus_manager::try_acquire(device& p_device)
+{
+  for (const auto* other : m_devices) {
+    if (other != &p_device &&
+        other->m_waiting.load(std::memory_order_acquire) &&
+        outranks(*other, p_device)) {
+      return false;
+    }
+  }
+  bool expected = false;
+  return m_busy.compare_exchange_strong(
+    expected, true, std::memory_order_acquire);
+}
+
+/**
+ * @brief Perform a device's transfer on the bus
+ *
+ * The bus is reconfigured only if its settings differ from the device's.
+ */
+inline status spi_bus_manager::perform(device& p_device,
+                                       std::span<const hal::byte> p_data_out,
+                                       std::span<hal::byte> p_data_in,
+                                       hal::byte p_filler)
+{
+  if (!m_bus_configured || !(m_bus_settings == p_device.m_bus_settings)) {
+    m_bus_configured = false;
+    m_configurations++;
+    p_device.m_statistics.reconfigurations++;
+    HAL_CHECK(m_spi->configure(p_device.m_bus_settings));
+    m_bus_settings = p_device.m_bus_settings;
+    m_bus_configured = true;
+  }
+  return m_spi->transfer(p_data_out, p_data_in, p_filler);
+}
+}  // namespace hal
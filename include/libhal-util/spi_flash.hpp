@@ -0,0 +1,523 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <system_error>
+#include <type_traits>
+
+#include <libhal/error.hpp>
+#include <libhal/output_pin.hpp>
+#include <libhal/spi.hpp>
+#include <libhal/steady_clock.hpp>
+#include <libhal/units.hpp>
+
+#include "spi.hpp"
+#include "steady_clock.hpp"
+
+namespace hal {
+/**
+ * @brief Geometry and timing of an SPI NOR flash memory
+ *
+ * Normally read from the device's JEDEC SFDP tables with `read_sfdp()`. The
+ * defaults describe a typical 3-byte address flash with 256 byte pages and
+ * 4 KiB sectors.
+ */
+struct spi_flash_parameters
+{
+  /// Size of the memory in bytes. Must be set when the parameters are not
+  /// read with `read_sfdp()`.
+  std::uint64_t capacity = 0;
+  /// Number of bytes that one page program command can write
+  std::uint32_t page_size = 256;
+  /// Number of bytes erased by `erase_opcode`
+  std::uint32_t erase_size = 4096;
+  /// Opcode of the smallest erase
+  hal::byte erase_opcode = 0x20;
+  /// Number of address bytes sent with each command, 3 or 4
+  std::uint8_t address_bytes = 3;
+  /// Typical time to program a page
+  hal::time_duration page_program_time = std::chrono::microseconds(700);
+  /// Typical time to erase erase_size bytes
+  hal::time_duration erase_time = std::chrono::milliseconds(45);
+  /// Maximum program or erase time as a multiple of the typical time
+  std::uint32_t max_time_multiplier = 16;
+};
+
+/**
+ * @brief Read the parameters of an SPI NOR flash from its SFDP tables
+ *
+ * Reads the SFDP header and the JEDEC Basic Flash Parameter Table (BFPT)
+ * described by JESD216. Parameters not present in older revisions of the
+ * table keep their defaults.
+ *
+ * @param p_spi - spi bus the flash is on
+ * @param p_chip_select - active low chip select of the flash
+ * @return result<spi_flash_parameters> - parameters of the flash
+ * @throws std::errc::not_supported - the device has no SFDP tables, its
+ * first parameter table is not the BFPT or its density cannot be represented
+ */
+[[nodiscard]] inline result<spi_flash_parameters> read_sfdp(
+  hal::spi& p_spi,
+  hal::output_pin& p_chip_select)
+{
+  constexpr hal::byte read_sfdp_opcode = 0x5A;
+  constexpr std::size_t max_bfpt_words = 16;
+
+  auto read_table = [&p_spi, &p_chip_select](std::uint32_t p_address,
+                                             std::span<hal::byte> p_data) {
+    const std::array<hal::byte, 4> command{
+      read_sfdp_opcode,
+      static_cast<hal::byte>(p_address >> 16),
+      static_cast<hal::byte>(p_address >> 8),
+      static_cast<hal::byte>(p_address),
+    };
+    const std::array segments{
+      spi_write(command),
+      spi_dummy(1),
+      spi_read(p_data),
+    };
+    return segmented_transfer(p_spi, p_chip_select, segments);
+  };
+
+  // SFDP header followed by the first parameter header
+  std::array<hal::byte, 16> header{};
+  HAL_CHECK(read_table(0, header));
+  const bool has_signature = header[0] == 'S' && header[1] == 'F' &&
+                             header[2] == 'D' && header[3] == 'P';
+  // Parameter ID 0xFF00 is the JEDEC Basic Flash Parameter Table
+  if (!has_signature || header[8] != 0x00 || header[15] != 0xFF) {
+    return hal::new_error(std::errc::not_supported);
+  }
+
+  const auto word_count = std::min<std::size_t>(header[11], max_bfpt_words);
+  const auto table_address = static_cast<std::uint32_t>(
+    header[12] | (header[13] << 8) | (header[14] << 16));
+  std::array<hal::byte, max_bfpt_words * 4> table{};
+  HAL_CHECK(read_table(table_address, std::span(table).first(word_count * 4)));
+
+  // BFPT DWORDs are numbered from 1 in JESD216
+  auto dword = [&table, word_count](std::size_t p_number) -> std::uint32_t {
+    if (p_number > word_count) {
+      return 0;
+    }
+    const auto* word = &table[(p_number - 1) * 4];
+    return static_cast<std::uint32_t>(word[0]) |
+           static_cast<std::uint32_t>(word[1]) << 8 |
+           static_cast<std::uint32_t>(word[2]) << 16 |
+           static_cast<std::uint32_t>(word[3]) << 24;
+  };
+
+  spi_flash_parameters parameters{};
+
+  // Density in bits, either 2^N for N of 32 or more, or the value plus 1
+  const auto density = dword(2);
+  if (density & (1UL << 31)) {
+    const auto exponent = density & 0x7FFF'FFFF;
+    if (exponent >= 64) {
+      return hal::new_error(std::errc::not_supported);
+    }
+    parameters.capacity = (std::uint64_t{ 1 } << exponent) / 8;
+  } else {
+    parameters.capacity = (std::uint64_t{ density } + 1) / 8;
+  }
+  if (parameters.capacity == 0) {
+    return hal::new_error(std::errc::not_supported);
+  }
+
+  // 3-byte only, 3 or 4-byte, 4-byte only
+  const auto addressing = (dword(1) >> 17) & 0b11;
+  if (addressing == 0b10 ||
+      (addressing == 0b01 && parameters.capacity > (1UL << 24))) {
+    parameters.address_bytes = 4;
+  }
+
+  // Pick the smallest of the four erase types
+  parameters.erase_size = 0;
+  std::size_t erase_type = 0;
+  for (std::size_t type = 0; type < 4; type++) {
+    const auto erase_word = dword(8 + type / 2) >> ((type % 2) * 16);
+    const auto size_exponent = erase_word & 0xFF;
+    if (size_exponent == 0) {
+      continue;
+    }
+    const auto size = std::uint32_t{ 1 } << size_exponent;
+    if (parameters.erase_size == 0 || size < parameters.erase_size) {
+      parameters.erase_size = size;
+      parameters.erase_opcode = static_cast<hal::byte>(erase_word >> 8);
+      erase_type = type;
+    }
+  }
+  if (parameters.erase_size == 0) {
+    // JESD216 tables without erase types only describe the 4 KiB erase
+    parameters.erase_size = 4096;
+    parameters.erase_opcode = static_cast<hal::byte>(dword(1) >> 8);
+  }
+
+  // Erase and program times each report their own maximum multiplier
+  std::uint32_t max_time_multiplier = 0;
+  if (const auto timing = dword(10); timing != 0) {
+    using namespace std::chrono_literals;
+    constexpr std::array<hal::time_duration, 4> units{ 1ms, 16ms, 128ms, 1s };
+    const auto erase_timing = timing >> (4 + erase_type * 7);
+    parameters.erase_time =
+      ((erase_timing & 0x1F) + 1) * units[(erase_timing >> 5) & 0b11];
+    max_time_multiplier = 2 * ((timing & 0xF) + 1);
+  }
+
+  if (const auto program = dword(11); program != 0) {
+    parameters.page_size = std::uint32_t{ 1 } << ((program >> 4) & 0xF);
+    const auto unit = (program & (1 << 13)) ? std::chrono::microseconds(64)
+                                            : std::chrono::microseconds(8);
+    parameters.page_program_time = (((program >> 8) & 0x1F) + 1) * unit;
+    max_time_multiplier =
+      std::max<std::uint32_t>(max_time_multiplier, 2 * ((program & 0xF) + 1));
+  }
+  if (max_time_multiplier != 0) {
+    parameters.max_time_multiplier = max_time_multiplier;
+  }
+
+  return parameters;
+}
+
+/**
+ * @brief Read, program and erase an SPI NOR flash memory
+ *
+ * Reads are a single fast read command no matter the length, as NOR flash
+ * continues reading across page and sector boundaries. Writes are split at
+ * page boundaries and each page is written with a single page program command.
+ * After each program or erase, the status register is first polled after the
+ * typical time reported by the device, then with a backoff that doubles up to
+ * the typical time, so that a long erase does not flood the bus with status
+ * reads. The operation fails with std::errc::timed_out if it does not finish
+ * within the maximum time reported by the device.
+ *
+ *     auto flash = HAL_CHECK(hal::spi_flash::create(spi, cs, steady_clock));
+ *     std::array<hal::byte, 512> chunk{};
+ *     HAL_CHECK(flash.stream(0x10000, asset_size, chunk,
+ *                            [&decoder](std::span<const hal::byte> p_chunk) {
+ *                              decoder.feed(p_chunk);
+ *                            }));
+ *
+ * The caller is responsible for configuring the spi bus.
+ */
+class spi_flash
+{
+public:
+  /// Status register bit set while a program or erase is in progress
+  static constexpr hal::byte write_in_progress = 1 << 0;
+
+  /**
+   * @brief Create an spi_flash from the device's SFDP tables
+   *
+   * Devices larger than 16 MiB that support both 3 and 4-byte addresses are
+   * switched to 4-byte address mode.
+   *
+   * @param p_spi - spi bus the flash is on. Must outlive this object.
+   * @param p_chip_select - active low chip select of the flash. Must outlive
+   * this object.
+   * @param p_steady_clock - clock used to wait for programs and erases. Must
+   * outlive this object.
+   * @return result<spi_flash> - the flash
+   * @throws std::errc::not_supported - the device has no SFDP tables
+   */
+  [[nodiscard]] static result<spi_flash> create(
+    hal::spi& p_spi,
+    hal::output_pin& p_chip_select,
+    hal::steady_clock& p_steady_clock)
+  {
+    const auto parameters = HAL_CHECK(read_sfdp(p_spi, p_chip_select));
+    spi_flash flash(p_spi, p_chip_select, p_steady_clock, parameters);
+    if (parameters.address_bytes == 4) {
+      HAL_CHECK(flash.command(enter_4_byte_address_mode));
+    }
+    return flash;
+  }
+
+  /**
+   * @brief Construct a new spi flash with known parameters
+   *
+   * For devices without SFDP tables. The device must already be in the
+   * addressing mode given by `p_parameters.address_bytes`. The capacity must
+   * be set, as every access is rejected as beyond the end of a flash with no
+   * capacity:
+   *
+   *     hal::spi_flash flash(spi, cs, steady_clock,
+   *                          { .capacity = 2 * 1024 * 1024 });
+   *
+   * @param p_spi - spi bus the flash is on. Must outlive this object.
+   * @param p_chip_select - active low chip select of the flash. Must outlive
+   * this object.
+   * @param p_steady_clock - clock used to wait for programs and erases. Must
+   * outlive this object.
+   * @param p_parameters - geometry and timing of the flash, with a non-zero
+   * capacity
+   */
+  spi_flash(hal::spi& p_spi,
+            hal::output_pin& p_chip_select,
+            hal::steady_clock& p_steady_clock,
+            const spi_flash_parameters& p_parameters)
+    : m_spi(&p_spi)
+    , m_chip_select(&p_chip_select)
+    , m_steady_clock(&p_steady_clock)
+    , m_parameters(p_parameters)
+  {
+  }
+
+  /**
+   * @brief Get the geometry and timing of the flash
+   *
+   * @return const spi_flash_parameters& - parameters of the flash
+   */
+  [[nodiscard]] const spi_flash_parameters& parameters() const
+  {
+    return m_parameters;
+  }
+
+  /**
+   * @brief Read any number of bytes with a single fast read command
+   *
+   * @param p_address - address of the first byte
+   * @param p_data - buffer to read into
+   * @return status - success or failure
+   * @throws std::errc::invalid_argument - range is beyond the end of the flash
+   */
+  [[nodiscard]] status read(std::uint64_t p_address,
+                            std::span<hal::byte> p_data)
+  {
+    HAL_CHECK(check_range(p_address, p_data.size()));
+    const auto header = command_header(fast_read, p_address);
+    const std::array segments{
+      spi_write(std::span(header).first(header_size())),
+      spi_dummy(1),
+      spi_read(p_data),
+    };
+    return segmented_transfer(*m_spi, *m_chip_select, segments);
+  }
+
+  /**
+   * @brief Read a range of the flash in chunks handed to a consumer
+   *
+   * A single fast read command is held open across every chunk, thus only
+   * the first chunk pays for the command, address and dummy bytes; each
+   * following chunk continues from where the previous one stopped. Chip
+   * select stays active while the consumer runs, so the consumer must not use
+   * other devices on the same spi bus.
+   *
+   * @param p_address - address of the first byte
+   * @param p_length - number of bytes to read
+   * @param p_chunk - buffer each chunk is read into. The last chunk may be
+   * shorter.
+   * @param p_consumer - callable taking `std::span<const hal::byte>`. If it
+   * returns a status, an error stops the stream and is passed to the caller.
+   * @return status - success or failure
+   * @throws std::errc::invalid_argument - range is beyond the end of the flash
+   * or p_chunk is empty
+   */
+  template<class Consumer>
+  [[nodiscard]] status stream(std::uint64_t p_address,
+                              std::uint64_t p_length,
+                              std::span<hal::byte> p_chunk,
+                              Consumer&& p_consumer)
+  {
+    HAL_CHECK(check_range(p_address, p_length));
+    if (p_chunk.empty() && p_length > 0) {
+      return hal::new_error(std::errc::invalid_argument);
+    }
+
+    HAL_CHECK(m_chip_select->level(false));
+    auto streamed = [this, p_address, p_length, p_chunk, &p_consumer]()
+      -> status {
+      const auto header = command_header(fast_read, p_address);
+      const std::array segments{
+        spi_write(std::span(header).first(header_size())),
+        spi_dummy(1),
+      };
+      HAL_CHECK(segmented_transfer(*m_spi, segments));
+
+      auto remaining = p_length;
+      while (remaining > 0) {
+        const auto size = std::min<std::uint64_t>(remaining, p_chunk.size());
+        const auto chunk = p_chunk.first(static_cast<std::size_t>(size));
+        HAL_CHECK(hal::read(*m_spi, chunk));
+        remaining -= size;
+        using consumer_result =
+          std::invoke_result_t<Consumer&, std::span<const hal::byte>>;
+        if constexpr (std::is_void_v<consumer_result>) {
+          p_consumer(std::span<const hal::byte>(chunk));
+        } else {
+          HAL_CHECK(p_consumer(std::span<const hal::byte>(chunk)));
+        }
+      }
+      return success();
+    }();
+    auto released = m_chip_select->level(true);
+    if (!streamed) {
+      return streamed;
+    }
+    return released;
+  }
+
+  /**
+   * @brief Program bytes into the flash
+   *
+   * The bytes must have been erased beforehand. Data is split at page
+   * boundaries and each page is written with one page program command.
+   *
+   * @param p_address - address of the first byte
+   * @param p_data - bytes to program
+   * @return status - success or failure
+   * @throws std::errc::invalid_argument - range is beyond the end of the flash
+   * @throws std::errc::timed_out - a page program did not finish in time
+   */
+  [[nodiscard]] status write(std::uint64_t p_address,
+                             std::span<const hal::byte> p_data)
+  {
+    HAL_CHECK(check_range(p_address, p_data.size()));
+    while (!p_data.empty()) {
+      const auto page_offset = p_address % m_parameters.page_size;
+      const auto size = std::min<std::uint64_t>(
+        m_parameters.page_size - page_offset, p_data.size());
+      const auto page = p_data.first(static_cast<std::size_t>(size));
+
+      HAL_CHECK(command(write_enable));
+      const auto header = command_header(page_program, p_address);
+      const std::array segments{
+        spi_write(std::span(header).first(header_size())),
+        spi_write(page),
+      };
+      HAL_CHECK(segmented_transfer(*m_spi, *m_chip_select, segments));
+      HAL_CHECK(wait_while_busy(m_parameters.page_program_time));
+
+      p_address += size;
+      p_data = p_data.subspan(page.size());
+    }
+    return success();
+  }
+
+  /**
+   * @brief Erase a range of the flash
+   *
+   * @param p_address - address of the first byte, a multiple of the erase size
+   * @param p_length - number of bytes, a multiple of the erase size
+   * @return status - success or failure
+   * @throws std::errc::invalid_argument - range is beyond the end of the flash
+   * or is not aligned to the erase size
+   * @throws std::errc::timed_out - an erase did not finish in time
+   */
+  [[nodiscard]] status erase(std::uint64_t p_address, std::uint64_t p_length)
+  {
+    HAL_CHECK(check_range(p_address, p_length));
+    if (p_address % m_parameters.erase_size != 0 ||
+        p_length % m_parameters.erase_size != 0) {
+      return hal::new_error(std::errc::invalid_argument);
+    }
+    for (auto end = p_address + p_length; p_address < end;
+         p_address += m_parameters.erase_size) {
+      HAL_CHECK(command(write_enable));
+      const auto header = command_header(m_parameters.erase_opcode, p_address);
+      HAL_CHECK(segmented_transfer(
+        *m_spi,
+        *m_chip_select,
+        std::array{ spi_write(std::span(header).first(header_size())) }));
+      HAL_CHECK(wait_while_busy(m_parameters.erase_time));
+    }
+    return success();
+  }
+
+  /**
+   * @brief Read the status register
+   *
+   * @return result<hal::byte> - value of status register 1
+   */
+  [[nodiscard]] result<hal::byte> status_register()
+  {
+    // Full duplex so that the opcode and response cost one transfer
+    const std::array<hal::byte, 1> opcode{ read_status };
+    std::array<hal::byte, 2> response{};
+    HAL_CHECK(segmented_transfer(
+      *m_spi, *m_chip_select, std::array{ spi_full_duplex(opcode, response) }));
+    return response[1];
+  }
+
+  /**
+   * @brief Get the number of status register reads spent waiting on programs
+   * and erases
+   *
+   * @return std::uint32_t - number of status polls
+   */
+  [[nodiscard]] std::uint32_t status_polls() const
+  {
+    return m_status_polls;
+  }
+
+private:
+  static constexpr hal::byte fast_read = 0x0B;
+  static constexpr hal::byte page_program = 0x02;
+  static constexpr hal::byte write_enable = 0x06;
+  static constexpr hal::byte read_status = 0x05;
+  static constexpr hal::byte enter_4_byte_address_mode = 0xB7;
+
+  std::size_t header_size() const
+  {
+    return 1 + m_parameters.address_bytes;
+  }
+
+  std::array<hal::byte, 5> command_header(hal::byte p_opcode,
+                                          std::uint64_t p_address) const
+  {
+    std::array<hal::byte, 5> header{ p_opcode };
+    for (std::size_t i = m_parameters.address_bytes; i > 0; i--) {
+      header[i] = static_cast<hal::byte>(p_address);
+      p_address >>= 8;
+    }
+    return header;
+  }
+
+  status check_range(std::uint64_t p_address, std::uint64_t p_length) const
+  {
+    if (p_address > m_parameters.capacity ||
+        p_length > m_parameters.capacity - p_address) {
+      return hal::new_error(std::errc::invalid_argument);
+    }
+    return success();
+  }
+
+  status command(hal::byte p_opcode)
+  {
+    const std::array<hal::byte, 1> opcode{ p_opcode };
+    return segmented_transfer(
+      *m_spi, *m_chip_select, std::array{ spi_write(opcode) });
+  }
+
+  status wait_while_busy(hal::time_duration p_typical)
+  {
+    const auto typical = std::max(p_typical, hal::time_duration(1));
+    auto deadline = HAL_CHECK(create_timeout(
+      *m_steady_clock, typical * m_parameters.max_time_multiplier));
+    HAL_CHECK(delay(*m_steady_clock, typical));
+    // Poll soon after the typical time, then back off up to the typical time
+    auto backoff = std::max(typical / 8, hal::time_duration(1));
+
+    while (true) {
+      m_status_polls++;
+      const auto flags = HAL_CHECK(status_register());
+      if (!(flags & write_in_progress)) {
+        return success();
+      }
+      HAL_CHECK(deadline());
+      HAL_CHECK(delay(*m_steady_clock, backoff));
+      backoff = std::min(backoff * 2, typical);
+    }
+  }
+
+  hal::spi* m_spi;
+  hal::output_pin* m_chip_select;
+  hal::steady_clock* m_steady_clock;
+  spi_flash_parameters m_parameters;
+  std::uint32_t m_status_polls = 0;
+};
+}  // namespace hal
@@ -330,6 +330,37 @@ public:
     return item(this, p_value);
   }
 
+  /**
+   * @brief Relink an item to the front of the list
+   *
+   * No objects are moved or copied, only the links between items change, thus
+   * iterators and references to every item remain valid. Useful for keeping
+   * frequently searched items near the front of the list.
+   *
+   * @param p_position - iterator to an item within this list. Does nothing if
+   * p_position is end() or already the first item.
+   */
+  constexpr void move_to_front(item_iterator p_position)
+  {
+    item* node = p_position.m_self;
+    if (node == nullptr || node == m_head) {
+      return;
+    }
+
+    // If this isn't the head then there MUST be a PREVIOUS node
+    node->m_previous->m_next = node->m_next;
+    if (m_tail == node) {
+      m_tail = node->m_previous;
+    } else {
+      node->m_next->m_previous = node->m_previous;
+    }
+
+    node->m_previous = nullptr;
+    node->m_next = m_head;
+    m_head->m_previous = node;
+    m_head = node;
+  }
+
   constexpr bool empty()
   {
     return m_size == 0;
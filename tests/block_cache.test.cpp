@@ -0,0 +1,278 @@
+#include <libhal-util/block_cache.hpp>
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+#include <libhal-util/sd_card.hpp>
+
+#include <boost/ut.hpp>
+
+namespace hal {
+namespace {
+/// Block device in memory that records every transfer
+class mock_block_device
+{
+public:
+  static constexpr std::size_t block_size = 16;
+  static constexpr std::size_t block_count = 32;
+
+  struct transfer_t
+  {
+    std::uint32_t block;
+    std::size_t count;
+  };
+
+  [[nodiscard]] status read(std::uint32_t p_block, std::span<hal::byte> p_data)
+  {
+    m_reads.push_back({ p_block, p_data.size() / block_size });
+    auto start = m_memory.begin() + p_block * block_size;
+    std::copy(start,
+              start + static_cast<std::ptrdiff_t>(p_data.size()),
+              p_data.begin());
+    return success();
+  }
+
+  [[nodiscard]] status write(std::uint32_t p_block,
+                             std::span<const hal::byte> p_data)
+  {
+    if (m_fail_writes) {
+      return hal::new_error(std::errc::io_error);
+    }
+    m_writes.push_back({ p_block, p_data.size() / block_size });
+    std::copy(p_data.begin(),
+              p_data.end(),
+              m_memory.begin() + p_block * block_size);
+    return success();
+  }
+
+  std::vector<hal::byte> m_memory =
+    std::vector<hal::byte>(block_count * block_size, 0);
+  std::vector<transfer_t> m_reads{};
+  std::vector<transfer_t> m_writes{};
+  bool m_fail_writes = false;
+};
+
+using block_t = std::array<hal::byte, mock_block_device::block_size>;
+
+block_t filled(hal::byte p_value)
+{
+  block_t block{};
+  block.fill(p_value);
+  return block;
+}
+}  // namespace
+
+static_assert(block_device<sd_card>);
+static_assert(block_device<mock_block_device>);
+static_assert(block_device<block_cache<mock_block_device, 2>>);
+
+void block_cache_test()
+{
+  using namespace boost::ut;
+
+  "hal::block_cache::read() serves repeated reads from the cache"_test = []() {
+    // Setup
+    mock_block_device device;
+    device.m_memory[3 * mock_block_device::block_size] = 0xAB;
+    block_cache<mock_block_device, 2> cache(device);
+    block_t block{};
+
+    // Exercise
+    auto first = cache.read(3, block);
+    block = filled(0);
+    auto second = cache.read(3, block);
+
+    // Verify
+    expect(bool{ first });
+    expect(bool{ second });
+    expect(that % 0xAB == block[0]);
+    expect(that % 1 == device.m_reads.size());
+    expect(that % 1 == cache.statistics().hits);
+    expect(that % 1 == cache.statistics().misses);
+    expect(that % cache.contains(3));
+  };
+
+  "hal::block_cache evicts the least recently used block"_test = []() {
+    // Setup
+    mock_block_device device;
+    block_cache<mock_block_device, 2> cache(device);
+    block_t block{};
+
+    // Exercise
+    auto result0 = cache.read(0, block);
+    auto result1 = cache.read(1, block);
+    auto result2 = cache.read(0, block);
+    auto result3 = cache.read(2, block);
+
+    // Verify
+    expect(bool{ result0 });
+    expect(bool{ result1 });
+    expect(bool{ result2 });
+    expect(bool{ result3 });
+    expect(that % cache.contains(0));
+    expect(that % not cache.contains(1));
+    expect(that % cache.contains(2));
+    expect(that % 1 == cache.statistics().evictions);
+    expect(that % 0 == cache.statistics().write_backs);
+  };
+
+  "hal::block_cache::write() writes back dirty blocks on eviction"_test =
+    []() {
+      // Setup
+      mock_block_device device;
+      block_cache<mock_block_device, 1> cache(device);
+      block_t block = filled(0x5A);
+
+      // Exercise
+      auto write_result = cache.write(4, block);
+      const auto writes_before_eviction = device.m_writes.size();
+      auto read_result = cache.read(5, block);
+
+      // Verify
+      expect(bool{ write_result });
+      expect(bool{ read_result });
+      expect(that % 0 == writes_before_eviction);
+      expect(that % 1 == device.m_writes.size());
+      expect(that % 4 == device.m_writes[0].block);
+      expect(that % 0x5A == device.m_memory[4 * block.size()]);
+      expect(that % 1 == cache.statistics().write_backs);
+      expect(that % 0 == cache.dirty_count());
+    };
+
+  "hal::block_cache::flush() writes dirty blocks in order"_test = []() {
+    // Setup
+    mock_block_device device;
+    block_cache<mock_block_device, 4> cache(device);
+
+    // Exercise
+    auto result9 = cache.write(9, filled(9));
+    auto result2 = cache.write(2, filled(2));
+    auto result5 = cache.write(5, filled(5));
+    auto result9_again = cache.write(9, filled(0x99));
+    const auto dirty_before_flush = cache.dirty_count();
+    auto flush_result = cache.flush();
+
+    // Verify
+    expect(bool{ result9 });
+    expect(bool{ result2 });
+    expect(bool{ result5 });
+    expect(bool{ result9_again });
+    expect(bool{ flush_result });
+    expect(that % 3 == dirty_before_flush);
+    expect(that % 0 == cache.dirty_count());
+    expect(that % 3 == device.m_writes.size());
+    expect(that % 2 == device.m_writes[0].block);
+    expect(that % 5 == device.m_writes[1].block);
+    expect(that % 9 == device.m_writes[2].block);
+    expect(that % 0x99 == device.m_memory[9 * mock_block_device::block_size]);
+    expect(that % 0 == device.m_reads.size());
+  };
+
+  "hal::block_cache::read() bypasses the cache for multiple blocks"_test =
+    []() {
+      // Setup
+      mock_block_device device;
+      block_cache<mock_block_device, 2> cache(device);
+      auto write_result = cache.write(2, filled(0x22));
+      std::array<hal::byte, 4 * mock_block_device::block_size> data{};
+
+      // Exercise
+      auto result = cache.read(0, data);
+
+      // Verify
+      expect(bool{ write_result });
+      expect(bool{ result });
+      expect(that % 2 == device.m_reads.size());
+      expect(that % 0 == device.m_reads[0].block);
+      expect(that % 2 == device.m_reads[0].count);
+      expect(that % 3 == device.m_reads[1].block);
+      expect(that % 1 == device.m_reads[1].count);
+      expect(that % 0x22 == data[2 * mock_block_device::block_size]);
+      expect(that % 1 == cache.statistics().hits);
+      expect(that % 3 == cache.statistics().misses);
+      expect(that % not cache.contains(0));
+    };
+
+  "hal::block_cache::write() updates cached copies of multiple blocks"_test =
+    []() {
+      // Setup
+      mock_block_device device;
+      block_cache<mock_block_device, 2> cache(device);
+      auto write_result = cache.write(1, filled(0x11));
+      std::array<hal::byte, 3 * mock_block_device::block_size> data{};
+      data.fill(0x77);
+      block_t block{};
+
+      // Exercise
+      auto result = cache.write(0, data);
+      auto read_result = cache.read(1, block);
+
+      // Verify
+      expect(bool{ write_result });
+      expect(bool{ result });
+      expect(bool{ read_result });
+      expect(that % 1 == device.m_writes.size());
+      expect(that % 3 == device.m_writes[0].count);
+      expect(that % 0x77 == block[0]);
+      expect(that % 0 == cache.dirty_count());
+      expect(that % 0 == device.m_reads.size());
+    };
+
+  "hal::block_cache keeps dirty blocks when a write back fails"_test = []() {
+    // Setup
+    mock_block_device device;
+    block_cache<mock_block_device, 1> cache(device);
+    auto write_result = cache.write(6, filled(0x66));
+    device.m_fail_writes = true;
+    block_t block{};
+
+    // Exercise
+    auto read_result = cache.read(7, block);
+    auto flush_result = cache.flush();
+
+    // Verify
+    expect(bool{ write_result });
+    expect(!read_result);
+    expect(!flush_result);
+    expect(that % cache.contains(6));
+    expect(that % 1 == cache.dirty_count());
+    expect(that % 0 == cache.statistics().evictions);
+  };
+
+  "hal::block_cache rejects partial blocks"_test = []() {
+    // Setup
+    mock_block_device device;
+    block_cache<mock_block_device, 1> cache(device);
+    std::array<hal::byte, mock_block_device::block_size + 1> data{};
+
+    // Exercise
+    auto read_result = cache.read(0, data);
+    auto write_result = cache.write(0, data);
+    auto empty_result = cache.read(0, std::span<hal::byte>{});
+
+    // Verify
+    expect(!read_result);
+    expect(!write_result);
+    expect(!empty_result);
+    expect(that % 0 == device.m_reads.size());
+  };
+
+  "hal::block_cache::invalidate() discards cached blocks"_test = []() {
+    // Setup
+    mock_block_device device;
+    block_cache<mock_block_device, 2> cache(device);
+    auto write_result = cache.write(1, filled(0x11));
+
+    // Exercise
+    cache.invalidate();
+    auto flush_result = cache.flush();
+
+    // Verify
+    expect(bool{ write_result });
+    expect(bool{ flush_result });
+    expect(that % not cache.contains(1));
+    expect(that % 0 == device.m_writes.size());
+  };
+};
+}  // namespace hal
@@ -1,6 +1,9 @@
 #include <libhal-util/can.hpp>
 
 #include <algorithm>
+#include <cmath>
+#include <optional>
+#include <vector>
 
 #include <libhal/functional.hpp>
 
@@ -15,6 +18,8 @@ public:
   message_t m_message{};
   std::function<handler> m_handler{};
   bool m_return_error_status{ false };
+  /// Number of messages sent before every send fails
+  std::optional<std::size_t> m_sends_before_error{};
 
 private:
   status driver_configure(const settings& p_settings) override
@@ -28,6 +33,12 @@ private:
 
   status driver_send(const message_t& p_message) override
   {
+    if (m_sends_before_error) {
+      if (*m_sends_before_error == 0) {
+        return hal::new_error();
+      }
+      (*m_sends_before_error)--;
+    }
     m_message = p_message;
     if (m_return_error_status) {
       return hal::new_error();
@@ -44,12 +55,128 @@ private:
     return success();
   };
 };
+
+class mock_steady_clock : public hal::steady_clock
+{
+public:
+  std::uint64_t m_uptime = 0;
+  std::uint64_t m_increment = 1;
+
+private:
+  hertz driver_frequency() override
+  {
+    return 1.0_MHz;
+  }
+
+  result<std::uint64_t> driver_uptime() override
+  {
+    const auto current = m_uptime;
+    m_uptime += m_increment;
+    return current;
+  }
+};
 }  // namespace
 
 void can_router_test()
 {
   using namespace boost::ut;
 
+  "is_valid_segments()"_test = []() {
+    expect(is_valid_segments(can::settings{}));
+    expect(!is_valid_segments(can::settings{ .propagation_delay = 0 }));
+    expect(!is_valid_segments(can::settings{ .propagation_delay = 1,
+                                             .phase_segment1 = 1,
+                                             .phase_segment2 = 1 }));
+    expect(!is_valid_segments(
+      can::settings{ .phase_segment2 = 2, .synchronization_jump_width = 3 }));
+  };
+
+  "solve_bit_timing() 16MHz @ 500kHz"_test = []() {
+    // Setup
+    std::array<can_bit_timing, 4> results{};
+
+    // Exercise
+    auto count = solve_bit_timing(16.0_MHz, 500.0_kHz, results);
+
+    // Verify
+    expect(that % 4 == count);
+    expect(that % 2 == results[0].prescaler);
+    expect(that % 16 == bit_width(results[0].settings));
+    expect(that % 0.0f == results[0].baud_error);
+    expect(that % 0.875f == results[0].sample_point);
+    expect(that % 500.0_kHz == results[0].settings.baud_rate);
+    expect(results[0].prescaler == is_valid(results[0].settings, 16.0_MHz));
+    for (std::size_t i = 1; i < count; i++) {
+      expect(results[i - 1].baud_error <= results[i].baud_error);
+      expect(is_valid_segments(results[i].settings));
+      expect(results[i].prescaler == is_valid(results[i].settings, 16.0_MHz));
+    }
+  };
+
+  "solve_bit_timing() inexact baud rate"_test = []() {
+    // Setup
+    std::array<can_bit_timing, 2> results{};
+
+    // Exercise
+    // 36MHz cannot produce 833.333kHz exactly with 8 to 25 Tq per bit
+    auto count = solve_bit_timing(36.0_MHz, 833.333_kHz, results, 0.8f);
+
+    // Verify
+    expect(that % 2 == count);
+    expect(that % 44 == results[0].prescaler * bit_width(results[0].settings));
+    expect(results[0].baud_error < 0.02f);
+    expect(results[0].baud_error <= results[1].baud_error);
+    // Equal baud rate error, so the sample point closest to 80% wins
+    expect(that % 4 == results[0].prescaler);
+    expect(that % 2 == results[1].prescaler);
+  };
+
+  "solve_bit_timing() non-integer ideal prescaler"_test = []() {
+    // Setup
+    std::array<can_bit_timing, 64> results{};
+
+    // Exercise
+    // The ideal prescaler for 10 Tq per bit is 2.45, which rounds to 2
+    auto count = solve_bit_timing(2.45_MHz, 100.0_kHz, results);
+
+    // Verify
+    expect(count > 0);
+    for (std::size_t i = 0; i < count; i++) {
+      expect(results[i].prescaler == is_valid(results[i].settings, 2.45_MHz));
+      expect(!(results[i].prescaler == 3 &&
+               bit_width(results[i].settings) == 10));
+    }
+  };
+
+  "solve_bit_timing() no solution"_test = []() {
+    // Setup
+    std::array<can_bit_timing, 2> results{};
+
+    // Exercise
+    auto too_fast = solve_bit_timing(1.0_MHz, 1.0_MHz, results);
+    auto zero = solve_bit_timing(16.0_MHz, 0.0_Hz, results);
+    auto empty = solve_bit_timing(16.0_MHz, 500.0_kHz, {});
+    auto limited = best_bit_timing(
+      80.0_MHz, 10.0_kHz, 0.875f, can_bit_timing_limits{ .max_prescaler = 64 });
+
+    // Verify
+    expect(that % 0 == too_fast);
+    expect(that % 0 == zero);
+    expect(that % 0 == empty);
+    expect(!limited.has_value());
+  };
+
+  "best_bit_timing() at compile time"_test = []() {
+    // Setup + Exercise
+    static constexpr auto timing = best_bit_timing(8.0_MHz, 250.0_kHz);
+
+    // Verify
+    static_assert(timing.has_value());
+    static_assert(timing->prescaler * bit_width(timing->settings) == 32);
+    static_assert(timing->baud_error == 0.0f);
+    expect(that % 0.875f == timing->sample_point);
+  };
+
   "operator==(can::settings)"_test = []() {
     can::settings a{};
     can::settings b{};
@@ -264,5 +391,893 @@ void can_router_test()
     expect(that % 1 == counter3);
     expect(expected3 == actual3);
   };
+
+  "basic_can_router<16>::bucket_index() spreads ids"_test = []() {
+    // Setup
+    using router_t = basic_can_router<16>;
+    std::array<int, 16> bucket_usage{};
+
+    // Exercise
+    for (can::id_t id = 0x100; id < 0x100 + 16; id++) {
+      bucket_usage[router_t::bucket_index(id)]++;
+    }
+
+    // Verify
+    // Sequential IDs should not collapse onto a handful of buckets
+    const auto used = std::count_if(bucket_usage.begin(),
+                                    bucket_usage.end(),
+                                    [](int p_usage) { return p_usage != 0; });
+    expect(that % 8 <= used);
+    expect(that % 0 == basic_can_router<1>::bucket_index(0x123));
+  };
+
+  "basic_can_router<16>::operator()"_test = []() {
+    // Setup
+    mock_can mock;
+    auto router = basic_can_router<16>::create(mock).value();
+    std::array<can::id_t, 6> received{};
+    std::size_t count = 0;
+    auto record = [&received, &count](const can::message_t& p_message) {
+      received[count++] = p_message.id;
+    };
+    auto item0 = router.add_message_callback(0x100, record);
+    auto item1 = router.add_message_callback(0x101, record);
+    auto item2 = router.add_message_callback(0x102, record);
+    auto item3 = router.add_message_callback(0x18FEF100, record);
+    auto item4 = router.add_message_callback(0x18FEF200, record);
+
+    // Exercise
+    router(can::message_t{ .id = 0x102 });
+    router(can::message_t{ .id = 0x18FEF200 });
+    router(can::message_t{ .id = 0x555 });
+    router(can::message_t{ .id = 0x100 });
+    router(can::message_t{ .id = 0x18FEF100 });
+    router(can::message_t{ .id = 0x101 });
+
+    // Verify
+    expect(that % 5 == router.size());
+    expect(that % 5 == count);
+    expect(that % 0x102 == received[0]);
+    expect(that % 0x18FEF200 == received[1]);
+    expect(that % 0x100 == received[2]);
+    expect(that % 0x18FEF100 == received[3]);
+    expect(that % 0x101 == received[4]);
+    expect(that % 0 == received[5]);
+  };
+
+  "basic_can_router<16> route_item removes route on destruction"_test = []() {
+    // Setup
+    mock_can mock;
+    auto router = basic_can_router<16>::create(mock).value();
+    int counter = 0;
+    auto persistent = router.add_message_callback(
+      0x10, [&counter](const can::message_t&) { counter++; });
+
+    // Exercise
+    {
+      auto temporary = router.add_message_callback(
+        0x20, [&counter](const can::message_t&) { counter += 10; });
+      expect(that % 2 == router.size());
+      expect(that % 1 <= router.bucket(0x20).size());
+      router(can::message_t{ .id = 0x20 });
+    }
+    router(can::message_t{ .id = 0x20 });
+    router(can::message_t{ .id = 0x10 });
+
+    // Verify
+    expect(that % 1 == router.size());
+    expect(that % 11 == counter);
+  };
+
+  "can_router::on_unmatched()"_test = []() {
+    // Setup
+    mock_can mock;
+    auto router = can_router::create(mock).value();
+    int routed = 0;
+    int unmatched = 0;
+    auto item = router.add_message_callback(
+      0x100, [&routed](const can::message_t&) { routed++; });
+
+    // Exercise
+    router(can::message_t{ .id = 0x101 });
+    router.on_unmatched([&unmatched](const can::message_t&) { unmatched++; });
+    router(can::message_t{ .id = 0x101 });
+    router(can::message_t{ .id = 0x100 });
+
+    // Verify
+    expect(that % 1 == routed);
+    expect(that % 1 == unmatched);
+  };
+
+  "can_filter_table::add(can_range_filter)"_test = []() {
+    // Setup
+    can_filter_table<4> table;
+    can::id_t last_id = 0;
+    int which = 0;
+
+    // Exercise
+    auto first = table.add(can_range_filter{ .first = 0x100, .last = 0x1FF },
+                           [&which](const can::message_t&) { which = 1; });
+    auto second = table.add(can_range_filter{ .first = 0x300, .last = 0x30F },
+                            [&which, &last_id](const can::message_t& p_msg) {
+                              which = 2;
+                              last_id = p_msg.id;
+                            });
+    auto overlapping =
+      table.add(can_range_filter{ .first = 0x1F0, .last = 0x2FF },
+                [](const can::message_t&) {});
+    auto inverted = table.add(can_range_filter{ .first = 0x500, .last = 0x400 },
+                              [](const can::message_t&) {});
+
+    // Verify
+    expect(bool{ first });
+    expect(bool{ second });
+    expect(!bool{ overlapping });
+    expect(!bool{ inverted });
+    expect(that % 2 == table.size());
+
+    expect(table(can::message_t{ .id = 0x100 }));
+    expect(that % 1 == which);
+    expect(table(can::message_t{ .id = 0x1FF }));
+    expect(that % 1 == which);
+    expect(table(can::message_t{ .id = 0x305 }));
+    expect(that % 2 == which);
+    expect(that % 0x305 == last_id);
+    expect(!table(can::message_t{ .id = 0x200 }));
+    expect(!table(can::message_t{ .id = 0x0FF }));
+    expect(!table(can::message_t{ .id = 0x310 }));
+  };
+
+  "can_filter_table::add(can_mask_filter)"_test = []() {
+    // Setup
+    can_filter_table<4> table;
+    int which = 0;
+
+    // Exercise
+    // Every J1939 message from source address 0x25
+    auto source = table.add(can_mask_filter{ .id = 0x25, .mask = 0xFF },
+                            [&which](const can::message_t&) { which = 1; });
+    // PGN 0xFEF1 from source address 0x25 specifically
+    auto specific =
+      table.add(can_mask_filter{ .id = 0x00FEF125, .mask = 0x00FFFFFF },
+                [&which](const can::message_t&) { which = 2; });
+    auto duplicate = table.add(can_mask_filter{ .id = 0x1125, .mask = 0xFF },
+                               [](const can::message_t&) {});
+
+    // Verify
+    expect(bool{ source });
+    expect(bool{ specific });
+    expect(!bool{ duplicate });
+    expect(that % 2 == table.size());
+
+    expect(table(can::message_t{ .id = 0x18F00425 }));
+    expect(that % 1 == which);
+    expect(table(can::message_t{ .id = 0x18FEF125 }));
+    expect(that % 2 == which);
+    expect(!table(can::message_t{ .id = 0x18FEF126 }));
+  };
+
+  "can_filter_table ranges take precedence and capacity is enforced"_test =
+    []() {
+      // Setup
+      can_filter_table<2> table;
+      int which = 0;
+
+      // Exercise
+      auto mask = table.add(can_mask_filter{ .id = 0x100, .mask = 0x700 },
+                            [&which](const can::message_t&) { which = 1; });
+      auto range = table.add(can_range_filter{ .first = 0x120, .last = 0x12F },
+                             [&which](const can::message_t&) { which = 2; });
+      auto full = table.add(can_range_filter{ .first = 0x500, .last = 0x5FF },
+                            [](const can::message_t&) {});
+
+      // Verify
+      expect(bool{ mask });
+      expect(bool{ range });
+      expect(!bool{ full });
+
+      expect(table(can::message_t{ .id = 0x125 }));
+      expect(that % 2 == which);
+      expect(table(can::message_t{ .id = 0x1A0 }));
+      expect(that % 1 == which);
+      expect(!table(can::message_t{ .id = 0x500 }));
+
+      table.clear();
+      expect(that % 0 == table.size());
+      expect(!table(can::message_t{ .id = 0x125 }));
+    };
+
+  "can_router::on_unmatched(can_filter_table)"_test = []() {
+    // Setup
+    mock_can mock;
+    auto router = can_router::create(mock).value();
+    can_filter_table<1> table;
+    int exact = 0;
+    int ranged = 0;
+    auto item = router.add_message_callback(
+      0x105, [&exact](const can::message_t&) { exact++; });
+    auto added = table.add(can_range_filter{ .first = 0x100, .last = 0x1FF },
+                           [&ranged](const can::message_t&) { ranged++; });
+    router.on_unmatched(std::ref(table));
+
+    // Exercise
+    router(can::message_t{ .id = 0x105 });
+    router(can::message_t{ .id = 0x106 });
+    router(can::message_t{ .id = 0x200 });
+
+    // Verify
+    expect(bool{ added });
+    expect(that % 1 == exact);
+    expect(that % 1 == ranged);
+  };
+
+  "can_receive_queue push, pop and overrun"_test = []() {
+    // Setup
+    std::array<can::message_t, 4> storage{};
+    can_receive_queue queue(storage);
+
+    // Exercise
+    auto pushed1 = queue.push(can::message_t{ .id = 1 });
+    auto pushed2 = queue.push(can::message_t{ .id = 2 });
+    auto pushed3 = queue.push(can::message_t{ .id = 3 });
+    auto pushed4 = queue.push(can::message_t{ .id = 4 });
+    queue(can::message_t{ .id = 5 });
+
+    // Verify
+    expect(that % 3 == queue.capacity());
+    expect(pushed1 && pushed2 && pushed3);
+    expect(!pushed4);
+    expect(that % 2 == queue.overruns());
+    expect(that % 3 == queue.size());
+    expect(that % 1 == queue.pop().value().id);
+    expect(that % 2 == queue.size());
+
+    // Exercise: wrap around the end of the storage
+    auto pushed6 = queue.push(can::message_t{ .id = 6 });
+    expect(pushed6);
+    expect(that % 2 == queue.pop().value().id);
+    expect(that % 3 == queue.pop().value().id);
+    expect(that % 6 == queue.pop().value().id);
+    expect(!queue.pop().has_value());
+    expect(that % 0 == queue.size());
+  };
+
+  "can_receive_queue::drain() in batches"_test = []() {
+    // Setup
+    std::array<can::message_t, 8> storage{};
+    can_receive_queue queue(storage);
+    std::array<can::id_t, 8> drained{};
+    std::size_t count = 0;
+    auto handler = [&drained, &count](const can::message_t& p_message) {
+      drained[count++] = p_message.id;
+    };
+    for (can::id_t id = 10; id < 15; id++) {
+      queue(can::message_t{ .id = id });
+    }
+
+    // Exercise
+    auto first_batch = queue.drain(handler, 2);
+    auto second_batch = queue.drain(handler);
+    auto third_batch = queue.drain(handler);
+
+    // Verify
+    expect(that % 2 == first_batch);
+    expect(that % 3 == second_batch);
+    expect(that % 0 == third_batch);
+    expect(that % 5 == count);
+    for (std::size_t i = 0; i < count; i++) {
+      expect(that % (10 + i) == drained[i]);
+    }
+  };
+
+  "can_router::create(can, queue) defers routing"_test = []() {
+    // Setup
+    mock_can mock;
+    std::array<can::message_t, 4> storage{};
+    can_receive_queue queue(storage);
+    auto router = can_router::create(mock, queue).value();
+    int counter = 0;
+    auto item = router.add_message_callback(
+      0x100, [&counter](const can::message_t&) { counter++; });
+
+    // Exercise
+    mock.m_handler(can::message_t{ .id = 0x100 });
+    mock.m_handler(can::message_t{ .id = 0x100 });
+    mock.m_handler(can::message_t{ .id = 0x100 });
+    const auto count_before_process = counter;
+    const auto processed_first = router.process(1);
+    const auto processed_rest = router.process();
+
+    // Verify
+    expect(that % 0 == count_before_process);
+    expect(that % 1 == processed_first);
+    expect(that % 2 == processed_rest);
+    expect(that % 3 == counter);
+    expect(that % 0 == queue.overruns());
+  };
+
+  "can_router::process() without a queue"_test = []() {
+    // Setup
+    mock_can mock;
+    auto router = can_router::create(mock).value();
+
+    // Exercise + Verify
+    expect(that % 0 == router.process());
+  };
+
+  "can_router receives from the bus after being moved"_test = []() {
+    // Setup
+    mock_can mock;
+    int counter = 0;
+    auto created = can_router::create(mock);
+    auto router = std::move(created.value());
+    auto item = router.add_message_callback(
+      0x100, [&counter](const can::message_t&) { counter++; });
+
+    // Exercise
+    mock.m_handler(can::message_t{ .id = 0x100 });
+
+    // Verify
+    expect(that % 1 == counter);
+  };
+
+  "can_router can be moved from twice"_test = []() {
+    // Setup
+    mock_can mock;
+    int counter = 0;
+    auto first = can_router::create(mock).value();
+    first.timestamp_with([]() -> std::uint64_t { return 42; });
+    auto item = first.add_message_callback(
+      0x100, [&counter](const can::message_t&) { counter++; });
+    mock.m_handler(can::message_t{ .id = 0x100 });
+
+    // Exercise
+    auto second = std::move(first);
+    auto detached = std::move(first);
+    auto third = std::move(second);
+    detached = std::move(second);
+    mock.m_handler(can::message_t{ .id = 0x100 });
+
+    // Verify
+    expect(that % 2 == counter);
+    expect(that % 42 == third.timestamp());
+  };
+
+  "can_router_no_statistics takes no space"_test = []() {
+    // Setup
+    using plain_route = can_router::route;
+    struct route_without_statistics
+    {
+      can::id_t id;
+      can_router::message_handler handler;
+    };
+
+    // Exercise + Verify
+    expect(that % sizeof(route_without_statistics) == sizeof(plain_route));
+  };
+
+  "basic_can_router<1, can_router_statistics>"_test = []() {
+    // Setup
+    using router_t = basic_can_router<1, can_router_statistics>;
+    mock_can mock;
+    mock_steady_clock clock;
+    auto router =
+      router_t::create(mock, can_router_statistics(clock)).value();
+    auto item1 = router.add_message_callback(0x100, [&clock](const auto&) {
+      clock.m_uptime += 10;
+    });
+    auto item2 = router.add_message_callback(0x200, [&clock](const auto&) {
+      clock.m_uptime += 3;
+    });
+    std::array<router_t::route_snapshot, 4> buffer{};
+
+    // Exercise
+    router(can::message_t{ .id = 0x100 });
+    router(can::message_t{ .id = 0x200 });
+    router(can::message_t{ .id = 0x200 });
+    clock.m_increment = 5;
+    router(can::message_t{ .id = 0x200 });
+    router(can::message_t{ .id = 0x300 });
+    router(can::message_t{ .id = 0x301 });
+    auto snapshot = router.snapshot(buffer);
+    auto truncated = router.snapshot(std::span(buffer).first(1));
+
+    // Verify
+    expect(that % 2 == snapshot.size());
+    expect(that % 1 == truncated.size());
+    expect(that % 0x100 == snapshot[0].id);
+    expect(that % 1 == snapshot[0].statistics.hits);
+    expect(that % 11 == snapshot[0].statistics.last_ticks);
+    expect(that % 11 == snapshot[0].statistics.max_ticks);
+    expect(that % 0x200 == snapshot[1].id);
+    expect(that % 3 == snapshot[1].statistics.hits);
+    expect(that % 8 == snapshot[1].statistics.last_ticks);
+    expect(that % 8 == snapshot[1].statistics.max_ticks);
+    expect(that % 2 == router.statistics().unmatched());
+    expect(that % 1.0_MHz == router.statistics().frequency());
+  };
+
+  "basic_can_router with can_route_move_to_front"_test = []() {
+    // Setup
+    using hot_can_router = basic_can_router<1,
+                                            can_router_no_statistics,
+                                            can_route_move_to_front>;
+    mock_can mock;
+    std::array<can::message_t, 8> storage{};
+    can_receive_queue queue(storage);
+    auto router = hot_can_router::create(mock, queue).value();
+    std::vector<can::id_t> received;
+    auto handler = [&received](const can::message_t& p_message) {
+      received.push_back(p_message.id);
+    };
+    auto route1 = router.add_message_callback(0x100, handler);
+    auto route2 = router.add_message_callback(0x200, handler);
+    auto route3 = router.add_message_callback(0x300, handler);
+
+    // Exercise
+    mock.m_handler(can::message_t{ .id = 0x300 });
+    (void)router.process();
+    const auto front_after_first = router.handlers().begin()->id;
+    mock.m_handler(can::message_t{ .id = 0x300 });
+    mock.m_handler(can::message_t{ .id = 0x300 });
+    mock.m_handler(can::message_t{ .id = 0x300 });
+    mock.m_handler(can::message_t{ .id = 0x555 });
+    (void)router.process();
+    auto& ordering = router.ordering();
+
+    // Verify
+    expect(that % 0x300 == front_after_first);
+    expect(std::vector<can::id_t>{ 0x300, 0x300, 0x300, 0x300 } == received);
+    expect(that % 5 == ordering.lookups());
+    expect(that % 3 == ordering.hits());
+    // 3 to find 0x300, 1 for each hit and 3 for the miss
+    expect(that % 9 == ordering.comparisons());
+    expect(that % 0.6f == ordering.hit_rate());
+    expect(that % 3 == router.size());
+    ordering.reset();
+    expect(that % 0.0f == ordering.hit_rate());
+    expect(that % 0.0f == ordering.average_comparisons());
+  };
+
+  "can_route_move_to_front with routes changed between dispatches"_test =
+    []() {
+      // Setup
+      using hot_can_router = basic_can_router<1,
+                                              can_router_no_statistics,
+                                              can_route_move_to_front>;
+      static_assert(can_route_move_to_front::reorders_routes);
+      static_assert(!can_route_insertion_order::reorders_routes);
+      mock_can mock;
+      std::array<can::message_t, 4> storage{};
+      can_receive_queue queue(storage);
+      auto router = hot_can_router::create(mock, queue).value();
+      std::vector<can::id_t> received;
+      auto handler = [&received](const can::message_t& p_message) {
+        received.push_back(p_message.id);
+      };
+      auto route1 = router.add_message_callback(0x100, handler);
+      std::optional<hot_can_router::route_item> route2;
+      route2.emplace(router.add_message_callback(0x200, handler));
+      std::optional<hot_can_router::route_item> route3;
+
+      // Exercise
+      mock.m_handler(can::message_t{ .id = 0x200 });
+      (void)router.process();
+      route3.emplace(router.add_message_callback(0x300, handler));
+      mock.m_handler(can::message_t{ .id = 0x300 });
+      (void)router.process();
+      std::vector<can::id_t> order_before_removal;
+      for (const auto& route : router.handlers()) {
+        order_before_removal.push_back(route.id);
+      }
+      route2.reset();
+      mock.m_handler(can::message_t{ .id = 0x100 });
+      mock.m_handler(can::message_t{ .id = 0x200 });
+      mock.m_handler(can::message_t{ .id = 0x300 });
+      (void)router.process();
+      std::vector<can::id_t> order;
+      for (const auto& route : router.handlers()) {
+        order.push_back(route.id);
+      }
+
+      // Verify
+      expect(std::vector<can::id_t>{ 0x300, 0x200, 0x100 } ==
+             order_before_removal);
+      expect(std::vector<can::id_t>{ 0x200, 0x300, 0x100, 0x300 } ==
+             received);
+      expect(std::vector<can::id_t>{ 0x300, 0x100 } == order);
+      expect(that % 2 == router.size());
+    };
+
+  "static_can_router table"_test = []() {
+    using router_t = static_can_router<0x7E8, 0x100, 0x18FEF125, 0x101>;
+
+    static_assert(router_t::route_count == 4);
+    static_assert(router_t::ids ==
+                  std::array<can::id_t, 4>{ 0x100, 0x101, 0x7E8, 0x18FEF125 });
+    static_assert(router_t::perfect_hash);
+    static_assert(router_t::index_of(0x100) == 0);
+    static_assert(router_t::index_of(0x101) == 1);
+    static_assert(router_t::index_of(0x7E8) == 2);
+    static_assert(router_t::index_of(0x18FEF125) == 3);
+    static_assert(!router_t::index_of(0x102).has_value());
+    static_assert(!router_t::index_of(0).has_value());
+  };
+
+  "static_can_router dispatch"_test = []() {
+    // Setup
+    mock_can mock;
+    auto router = static_can_router<0x111, 0x222>::create(mock).value();
+    int counter_111 = 0;
+    int counter_222 = 0;
+    can::id_t unmatched = 0;
+    router.set<0x111>([&counter_111](const can::message_t&) { counter_111++; });
+    auto set_status = router.set(
+      0x222, [&counter_222](const can::message_t&) { counter_222++; });
+    auto invalid_status = router.set(0x333, [](const can::message_t&) {});
+    router.on_unmatched([&unmatched](const can::message_t& p_message) {
+      unmatched = p_message.id;
+    });
+
+    // Exercise
+    mock.m_handler(can::message_t{ .id = 0x111 });
+    mock.m_handler(can::message_t{ .id = 0x222 });
+    mock.m_handler(can::message_t{ .id = 0x222 });
+    mock.m_handler(can::message_t{ .id = 0x333 });
+
+    // Verify
+    expect(bool{ set_status });
+    expect(!invalid_status);
+    expect(that % 1 == counter_111);
+    expect(that % 2 == counter_222);
+    expect(that % 0x333 == unmatched);
+    expect(that % 2 == router.handlers().size());
+  };
+
+  "static_can_router deferred"_test = []() {
+    // Setup
+    mock_can mock;
+    std::array<can::message_t, 4> storage{};
+    can_receive_queue queue(storage);
+    auto router = static_can_router<0x111>::create(mock, queue).value();
+    int counter = 0;
+    router.set<0x111>([&counter](const can::message_t&) { counter++; });
+
+    // Exercise
+    mock.m_handler(can::message_t{ .id = 0x111 });
+    mock.m_handler(can::message_t{ .id = 0x111 });
+    const auto before = counter;
+    const auto processed = router.process();
+
+    // Verify
+    expect(that % 0 == before);
+    expect(that % 2 == processed);
+    expect(that % 2 == counter);
+  };
+
+  "can_mailbox keeps latest message"_test = []() {
+    // Setup
+    mock_can mock;
+    auto router = can_router::create(mock).value();
+    can_mailbox mailbox;
+    auto route = router.add_message_callback(0x100, std::ref(mailbox));
+    const auto empty = mailbox.read();
+
+    // Exercise
+    mock.m_handler(
+      can::message_t{ .id = 0x100, .payload = { 1 }, .length = 1 });
+    mock.m_handler(
+      can::message_t{ .id = 0x100, .payload = { 2, 3 }, .length = 2 });
+    mock.m_handler(
+      can::message_t{ .id = 0x200, .payload = { 4 }, .length = 1 });
+    const auto latest = mailbox.read();
+
+    // Verify
+    expect(that % 0 == empty.sequence);
+    expect(that % 0 == empty.message.length);
+    expect(that % 2 == latest.sequence);
+    expect(that % 2 == mailbox.sequence());
+    expect(can::message_t{ .id = 0x100, .payload = { 2, 3 }, .length = 2 } ==
+           latest.message);
+  };
+
+  "can_mailbox_table"_test = []() {
+    // Setup
+    mock_can mock;
+    auto router = basic_can_router<4>::create(mock).value();
+    can_mailbox_table<basic_can_router<4>, 2> table(router);
+
+    // Exercise
+    auto first = table.subscribe(0x100);
+    auto second = table.subscribe(0x200);
+    auto duplicate = table.subscribe(0x100);
+    auto full = table.subscribe(0x300);
+    const auto* mailbox = table.find(0x200);
+    mock.m_handler(
+      can::message_t{ .id = 0x200, .payload = { 9 }, .length = 1 });
+    mock.m_handler(
+      can::message_t{ .id = 0x300, .payload = { 7 }, .length = 1 });
+
+    // Verify
+    expect(first && second);
+    expect(!duplicate);
+    expect(!full);
+    expect(that % 2 == table.size());
+    expect(that % 2 == router.size());
+    expect(mailbox != nullptr);
+    expect(that % 1 == mailbox->sequence());
+    expect(that % 9 == table.read(0x200)->message.payload[0]);
+    expect(that % 0 == table.read(0x100)->sequence);
+    expect(!table.read(0x300).has_value());
+    expect(table.find(0x300) == nullptr);
+  };
+
+  "can_mailbox_table removes routes on destruction"_test = []() {
+    // Setup
+    mock_can mock;
+    auto router = can_router::create(mock).value();
+
+    // Exercise
+    {
+      can_mailbox_table<can_router, 4> table(router);
+      (void)table.subscribe(0x100);
+      (void)table.subscribe(0x101);
+      expect(that % 2 == router.size());
+    }
+
+    // Verify
+    expect(that % 0 == router.size());
+  };
+
+  "can_frame_bits_worst_case()"_test = []() {
+    static_assert(can_frame_bits_unstuffed(8, can_id_format::standard) == 111);
+    static_assert(can_frame_bits_unstuffed(8, can_id_format::extended) == 131);
+    static_assert(can_frame_bits_unstuffed(8, can_id_format::standard, true) ==
+                  47);
+    static_assert(can_frame_bits_worst_case(8, can_id_format::standard) == 135);
+    static_assert(can_frame_bits_worst_case(8, can_id_format::extended) == 160);
+    static_assert(can_frame_bits_worst_case(0, can_id_format::standard) == 55);
+    static_assert(can_frame_bits_worst_case(12, can_id_format::standard) ==
+                  135);
+  };
+
+  "can_frame_bits()"_test = []() {
+    static_assert(can_frame_bits(can::message_t{ .id = 0, .length = 8 }) ==
+                  127);
+    static_assert(
+      can_frame_bits(can::message_t{ .id = 0x7FF,
+                                     .payload = { 0xFF, 0xFF, 0xFF, 0xFF,
+                                                  0xFF, 0xFF, 0xFF, 0xFF },
+                                     .length = 8 }) == 126);
+    static_assert(
+      can_frame_bits(can::message_t{
+        .id = 0x123, .payload = { 0x11, 0x22, 0x33, 0x44 }, .length = 4 }) ==
+      80);
+    static_assert(
+      can_frame_bits(can::message_t{ .id = 0x18FEF125,
+                                     .payload = { 1, 2, 3, 4, 5, 6, 7, 8 },
+                                     .length = 8 }) == 141);
+    static_assert(can_frame_bits(can::message_t{ .id = 0x100 }) == 51);
+    static_assert(can_frame_bits(can::message_t{ .id = 0x100,
+                                                 .payload = { 1, 2 },
+                                                 .length = 2,
+                                                 .is_remote_request = true }) ==
+                  49);
+    static_assert(can_id_format_of(0x7FF) == can_id_format::standard);
+    static_assert(can_id_format_of(0x800) == can_id_format::extended);
+  };
+
+  "can_wire_time()"_test = []() {
+    using namespace std::chrono_literals;
+    const can::message_t message{ .id = 0x123,
+                                  .payload = { 0x11, 0x22, 0x33, 0x44 },
+                                  .length = 4 };
+
+    expect(that % 270'000 == can_wire_time(135, 500.0_kHz).count());
+    expect(that % 80'000 ==
+           can_wire_time(message, can::settings{ .baud_rate = 1.0_MHz })
+             .count());
+  };
+
+  "can_bus_load_meter on router"_test = []() {
+    // Setup
+    mock_can mock;
+    mock_steady_clock clock;
+    clock.m_increment = 0;
+    auto router = can_router::create(mock).value();
+    can_bus_load_meter meter(clock, 1.0_MHz);
+    router.on_message(std::ref(meter));
+    const can::message_t message{ .id = 0x123,
+                                  .payload = { 0x11, 0x22, 0x33, 0x44 },
+                                  .length = 4 };
+
+    // Exercise
+    auto first = meter.sample();
+    for (int i = 0; i < 5; i++) {
+      mock.m_handler(message);
+    }
+    clock.m_uptime += 1000;
+    auto half = meter.sample();
+    clock.m_uptime += 1000;
+    auto idle = meter.sample();
+    auto no_time = meter.sample();
+
+    // Verify
+    expect(that % 0.0f == first.value());
+    expect(std::abs(half.value() - 0.4f) < 0.0001f);
+    expect(that % 0.0f == idle.value());
+    expect(that % 0.0f == no_time.value());
+    expect(half.value() == meter.peak());
+    expect(that % 400 == meter.bits());
+  };
+
+  "static_can_router on_message"_test = []() {
+    // Setup
+    mock_can mock;
+    auto router = static_can_router<0x111>::create(mock).value();
+    int seen = 0;
+    router.on_message([&seen](const can::message_t&) { seen++; });
+
+    // Exercise
+    mock.m_handler(can::message_t{ .id = 0x111 });
+    mock.m_handler(can::message_t{ .id = 0x222 });
+
+    // Verify
+    expect(that % 2 == seen);
+  };
+
+  "can_router timestamps messages on receive"_test = []() {
+    // Setup
+    mock_can mock;
+    mock_steady_clock clock;
+    clock.m_uptime = 1'000;
+    clock.m_increment = 10;
+    can_steady_clock_timestamp source(clock);
+    auto router = can_router::create(mock).value();
+    router.timestamp_with(std::ref(source));
+    std::vector<std::uint64_t> timestamps;
+    auto item = router.add_message_callback(
+      0x100, [&timestamps, &router](const can::message_t&) {
+        timestamps.push_back(router.timestamp());
+      });
+
+    // Exercise
+    mock.m_handler(can::message_t{ .id = 0x100 });
+    mock.m_handler(can::message_t{ .id = 0x100 });
+
+    // Verify
+    expect(std::vector<std::uint64_t>{ 1'000, 1'010 } == timestamps);
+  };
+
+  "can_router keeps timestamps through the receive queue"_test = []() {
+    // Setup
+    mock_can mock;
+    std::array<can::message_t, 4> storage{};
+    std::array<std::uint64_t, 4> timestamp_storage{};
+    can_receive_queue queue(storage, timestamp_storage);
+    volatile std::uint32_t counter = 0xFFFF'FFF0;
+    can_counter_timestamp source(counter);
+    auto router = static_can_router<0x100>::create(mock, queue).value();
+    router.timestamp_with(std::ref(source));
+    std::vector<std::uint64_t> timestamps;
+    router.set<0x100>([&timestamps, &router](const can::message_t&) {
+      timestamps.push_back(router.timestamp());
+    });
+
+    // Exercise
+    mock.m_handler(can::message_t{ .id = 0x100 });
+    counter = 0x0000'0010;
+    mock.m_handler(can::message_t{ .id = 0x100 });
+    const auto processed = router.process();
+
+    // Verify
+    expect(that % 2 == processed);
+    expect(std::vector<std::uint64_t>{ 0xFFFF'FFF0, 0x1'0000'0010 } ==
+           timestamps);
+  };
+
+  "can_receive_queue without timestamp storage"_test = []() {
+    // Setup
+    std::array<can::message_t, 4> storage{};
+    std::array<std::uint64_t, 2> wrong_size{};
+    can_receive_queue queue(storage, wrong_size);
+    std::uint64_t timestamp = 1;
+
+    // Exercise
+    (void)queue.push(can::message_t{ .id = 0x100 }, 55);
+    queue.drain([&timestamp](const can::message_t&, std::uint64_t p_time) {
+      timestamp = p_time;
+    });
+
+    // Verify
+    expect(that % 0 == timestamp);
+    expect(that % 0 == wrong_size[0]);
+  };
+
+  "can_transmit_queue sends lowest ID first"_test = []() {
+    // Setup
+    mock_can mock;
+    can_transmit_queue<8> queue(mock);
+    std::vector<std::pair<can::id_t, hal::byte>> sent;
+
+    // Exercise
+    queue.push({ .id = 0x300, .payload = { 1 }, .length = 1 });
+    queue.push({ .id = 0x100, .payload = { 2 }, .length = 1 });
+    queue.push({ .id = 0x300, .payload = { 3 }, .length = 1 });
+    queue.push({ .id = 0x200, .payload = { 4 }, .length = 1 });
+    queue.push({ .id = 0x100, .payload = { 5 }, .length = 1 });
+    const auto front_id = queue.front()->id;
+    const auto depth = queue.size();
+    auto first_burst = queue.flush(2);
+    sent.emplace_back(mock.m_message.id, mock.m_message.payload[0]);
+    while (queue.size() > 0) {
+      (void)queue.flush(1);
+      sent.emplace_back(mock.m_message.id, mock.m_message.payload[0]);
+    }
+
+    // Verify
+    expect(that % 0x100 == front_id);
+    expect(that % 5 == depth);
+    expect(that % 2 == first_burst.value());
+    const std::vector<std::pair<can::id_t, hal::byte>> expected{
+      { 0x100, 5 }, { 0x200, 4 }, { 0x300, 1 }, { 0x300, 3 }
+    };
+    expect(expected == sent);
+    expect(that % 5 == queue.sent());
+    expect(that % 5 == queue.peak_size());
+    expect(that % 0 == queue.dropped());
+    expect(queue.front() == nullptr);
+  };
+
+  "can_transmit_queue full evicts lowest priority"_test = []() {
+    // Setup
+    mock_can mock;
+    can_transmit_queue<3> queue(mock);
+
+    // Exercise
+    const bool first = queue.push({ .id = 0x10 });
+    const bool second = queue.push({ .id = 0x30 });
+    const bool third = queue.push({ .id = 0x20 });
+    const bool rejected = queue.push({ .id = 0x40 });
+    const bool evicting = queue.push({ .id = 0x05 });
+    std::vector<can::id_t> sent;
+    while (queue.size() > 0) {
+      (void)queue.flush(1);
+      sent.push_back(mock.m_message.id);
+    }
+
+    // Verify
+    expect(first && second && third);
+    expect(!rejected);
+    expect(evicting);
+    expect(that % 2 == queue.dropped());
+    expect(that % 3 == queue.peak_size());
+    expect(std::vector<can::id_t>{ 0x05, 0x10, 0x20 } == sent);
+  };
+
+  "can_transmit_queue keeps message on send failure"_test = []() {
+    // Setup
+    mock_can mock;
+    can_transmit_queue<4> queue(mock);
+    queue.push({ .id = 0x10 });
+    queue.push({ .id = 0x20 });
+    queue.push({ .id = 0x30 });
+
+    // Exercise
+    mock.m_sends_before_error = 1;
+    auto failed = queue.flush();
+    const auto sent_before_retry = queue.sent();
+    const auto size_before_retry = queue.size();
+    mock.m_sends_before_error.reset();
+    auto retried = queue.flush();
+
+    // Verify
+    expect(!failed);
+    expect(that % 1 == sent_before_retry);
+    expect(that % 2 == size_before_retry);
+    expect(that % 2 == retried.value());
+    expect(that % 0x30 == mock.m_message.id);
+    expect(that % 3 == queue.sent());
+  };
 };
-}  // namespace hal
\ No newline at end of file
+}  // namespace hal
@@ -0,0 +1,390 @@
+#include <libhal-util/can_log.hpp>
+
+#include <array>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <boost/ut.hpp>
+
+namespace hal {
+namespace {
+class mock_steady_clock : public hal::steady_clock
+{
+public:
+  std::uint64_t m_uptime = 0;
+
+private:
+  hertz driver_frequency() override
+  {
+    return 1.0_MHz;
+  }
+
+  result<std::uint64_t> driver_uptime() override
+  {
+    return m_uptime;
+  }
+};
+}  // namespace
+
+void can_log_test()
+{
+  using namespace boost::ut;
+  using namespace std::chrono_literals;
+
+  "can_log_writer and can_log_reader round trip"_test = []() {
+    // Setup
+    const std::array<can_log_record, 3> records{
+      can_log_record{ .timestamp = 100us,
+                      .message = { .id = 0x123,
+                                   .payload = { 1, 2, 3, 4, 5, 6, 7, 8 },
+                                   .length = 8 } },
+      can_log_record{
+        .timestamp = 5'000'000us,
+        .message = { .id = 0x18FEF125, .payload = { 0xAA }, .length = 1 } },
+      can_log_record{ .timestamp = 5'000'000us,
+                      .message = { .id = 0x7DF,
+                                   .length = 3,
+                                   .is_remote_request = true } },
+    };
+    can_log_writer writer;
+    can_log_reader reader;
+    std::array<hal::byte, 3 * can_log_writer::max_record_size> buffer{};
+    std::size_t size = 0;
+
+    // Exercise
+    std::vector<std::size_t> sizes;
+    for (const auto& record : records) {
+      auto written =
+        writer.write(record, std::span(buffer).subspan(size)).value();
+      sizes.push_back(written.size());
+      size += written.size();
+    }
+
+    std::vector<can_log_record> decoded;
+    auto log = std::span<const hal::byte>(buffer).first(size);
+    while (!log.empty()) {
+      can_log_record record{};
+      auto consumed = reader.read(log, record).value();
+      if (consumed == 0) {
+        break;
+      }
+      decoded.push_back(record);
+      log = log.subspan(consumed);
+    }
+
+    // Verify
+    // flags + 1 byte delta + 2 byte ID + payload
+    expect(that % 12 == sizes[0]);
+    // flags + 4 byte delta + 5 byte ID + payload
+    expect(that % 11 == sizes[1]);
+    // flags + 1 byte delta + 2 byte ID, remote requests have no payload
+    expect(that % 4 == sizes[2]);
+    expect(that % 3 == decoded.size());
+    for (std::size_t i = 0; i < decoded.size(); i++) {
+      expect(records[i].timestamp == decoded[i].timestamp);
+      expect(records[i].message == decoded[i].message);
+    }
+  };
+
+  "can_log_writer errors"_test = []() {
+    // Setup
+    can_log_writer writer;
+    std::array<hal::byte, 4> small{};
+    std::array<hal::byte, can_log_writer::max_record_size> buffer{};
+    const can_log_record record{
+      .timestamp = 10us,
+      .message = { .id = 0x100, .payload = { 1, 2 }, .length = 2 },
+    };
+
+    // Exercise
+    auto too_small = writer.write(record, small);
+    auto written = writer.write(record, buffer);
+    auto out_of_order =
+      writer.write(can_log_record{ .timestamp = 9us }, buffer);
+
+    // Verify
+    expect(!too_small);
+    expect(bool{ written });
+    expect(!out_of_order);
+  };
+
+  "can_log_reader partial and malformed data"_test = []() {
+    // Setup
+    can_log_writer writer;
+    can_log_reader reader;
+    std::array<hal::byte, can_log_writer::max_record_size> buffer{};
+    const can_log_record record{
+      .timestamp = 1us,
+      .message = { .id = 0x100, .payload = { 9, 8, 7 }, .length = 3 },
+    };
+    auto encoded = writer.write(record, buffer).value();
+    const std::array<hal::byte, 2> bad_flags{ 0x09, 0x00 };
+    can_log_record decoded{};
+
+    // Exercise
+    std::vector<std::size_t> partial;
+    for (std::size_t i = 0; i < encoded.size(); i++) {
+      partial.push_back(reader.read(encoded.first(i), decoded).value());
+    }
+    auto whole = reader.read(encoded, decoded);
+    auto malformed = reader.read(bad_flags, decoded);
+
+    // Verify
+    expect(std::vector<std::size_t>(encoded.size(), 0) == partial);
+    expect(that % encoded.size() == whole.value());
+    expect(record.message == decoded.message);
+    expect(!malformed);
+  };
+
+  "can_log_reader rejects malformed varints"_test = []() {
+    // Setup
+    can_log_reader reader;
+    can_log_record decoded{};
+    // Flags byte followed by a delta varint
+    std::array<hal::byte, 11> ten_continuations{};
+    ten_continuations.fill(0x80);
+    ten_continuations[0] = 0x00;
+    std::array<hal::byte, 11> overflow{};
+    overflow.fill(0xFF);
+    overflow[0] = 0x00;
+    overflow[10] = 0x02;
+    const std::array<hal::byte, 4> overlong{ 0x00, 0x81, 0x00, 0x01 };
+    const std::array<hal::byte, 10> nine_continuations{
+      0x00, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80
+    };
+
+    // Exercise
+    auto too_long = reader.read(ten_continuations, decoded);
+    auto too_large = reader.read(overflow, decoded);
+    auto not_minimal = reader.read(overlong, decoded);
+    auto incomplete = reader.read(nine_continuations, decoded);
+
+    // Verify
+    expect(!too_long);
+    expect(!too_large);
+    expect(!not_minimal);
+    expect(that % 0 == incomplete.value());
+  };
+
+  "can_log_timestamp()"_test = []() {
+    static_assert(can_log_timestamp(48'000'000, 48.0_MHz) == 1s);
+    static_assert(can_log_timestamp(24, 48.0_MHz) == 0us);
+    static_assert(can_log_timestamp(48, 48.0_MHz) == 1us);
+    // 2^63 ticks of a 1GHz clock would overflow a naive ticks * 1e6
+    static_assert(can_log_timestamp(1ULL << 62, 1000.0_MHz) ==
+                  std::chrono::microseconds((1ULL << 62) / 1000));
+  };
+
+  "can_log_capture"_test = []() {
+    // Setup
+    mock_steady_clock clock;
+    std::array<hal::byte, 20> buffer{};
+    can_log_capture capture(clock, buffer);
+    can_log_reader reader;
+    can_log_record first{};
+    can_log_record second{};
+
+    // Exercise
+    clock.m_uptime = 1'000;
+    capture(can::message_t{ .id = 0x10, .payload = { 1 }, .length = 1 });
+    clock.m_uptime = 2'500;
+    capture(can::message_t{ .id = 0x20, .payload = { 2 }, .length = 1 });
+    // Does not fit in the buffer
+    capture(can::message_t{ .id = 0x30, .length = 8 });
+    auto log = capture.data();
+    auto first_size = reader.read(log, first).value();
+    auto second_size = reader.read(log.subspan(first_size), second).value();
+    capture.clear();
+
+    // Verify
+    expect(that % 1 == capture.dropped());
+    expect(that % log.size() == first_size + second_size);
+    expect(1'000us == first.timestamp);
+    expect(that % 0x10 == first.message.id);
+    expect(2'500us == second.timestamp);
+    expect(that % 0x20 == second.message.id);
+    expect(capture.data().empty());
+  };
+
+  "format_candump()"_test = []() {
+    // Setup
+    std::array<char, 64> buffer{};
+    std::array<char, 10> small{};
+
+    // Exercise
+    auto standard = format_candump(
+      { .timestamp = 1'436'509'052'249'713us,
+        .message = { .id = 0x123,
+                     .payload = { 0x11, 0x22, 0x33, 0x44 },
+                     .length = 4 } },
+      buffer);
+    auto standard_text = std::string(standard.value());
+    auto extended = format_candump(
+      { .timestamp = 5us,
+        .message = { .id = 0x18FEF125, .payload = { 0xAB }, .length = 1 } },
+      buffer,
+      "vcan1");
+    auto extended_text = std::string(extended.value());
+    auto remote = format_candump(
+      { .message = { .id = 0x7DF, .length = 2, .is_remote_request = true } },
+      buffer);
+    auto remote_text = std::string(remote.value());
+    auto too_small = format_candump({}, small);
+
+    // Verify
+    expect("(1436509052.249713) can0 123#11223344" == standard_text);
+    expect("(0.000005) vcan1 18FEF125#AB" == extended_text);
+    expect("(0.000000) can0 7DF#R" == remote_text);
+    expect(!too_small);
+  };
+
+  "parse_candump()"_test = []() {
+    // Exercise
+    auto standard = parse_candump("(1436509052.249713) can0 123#11223344\n");
+    auto extended = parse_candump("(0.000005) vcan1 18FEF125#AB");
+    auto remote = parse_candump("(0.000000) can0 7DF#R2");
+    auto empty = parse_candump("(0.000000) can0 100#");
+    auto bad_data = parse_candump("(0.000000) can0 100#123");
+    auto bad_time = parse_candump("0.000000 can0 100#12");
+    auto no_interface = parse_candump("(0.000000)");
+
+    // Verify
+    expect(1'436'509'052'249'713us == standard.value().timestamp);
+    expect(can::message_t{ .id = 0x123,
+                           .payload = { 0x11, 0x22, 0x33, 0x44 },
+                           .length = 4 } == standard.value().message);
+    expect(5us == extended.value().timestamp);
+    expect(can::message_t{ .id = 0x18FEF125,
+                           .payload = { 0xAB },
+                           .length = 1 } == extended.value().message);
+    expect(can::message_t{ .id = 0x7DF,
+                           .length = 2,
+                           .is_remote_request = true } ==
+           remote.value().message);
+    expect(that % 0 == empty.value().message.length);
+    expect(!bad_data);
+    expect(!bad_time);
+    expect(!no_interface);
+  };
+
+  "can_log_replay"_test = []() {
+    // Setup
+    mock_steady_clock clock;
+    can_log_writer writer;
+    std::array<hal::byte, 3 * can_log_writer::max_record_size> buffer{};
+    std::size_t size = 0;
+    for (auto [timestamp, id] : { std::pair{ 10'000us, 0x100U },
+                                  std::pair{ 11'000us, 0x200U },
+                                  std::pair{ 13'000us, 0x300U } }) {
+      size += writer
+                .write({ .timestamp = timestamp, .message = { .id = id } },
+                       std::span(buffer).subspan(size))
+                .value()
+                .size();
+    }
+    auto log = std::span<const hal::byte>(buffer).first(size);
+    can_log_replay replay(log, clock, 2.0f);
+    std::vector<can::id_t> received;
+    (void)replay.on_receive([&received](const can::message_t& p_message) {
+      received.push_back(p_message.id);
+    });
+
+    // Exercise
+    clock.m_uptime = 50'000;
+    auto first = replay();
+    auto after_first = received.size();
+    clock.m_uptime += 499;
+    auto early = replay();
+    auto after_early = received.size();
+    clock.m_uptime += 1;
+    auto second = replay();
+    auto after_second = received.size();
+    clock.m_uptime += 1'000;
+    auto last = replay();
+    (void)replay.send({});
+
+    // Verify
+    expect(work_state::in_progress == first.value());
+    expect(that % 1 == after_first);
+    expect(work_state::in_progress == early.value());
+    expect(that % 1 == after_early);
+    expect(work_state::in_progress == second.value());
+    expect(that % 2 == after_second);
+    expect(work_state::finished == last.value());
+    expect(std::vector<can::id_t>{ 0x100, 0x200, 0x300 } == received);
+    expect(that % 3 == replay.delivered());
+    expect(that % 1 == replay.sent());
+  };
+
+  "can_log_replay keeps microsecond timing in long logs"_test = []() {
+    // Setup
+    mock_steady_clock clock;
+    can_log_writer writer;
+    std::array<hal::byte, 2 * can_log_writer::max_record_size> buffer{};
+    auto first = writer
+                   .write({ .timestamp = 0us, .message = { .id = 0x100 } },
+                          buffer)
+                   .value();
+    // 35 minutes in, where float steps in 128us
+    auto second =
+      writer
+        .write({ .timestamp = 2'100'000'050us, .message = { .id = 0x200 } },
+               std::span(buffer).subspan(first.size()))
+        .value();
+    auto log =
+      std::span<const hal::byte>(buffer).first(first.size() + second.size());
+    can_log_replay replay(log, clock, 1.0f);
+    std::vector<can::id_t> received;
+    (void)replay.on_receive([&received](const can::message_t& p_message) {
+      received.push_back(p_message.id);
+    });
+
+    // Exercise
+    auto started = replay();
+    clock.m_uptime = 2'100'000'000;
+    auto early = replay();
+    auto after_early = received.size();
+    clock.m_uptime = 2'100'000'050;
+    auto last = replay();
+
+    // Verify
+    expect(work_state::in_progress == started.value());
+    expect(work_state::in_progress == early.value());
+    expect(that % 1 == after_early);
+    expect(work_state::finished == last.value());
+    expect(std::vector<can::id_t>{ 0x100, 0x200 } == received);
+  };
+
+  "can_log_replay as fast as possible into a router"_test = []() {
+    // Setup
+    mock_steady_clock clock;
+    can_log_writer writer;
+    std::array<hal::byte, 2 * can_log_writer::max_record_size> buffer{};
+    auto first = writer
+                   .write({ .timestamp = 1s, .message = { .id = 0x100 } },
+                          buffer)
+                   .value();
+    auto second = writer
+                    .write({ .timestamp = 60s, .message = { .id = 0x100 } },
+                           std::span(buffer).subspan(first.size()))
+                    .value();
+    auto log =
+      std::span<const hal::byte>(buffer).first(first.size() + second.size());
+    can_log_replay replay(log, clock, 0.0f);
+    auto router = can_router::create(replay).value();
+    int counter = 0;
+    auto route =
+      router.add_message_callback(0x100, [&counter](const can::message_t&) {
+        counter++;
+      });
+
+    // Exercise
+    auto state = replay();
+
+    // Verify
+    expect(work_state::finished == state.value());
+    expect(that % 2 == counter);
+  };
+};
+}  // namespace hal
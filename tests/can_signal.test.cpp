@@ -0,0 +1,256 @@
+#include <libhal-util/can_signal.hpp>
+
+#include <cstdint>
+#include <limits>
+
+#include <libhal-util/can.hpp>
+
+#include <boost/ut.hpp>
+
+namespace hal {
+namespace {
+enum class gear : std::uint8_t
+{
+  park = 0,
+  reverse = 1,
+  neutral = 2,
+  drive = 3,
+};
+
+struct engine_status
+{
+  float speed = 0.0f;
+  float coolant_temperature = 0.0f;
+  std::int16_t torque = 0;
+  gear selected_gear = gear::park;
+  bool running = false;
+};
+
+constexpr can_message_codec engine_status_codec{
+  can_field(&engine_status::speed,
+            { .start_bit = 24, .length = 16, .scale = 0.125f }),
+  can_field(&engine_status::coolant_temperature,
+            { .start_bit = 0, .length = 8, .offset = -40.0f }),
+  can_field(&engine_status::torque,
+            { .start_bit = 8, .length = 12, .is_signed = true }),
+  can_field(&engine_status::selected_gear, { .start_bit = 20, .length = 2 }),
+  can_field(&engine_status::running, { .start_bit = 47 }),
+};
+}  // namespace
+
+void can_signal_test()
+{
+  using namespace boost::ut;
+
+  "can_payload_words"_test = []() {
+    constexpr can::message_t message{
+      .id = 0,
+      .payload = { 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08 },
+      .length = 8,
+    };
+    constexpr auto words = can_payload_words::load(message);
+    static_assert(words.little_endian == 0x0807060504030201ULL);
+    static_assert(words.big_endian == 0x0102030405060708ULL);
+
+    can::message_t stored{};
+    words.store(stored);
+    expect(message.payload == stored.payload);
+  };
+
+  "little endian signals"_test = []() {
+    constexpr can::message_t message{
+      .id = 0,
+      .payload = { 0xFE, 0x3F, 0x00, 0x40, 0x1F, 0, 0, 0 },
+      .length = 8,
+    };
+    constexpr auto words = can_payload_words::load(message);
+    constexpr can_signal whole_byte{ .start_bit = 0, .length = 8 };
+    constexpr can_signal signed_byte{ .start_bit = 0,
+                                      .length = 8,
+                                      .is_signed = true };
+    constexpr can_signal speed{ .start_bit = 24,
+                                .length = 16,
+                                .scale = 0.125f };
+    constexpr can_signal across_bytes{ .start_bit = 12, .length = 4 };
+
+    static_assert(whole_byte.decode_raw(words) == 0xFE);
+    static_assert(signed_byte.decode_raw(words) == -2);
+    static_assert(speed.decode_raw(words) == 0x1F40);
+    static_assert(speed.decode(words) == 1000.0f);
+    static_assert(across_bytes.decode_raw(words) == 0x3);
+    static_assert(speed.bytes_used() == 5);
+  };
+
+  "big endian signals"_test = []() {
+    constexpr can::message_t message{
+      .id = 0,
+      .payload = { 0xA5, 0x5A, 0xF0, 0x00, 0, 0, 0, 0 },
+      .length = 8,
+    };
+    constexpr auto words = can_payload_words::load(message);
+    // Bytes 0 and 1, byte 0 is most significant
+    constexpr can_signal word{ .start_bit = 7,
+                               .length = 16,
+                               .byte_order = can_byte_order::big_endian };
+    // Lower nibble of byte 0 followed by byte 1
+    constexpr can_signal twelve_bits{
+      .start_bit = 3, .length = 12, .byte_order = can_byte_order::big_endian
+    };
+    // Upper nibble of byte 2
+    constexpr can_signal nibble{ .start_bit = 23,
+                                 .length = 4,
+                                 .byte_order = can_byte_order::big_endian,
+                                 .is_signed = true };
+
+    static_assert(word.decode_raw(words) == 0xA55A);
+    static_assert(twelve_bits.decode_raw(words) == 0x55A);
+    static_assert(nibble.decode_raw(words) == -1);
+    static_assert(word.bytes_used() == 2);
+    static_assert(twelve_bits.bytes_used() == 2);
+    static_assert(nibble.bytes_used() == 3);
+  };
+
+  "encode saturates and rounds"_test = []() {
+    constexpr can_signal temperature{ .start_bit = 0,
+                                      .length = 8,
+                                      .offset = -40.0f };
+    constexpr can_signal signed_signal{
+      .start_bit = 8,
+      .length = 4,
+      .byte_order = can_byte_order::big_endian,
+      .is_signed = true,
+      .scale = 0.5f,
+    };
+    can_payload_words words;
+
+    temperature.encode(words, 300.0f);
+    expect(that % 255 == temperature.decode_raw(words));
+    temperature.encode(words, -100.0f);
+    expect(that % 0 == temperature.decode_raw(words));
+    temperature.encode(words, 20.4f);
+    expect(that % 60 == temperature.decode_raw(words));
+    signed_signal.encode(words, -1.4f);
+    expect(that % -3 == signed_signal.decode_raw(words));
+    signed_signal.encode(words, 10.0f);
+    expect(that % 7 == signed_signal.decode_raw(words));
+    signed_signal.encode(words, -10.0f);
+    expect(that % -8 == signed_signal.decode_raw(words));
+    // Neighbouring signal is untouched
+    expect(that % 60 == temperature.decode_raw(words));
+  };
+
+  "encode saturates wide signals"_test = []() {
+    constexpr can_signal unsigned_32{ .start_bit = 0, .length = 32 };
+    constexpr can_signal signed_32{ .start_bit = 32,
+                                    .length = 32,
+                                    .is_signed = true };
+    constexpr can_signal signed_64{ .start_bit = 0,
+                                    .length = 64,
+                                    .is_signed = true };
+    can_payload_words words;
+
+    static_assert(signed_64.min_raw() == INT64_MIN);
+    static_assert(signed_64.max_raw() == INT64_MAX);
+    static_assert(signed_32.min_raw() == INT32_MIN);
+
+    unsigned_32.encode(words, 1e12f);
+    expect(that % 4294967295 == unsigned_32.decode_raw(words));
+    unsigned_32.encode(words, -1e12f);
+    expect(that % 0 == unsigned_32.decode_raw(words));
+    unsigned_32.encode(words, 4294967040.0f);
+    expect(that % 4294967040 == unsigned_32.decode_raw(words));
+    signed_32.encode(words, 1e12f);
+    expect(that % INT32_MAX == signed_32.decode_raw(words));
+    signed_32.encode(words, -1e12f);
+    expect(that % INT32_MIN == signed_32.decode_raw(words));
+    signed_32.encode(words, std::numeric_limits<float>::quiet_NaN());
+    expect(that % 0 == signed_32.decode_raw(words));
+
+    signed_64.encode(words, 1e30);
+    expect(that % INT64_MAX == signed_64.decode_raw(words));
+    signed_64.encode(words, -1e30);
+    expect(that % INT64_MIN == signed_64.decode_raw(words));
+  };
+
+  "is_valid() rejects signals beyond the payload"_test = []() {
+    static_assert(can_signal{ .start_bit = 0, .length = 64 }.is_valid());
+    static_assert(can_signal{ .start_bit = 56, .length = 8 }.is_valid());
+    static_assert(!can_signal{ .start_bit = 0, .length = 0 }.is_valid());
+    static_assert(!can_signal{ .start_bit = 0, .length = 65 }.is_valid());
+    static_assert(!can_signal{ .start_bit = 60, .length = 8 }.is_valid());
+    static_assert(!can_signal{ .start_bit = 64, .length = 1 }.is_valid());
+    static_assert(can_signal{ .start_bit = 7,
+                              .length = 64,
+                              .byte_order = can_byte_order::big_endian }
+                    .is_valid());
+    static_assert(!can_signal{ .start_bit = 58,
+                               .length = 4,
+                               .byte_order = can_byte_order::big_endian }
+                     .is_valid());
+  };
+
+  "invalid signals decode as 0 and are not encoded"_test = []() {
+    // Setup
+    const can_signal empty{ .start_bit = 0, .length = 0, .is_signed = true };
+    const can_signal overflowing{ .start_bit = 60, .length = 8 };
+    const can_signal big_endian{ .start_bit = 58,
+                                 .length = 4,
+                                 .byte_order = can_byte_order::big_endian,
+                                 .is_signed = true };
+    const can_payload_words words{ .little_endian = ~std::uint64_t{ 0 },
+                                   .big_endian = ~std::uint64_t{ 0 } };
+    can_payload_words encoded{};
+
+    // Exercise
+    empty.encode(encoded, 1.0f);
+    overflowing.encode_raw(encoded, 0xFF);
+    big_endian.encode(encoded, -1.0f);
+
+    // Verify
+    expect(that % 0 == empty.decode_raw(words));
+    expect(that % 0 == overflowing.decode_raw(words));
+    expect(that % 0 == big_endian.decode_raw(words));
+    expect(that % 0 == encoded.little_endian);
+    expect(that % 0 == encoded.big_endian);
+    expect(that % 0 == empty.min_raw());
+    expect(that % 0 == big_endian.max_raw());
+    expect(that % 0 == overflowing.bytes_used());
+  };
+
+  "can_message_codec round trip"_test = []() {
+    // Setup
+    const engine_status engine{
+      .speed = 1500.5f,
+      .coolant_temperature = 90.0f,
+      .torque = -300,
+      .selected_gear = gear::drive,
+      .running = true,
+    };
+
+    // Exercise
+    const auto message = engine_status_codec.encode(engine, 0x0CF00400);
+    const auto decoded = engine_status_codec.decode(message);
+
+    // Verify
+    expect(that % 0x0CF00400 == message.id);
+    expect(that % 6 == message.length);
+    expect(that % 130 == message.payload[0]);
+    expect(that % engine.speed == decoded.speed);
+    expect(that % engine.coolant_temperature == decoded.coolant_temperature);
+    expect(that % engine.torque == decoded.torque);
+    expect(engine.selected_gear == decoded.selected_gear);
+    expect(decoded.running);
+  };
+
+  "can_message_codec is constexpr"_test = []() {
+    constexpr engine_status engine{ .speed = 8.0f, .running = true };
+    constexpr auto message = engine_status_codec.encode(engine, 0x100);
+    constexpr auto decoded = engine_status_codec.decode(message);
+    static_assert(message.payload[3] == 64);
+    static_assert(decoded.speed == 8.0f);
+    static_assert(decoded.coolant_temperature == 0.0f);
+    static_assert(message.payload[0] == 40);
+    static_assert(decoded.running);
+  };
+};
+}  // namespace hal
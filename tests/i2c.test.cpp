@@ -1,5 +1,8 @@
 #include <libhal-util/i2c.hpp>
 
+#include <algorithm>
+#include <vector>
+
 #include <libhal/functional.hpp>
 
 #include <boost/ut.hpp>
@@ -324,5 +327,216 @@ void i2c_util_test()
     expect(that % 0 == i2c.m_out.size());
     expect(that % nullptr == i2c.m_out.data());
   };
+  "[success] segmented_transaction joins contiguous segments"_test = []() {
+    // Setup
+    test_i2c i2c;
+    std::array<hal::byte, 5> buffer{ 0x10, 0xAA, 0xBB, 0, 0 };
+    auto buffer_span = std::span(buffer);
+    const std::array segments{
+      i2c_write(buffer_span.first(1)),
+      i2c_write(buffer_span.subspan(1, 2)),
+      i2c_read(buffer_span.subspan(3, 1)),
+      i2c_read(buffer_span.subspan(4, 1)),
+    };
+
+    // Exercise
+    auto result = segmented_transaction(
+      i2c, successful_address, segments, hal::never_timeout());
+
+    // Verify
+    expect(bool{ result });
+    expect(successful_address == i2c.m_address);
+    expect(that % buffer.data() == i2c.m_out.data());
+    expect(that % 3 == i2c.m_out.size());
+    expect(that % (buffer.data() + 3) == i2c.m_in.data());
+    expect(that % 2 == i2c.m_in.size());
+    expect(that % filler_byte == buffer[3]);
+    expect(that % filler_byte == buffer[4]);
+  };
+
+  "[success] segmented_transaction stages scattered segments"_test = []() {
+    // Setup
+    class recording_i2c : public hal::i2c
+    {
+    public:
+      std::vector<std::vector<hal::byte>> m_writes{};
+      std::vector<std::size_t> m_read_sizes{};
+
+    private:
+      status driver_configure(const settings&) override
+      {
+        return success();
+      }
+      status driver_transaction(
+        hal::byte,
+        std::span<const hal::byte> p_out,
+        std::span<hal::byte> p_in,
+        hal::function_ref<hal::timeout_function>) override
+      {
+        m_writes.emplace_back(p_out.begin(), p_out.end());
+        m_read_sizes.push_back(p_in.size());
+        hal::byte counter = 1;
+        for (auto& value : p_in) {
+          value = counter++;
+        }
+        return success();
+      }
+    };
+    recording_i2c i2c;
+    const std::array<hal::byte, 1> address{ 0x20 };
+    const std::array<hal::byte, 2> payload{ 0x01, 0x02 };
+    std::array<hal::byte, 2> first_read{};
+    std::array<hal::byte, 1> second_read{};
+    const std::array<hal::byte, 1> trailing{ 0x30 };
+    const std::array segments{
+      i2c_write(address),    i2c_write(payload),  i2c_read(first_read),
+      i2c_read(second_read), i2c_write(trailing),
+    };
+
+    // Exercise
+    auto result = segmented_transaction<8>(
+      i2c, successful_address, segments, hal::never_timeout());
+
+    // Verify
+    expect(bool{ result });
+    expect(that % 2 == i2c.m_writes.size());
+    expect(std::vector<hal::byte>{ 0x20, 0x01, 0x02 } == i2c.m_writes[0]);
+    expect(std::vector<hal::byte>{ 0x30 } == i2c.m_writes[1]);
+    expect(std::vector<std::size_t>{ 3, 0 } == i2c.m_read_sizes);
+    expect(std::array<hal::byte, 2>{ 1, 2 } == first_read);
+    expect(std::array<hal::byte, 1>{ 3 } == second_read);
+  };
+
+  "[failure] segmented_transaction without enough staging"_test = []() {
+    // Setup
+    test_i2c i2c;
+    const std::array<hal::byte, 1> address{ 0x20 };
+    const std::array<hal::byte, 4> payload{};
+    const std::array segments{ i2c_write(address), i2c_write(payload) };
+
+    // Exercise
+    auto result = segmented_transaction<4>(
+      i2c, successful_address, segments, hal::never_timeout());
+
+    // Verify
+    expect(!result);
+    expect(that % 0 == i2c.m_out.size());
+  };
+
+  "[failure] segmented_transaction stops at first failure"_test = []() {
+    // Setup
+    test_i2c i2c;
+    std::array<hal::byte, 1> data{};
+    const std::array segments{ i2c_read(data), i2c_write(data) };
+
+    // Exercise
+    auto result = segmented_transaction(
+      i2c, failure_address, segments, hal::never_timeout());
+
+    // Verify
+    expect(!result);
+    expect(that % 0 == i2c.m_out.size());
+    expect(that % 1 == i2c.m_in.size());
+  };
+  "i2c_address_set"_test = []() {
+    // Setup
+    i2c_address_set set;
+
+    // Exercise
+    set.insert(0x00);
+    set.insert(0x3F);
+    set.insert(0x40);
+    set.insert(0xFF);
+
+    // Verify
+    expect(that % 4 == set.size());
+    expect(set.contains(0x00));
+    expect(set.contains(0x3F));
+    expect(set.contains(0x40));
+    expect(set.contains(0x7F));
+    expect(!set.contains(0x41));
+    expect(that % 0x8000'0000'0000'0001ULL == set.words[0]);
+    expect(that % 0x8000'0000'0000'0001ULL == set.words[1]);
+  };
+
+  "scan(i2c&, steady_clock&)"_test = []() {
+    // Setup
+    class counting_steady_clock : public hal::steady_clock
+    {
+    public:
+      std::uint64_t m_uptime = 0;
+
+    private:
+      hertz driver_frequency() override
+      {
+        return 1.0_MHz;
+      }
+      result<std::uint64_t> driver_uptime() override
+      {
+        return m_uptime++;
+      }
+    };
+
+    class bus_with_devices : public hal::i2c
+    {
+    public:
+      std::vector<hal::byte> m_probed{};
+
+    private:
+      status driver_configure(const settings&) override
+      {
+        return success();
+      }
+      status driver_transaction(
+        hal::byte p_address,
+        std::span<const hal::byte>,
+        std::span<hal::byte>,
+        hal::function_ref<hal::timeout_function> p_timeout) override
+      {
+        m_probed.push_back(p_address);
+        if (p_address == 0x20 || p_address == 0x68) {
+          return success();
+        }
+        if (p_address == 0x30) {
+          // Stretch the clock until the timeout expires
+          while (true) {
+            HAL_CHECK(p_timeout());
+          }
+        }
+        return hal::new_error(std::errc::no_such_device_or_address);
+      }
+    };
+
+    counting_steady_clock clock;
+    bus_with_devices bus;
+    bus_with_devices default_bus;
+    i2c_scan_settings settings{ .probe_timeout = std::chrono::microseconds(5),
+                                .first = 0x10,
+                                .last = 0x70 };
+    settings.skip.insert(0x50);
+
+    // Exercise
+    auto scan_result = scan(bus, clock, settings).value();
+    auto default_scan = scan(default_bus, clock).value();
+
+    // Verify
+    expect(that % 2 == scan_result.present.size());
+    expect(scan_result.present.contains(0x20));
+    expect(scan_result.present.contains(0x68));
+    expect(that % 1 == scan_result.timed_out.size());
+    expect(scan_result.timed_out.contains(0x30));
+    // 0x10 to 0x70 without 0x50
+    expect(that % 96 == bus.m_probed.size());
+    expect(std::ranges::find(bus.m_probed, 0x50) == bus.m_probed.end());
+    expect(that % 1 == scan_result.latency[0x20]);
+    expect(that % 5 == scan_result.latency[0x30]);
+    expect(that % 0 == scan_result.latency[0x50]);
+    expect(that % 1'000'000.0f == scan_result.frequency);
+    // 0x08 to 0x77
+    expect(that % 112 == default_bus.m_probed.size());
+    expect(that % 0x08 == default_bus.m_probed.front());
+    expect(that % 0x77 == default_bus.m_probed.back());
+    expect(that % 2 == default_scan.present.size());
+  };
 };
 }  // namespace hal
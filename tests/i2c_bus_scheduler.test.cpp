@@ -0,0 +1,290 @@
+#include <libhal-util/i2c_bus_scheduler.hpp>
+
+#include <array>
+#include <functional>
+#include <vector>
+
+#include <boost/ut.hpp>
+
+namespace hal {
+namespace {
+class mock_steady_clock : public hal::steady_clock
+{
+public:
+  std::uint64_t m_uptime = 0;
+
+private:
+  hertz driver_frequency() override
+  {
+    return 1.0_MHz;
+  }
+
+  result<std::uint64_t> driver_uptime() override
+  {
+    return m_uptime++;
+  }
+};
+
+class mock_i2c_bus : public hal::i2c
+{
+public:
+  std::vector<std::vector<hal::byte>> m_writes{};
+  std::vector<hertz> m_configurations{};
+  std::function<void()> m_during_transaction{};
+
+private:
+  status driver_configure(const settings& p_settings) override
+  {
+    m_configurations.push_back(p_settings.clock_rate);
+    return success();
+  }
+
+  status driver_transaction(
+    hal::byte,
+    std::span<const hal::byte> p_data_out,
+    std::span<hal::byte> p_data_in,
+    hal::function_ref<hal::timeout_function>) override
+  {
+    m_writes.emplace_back(p_data_out.begin(), p_data_out.end());
+    std::fill(p_data_in.begin(), p_data_in.end(), 0xA5);
+    if (m_during_transaction) {
+      auto during = std::move(m_during_transaction);
+      m_during_transaction = nullptr;
+      during();
+    }
+    return success();
+  }
+};
+
+/// Fails after being called p_limit times
+auto failing_timeout(int& p_calls, int p_limit)
+{
+  return [&p_calls, p_limit]() -> status {
+    if (++p_calls >= p_limit) {
+      return hal::new_error(std::errc::timed_out);
+    }
+    return success();
+  };
+}
+}  // namespace
+
+void i2c_bus_scheduler_test()
+{
+  using namespace boost::ut;
+
+  "i2c_bus_scheduler uncontended transaction"_test = []() {
+    // Setup
+    mock_i2c_bus bus;
+    mock_steady_clock clock;
+    i2c_bus_scheduler scheduler(bus, clock);
+    i2c_bus_scheduler::client sensor(scheduler, { .priority = 3 });
+    const std::array<hal::byte, 1> address{ 0x10 };
+    std::array<hal::byte, 2> data{};
+
+    // Exercise
+    auto result = sensor.transaction(0x42, address, data, never_timeout());
+
+    // Verify
+    expect(bool{ result });
+    expect(that % 1 == scheduler.clients());
+    expect(std::array<hal::byte, 2>{ 0xA5, 0xA5 } == data);
+    expect(that % 1 == sensor.statistics().transactions);
+    expect(that % 1 == sensor.statistics().last_wait);
+    expect(that % 0 == sensor.statistics().deadline_misses);
+    expect(that % 3 == sensor.client_settings().priority);
+  };
+
+  "i2c_bus_scheduler reconfigures the bus only when settings differ"_test =
+    []() {
+      // Setup
+      mock_i2c_bus bus;
+      mock_steady_clock clock;
+      i2c_bus_scheduler scheduler(bus, clock);
+      i2c_bus_scheduler::client first(scheduler);
+      i2c_bus_scheduler::client second(scheduler);
+      i2c_bus_scheduler::client fast(scheduler);
+      const std::array<hal::byte, 1> data{};
+
+      // Exercise
+      (void)fast.configure({ .clock_rate = 400.0_kHz });
+      (void)first.transaction(0x10, data, {}, never_timeout());
+      (void)second.transaction(0x11, data, {}, never_timeout());
+      (void)first.transaction(0x10, data, {}, never_timeout());
+      (void)fast.transaction(0x12, data, {}, never_timeout());
+      (void)fast.transaction(0x12, data, {}, never_timeout());
+      (void)second.transaction(0x11, data, {}, never_timeout());
+
+      // Verify
+      expect(std::vector<hertz>{ 100.0_kHz, 400.0_kHz, 100.0_kHz } ==
+             bus.m_configurations);
+      expect(that % 6 == bus.m_writes.size());
+    };
+
+  "i2c_bus_scheduler applies a client's new settings on its next use"_test =
+    []() {
+      // Setup
+      mock_i2c_bus bus;
+      mock_steady_clock clock;
+      i2c_bus_scheduler scheduler(bus, clock);
+      i2c_bus_scheduler::client sensor(scheduler);
+      const std::array<hal::byte, 1> data{};
+      (void)sensor.transaction(0x10, data, {}, never_timeout());
+
+      // Exercise
+      (void)sensor.configure({ .clock_rate = 400.0_kHz });
+      const auto configurations_after_configure = bus.m_configurations.size();
+      (void)sensor.transaction(0x10, data, {}, never_timeout());
+      (void)sensor.configure({ .clock_rate = 400.0_kHz });
+      (void)sensor.transaction(0x10, data, {}, never_timeout());
+
+      // Verify
+      expect(that % 1 == configurations_after_configure);
+      expect(std::vector<hertz>{ 100.0_kHz, 400.0_kHz } ==
+             bus.m_configurations);
+    };
+
+  "i2c_bus_scheduler splits long writes"_test = []() {
+    // Setup
+    mock_i2c_bus bus;
+    mock_steady_clock clock;
+    i2c_bus_scheduler scheduler(bus, clock);
+    std::array<hal::byte, 5> split_buffer{};
+    i2c_bus_scheduler::client eeprom(
+      scheduler, { .address_bytes = 2 }, split_buffer);
+    const std::array<hal::byte, 9> write{ 0x01, 0xFE, 1, 2, 3, 4, 5, 6, 7 };
+
+    // Exercise
+    auto result = eeprom.transaction(0x50, write, {}, never_timeout());
+
+    // Verify
+    expect(bool{ result });
+    expect(that % 3 == bus.m_writes.size());
+    expect(std::vector<hal::byte>{ 0x01, 0xFE, 1, 2, 3 } == bus.m_writes[0]);
+    expect(std::vector<hal::byte>{ 0x02, 0x01, 4, 5, 6 } == bus.m_writes[1]);
+    expect(std::vector<hal::byte>{ 0x02, 0x04, 7 } == bus.m_writes[2]);
+    expect(that % 3 == eeprom.statistics().transactions);
+  };
+
+  "i2c_bus_scheduler grants the most urgent waiting client"_test = []() {
+    // Setup
+    mock_i2c_bus bus;
+    mock_steady_clock clock;
+    i2c_bus_scheduler scheduler(bus, clock);
+    i2c_bus_scheduler::client background(scheduler, { .priority = 0 });
+    i2c_bus_scheduler::client urgent(scheduler, { .priority = 5 });
+    i2c_bus_scheduler::client sooner(
+      scheduler, { .priority = 0, .deadline = std::chrono::microseconds(1) });
+    const std::array<hal::byte, 1> data{};
+    int urgent_calls = 0;
+    int background_calls = 0;
+    int sooner_calls = 0;
+    status background_result{};
+    status sooner_result{};
+
+    // While the urgent client waits for the bus, lower ranked clients must
+    // wait behind it, even if the bus is free.
+    auto urgent_waiting = [&]() -> status {
+      urgent_calls++;
+      if (urgent_calls == 1) {
+        background_result = background.transaction(
+          0x20, data, {}, failing_timeout(background_calls, 3));
+      }
+      return hal::new_error(std::errc::timed_out);
+    };
+    // While the bus is held, the urgent client begins waiting
+    bus.m_during_transaction = [&]() {
+      (void)urgent.transaction(0x30, data, {}, urgent_waiting);
+    };
+
+    // Exercise
+    auto holder = sooner.transaction(0x40, data, {}, never_timeout());
+    auto after = background.transaction(0x20, data, {}, never_timeout());
+    auto sooner_first = [&]() -> status {
+      return sooner.transaction(
+        0x40, data, {}, failing_timeout(sooner_calls, 2));
+    };
+    bus.m_during_transaction = [&]() { sooner_result = sooner_first(); };
+    (void)urgent.transaction(0x30, data, {}, never_timeout());
+
+    // Verify
+    expect(bool{ holder });
+    expect(!background_result);
+    expect(that % 3 == background_calls);
+    expect(that % 1 == background.statistics().transactions);
+    expect(bool{ after });
+    expect(that % 1 == urgent.statistics().transactions);
+    // The bus was held by the urgent client
+    expect(!sooner_result);
+    expect(that % 2 == sooner_calls);
+  };
+
+  "i2c_bus_scheduler orders equal priority by deadline"_test = []() {
+    // Setup
+    mock_i2c_bus bus;
+    mock_steady_clock clock;
+    i2c_bus_scheduler scheduler(bus, clock);
+    i2c_bus_scheduler::client holder(scheduler);
+    i2c_bus_scheduler::client tight(
+      scheduler, { .deadline = std::chrono::microseconds(2) });
+    i2c_bus_scheduler::client relaxed(
+      scheduler, { .deadline = std::chrono::milliseconds(50) });
+    const std::array<hal::byte, 1> data{};
+    int relaxed_calls = 0;
+    status relaxed_result{};
+
+    auto tight_waiting = [&]() -> status {
+      relaxed_result = relaxed.transaction(
+        0x20, data, {}, failing_timeout(relaxed_calls, 1));
+      return hal::new_error(std::errc::timed_out);
+    };
+    bus.m_during_transaction = [&]() {
+      (void)tight.transaction(0x30, data, {}, tight_waiting);
+    };
+
+    // Exercise
+    (void)holder.transaction(0x10, data, {}, never_timeout());
+    auto tight_after = tight.transaction(0x30, data, {}, never_timeout());
+
+    // Verify
+    expect(!relaxed_result);
+    expect(that % 1 == relaxed_calls);
+    expect(that % 0 == relaxed.statistics().transactions);
+    expect(bool{ tight_after });
+  };
+
+  "i2c_bus_scheduler timeout while waiting"_test = []() {
+    // Setup
+    mock_i2c_bus bus;
+    mock_steady_clock clock;
+    i2c_bus_scheduler scheduler(bus, clock);
+    i2c_bus_scheduler::client holder(scheduler);
+    i2c_bus_scheduler::client waiter(
+      scheduler, { .deadline = std::chrono::microseconds(3) });
+    i2c_bus_scheduler::client immediate(
+      scheduler, { .deadline = std::chrono::microseconds(0) });
+    const std::array<hal::byte, 1> data{};
+    int waiter_calls = 0;
+    status waited{};
+
+    bus.m_during_transaction = [&]() {
+      waited = waiter.transaction(
+        0x30, data, {}, failing_timeout(waiter_calls, 10));
+    };
+
+    // Exercise
+    (void)holder.transaction(0x10, data, {}, never_timeout());
+    auto retried = waiter.transaction(0x30, data, {}, never_timeout());
+    (void)immediate.transaction(0x40, data, {}, never_timeout());
+
+    // Verify
+    expect(!waited);
+    expect(that % 10 == waiter_calls);
+    expect(bool{ retried });
+    expect(that % 1 == waiter.statistics().transactions);
+    expect(that % 0 == waiter.statistics().deadline_misses);
+    expect(that % 1 == waiter.statistics().max_wait);
+    // Granted one tick after being requested
+    expect(that % 1 == immediate.statistics().deadline_misses);
+  };
+};
+}  // namespace hal
@@ -0,0 +1,159 @@
+#include <libhal-util/i2c_profiler.hpp>
+
+#include <array>
+
+#include <boost/ut.hpp>
+
+namespace hal {
+namespace {
+class mock_steady_clock : public hal::steady_clock
+{
+public:
+  std::uint64_t m_uptime = 0;
+
+private:
+  hertz driver_frequency() override
+  {
+    return 1.0_MHz;
+  }
+
+  result<std::uint64_t> driver_uptime() override
+  {
+    return m_uptime;
+  }
+};
+
+class mock_i2c : public hal::i2c
+{
+public:
+  mock_steady_clock* m_clock = nullptr;
+  std::uint64_t m_duration = 0;
+  settings m_settings{};
+  std::errc m_error{};
+  bool m_fail = false;
+
+private:
+  status driver_configure(const settings& p_settings) override
+  {
+    m_settings = p_settings;
+    return success();
+  }
+
+  status driver_transaction(
+    hal::byte,
+    std::span<const hal::byte>,
+    std::span<hal::byte> p_data_in,
+    hal::function_ref<hal::timeout_function>) override
+  {
+    m_clock->m_uptime += m_duration;
+    std::fill(p_data_in.begin(), p_data_in.end(), 0x33);
+    if (!m_fail) {
+      return success();
+    }
+    if (m_error == std::errc{}) {
+      return hal::new_error();
+    }
+    return hal::new_error(m_error);
+  }
+};
+}  // namespace
+
+void i2c_profiler_test()
+{
+  using namespace boost::ut;
+
+  "i2c_address_profile::bucket_of()"_test = []() {
+    using profile = i2c_address_profile<4>;
+    static_assert(profile::bucket_of(0) == 0);
+    static_assert(profile::bucket_of(1) == 1);
+    static_assert(profile::bucket_of(2) == 2);
+    static_assert(profile::bucket_of(3) == 2);
+    static_assert(profile::bucket_of(4) == 3);
+    static_assert(profile::bucket_of(1'000'000) == 3);
+  };
+
+  "i2c_profiler records transactions per address"_test = []() {
+    // Setup
+    mock_steady_clock clock;
+    mock_i2c bus;
+    bus.m_clock = &clock;
+    i2c_profiler<2, 8> profiler(bus, clock);
+    const std::array<hal::byte, 2> out{};
+    std::array<hal::byte, 4> in{};
+
+    // Exercise
+    bus.m_duration = 10;
+    auto first = profiler.transaction(0x40, out, in, never_timeout());
+    bus.m_duration = 100;
+    auto second = profiler.transaction(0x40, out, {}, never_timeout());
+    (void)profiler.transaction(0x41, {}, in, never_timeout());
+    (void)profiler.transaction(0x42, {}, in, never_timeout());
+    auto configured = profiler.configure({ .clock_rate = 400.0_kHz });
+
+    // Verify
+    expect(bool{ first });
+    expect(bool{ second });
+    expect(bool{ configured });
+    expect(that % 400.0_kHz == bus.m_settings.clock_rate);
+    expect(that % 0x33 == in[0]);
+    expect(that % 2 == profiler.addresses().size());
+    expect(that % 1 == profiler.untracked());
+    const auto* profile = profiler.find(0x40);
+    expect(profile != nullptr);
+    expect(that % 2 == profile->transactions);
+    expect(that % 0 == profile->errors);
+    expect(that % 4 == profile->bytes_written);
+    expect(that % 4 == profile->bytes_read);
+    expect(that % 100 == profile->max_latency);
+    expect(that % 110 == profile->total_latency);
+    // 10 ticks in [8, 16), 100 ticks in [64, 128)
+    expect(that % 1 == profile->histogram[4]);
+    expect(that % 1 == profile->histogram[7]);
+    expect(profiler.find(0x42) == nullptr);
+    expect(that % 1'000'000.0f == profiler.frequency());
+  };
+
+  "i2c_profiler counts errors by code and forwards them"_test = []() {
+    // Setup
+    mock_steady_clock clock;
+    mock_i2c bus;
+    bus.m_clock = &clock;
+    bus.m_fail = true;
+    i2c_profiler profiler(bus, clock);
+    bool forwarded_timed_out = false;
+
+    // Exercise
+    bus.m_error = std::errc::no_such_device_or_address;
+    (void)profiler.transaction(0x50, {}, {}, never_timeout());
+    (void)profiler.transaction(0x50, {}, {}, never_timeout());
+    bus.m_error = std::errc::timed_out;
+    hal::attempt_all(
+      [&profiler]() -> status {
+        return profiler.transaction(0x51, {}, {}, never_timeout());
+      },
+      [&forwarded_timed_out](match<std::errc, std::errc::timed_out>) {
+        forwarded_timed_out = true;
+      },
+      []() {});
+    bus.m_error = std::errc{};
+    auto uncoded = profiler.transaction(0x51, {}, {}, never_timeout());
+
+    // Verify
+    expect(forwarded_timed_out);
+    expect(!uncoded);
+    const auto errors = profiler.errors();
+    expect(that % 3 == errors.size());
+    expect(std::errc::no_such_device_or_address == errors[0].error);
+    expect(that % 2 == errors[0].count);
+    expect(std::errc::timed_out == errors[1].error);
+    expect(that % 1 == errors[1].count);
+    expect(std::errc{} == errors[2].error);
+    expect(that % 2 == profiler.find(0x50)->errors);
+    expect(that % 2 == profiler.find(0x51)->errors);
+
+    profiler.reset();
+    expect(profiler.errors().empty());
+    expect(profiler.addresses().empty());
+  };
+};
+}  // namespace hal
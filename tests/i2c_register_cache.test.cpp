@@ -0,0 +1,282 @@
+#include <libhal-util/i2c_register_cache.hpp>
+
+#include <algorithm>
+#include <array>
+#include <vector>
+
+#include <boost/ut.hpp>
+
+namespace hal {
+namespace {
+/// Device with 16 auto-incrementing registers
+class mock_register_device : public hal::i2c
+{
+public:
+  std::array<hal::byte, 32> m_registers{};
+  std::vector<std::vector<hal::byte>> m_writes{};
+  std::size_t m_reads = 0;
+  bool m_fail = false;
+
+private:
+  status driver_configure(const settings&) override
+  {
+    return success();
+  }
+
+  status driver_transaction(
+    hal::byte,
+    std::span<const hal::byte> p_out,
+    std::span<hal::byte> p_in,
+    hal::function_ref<hal::timeout_function>) override
+  {
+    if (m_fail) {
+      // Model a burst that failed part way with garbage in the buffer
+      std::fill(p_in.begin(), p_in.end(), hal::byte{ 0xEE });
+      return hal::new_error(std::errc::io_error);
+    }
+    auto address = p_out[0];
+    if (p_in.empty()) {
+      m_writes.emplace_back(p_out.begin(), p_out.end());
+      for (auto value : p_out.subspan(1)) {
+        m_registers[address++] = value;
+      }
+      return success();
+    }
+    m_reads++;
+    for (auto& value : p_in) {
+      value = m_registers[address++];
+    }
+    return success();
+  }
+};
+}  // namespace
+
+void i2c_register_cache_test()
+{
+  using namespace boost::ut;
+
+  "i2c_register_cache::read() only reads unknown registers"_test = []() {
+    // Setup
+    mock_register_device device;
+    device.m_registers[3] = 0x5A;
+    i2c_register_cache<16> registers(device, 0x42);
+
+    // Exercise
+    auto first = registers.read(0x03);
+    auto second = registers.read(0x03);
+    auto field = registers.read(0x03, bit::mask::from<4, 7>());
+    auto out_of_range = registers.read(0x10);
+
+    // Verify
+    expect(that % 0x5A == first.value());
+    expect(that % 0x5A == second.value());
+    expect(that % 0x5 == field.value());
+    expect(!out_of_range);
+    expect(that % 1 == device.m_reads);
+  };
+
+  "i2c_register_cache::modify() write through"_test = []() {
+    // Setup
+    mock_register_device device;
+    device.m_registers[2] = 0b1000'0001;
+    i2c_register_cache<16> registers(device, 0x42);
+
+    // Exercise
+    auto first = registers.modify(0x02, bit::mask::from<2, 4>(), 5U);
+    auto second = registers.modify(0x02, bit::mask::from<6>(), 1U);
+    auto unchanged = registers.modify(0x02, bit::mask::from<6>(), 1U);
+
+    // Verify
+    expect(bool{ first });
+    expect(bool{ second });
+    expect(bool{ unchanged });
+    expect(that % 0b1101'0101 == device.m_registers[2]);
+    expect(that % 1 == device.m_reads);
+    expect(that % 2 == device.m_writes.size());
+    expect(that % 3 == registers.transactions());
+  };
+
+  "i2c_register_cache::flush() coalesces dirty registers"_test = []() {
+    // Setup
+    mock_register_device device;
+    i2c_register_cache<16> registers(
+      device, 0x42, i2c_write_policy::write_back);
+    (void)registers.refresh(0x00, 16);
+    (void)registers.set_volatile(0x08);
+
+    // Exercise
+    (void)registers.write(0x01, 0x11);
+    (void)registers.write(0x02, 0x22);
+    // Registers 3 and 4 are clean and bridged
+    (void)registers.write(0x05, 0x55);
+    // Volatile register 8 splits the burst
+    (void)registers.write(0x07, 0x77);
+    (void)registers.write(0x09, 0x99);
+    const auto dirty_before_flush = registers.dirty_count();
+    const auto writes_before_flush = device.m_writes.size();
+    auto result = registers.flush();
+
+    // Verify
+    expect(bool{ result });
+    expect(that % 5 == dirty_before_flush);
+    expect(that % 0 == writes_before_flush);
+    expect(that % 0 == registers.dirty_count());
+    expect(that % 2 == device.m_writes.size());
+    expect(std::vector<hal::byte>{ 0x01, 0x11, 0x22, 0, 0, 0x55, 0, 0x77 } ==
+           device.m_writes[0]);
+    expect(std::vector<hal::byte>{ 0x09, 0x99 } == device.m_writes[1]);
+  };
+
+  "i2c_register_cache volatile registers bypass the cache"_test = []() {
+    // Setup
+    mock_register_device device;
+    i2c_register_cache<16> registers(
+      device, 0x42, i2c_write_policy::write_back);
+    (void)registers.set_volatile(0x0A);
+
+    // Exercise
+    device.m_registers[0x0A] = 1;
+    auto first = registers.read(0x0A);
+    device.m_registers[0x0A] = 2;
+    auto second = registers.read(0x0A);
+    auto written = registers.write(0x0A, 3);
+
+    // Verify
+    expect(that % 1 == first.value());
+    expect(that % 2 == second.value());
+    expect(bool{ written });
+    expect(that % 3 == device.m_registers[0x0A]);
+    expect(!registers.dirty(0x0A));
+  };
+
+  "i2c_register_cache::flush() keeps registers dirty on failure"_test = []() {
+    // Setup
+    mock_register_device device;
+    i2c_register_cache<4> registers(
+      device, 0x42, i2c_write_policy::write_back, 0x04);
+    (void)registers.write(0x05, 0x12);
+
+    // Exercise
+    device.m_fail = true;
+    auto failed = registers.flush();
+    const auto dirty_after_failure = registers.dirty(0x05);
+    device.m_fail = false;
+    auto retried = registers.flush();
+
+    // Verify
+    expect(!failed);
+    expect(dirty_after_failure);
+    expect(bool{ retried });
+    expect(!registers.dirty(0x05));
+    expect(that % 0x12 == device.m_registers[0x05]);
+  };
+
+  "i2c_register_cache::write() retries a failed write through"_test = []() {
+    // Setup
+    mock_register_device device;
+    i2c_register_cache<16> registers(device, 0x42);
+    (void)registers.write(0x02, 0x11);
+
+    // Exercise
+    device.m_fail = true;
+    auto failed = registers.write(0x02, 0x22);
+    device.m_fail = false;
+    auto retried = registers.write(0x02, 0x22);
+    auto value = registers.read(0x02);
+
+    // Verify
+    expect(!failed);
+    expect(bool{ retried });
+    expect(that % 0x22 == device.m_registers[0x02]);
+    expect(that % 2 == device.m_writes.size());
+    expect(that % 0x22 == value.value());
+  };
+
+  "i2c_register_cache::refresh() keeps known values on failure"_test = []() {
+    // Setup
+    mock_register_device device;
+    i2c_register_cache<16> registers(device, 0x42);
+    (void)registers.write(0x03, 0x44);
+
+    // Exercise
+    device.m_fail = true;
+    auto failed = registers.refresh(0x00, 16);
+    device.m_fail = false;
+    const auto reads_before = device.m_reads;
+    auto value = registers.read(0x03);
+
+    // Verify
+    expect(!failed);
+    expect(that % 0x44 == value.value());
+    expect(that % reads_before == device.m_reads);
+  };
+
+  "i2c_register_cache::refresh() keeps pending writes"_test = []() {
+    // Setup
+    mock_register_device device;
+    device.m_registers[0x02] = 0x11;
+    device.m_registers[0x03] = 0x33;
+    i2c_register_cache<16> registers(
+      device, 0x42, i2c_write_policy::write_back);
+    (void)registers.write(0x02, 0x55);
+
+    // Exercise
+    auto refreshed = registers.refresh(0x00, 4);
+    auto pending = registers.read(0x02);
+    auto loaded = registers.read(0x03);
+    const auto dirty_after_refresh = registers.dirty(0x02);
+    auto flushed = registers.flush();
+
+    // Verify
+    expect(bool{ refreshed });
+    expect(that % 0x55 == pending.value());
+    expect(that % 0x33 == loaded.value());
+    expect(dirty_after_refresh);
+    expect(bool{ flushed });
+    expect(that % 0x55 == device.m_registers[0x02]);
+  };
+
+  "i2c_register_cache::set_volatile() writes a pending value"_test = []() {
+    // Setup
+    mock_register_device device;
+    i2c_register_cache<16> registers(
+      device, 0x42, i2c_write_policy::write_back);
+    (void)registers.write(0x05, 0x12);
+
+    // Exercise
+    auto marked = registers.set_volatile(0x05);
+
+    // Verify
+    expect(bool{ marked });
+    expect(that % 0x12 == device.m_registers[0x05]);
+    expect(that % 0 == registers.dirty_count());
+  };
+
+  "i2c_register_cache splits long bursts"_test = []() {
+    // Setup
+    using cache_t = i2c_register_cache<32>;
+    mock_register_device device;
+    cache_t registers(device, 0x42, i2c_write_policy::write_back);
+    for (hal::byte i = 0; i < 20; i++) {
+      (void)registers.write(i, static_cast<hal::byte>(i + 1));
+    }
+
+    // Exercise
+    auto flushed = registers.flush();
+    std::vector<std::size_t> burst_sizes;
+    for (const auto& write : device.m_writes) {
+      burst_sizes.push_back(write.size());
+    }
+    registers.invalidate();
+    auto refreshed = registers.refresh(0x00, 20);
+
+    // Verify
+    static_assert(cache_t::max_burst_size == 16);
+    expect(bool{ flushed });
+    expect(bool{ refreshed });
+    expect(std::vector<std::size_t>{ 17, 5 } == burst_sizes);
+    expect(that % 2 == device.m_reads);
+    expect(that % 20 == device.m_registers[19]);
+  };
+};
+}  // namespace hal
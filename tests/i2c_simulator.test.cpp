@@ -0,0 +1,156 @@
+#include <libhal-util/i2c_simulator.hpp>
+
+#include <array>
+
+#include <libhal-util/i2c.hpp>
+#include <libhal-util/steady_clock.hpp>
+
+#include <boost/ut.hpp>
+
+namespace hal {
+void i2c_simulator_test()
+{
+  using namespace boost::ut;
+  using namespace std::chrono_literals;
+
+  "simulated_steady_clock"_test = []() {
+    // Setup
+    simulated_steady_clock clock(2.0_MHz);
+
+    // Exercise
+    clock.advance(std::uint64_t{ 5 });
+    clock.advance(10us);
+    clock.advance(-10us);
+
+    // Verify
+    expect(that % 25 == clock.uptime().value());
+    expect(that % 2'000'000.0f == clock.frequency());
+  };
+
+  "simulated_i2c_register_target read and write"_test = []() {
+    // Setup
+    simulated_steady_clock clock(1.0_MHz);
+    simulated_i2c_bus bus(clock);
+    simulated_i2c_register_target<16> device(bus, 0x68);
+    device.registers()[0x0F] = 0xAB;
+    device.registers()[0x00] = 0xCD;
+    const std::array<hal::byte, 3> write_data{ 0x02, 0x11, 0x22 };
+    const std::array<hal::byte, 1> select{ 0x0F };
+    std::array<hal::byte, 2> read_data{};
+
+    // Exercise
+    auto written = write(bus, 0x68, write_data, never_timeout());
+    const auto after_write = clock.uptime().value();
+    auto read = write_then_read(bus, 0x68, select, read_data, never_timeout());
+    const auto after_read = clock.uptime().value();
+
+    // Verify
+    expect(bool{ written });
+    expect(bool{ read });
+    expect(that % 0x11 == device.registers()[0x02]);
+    expect(that % 0x22 == device.registers()[0x03]);
+    // Reads wrap around the end of the registers
+    expect(std::array<hal::byte, 2>{ 0xAB, 0xCD } == read_data);
+    expect(that % 1 == device.selected());
+    // 100kHz with a 1MHz clock is 10 ticks per SCL cycle
+    // start + address + 3 bytes + stop = 1 + 9 + 27 + 1 cycles
+    expect(that % 380 == after_write);
+    // start + address + 1 byte + restart + address + 2 bytes + stop
+    expect(that % (380 + 480) == after_read);
+    expect(that % 2 == device.transactions());
+    expect(that % 2 == bus.transactions());
+    expect(that % after_read == bus.busy_ticks());
+  };
+
+  "simulated_i2c_bus fractional SCL periods do not drift"_test = []() {
+    // Setup
+    simulated_steady_clock clock(1.0_MHz);
+    simulated_i2c_bus bus(clock);
+    simulated_i2c_register_target<4> device(bus, 0x10);
+    const std::array<hal::byte, 1> data{};
+
+    // Exercise
+    auto configured = bus.configure({ .clock_rate = 400.0_kHz });
+    (void)write(bus, 0x10, data, never_timeout());
+    const auto first = clock.uptime().value();
+    (void)write(bus, 0x10, data, never_timeout());
+    const auto second = clock.uptime().value();
+
+    // Verify
+    expect(bool{ configured });
+    expect(that % 400'000.0f == bus.clock_rate());
+    // 20 cycles of 2.5 ticks
+    expect(that % 50 == first);
+    expect(that % 100 == second);
+    expect(!bus.configure({ .clock_rate = 0.0f }));
+  };
+
+  "simulated_i2c_bus address NACKs"_test = []() {
+    // Setup
+    simulated_steady_clock clock(1.0_MHz);
+    simulated_i2c_bus bus(clock);
+    simulated_i2c_register_target<4> device(bus, 0x10);
+    const std::array<hal::byte, 1> data{};
+    device.nack(2);
+
+    // Exercise
+    auto missing = write(bus, 0x11, data, never_timeout());
+    auto first = write(bus, 0x10, data, never_timeout());
+    auto second = write(bus, 0x10, data, never_timeout());
+    auto third = write(bus, 0x10, data, never_timeout());
+    auto found = probe(bus, 0x10);
+
+    // Verify
+    expect(!missing);
+    expect(!first);
+    expect(!second);
+    expect(bool{ third });
+    expect(bool{ found });
+    expect(that % 2 == device.transactions());
+    expect(that % 5 == bus.transactions());
+  };
+
+  "simulated_i2c_bus data NACK"_test = []() {
+    // Setup
+    simulated_steady_clock clock(1.0_MHz);
+    simulated_i2c_bus bus(clock);
+    simulated_i2c_register_target<8> eeprom(bus, 0x50);
+    const std::array<hal::byte, 4> data{ 0x01, 0xAA, 0xBB, 0xCC };
+    eeprom.nack_data_after(2);
+
+    // Exercise
+    auto rejected = write(bus, 0x50, data, never_timeout());
+    const auto registers_after_nack = eeprom.registers();
+    auto accepted = write(bus, 0x50, data, never_timeout());
+
+    // Verify
+    expect(!rejected);
+    expect(that % 0xAA == registers_after_nack[1]);
+    expect(that % 0x00 == registers_after_nack[2]);
+    expect(bool{ accepted });
+    expect(that % 0xCC == eeprom.registers()[3]);
+  };
+
+  "simulated_i2c_bus clock stretching reaches the timeout"_test = []() {
+    // Setup
+    simulated_steady_clock clock(1.0_MHz);
+    simulated_i2c_bus bus(clock);
+    simulated_i2c_register_target<4> slow(bus, 0x20);
+    slow.stretch(2ms);
+    std::array<hal::byte, 1> data{};
+
+    // Exercise
+    auto short_timeout = create_timeout(clock, 1ms).value();
+    auto timed_out = read(bus, 0x20, data, short_timeout);
+    const auto after_timeout = clock.uptime().value();
+    auto long_timeout = create_timeout(clock, 5ms).value();
+    auto finished = read(bus, 0x20, data, long_timeout);
+
+    // Verify
+    expect(!timed_out);
+    // Start + address, then the stretch
+    expect(that % (100 + 2'000) == after_timeout);
+    expect(bool{ finished });
+  };
+};
+}  // namespace hal
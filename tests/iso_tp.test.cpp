@@ -0,0 +1,385 @@
+#include <libhal-util/iso_tp.hpp>
+
+#include <algorithm>
+#include <array>
+#include <numeric>
+#include <vector>
+
+#include <libhal/functional.hpp>
+
+#include <boost/ut.hpp>
+
+namespace hal {
+namespace {
+class loopback_can : public hal::can
+{
+public:
+  std::vector<message_t> m_sent{};
+  std::function<handler> m_handler{};
+
+private:
+  status driver_configure(const settings&) override
+  {
+    return success();
+  };
+
+  status driver_send(const message_t& p_message) override
+  {
+    m_sent.push_back(p_message);
+    return success();
+  };
+
+  status driver_on_receive(hal::callback<handler> p_handler) override
+  {
+    m_handler = p_handler;
+    return success();
+  };
+};
+
+class mock_steady_clock : public hal::steady_clock
+{
+public:
+  std::uint64_t m_uptime = 0;
+
+private:
+  hertz driver_frequency() override
+  {
+    return 1.0_MHz;
+  }
+
+  result<std::uint64_t> driver_uptime() override
+  {
+    return m_uptime;
+  }
+};
+
+/// Deliver every frame sent on one bus to the node attached to the other
+std::size_t deliver(loopback_can& p_from, loopback_can& p_to)
+{
+  auto frames = std::move(p_from.m_sent);
+  p_from.m_sent.clear();
+  for (const auto& frame : frames) {
+    p_to.m_handler(frame);
+  }
+  return frames.size();
+}
+}  // namespace
+
+void iso_tp_test()
+{
+  using namespace boost::ut;
+  using namespace std::chrono_literals;
+
+  static constexpr can::id_t sender_id = 0x7E0;
+  static constexpr can::id_t receiver_id = 0x7E8;
+
+  "iso_tp_encode_separation_time()"_test = []() {
+    static_assert(iso_tp_encode_separation_time(0us) == 0x00);
+    static_assert(iso_tp_encode_separation_time(100us) == 0xF1);
+    static_assert(iso_tp_encode_separation_time(150us) == 0xF2);
+    static_assert(iso_tp_encode_separation_time(900us) == 0xF9);
+    static_assert(iso_tp_encode_separation_time(901us) == 0x01);
+    static_assert(iso_tp_encode_separation_time(5ms) == 0x05);
+    static_assert(iso_tp_encode_separation_time(1s) == 0x7F);
+  };
+
+  "iso_tp_decode_separation_time()"_test = []() {
+    static_assert(iso_tp_decode_separation_time(0x00) == 0us);
+    static_assert(iso_tp_decode_separation_time(0x7F) == 127ms);
+    static_assert(iso_tp_decode_separation_time(0xF1) == 100us);
+    static_assert(iso_tp_decode_separation_time(0xF9) == 900us);
+    static_assert(iso_tp_decode_separation_time(0x80) == 127ms);
+    static_assert(iso_tp_decode_separation_time(0xFA) == 127ms);
+  };
+
+  "single frame"_test = []() {
+    // Setup
+    loopback_can sender_bus;
+    loopback_can receiver_bus;
+    mock_steady_clock clock;
+    auto sender_router = can_router::create(sender_bus).value();
+    auto receiver_router = can_router::create(receiver_bus).value();
+    std::array<hal::byte, 16> buffer{};
+    iso_tp_sender sender(sender_router, clock, sender_id, receiver_id);
+    iso_tp_receiver receiver(
+      receiver_router, clock, sender_id, receiver_id, buffer);
+    const std::array<hal::byte, 3> message{ 0x22, 0xF1, 0x90 };
+
+    // Exercise
+    auto send_status = sender.send(message);
+    auto sender_state = sender();
+    deliver(sender_bus, receiver_bus);
+    auto receiver_state = receiver();
+
+    // Verify
+    expect(bool{ send_status });
+    expect(work_state::finished == sender_state.value());
+    expect(work_state::finished == receiver_state.value());
+    expect(std::ranges::equal(message, receiver.data()));
+    expect(that % 0 == receiver_bus.m_sent.size());
+  };
+
+  "multi frame with block size"_test = []() {
+    // Setup
+    loopback_can sender_bus;
+    loopback_can receiver_bus;
+    mock_steady_clock clock;
+    auto sender_router = can_router::create(sender_bus).value();
+    auto receiver_router = can_router::create(receiver_bus).value();
+    std::array<hal::byte, 64> buffer{};
+    std::array<hal::byte, 40> message{};
+    std::iota(message.begin(), message.end(), hal::byte{ 1 });
+    iso_tp_sender sender(sender_router, clock, sender_id, receiver_id);
+    iso_tp_receiver receiver(receiver_router,
+                             clock,
+                             sender_id,
+                             receiver_id,
+                             buffer,
+                             { .block_size = 2, .padding = std::nullopt });
+    std::size_t flow_control_frames = 0;
+    std::vector<hal::byte> sequence_numbers;
+
+    // Exercise
+    expect(bool{ sender.send(message) });
+    expect(that % 1 == sender_bus.m_sent.size());
+    expect(that % 0x10 == sender_bus.m_sent[0].payload[0]);
+    expect(that % 40 == sender_bus.m_sent[0].payload[1]);
+    deliver(sender_bus, receiver_bus);
+
+    auto collect_sequence_numbers = [&]() {
+      for (const auto& frame : sender_bus.m_sent) {
+        sequence_numbers.push_back(frame.payload[0]);
+      }
+    };
+
+    for (int i = 0; i < 10 && sender().value() == work_state::in_progress;
+         i++) {
+      collect_sequence_numbers();
+      deliver(sender_bus, receiver_bus);
+      flow_control_frames += deliver(receiver_bus, sender_bus);
+    }
+    collect_sequence_numbers();
+    deliver(sender_bus, receiver_bus);
+
+    // Verify
+    expect(work_state::finished == sender().value());
+    expect(work_state::finished == receiver().value());
+    expect(std::ranges::equal(message, receiver.data()));
+    // 40 bytes = 6 in the first frame + 5 consecutive frames
+    expect(that % 3 == flow_control_frames);
+    const std::vector<hal::byte> expected{ 0x21, 0x22, 0x23, 0x24, 0x25 };
+    expect(expected == sequence_numbers);
+  };
+
+  "separation time paces consecutive frames"_test = []() {
+    // Setup
+    loopback_can sender_bus;
+    loopback_can receiver_bus;
+    mock_steady_clock clock;
+    auto sender_router = can_router::create(sender_bus).value();
+    auto receiver_router = can_router::create(receiver_bus).value();
+    std::array<hal::byte, 27> buffer{};
+    std::array<hal::byte, 27> message{};
+    std::iota(message.begin(), message.end(), hal::byte{ 0 });
+    iso_tp_sender sender(sender_router, clock, sender_id, receiver_id);
+    iso_tp_receiver receiver(receiver_router,
+                             clock,
+                             sender_id,
+                             receiver_id,
+                             buffer,
+                             { .separation_time = 2ms });
+
+    // Exercise
+    expect(bool{ sender.send(message) });
+    deliver(sender_bus, receiver_bus);
+    deliver(receiver_bus, sender_bus);
+    auto first_state = sender();
+    auto first_count = sender_bus.m_sent.size();
+    clock.m_uptime += 1'999;
+    auto early_state = sender();
+    auto early_count = sender_bus.m_sent.size();
+    clock.m_uptime += 1;
+    auto second_state = sender();
+    auto second_count = sender_bus.m_sent.size();
+    clock.m_uptime += 2'000;
+    auto last_state = sender();
+    deliver(sender_bus, receiver_bus);
+
+    // Verify
+    expect(work_state::in_progress == first_state.value());
+    expect(that % 1 == first_count);
+    expect(work_state::in_progress == early_state.value());
+    expect(that % 1 == early_count);
+    expect(work_state::in_progress == second_state.value());
+    expect(that % 2 == second_count);
+    expect(work_state::finished == last_state.value());
+    expect(work_state::finished == receiver().value());
+    expect(std::ranges::equal(message, receiver.data()));
+  };
+
+  "receiver overflow aborts sender"_test = []() {
+    // Setup
+    loopback_can sender_bus;
+    loopback_can receiver_bus;
+    mock_steady_clock clock;
+    auto sender_router = can_router::create(sender_bus).value();
+    auto receiver_router = can_router::create(receiver_bus).value();
+    std::array<hal::byte, 8> buffer{};
+    std::array<hal::byte, 9> message{};
+    iso_tp_sender sender(sender_router, clock, sender_id, receiver_id);
+    iso_tp_receiver receiver(
+      receiver_router, clock, sender_id, receiver_id, buffer);
+
+    // Exercise
+    expect(bool{ sender.send(message) });
+    deliver(sender_bus, receiver_bus);
+    deliver(receiver_bus, sender_bus);
+
+    // Verify
+    expect(work_state::failed == sender().value());
+    expect(std::errc::no_buffer_space == sender.error());
+    expect(work_state::failed == receiver().value());
+    expect(std::errc::no_buffer_space == receiver.error());
+    expect(receiver.data().empty());
+  };
+
+  "timeouts"_test = []() {
+    // Setup
+    loopback_can sender_bus;
+    loopback_can receiver_bus;
+    mock_steady_clock clock;
+    auto sender_router = can_router::create(sender_bus).value();
+    auto receiver_router = can_router::create(receiver_bus).value();
+    std::array<hal::byte, 32> buffer{};
+    std::array<hal::byte, 32> message{};
+    iso_tp_sender sender(
+      sender_router, clock, sender_id, receiver_id, { .timeout = 10ms });
+    iso_tp_receiver receiver(receiver_router,
+                             clock,
+                             sender_id,
+                             receiver_id,
+                             buffer,
+                             { .timeout = 10ms });
+
+    // Exercise
+    expect(bool{ sender.send(message) });
+    deliver(sender_bus, receiver_bus);
+    // Flow control frame is lost
+    receiver_bus.m_sent.clear();
+    clock.m_uptime += 9'999;
+    auto sender_before = sender();
+    auto receiver_before = receiver();
+    clock.m_uptime += 1;
+    auto sender_after = sender();
+    auto receiver_after = receiver();
+    auto sender_error = sender.error();
+    auto restart_status = sender.send(message);
+
+    // Verify
+    expect(work_state::in_progress == sender_before.value());
+    expect(work_state::in_progress == receiver_before.value());
+    expect(work_state::failed == sender_after.value());
+    expect(std::errc::timed_out == sender_error);
+    expect(work_state::failed == receiver_after.value());
+    expect(std::errc::timed_out == receiver.error());
+    // A failed sender can start a new message
+    expect(bool{ restart_status });
+  };
+
+  "wait flow status and busy sender"_test = []() {
+    // Setup
+    loopback_can sender_bus;
+    loopback_can receiver_bus;
+    mock_steady_clock clock;
+    auto sender_router = can_router::create(sender_bus).value();
+    std::array<hal::byte, 32> message{};
+    iso_tp_sender sender(
+      sender_router, clock, sender_id, receiver_id, { .timeout = 10ms });
+    const can::message_t wait{ .id = receiver_id,
+                               .payload = { 0x31, 0, 0 },
+                               .length = 3 };
+
+    // Exercise
+    expect(bool{ sender.send(message) });
+    auto busy_status = sender.send(message);
+    clock.m_uptime += 9'000;
+    sender_bus.m_handler(wait);
+    clock.m_uptime += 9'000;
+    auto state = sender();
+
+    // Verify
+    expect(!busy_status);
+    expect(work_state::in_progress == state.value());
+    expect(that % 1 == sender_bus.m_sent.size());
+  };
+
+  "out of sequence consecutive frame"_test = []() {
+    // Setup
+    loopback_can receiver_bus;
+    mock_steady_clock clock;
+    auto receiver_router = can_router::create(receiver_bus).value();
+    std::array<hal::byte, 32> buffer{};
+    iso_tp_receiver receiver(
+      receiver_router, clock, sender_id, receiver_id, buffer);
+    const can::message_t first{ .id = sender_id,
+                                .payload = { 0x10, 20, 1, 2, 3, 4, 5, 6 },
+                                .length = 8 };
+    const can::message_t consecutive{ .id = sender_id,
+                                      .payload = { 0x22, 7, 8, 9 },
+                                      .length = 8 };
+
+    // Exercise
+    receiver_bus.m_handler(first);
+    auto receiving = receiver();
+    receiver_bus.m_handler(consecutive);
+    auto failed = receiver();
+    auto failure = receiver.error();
+    receiver.reset();
+    auto reset_state = receiver();
+
+    // Verify
+    expect(work_state::in_progress == receiving.value());
+    expect(that % 1 == receiver_bus.m_sent.size());
+    expect(that % 0x30 == receiver_bus.m_sent[0].payload[0]);
+    expect(that % receiver_id == receiver_bus.m_sent[0].id);
+    expect(work_state::failed == failed.value());
+    expect(std::errc::bad_message == failure);
+    expect(work_state::in_progress == reset_state.value());
+    expect(std::errc{} == receiver.error());
+  };
+
+  "concurrent sessions on one router"_test = []() {
+    // Setup
+    loopback_can node_a_bus;
+    loopback_can node_b_bus;
+    mock_steady_clock clock;
+    auto node_a = can_router::create(node_a_bus).value();
+    auto node_b = can_router::create(node_b_bus).value();
+    std::array<hal::byte, 16> buffer_a{};
+    std::array<hal::byte, 16> buffer_b{};
+    std::array<hal::byte, 10> message_a{};
+    std::array<hal::byte, 12> message_b{};
+    message_a.fill(0xAA);
+    message_b.fill(0xBB);
+    iso_tp_sender sender_a(node_a, clock, 0x100, 0x101);
+    iso_tp_sender sender_b(node_a, clock, 0x200, 0x201);
+    iso_tp_receiver receiver_a(node_b, clock, 0x100, 0x101, buffer_a);
+    iso_tp_receiver receiver_b(node_b, clock, 0x200, 0x201, buffer_b);
+
+    // Exercise
+    expect(bool{ sender_a.send(message_a) });
+    expect(bool{ sender_b.send(message_b) });
+    deliver(node_a_bus, node_b_bus);
+    deliver(node_b_bus, node_a_bus);
+    auto state_a = sender_a();
+    auto state_b = sender_b();
+    deliver(node_a_bus, node_b_bus);
+
+    // Verify
+    expect(work_state::finished == state_a.value());
+    expect(work_state::finished == state_b.value());
+    expect(std::ranges::equal(message_a, receiver_a.data()));
+    expect(std::ranges::equal(message_b, receiver_b.data()));
+  };
+};
+}  // namespace hal
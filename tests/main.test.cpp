@@ -3,18 +3,29 @@
 namespace hal {
 extern void as_bytes_test();
 extern void bit_test();
+extern void block_cache_test();
 extern void can_router_test();
+extern void can_log_test();
+extern void can_signal_test();
 extern void enum_test();
 extern void i2c_util_test();
+extern void i2c_bus_scheduler_test();
+extern void i2c_profiler_test();
+extern void i2c_register_cache_test();
+extern void i2c_simulator_test();
 extern void input_pin_util_test();
 extern void interrupt_pin_util_test();
+extern void iso_tp_test();
 extern void map_test();
 extern void math_test();
 extern void move_interceptor_test();
 extern void output_pin_util_test();
 extern void overflow_counter_test();
+extern void sd_card_test();
 extern void serial_util_test();
 extern void spi_util_test();
+extern void spi_bus_manager_test();
+extern void spi_flash_test();
 extern void static_callable_test();
 extern void static_list_test();
 extern void steady_clock_utility_test();
@@ -37,18 +48,29 @@ int main()
 
   hal::as_bytes_test();
   hal::bit_test();
+  hal::block_cache_test();
   hal::can_router_test();
+  hal::can_log_test();
+  hal::can_signal_test();
   hal::enum_test();
   hal::i2c_util_test();
+  hal::i2c_bus_scheduler_test();
+  hal::i2c_profiler_test();
+  hal::i2c_register_cache_test();
+  hal::i2c_simulator_test();
   hal::input_pin_util_test();
   hal::interrupt_pin_util_test();
+  hal::iso_tp_test();
   hal::map_test();
   hal::math_test();
   hal::move_interceptor_test();
   hal::output_pin_util_test();
   hal::overflow_counter_test();
+  hal::sd_card_test();
   hal::serial_util_test();
   hal::spi_util_test();
+  hal::spi_bus_manager_test();
+  hal::spi_flash_test();
   hal::static_callable_test();
   hal::static_list_test();
   hal::steady_clock_utility_test();
@@ -0,0 +1,531 @@
+#include <libhal-util/sd_card.hpp>
+
+#include <array>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+#include <boost/ut.hpp>
+
+namespace hal {
+namespace {
+/// SD card in spi mode that responds byte by byte
+class mock_sd_card : public hal::spi
+{
+public:
+  static constexpr std::size_t block_count = 16;
+
+  std::vector<hal::byte> m_memory =
+    std::vector<hal::byte>(block_count * sd_card::block_size, 0);
+  /// Index of each command received, application commands included
+  std::vector<hal::byte> m_commands{};
+  /// Argument of the last command
+  std::uint32_t m_last_argument = 0;
+  /// Argument of the last ACMD23
+  std::uint32_t m_pre_erase = 0;
+  /// Number of ACMD41 calls before the card leaves the idle state
+  int m_initialization_polls = 2;
+  /// Number of busy bytes after each written block
+  int m_busy_bytes = 3;
+  bool m_high_capacity = true;
+  bool m_version_1 = false;
+  bool m_corrupt_reads = false;
+  bool m_crc_enabled = false;
+  bool m_present = true;
+  bool m_selected = false;
+
+  void select(bool p_selected)
+  {
+    m_selected = p_selected;
+  }
+
+private:
+  enum class mode : std::uint8_t
+  {
+    command,
+    multiple_read,
+    receive_token,
+    receive_data,
+  };
+
+  status driver_configure(const settings&) override
+  {
+    return success();
+  }
+
+  status driver_transfer(std::span<const hal::byte> p_data_out,
+                         std::span<hal::byte> p_data_in,
+                         hal::byte p_filler) override
+  {
+    const auto length = std::max(p_data_out.size(), p_data_in.size());
+    for (std::size_t i = 0; i < length; i++) {
+      const auto out = i < p_data_out.size() ? p_data_out[i] : p_filler;
+      const auto in =
+        m_selected && m_present ? exchange(out) : hal::byte{ 0xFF };
+      if (i < p_data_in.size()) {
+        p_data_in[i] = in;
+      }
+    }
+    return success();
+  }
+
+  hal::byte exchange(hal::byte p_out)
+  {
+    if (m_responses.empty() && m_mode == mode::multiple_read) {
+      queue_block(m_block++);
+    }
+    hal::byte in = 0xFF;
+    if (!m_responses.empty()) {
+      in = m_responses.front();
+      m_responses.pop_front();
+    }
+    receive(p_out);
+    return in;
+  }
+
+  void receive(hal::byte p_out)
+  {
+    switch (m_mode) {
+      case mode::receive_data:
+        m_data.push_back(p_out);
+        if (m_data.size() == sd_card::block_size + 2) {
+          store_block();
+        }
+        return;
+      case mode::receive_token:
+        if (p_out == 0xFE || p_out == 0xFC) {
+          m_mode = mode::receive_data;
+          m_data.clear();
+        } else if (p_out == 0xFD) {
+          m_mode = mode::command;
+          m_responses.push_back(0xFF);
+          m_responses.insert(m_responses.end(), m_busy_bytes, 0x00);
+        }
+        return;
+      default:
+        break;
+    }
+
+    if (m_frame.empty() && (p_out & 0xC0) != 0x40) {
+      return;
+    }
+    m_frame.push_back(p_out);
+    if (m_frame.size() == 6) {
+      execute();
+      m_frame.clear();
+    }
+  }
+
+  hal::byte r1() const
+  {
+    return m_idle ? 0x01 : 0x00;
+  }
+
+  void respond(std::initializer_list<hal::byte> p_bytes)
+  {
+    m_responses.push_back(0xFF);
+    m_responses.insert(m_responses.end(), p_bytes);
+  }
+
+  std::size_t block_of(std::uint32_t p_argument) const
+  {
+    return m_high_capacity ? p_argument : p_argument / sd_card::block_size;
+  }
+
+  void queue_block(std::size_t p_block)
+  {
+    const auto block = std::span(m_memory).subspan(
+      p_block * sd_card::block_size, sd_card::block_size);
+    const auto crc = sd::crc16(block);
+    m_responses.push_back(0xFF);
+    m_responses.push_back(0xFE);
+    m_responses.insert(m_responses.end(), block.begin(), block.end());
+    if (m_corrupt_reads) {
+      m_responses[10] ^= 0x01;
+    }
+    m_responses.push_back(static_cast<hal::byte>(crc >> 8));
+    m_responses.push_back(static_cast<hal::byte>(crc));
+  }
+
+  void store_block()
+  {
+    const auto data = std::span(m_data).first(sd_card::block_size);
+    const auto crc = static_cast<std::uint16_t>(m_data[512] << 8 | m_data[513]);
+    if (crc != sd::crc16(data)) {
+      m_responses.push_back(0x0B);
+    } else {
+      std::copy(data.begin(),
+                data.end(),
+                m_memory.begin() + static_cast<std::ptrdiff_t>(
+                                     m_block * sd_card::block_size));
+      m_block++;
+      m_responses.push_back(0x05);
+      m_responses.insert(m_responses.end(), m_busy_bytes, 0x00);
+    }
+    m_mode = m_multiple ? mode::receive_token : mode::command;
+  }
+
+  void execute()
+  {
+    const auto index = static_cast<hal::byte>(m_frame[0] & 0x3F);
+    const auto argument =
+      static_cast<std::uint32_t>(m_frame[1] << 24 | m_frame[2] << 16 |
+                                 m_frame[3] << 8 | m_frame[4]);
+    const bool application = m_application;
+    m_application = false;
+    m_commands.push_back(index);
+    m_last_argument = argument;
+
+    const bool crc_required = m_crc_enabled || index == 0 || index == 8;
+    const auto crc = sd::crc7(std::span(m_frame).first(5));
+    if (crc_required && m_frame[5] != (crc << 1 | 1)) {
+      respond({ static_cast<hal::byte>(r1() | 0x08) });
+      return;
+    }
+
+    switch (index) {
+      case 0:
+        m_idle = true;
+        respond({ r1() });
+        break;
+      case 8:
+        if (m_version_1) {
+          respond({ 0x05 });
+        } else {
+          respond({ r1(), 0x00, 0x00, m_frame[3], m_frame[4] });
+        }
+        break;
+      case 12:
+        m_mode = mode::command;
+        m_responses.clear();
+        // Stuff byte, R1 then busy
+        m_responses.push_back(0x3C);
+        m_responses.push_back(0x00);
+        m_responses.insert(m_responses.end(), 2, 0x00);
+        break;
+      case 16:
+        respond({ r1() });
+        break;
+      case 17:
+        respond({ r1() });
+        queue_block(block_of(argument));
+        break;
+      case 18:
+        respond({ r1() });
+        m_block = block_of(argument);
+        m_mode = mode::multiple_read;
+        break;
+      case 23:
+        m_pre_erase = argument;
+        respond({ r1() });
+        break;
+      case 24:
+      case 25:
+        respond({ r1() });
+        m_block = block_of(argument);
+        m_multiple = index == 25;
+        m_mode = mode::receive_token;
+        break;
+      case 41:
+        if (application && --m_initialization_polls <= 0) {
+          m_idle = false;
+        }
+        respond({ r1() });
+        break;
+      case 55:
+        m_application = true;
+        respond({ r1() });
+        break;
+      case 58:
+        respond({ r1(),
+                  static_cast<hal::byte>(m_high_capacity ? 0xC0 : 0x80),
+                  0xFF,
+                  0x80,
+                  0x00 });
+        break;
+      case 59:
+        m_crc_enabled = argument & 1;
+        respond({ r1() });
+        break;
+      default:
+        respond({ static_cast<hal::byte>(r1() | 0x04) });
+        break;
+    }
+  }
+
+  std::deque<hal::byte> m_responses{};
+  std::vector<hal::byte> m_frame{};
+  std::vector<hal::byte> m_data{};
+  std::size_t m_block = 0;
+  mode m_mode = mode::command;
+  bool m_idle = false;
+  bool m_application = false;
+  bool m_multiple = false;
+};
+
+class mock_chip_select : public hal::output_pin
+{
+public:
+  explicit mock_chip_select(mock_sd_card& p_card)
+    : m_card(&p_card)
+  {
+  }
+
+  bool m_high = true;
+
+private:
+  status driver_configure(const settings&) override
+  {
+    return success();
+  }
+
+  status driver_level(bool p_high) override
+  {
+    m_high = p_high;
+    m_card->select(!p_high);
+    return success();
+  }
+
+  result<level_t> driver_level() override
+  {
+    return level_t{ m_high };
+  }
+
+  mock_sd_card* m_card;
+};
+
+class mock_steady_clock : public hal::steady_clock
+{
+public:
+  std::uint64_t m_uptime = 0;
+
+private:
+  hertz driver_frequency() override
+  {
+    return 1.0_MHz;
+  }
+
+  result<std::uint64_t> driver_uptime() override
+  {
+    m_uptime += 10;
+    return m_uptime;
+  }
+};
+
+std::vector<hal::byte> make_blocks(std::size_t p_count)
+{
+  std::vector<hal::byte> data(p_count * sd_card::block_size);
+  for (std::size_t i = 0; i < data.size(); i++) {
+    data[i] = static_cast<hal::byte>(i * 13 + i / 512);
+  }
+  return data;
+}
+}  // namespace
+
+void sd_card_test()
+{
+  using namespace boost::ut;
+
+  "sd::crc7 and sd::crc16"_test = []() {
+    constexpr std::array<hal::byte, 5> go_idle{ 0x40, 0, 0, 0, 0 };
+    constexpr std::array<hal::byte, 5> send_if_cond{ 0x48, 0, 0, 0x01, 0xAA };
+    constexpr std::array<hal::byte, 5> read_block{ 0x51, 0, 0, 0, 0 };
+    static_assert(sd::crc7(go_idle) == 0x4A);
+    static_assert(sd::crc7(send_if_cond) == 0x43);
+    static_assert(sd::crc7(read_block) == 0x2A);
+
+    std::array<hal::byte, 512> erased{};
+    erased.fill(0xFF);
+    constexpr std::array<hal::byte, 9> check{ '1', '2', '3', '4', '5',
+                                              '6', '7', '8', '9' };
+    expect(that % 0x7FA1 == sd::crc16(erased));
+    static_assert(sd::crc16(check) == 0x31C3);
+  };
+
+  "sd_card initializes a high capacity card"_test = []() {
+    // Setup
+    mock_sd_card card;
+    mock_chip_select chip_select(card);
+    mock_steady_clock clock;
+
+    // Exercise
+    auto result = sd_card::create(card, chip_select, clock);
+
+    // Verify
+    expect(bool{ result });
+    expect(result.value().high_capacity());
+    expect(std::vector<hal::byte>{ 0, 8, 59, 55, 41, 55, 41, 58 } ==
+           card.m_commands);
+    expect(card.m_crc_enabled);
+    expect(chip_select.m_high);
+  };
+
+  "sd_card initializes a version 1 card"_test = []() {
+    // Setup
+    mock_sd_card card;
+    mock_chip_select chip_select(card);
+    mock_steady_clock clock;
+    card.m_version_1 = true;
+    card.m_high_capacity = false;
+    card.m_initialization_polls = 1;
+
+    // Exercise
+    auto result = sd_card::create(card, chip_select, clock);
+    std::array<hal::byte, sd_card::block_size> block{};
+    auto read = result.value().read(2, block);
+
+    // Verify
+    expect(bool{ result });
+    expect(!result.value().high_capacity());
+    expect(std::vector<hal::byte>{ 0, 8, 59, 55, 41, 16, 17 } ==
+           card.m_commands);
+    expect(bool{ read });
+    // Byte addressed
+    expect(that % 1024 == card.m_last_argument);
+  };
+
+  "sd_card fails without a card"_test = []() {
+    // Setup
+    mock_sd_card card;
+    mock_chip_select chip_select(card);
+    mock_steady_clock clock;
+    card.m_present = false;
+
+    // Exercise
+    auto result = sd_card::create(card, chip_select, clock);
+
+    // Verify
+    expect(!result);
+    expect(that % 0 == card.m_commands.size());
+    expect(chip_select.m_high);
+  };
+
+  "sd_card times out while initializing"_test = []() {
+    // Setup
+    mock_sd_card card;
+    mock_chip_select chip_select(card);
+    mock_steady_clock clock;
+    card.m_initialization_polls = 1'000'000;
+
+    // Exercise
+    auto result = sd_card::create(card, chip_select, clock);
+
+    // Verify
+    expect(!result);
+    // One second at 10us per clock read
+    expect(that % 1'000'000 < clock.m_uptime);
+    expect(that % 1'000'000 > card.m_initialization_polls);
+    expect(chip_select.m_high);
+  };
+
+  "sd_card reads single and multiple blocks"_test = []() {
+    // Setup
+    mock_sd_card card;
+    mock_chip_select chip_select(card);
+    mock_steady_clock clock;
+    card.m_memory = make_blocks(mock_sd_card::block_count);
+    auto sd = sd_card::create(card, chip_select, clock).value();
+    card.m_commands.clear();
+    std::vector<hal::byte> single(sd_card::block_size);
+    std::vector<hal::byte> multiple(3 * sd_card::block_size);
+
+    // Exercise
+    auto single_result = sd.read(1, single);
+    auto multiple_result = sd.read(4, multiple);
+
+    // Verify
+    expect(bool{ single_result });
+    expect(bool{ multiple_result });
+    expect(std::vector<hal::byte>{ 17, 18, 12 } == card.m_commands);
+    expect(std::equal(
+      single.begin(), single.end(), card.m_memory.begin() + 1 * 512));
+    expect(std::equal(
+      multiple.begin(), multiple.end(), card.m_memory.begin() + 4 * 512));
+    expect(that % 4 == sd.statistics().blocks_read);
+    expect(chip_select.m_high);
+  };
+
+  "sd_card writes multiple blocks with a pre-erase hint"_test = []() {
+    // Setup
+    mock_sd_card card;
+    mock_chip_select chip_select(card);
+    mock_steady_clock clock;
+    auto sd = sd_card::create(card, chip_select, clock).value();
+    card.m_commands.clear();
+    const auto data = make_blocks(4);
+    const auto single = make_blocks(1);
+
+    // Exercise
+    auto multiple_result = sd.write(3, data);
+    auto single_result = sd.write(0, single);
+
+    // Verify
+    expect(bool{ multiple_result });
+    expect(bool{ single_result });
+    expect(std::vector<hal::byte>{ 55, 23, 25, 24 } == card.m_commands);
+    expect(that % 4 == card.m_pre_erase);
+    expect(std::equal(data.begin(), data.end(), card.m_memory.begin() + 1536));
+    expect(std::equal(single.begin(), single.end(), card.m_memory.begin()));
+    expect(that % 5 == sd.statistics().blocks_written);
+    expect(chip_select.m_high);
+  };
+
+  "sd_card streams writes with a busy worker"_test = []() {
+    // Setup
+    mock_sd_card card;
+    mock_chip_select chip_select(card);
+    mock_steady_clock clock;
+    auto sd = sd_card::create(card, chip_select, clock).value();
+    const auto data = make_blocks(2);
+    int busy_polls = 0;
+
+    // Exercise
+    auto begun = sd.begin_write(8, 2);
+    auto blocked = sd.read(0, std::span(card.m_memory).first(512));
+    auto first = sd.write_next(std::span(data).first(512));
+    auto busy = sd.busy();
+    while (busy().value() == work_state::in_progress) {
+      busy_polls++;
+    }
+    auto second = sd.write_next(std::span(data).subspan(512));
+    auto waited = try_until(sd.busy(), never_timeout());
+    auto ended = sd.end_write();
+
+    // Verify
+    expect(bool{ begun });
+    expect(!blocked);
+    expect(bool{ first });
+    expect(that % card.m_busy_bytes == busy_polls);
+    expect(bool{ second });
+    expect(bool{ waited });
+    expect(bool{ ended });
+    expect(std::equal(
+      data.begin(), data.end(), card.m_memory.begin() + 8 * 512));
+    expect(chip_select.m_high);
+    expect(!sd.write_next(std::span(data).first(512)));
+  };
+
+  "sd_card reports corrupted blocks"_test = []() {
+    // Setup
+    mock_sd_card card;
+    mock_chip_select chip_select(card);
+    mock_steady_clock clock;
+    auto sd = sd_card::create(card, chip_select, clock).value();
+    card.m_commands.clear();
+    card.m_corrupt_reads = true;
+    std::vector<hal::byte> data(2 * sd_card::block_size);
+
+    // Exercise
+    auto result = sd.read(0, data);
+    auto misaligned = sd.read(0, std::span(data).first(100));
+
+    // Verify
+    expect(!result);
+    expect(!misaligned);
+    expect(that % 1 == sd.statistics().crc_errors);
+    // The multiple block read is still stopped
+    expect(std::vector<hal::byte>{ 18, 12 } == card.m_commands);
+    expect(chip_select.m_high);
+  };
+};
+}  // namespace hal
@@ -1,8 +1,89 @@
 #include <libhal-util/spi.hpp>
 
+#include <vector>
+
 #include <boost/ut.hpp>
 
 namespace hal {
+namespace {
+struct spi_transfer_record
+{
+  std::span<const hal::byte> data_out;
+  std::span<hal::byte> data_in;
+  hal::byte filler;
+};
+
+struct recording_bus
+{
+  // Each chip select change is recorded as an empty transfer
+  std::vector<spi_transfer_record> events{};
+  std::vector<bool> chip_select_levels{};
+};
+
+class recording_spi : public hal::spi
+{
+public:
+  explicit recording_spi(recording_bus& p_bus)
+    : m_bus(&p_bus)
+  {
+  }
+
+  int fail_on_transfer = -1;
+
+private:
+  status driver_configure(const settings&) override
+  {
+    return {};
+  }
+
+  status driver_transfer(std::span<const hal::byte> p_out,
+                         std::span<hal::byte> p_in,
+                         hal::byte p_filler) override
+  {
+    m_bus->events.push_back({ p_out, p_in, p_filler });
+    for (std::size_t i = 0; i < p_in.size(); i++) {
+      p_in[i] = static_cast<hal::byte>(i);
+    }
+    if (fail_on_transfer-- == 0) {
+      return hal::new_error(std::errc::io_error);
+    }
+    return {};
+  }
+
+  recording_bus* m_bus;
+};
+
+class recording_chip_select : public hal::output_pin
+{
+public:
+  explicit recording_chip_select(recording_bus& p_bus)
+    : m_bus(&p_bus)
+  {
+  }
+
+private:
+  status driver_configure(const settings&) override
+  {
+    return {};
+  }
+
+  status driver_level(bool p_high) override
+  {
+    m_bus->events.push_back({});
+    m_bus->chip_select_levels.push_back(p_high);
+    return {};
+  }
+
+  result<level_t> driver_level() override
+  {
+    return level_t{ m_bus->chip_select_levels.empty() ||
+                    m_bus->chip_select_levels.back() };
+  }
+
+  recording_bus* m_bus;
+};
+}  // namespace
+
 void spi_util_test()
 {
   using namespace boost::ut;
@@ -213,5 +294,141 @@ void spi_util_test()
     expect(that % expected_payload.data() == spi.m_out.data());
     expect(that % expected_payload.size() == spi.m_out.size());
   };
+
+  "segmented_transfer() holds chip select across segments"_test = []() {
+    // Setup
+    recording_bus bus;
+    recording_spi spi(bus);
+    recording_chip_select chip_select(bus);
+    const std::array<hal::byte, 4> command{ 0x0B, 0x00, 0x10, 0x00 };
+    std::array<hal::byte, 8> data{};
+    const std::array segments{
+      spi_write(command),
+      spi_dummy(1),
+      spi_read(data, 0x00),
+    };
+
+    // Exercise
+    auto result = segmented_transfer(spi, chip_select, segments);
+
+    // Verify
+    expect(static_cast<bool>(result));
+    expect(that % 5 == bus.events.size());
+    expect(bus.chip_select_levels == std::vector<bool>{ false, true });
+    expect(that % command.data() == bus.events[1].data_out.data());
+    expect(that % 4 == bus.events[1].data_out.size());
+    expect(that % 0 == bus.events[1].data_in.size());
+    expect(that % 1 == bus.events[2].data_out.size());
+    expect(that % 0xFF == bus.events[2].data_out[0]);
+    expect(that % 0 == bus.events[3].data_out.size());
+    expect(that % data.data() == bus.events[3].data_in.data());
+    expect(that % 8 == bus.events[3].data_in.size());
+    expect(that % 0x00 == bus.events[3].filler);
+    expect(that % 7 == data[7]);
+  };
+
+  "segmented_transfer() joins neighbouring buffers"_test = []() {
+    // Setup
+    recording_bus bus;
+    recording_spi spi(bus);
+    std::array<hal::byte, 6> frame{};
+    std::array<hal::byte, 4> tx{};
+    std::array<hal::byte, 4> rx{};
+    const std::array segments{
+      // Joined into one write
+      spi_write(std::span(frame).first(1)),
+      spi_write(std::span(frame).subspan(1, 3)),
+      // Joined into one read
+      spi_read(std::span(frame).subspan(4, 1), 0xA5),
+      spi_read(std::span(frame).subspan(5, 1), 0xA5),
+      // Joined into one full duplex transfer
+      spi_full_duplex(std::span(tx).first(2), std::span(rx).first(2)),
+      spi_full_duplex(std::span(tx).subspan(2), std::span(rx).subspan(2)),
+      // Joined into 16 and 4 bytes of dummy cycles
+      spi_dummy(12),
+      spi_dummy(8),
+    };
+
+    // Exercise
+    auto result = segmented_transfer(spi, segments);
+
+    // Verify
+    expect(static_cast<bool>(result));
+    expect(that % 5 == bus.events.size());
+    expect(that % frame.data() == bus.events[0].data_out.data());
+    expect(that % 4 == bus.events[0].data_out.size());
+    expect(that % &frame[4] == bus.events[1].data_in.data());
+    expect(that % 2 == bus.events[1].data_in.size());
+    expect(that % 0xA5 == bus.events[1].filler);
+    expect(that % 4 == bus.events[2].data_out.size());
+    expect(that % 4 == bus.events[2].data_in.size());
+    expect(that % 16 == bus.events[3].data_out.size());
+    expect(that % 4 == bus.events[4].data_out.size());
+  };
+
+  "segmented_transfer() keeps unrelated segments apart"_test = []() {
+    // Setup
+    recording_bus bus;
+    recording_spi spi(bus);
+    std::array<hal::byte, 4> frame{};
+    std::array<hal::byte, 2> other{};
+    const std::array segments{
+      // Not contiguous
+      spi_write(std::span(frame).first(1)),
+      spi_write(other),
+      // Contiguous but with a different filler
+      spi_read(std::span(frame).subspan(1, 1), 0x00),
+      spi_read(std::span(frame).subspan(2, 1), 0xFF),
+      // Contiguous but a write cannot be joined onto a read
+      spi_write(std::span(frame).subspan(3, 1)),
+    };
+
+    // Exercise
+    auto result = segmented_transfer(spi, segments);
+
+    // Verify
+    expect(static_cast<bool>(result));
+    expect(that % 5 == bus.events.size());
+  };
+
+  "segmented_transfer() performs a command and response in one call"_test =
+    []() {
+      // Setup
+      recording_bus bus;
+      recording_spi spi(bus);
+      const std::array<hal::byte, 1> command{ 0x9F };
+      std::array<hal::byte, 4> response{};
+      const std::array segments{ spi_full_duplex(command, response) };
+
+      // Exercise
+      auto result = segmented_transfer(spi, segments);
+
+      // Verify
+      expect(static_cast<bool>(result));
+      expect(that % 1 == bus.events.size());
+      expect(that % 1 == bus.events[0].data_out.size());
+      expect(that % 4 == bus.events[0].data_in.size());
+      // The identification bytes follow the byte received during the command
+      expect(that % 3 == response[3]);
+    };
+
+  "segmented_transfer() releases chip select on failure"_test = []() {
+    // Setup
+    recording_bus bus;
+    recording_spi spi(bus);
+    recording_chip_select chip_select(bus);
+    const std::array<hal::byte, 2> command{ 0x03, 0x00 };
+    std::array<hal::byte, 2> data{};
+    const std::array segments{ spi_write(command), spi_read(data) };
+    spi.fail_on_transfer = 0;
+
+    // Exercise
+    auto result = segmented_transfer(spi, chip_select, segments);
+
+    // Verify
+    expect(!result);
+    expect(that % 3 == bus.events.size());
+    expect(bus.chip_select_levels == std::vector<bool>{ false, true });
+  };
 };
 }  // namespace hal
@@ -0,0 +1,245 @@
+#include <libhal-util/spi_bus_manager.hpp>
+
+#include <array>
+#include <functional>
+#include <optional>
+#include <vector>
+
+#include <boost/ut.hpp>
+
+namespace hal {
+namespace {
+class mock_spi_bus : public hal::spi
+{
+public:
+  std::vector<hertz> m_configurations{};
+  std::vector<hal::byte> m_fillers{};
+  std::function<void()> m_during_transfer{};
+  bool m_fail_configure = false;
+
+private:
+  status driver_configure(const settings& p_settings) override
+  {
+    m_configurations.push_back(p_settings.clock_rate);
+    if (m_fail_configure) {
+      return hal::new_error(std::errc::invalid_argument);
+    }
+    return success();
+  }
+
+  status driver_transfer(std::span<const hal::byte>,
+                         std::span<hal::byte> p_data_in,
+                         hal::byte p_filler) override
+  {
+    m_fillers.push_back(p_filler);
+    std::fill(p_data_in.begin(), p_data_in.end(), 0xA5);
+    if (m_during_transfer) {
+      auto during = std::move(m_during_transfer);
+      m_during_transfer = nullptr;
+      during();
+    }
+    return success();
+  }
+};
+
+/// Fails after being called p_limit times
+auto failing_wait(int& p_calls, int p_limit)
+{
+  return [&p_calls, p_limit]() -> status {
+    if (++p_calls >= p_limit) {
+      return hal::new_error(std::errc::timed_out);
+    }
+    return success();
+  };
+}
+}  // namespace
+
+void spi_bus_manager_test()
+{
+  using namespace boost::ut;
+
+  "spi_bus_manager uncontended transfer"_test = []() {
+    // Setup
+    mock_spi_bus bus;
+    spi_bus_manager manager(bus);
+    spi_bus_manager::device sensor(manager, { .priority = 3 });
+    const std::array<hal::byte, 1> command{ 0x10 };
+    std::array<hal::byte, 2> data{};
+
+    // Exercise
+    auto result = sensor.transfer(command, data, 0x00);
+
+    // Verify
+    expect(bool{ result });
+    expect(that % 1 == manager.devices());
+    expect(std::array<hal::byte, 2>{ 0xA5, 0xA5 } == data);
+    expect(std::vector<hal::byte>{ 0x00 } == bus.m_fillers);
+    expect(that % 1 == sensor.statistics().transfers);
+    expect(that % 0 == sensor.statistics().contentions);
+    expect(that % 3 == sensor.device_settings().priority);
+  };
+
+  "spi_bus_manager skips redundant configuration"_test = []() {
+    // Setup
+    mock_spi_bus bus;
+    spi_bus_manager manager(bus);
+    spi_bus_manager::device display(manager);
+    spi_bus_manager::device flash(manager);
+    spi_bus_manager::device sensor(manager);
+    const spi::settings display_settings{ .clock_rate = 20.0_MHz };
+    const spi::settings flash_settings{ .clock_rate = 20.0_MHz };
+    const spi::settings sensor_settings{ .clock_rate = 1.0_MHz,
+                                         .clock_idles_high = true };
+    const std::array<hal::byte, 1> data{};
+
+    // Exercise
+    // Each driver configures its device before every transfer
+    for (int i = 0; i < 4; i++) {
+      (void)display.configure(display_settings);
+      (void)write(display, data);
+      (void)flash.configure(flash_settings);
+      (void)write(flash, data);
+    }
+    (void)sensor.configure(sensor_settings);
+    (void)write(sensor, data);
+    (void)display.configure(display_settings);
+    (void)write(display, data);
+
+    // Verify
+    expect(std::vector<hertz>{ 20.0_MHz, 1.0_MHz, 20.0_MHz } ==
+           bus.m_configurations);
+    expect(that % 3 == manager.configurations());
+    expect(that % 5 == display.statistics().configure_calls);
+    expect(that % 2 == display.statistics().reconfigurations);
+    expect(that % 0 == flash.statistics().reconfigurations);
+    expect(that % 1 == sensor.statistics().reconfigurations);
+    expect(sensor_settings == sensor.bus_settings());
+  };
+
+  "spi_bus_manager retries a failed configuration"_test = []() {
+    // Setup
+    mock_spi_bus bus;
+    spi_bus_manager manager(bus);
+    spi_bus_manager::device device(manager);
+    const std::array<hal::byte, 1> data{};
+    bus.m_fail_configure = true;
+
+    // Exercise
+    auto failed = write(device, data);
+    bus.m_fail_configure = false;
+    auto retried = write(device, data);
+
+    // Verify
+    expect(!failed);
+    expect(bool{ retried });
+    expect(that % 2 == bus.m_configurations.size());
+    expect(that % 1 == bus.m_fillers.size());
+  };
+
+  "spi_bus_manager grants the highest priority waiting device"_test = []() {
+    // Setup
+    mock_spi_bus bus;
+    spi_bus_manager manager(bus);
+    int urgent_calls = 0;
+    int background_calls = 0;
+    spi_bus_manager::device holder(manager);
+    spi_bus_manager::device background(
+      manager, {}, failing_wait(background_calls, 3));
+    spi_bus_manager::device urgent(manager, { .priority = 5 }, [&]() -> status {
+      urgent_calls++;
+      if (urgent_calls == 1) {
+        // Bus is busy and the urgent device is waiting
+        (void)write(background, std::array<hal::byte, 1>{});
+      }
+      return hal::new_error(std::errc::timed_out);
+    });
+    status urgent_result{};
+    bus.m_during_transfer = [&]() {
+      urgent_result = write(urgent, std::array<hal::byte, 1>{});
+    };
+
+    // Exercise
+    auto held = write(holder, std::array<hal::byte, 1>{});
+    auto after = write(background, std::array<hal::byte, 1>{});
+
+    // Verify
+    expect(bool{ held });
+    expect(!urgent_result);
+    expect(that % 1 == urgent_calls);
+    expect(that % 3 == background_calls);
+    expect(that % 0 == urgent.statistics().transfers);
+    expect(bool{ after });
+    expect(that % 1 == background.statistics().transfers);
+  };
+
+  "spi_bus_manager orders equal priority by request"_test = []() {
+    // Setup
+    mock_spi_bus bus;
+    spi_bus_manager manager(bus);
+    int later_calls = 0;
+    spi_bus_manager::device holder(manager);
+    spi_bus_manager::device later(manager, {}, failing_wait(later_calls, 1));
+    spi_bus_manager::device earlier(manager, {}, [&]() -> status {
+      (void)write(later, std::array<hal::byte, 1>{});
+      return hal::new_error(std::errc::timed_out);
+    });
+    bus.m_during_transfer = [&]() {
+      (void)write(earlier, std::array<hal::byte, 1>{});
+    };
+
+    // Exercise
+    (void)write(holder, std::array<hal::byte, 1>{});
+    auto earlier_after = write(earlier, std::array<hal::byte, 1>{});
+
+    // Verify
+    expect(that % 1 == later_calls);
+    expect(that % 0 == later.statistics().transfers);
+    expect(bool{ earlier_after });
+    expect(that % 1 == earlier.statistics().transfers);
+    expect(that % 0 == earlier.statistics().contentions);
+  };
+
+  "spi_bus_manager lock holds the bus across a chip select frame"_test =
+    []() {
+      // Setup
+      mock_spi_bus bus;
+      spi_bus_manager manager(bus);
+      std::vector<int> chip_select{};
+      spi_bus_manager::device flash(manager);
+      std::optional<result<spi_bus_manager::device::bus_lock>> flash_lock{};
+      status second_half{};
+      bool nested_locked = true;
+      spi_bus_manager::device display(manager, {}, [&]() -> status {
+        // The display is waiting in the middle of the flash's frame
+        second_half = flash.transfer({}, {}, 0x01);
+        nested_locked = bool{ flash.lock() };
+        chip_select.push_back(1);
+        (*flash_lock)->unlock();
+        return success();
+      });
+      status display_result{};
+      bus.m_during_transfer = [&]() {
+        display_result = display.transfer({}, {}, 0x02);
+      };
+
+      // Exercise
+      flash_lock = flash.lock();
+      chip_select.push_back(0);
+      auto first_half = flash.transfer({}, {}, 0x01);
+      auto after = flash.transfer({}, {}, 0x01);
+
+      // Verify
+      expect(bool{ *flash_lock });
+      expect(bool{ first_half });
+      expect(bool{ second_half });
+      expect(!nested_locked);
+      expect(bool{ display_result });
+      expect(bool{ after });
+      expect(std::vector<int>{ 0, 1 } == chip_select);
+      expect(std::vector<hal::byte>{ 0x01, 0x01, 0x02, 0x01 } == bus.m_fillers);
+      expect(that % 3 == flash.statistics().transfers);
+      expect(that % 1 == display.statistics().transfers);
+      expect(that % 1 == display.statistics().contentions);
+    };
+};
+}  // namespace hal
@@ -0,0 +1,436 @@
+#include <libhal-util/spi_flash.hpp>
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+#include <boost/ut.hpp>
+
+namespace hal {
+namespace {
+/// 8 KiB flash with 256 byte pages, 4 KiB and 64 KiB erases, a 3ms typical
+/// 4 KiB erase and a 640us typical page program
+std::vector<hal::byte> make_sfdp()
+{
+  std::vector<hal::byte> sfdp(0x30 + 16 * 4, 0xFF);
+  const std::array<hal::byte, 16> headers{
+    'S', 'F', 'D', 'P', 0x06, 0x01, 0x00, 0xFF,
+    0x00, 0x06, 0x01, 16, 0x30, 0x00, 0x00, 0xFF,
+  };
+  std::copy(headers.begin(), headers.end(), sfdp.begin());
+  const std::array<std::uint32_t, 16> bfpt{
+    0x0000'2001,  // 4 KiB erase with opcode 0x20, 3-byte addresses
+    65535,        // 64 Kibit
+    0, 0, 0, 0, 0,
+    0xD810'200C,  // 4 KiB erase 0x20, 64 KiB erase 0xD8
+    0,
+    0x0000'0022,  // 4 KiB erase takes 3ms, maximum is 6 times typical
+    0x0000'2981,  // 256 byte pages, programs take 640us, maximum is 4 times
+    0, 0, 0, 0, 0,
+  };
+  for (std::size_t i = 0; i < bfpt.size(); i++) {
+    for (std::size_t b = 0; b < 4; b++) {
+      sfdp[0x30 + i * 4 + b] = static_cast<hal::byte>(bfpt[i] >> (b * 8));
+    }
+  }
+  return sfdp;
+}
+
+class mock_nor_flash : public hal::spi
+{
+public:
+  std::vector<hal::byte> m_memory = std::vector<hal::byte>(8192, 0xFF);
+  std::vector<hal::byte> m_sfdp = make_sfdp();
+  /// Opcode of each command, recorded when chip select is released
+  std::vector<hal::byte> m_commands{};
+  /// Number of status reads that report busy after each program or erase
+  int m_busy_polls = 2;
+  std::size_t m_page_size = 256;
+  std::size_t m_address_bytes = 3;
+  bool m_selected = false;
+
+  void select(bool p_selected)
+  {
+    if (m_selected && !p_selected && !m_frame.empty()) {
+      execute();
+    }
+    m_selected = p_selected;
+    m_frame.clear();
+  }
+
+private:
+  status driver_configure(const settings&) override
+  {
+    return success();
+  }
+
+  status driver_transfer(std::span<const hal::byte> p_data_out,
+                         std::span<hal::byte> p_data_in,
+                         hal::byte p_filler) override
+  {
+    const auto length = std::max(p_data_out.size(), p_data_in.size());
+    for (std::size_t i = 0; i < length; i++) {
+      const auto out = i < p_data_out.size() ? p_data_out[i] : p_filler;
+      const auto in = m_selected ? exchange(out) : hal::byte{ 0xFF };
+      if (i < p_data_in.size()) {
+        p_data_in[i] = in;
+      }
+    }
+    return success();
+  }
+
+  std::uint64_t address(std::size_t p_bytes) const
+  {
+    std::uint64_t value = 0;
+    for (std::size_t i = 1; i <= p_bytes; i++) {
+      value = (value << 8) | m_frame[i];
+    }
+    return value;
+  }
+
+  hal::byte exchange(hal::byte p_out)
+  {
+    const auto position = m_frame.size();
+    m_frame.push_back(p_out);
+    switch (m_frame[0]) {
+      case 0x5A: {
+        if (position < 5) {
+          return 0xFF;
+        }
+        const auto index = address(3) + (position - 5);
+        return index < m_sfdp.size() ? m_sfdp[index] : hal::byte{ 0xFF };
+      }
+      case 0x0B: {
+        const auto data_start = 1 + m_address_bytes + 1;
+        if (position < data_start) {
+          return 0xFF;
+        }
+        const auto index = address(m_address_bytes) + (position - data_start);
+        return m_memory[index % m_memory.size()];
+      }
+      case 0x05: {
+        if (position == 0) {
+          return 0xFF;
+        }
+        if (m_busy_remaining > 0) {
+          m_busy_remaining--;
+          return 0x03;
+        }
+        return m_write_enabled ? 0x02 : 0x00;
+      }
+      default:
+        return 0xFF;
+    }
+  }
+
+  void execute()
+  {
+    m_commands.push_back(m_frame[0]);
+    switch (m_frame[0]) {
+      case 0x06:
+        m_write_enabled = true;
+        break;
+      case 0xB7:
+        m_address_bytes = 4;
+        break;
+      case 0x02: {
+        if (!m_write_enabled) {
+          break;
+        }
+        const auto start = address(m_address_bytes);
+        const auto page = start - start % m_page_size;
+        const auto data = std::span(m_frame).subspan(1 + m_address_bytes);
+        for (std::size_t i = 0; i < data.size(); i++) {
+          // Page programs wrap around within the page
+          const auto offset = (start % m_page_size + i) % m_page_size;
+          m_memory[page + offset] &= data[i];
+        }
+        m_write_enabled = false;
+        m_busy_remaining = m_busy_polls;
+        break;
+      }
+      case 0x20: {
+        if (!m_write_enabled) {
+          break;
+        }
+        const auto sector = address(m_address_bytes) / 4096 * 4096;
+        std::fill_n(m_memory.begin() + static_cast<std::ptrdiff_t>(sector),
+                    4096,
+                    hal::byte{ 0xFF });
+        m_write_enabled = false;
+        m_busy_remaining = m_busy_polls;
+        break;
+      }
+      default:
+        break;
+    }
+  }
+
+  std::vector<hal::byte> m_frame{};
+  int m_busy_remaining = 0;
+  bool m_write_enabled = false;
+};
+
+class mock_chip_select : public hal::output_pin
+{
+public:
+  explicit mock_chip_select(mock_nor_flash& p_flash)
+    : m_flash(&p_flash)
+  {
+  }
+
+  bool m_high = true;
+
+private:
+  status driver_configure(const settings&) override
+  {
+    return success();
+  }
+
+  status driver_level(bool p_high) override
+  {
+    m_high = p_high;
+    m_flash->select(!p_high);
+    return success();
+  }
+
+  result<level_t> driver_level() override
+  {
+    return level_t{ m_high };
+  }
+
+  mock_nor_flash* m_flash;
+};
+
+class mock_steady_clock : public hal::steady_clock
+{
+public:
+  std::uint64_t m_uptime = 0;
+
+private:
+  hertz driver_frequency() override
+  {
+    return 1.0_MHz;
+  }
+
+  result<std::uint64_t> driver_uptime() override
+  {
+    m_uptime += 100;
+    return m_uptime;
+  }
+};
+
+void fill_pattern(std::vector<hal::byte>& p_memory)
+{
+  for (std::size_t i = 0; i < p_memory.size(); i++) {
+    p_memory[i] = static_cast<hal::byte>(i * 7 + i / 256);
+  }
+}
+}  // namespace
+
+void spi_flash_test()
+{
+  using namespace boost::ut;
+  using namespace std::chrono_literals;
+
+  "read_sfdp() parses the basic flash parameter table"_test = []() {
+    // Setup
+    mock_nor_flash device;
+    mock_chip_select chip_select(device);
+
+    // Exercise
+    auto result = read_sfdp(device, chip_select);
+
+    // Verify
+    expect(bool{ result });
+    const auto parameters = result.value();
+    expect(that % 8192 == parameters.capacity);
+    expect(that % 256 == parameters.page_size);
+    expect(that % 4096 == parameters.erase_size);
+    expect(that % 0x20 == parameters.erase_opcode);
+    expect(that % 3 == parameters.address_bytes);
+    expect(3ms == parameters.erase_time);
+    expect(640us == parameters.page_program_time);
+    expect(that % 6 == parameters.max_time_multiplier);
+    expect(chip_select.m_high);
+  };
+
+  "read_sfdp() rejects devices without SFDP"_test = []() {
+    // Setup
+    mock_nor_flash device;
+    mock_chip_select chip_select(device);
+    mock_steady_clock clock;
+    device.m_sfdp.clear();
+
+    // Exercise
+    auto result = spi_flash::create(device, chip_select, clock);
+
+    // Verify
+    expect(!result);
+  };
+
+  "read_sfdp() rejects densities that do not fit in 64 bits"_test = []() {
+    // Setup
+    mock_nor_flash device;
+    mock_chip_select chip_select(device);
+    // 2^64 bits
+    device.m_sfdp[0x34] = 0x40;
+    device.m_sfdp[0x35] = 0x00;
+    device.m_sfdp[0x36] = 0x00;
+    device.m_sfdp[0x37] = 0x80;
+
+    // Exercise
+    auto result = read_sfdp(device, chip_select);
+
+    // Verify
+    expect(!result);
+    expect(chip_select.m_high);
+  };
+
+  "spi_flash reads across pages with one command"_test = []() {
+    // Setup
+    mock_nor_flash device;
+    mock_chip_select chip_select(device);
+    mock_steady_clock clock;
+    fill_pattern(device.m_memory);
+    auto flash = spi_flash::create(device, chip_select, clock).value();
+    device.m_commands.clear();
+    std::array<hal::byte, 600> data{};
+
+    // Exercise
+    auto result = flash.read(100, data);
+
+    // Verify
+    expect(bool{ result });
+    expect(std::vector<hal::byte>{ 0x0B } == device.m_commands);
+    expect(std::equal(data.begin(), data.end(), device.m_memory.begin() + 100));
+    expect(!flash.read(8000, data));
+  };
+
+  "spi_flash programs one page per command"_test = []() {
+    // Setup
+    mock_nor_flash device;
+    mock_chip_select chip_select(device);
+    mock_steady_clock clock;
+    auto flash = spi_flash::create(device, chip_select, clock).value();
+    device.m_commands.clear();
+    std::vector<hal::byte> data(600);
+    fill_pattern(data);
+
+    // Exercise
+    auto result = flash.write(200, data);
+
+    // Verify
+    expect(bool{ result });
+    // Pages of 56, 256, 256 and 32 bytes, each followed by status polls
+    const std::vector<hal::byte> page_commands{
+      0x06, 0x02, 0x05, 0x05, 0x05,
+    };
+    expect(that % 20 == device.m_commands.size());
+    for (std::size_t i = 0; i < 20; i += page_commands.size()) {
+      expect(std::equal(page_commands.begin(),
+                        page_commands.end(),
+                        device.m_commands.begin() +
+                          static_cast<std::ptrdiff_t>(i)));
+    }
+    expect(that % 12 == flash.status_polls());
+    expect(std::equal(data.begin(), data.end(), device.m_memory.begin() + 200));
+    expect(that % 0xFF == device.m_memory[199]);
+    expect(that % 0xFF == device.m_memory[800]);
+  };
+
+  "spi_flash erases sectors"_test = []() {
+    // Setup
+    mock_nor_flash device;
+    mock_chip_select chip_select(device);
+    mock_steady_clock clock;
+    fill_pattern(device.m_memory);
+    auto flash = spi_flash::create(device, chip_select, clock).value();
+    device.m_commands.clear();
+
+    // Exercise
+    auto misaligned = flash.erase(100, 4096);
+    auto result = flash.erase(4096, 4096);
+
+    // Verify
+    expect(!misaligned);
+    expect(bool{ result });
+    expect(std::vector<hal::byte>{ 0x06, 0x20, 0x05, 0x05, 0x05 } ==
+           device.m_commands);
+    expect(std::all_of(device.m_memory.begin() + 4096,
+                       device.m_memory.end(),
+                       [](hal::byte p_byte) { return p_byte == 0xFF; }));
+    expect(that % 0xFF != device.m_memory[4095]);
+  };
+
+  "spi_flash gives up on a device that stays busy"_test = []() {
+    // Setup
+    mock_nor_flash device;
+    mock_chip_select chip_select(device);
+    mock_steady_clock clock;
+    auto flash = spi_flash::create(device, chip_select, clock).value();
+    device.m_busy_polls = 1000;
+    const std::array<hal::byte, 4> data{};
+
+    // Exercise
+    auto result = flash.write(0, data);
+
+    // Verify
+    expect(!result);
+    expect(that % 1 < flash.status_polls());
+    expect(that % 1000 > flash.status_polls());
+    expect(chip_select.m_high);
+  };
+
+  "spi_flash streams chunks from one read command"_test = []() {
+    // Setup
+    mock_nor_flash device;
+    mock_chip_select chip_select(device);
+    mock_steady_clock clock;
+    fill_pattern(device.m_memory);
+    auto flash = spi_flash::create(device, chip_select, clock).value();
+    device.m_commands.clear();
+    std::array<hal::byte, 256> chunk{};
+    std::vector<hal::byte> received{};
+    std::vector<std::size_t> sizes{};
+
+    // Exercise
+    auto result = flash.stream(
+      1000, 1000, chunk, [&](std::span<const hal::byte> p_chunk) {
+        expect(!chip_select.m_high);
+        sizes.push_back(p_chunk.size());
+        received.insert(received.end(), p_chunk.begin(), p_chunk.end());
+      });
+
+    // Verify
+    expect(bool{ result });
+    expect(std::vector<std::size_t>{ 256, 256, 256, 232 } == sizes);
+    expect(std::equal(
+      received.begin(), received.end(), device.m_memory.begin() + 1000));
+    expect(std::vector<hal::byte>{ 0x0B } == device.m_commands);
+    expect(chip_select.m_high);
+  };
+
+  "spi_flash stream stops on a consumer error"_test = []() {
+    // Setup
+    mock_nor_flash device;
+    mock_chip_select chip_select(device);
+    mock_steady_clock clock;
+    auto flash = spi_flash::create(device, chip_select, clock).value();
+    std::array<hal::byte, 16> chunk{};
+    int calls = 0;
+
+    // Exercise
+    auto consumer = [&calls](std::span<const hal::byte>) -> status {
+      calls++;
+      return hal::new_error(std::errc::operation_canceled);
+    };
+    auto result = flash.stream(0, 64, chunk, consumer);
+
+    // Verify
+    expect(!result);
+    expect(that % 1 == calls);
+    expect(chip_select.m_high);
+  };
+};
+}  // namespace hal
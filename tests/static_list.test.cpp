@@ -1,5 +1,7 @@
 #include <libhal-util/static_list.hpp>
 
+#include <vector>
+
 #include <boost/ut.hpp>
 
 namespace hal {
@@ -327,6 +329,47 @@ void static_list_test()
     expect(that % false == list.empty());
   };
 
+  "static_list::move_to_front()"_test = []() {
+    // Setup
+    static_list<int> list;
+    auto item0 = list.push_back(0);
+    [[maybe_unused]] auto item1 = list.push_back(1);
+    [[maybe_unused]] auto item2 = list.push_back(2);
+    auto collect = [&list]() {
+      std::vector<int> values;
+      for (const auto& value : list) {
+        values.push_back(value);
+      }
+      return values;
+    };
+
+    // Exercise
+    list.move_to_front(std::next(list.begin(), 2));
+    const auto after_tail = collect();
+    list.move_to_front(std::next(list.begin(), 1));
+    const auto after_middle = collect();
+    list.move_to_front(list.begin());
+    list.move_to_front(list.end());
+    const auto unchanged = collect();
+    std::vector<int> reversed;
+    for (auto position = list.end(); position != list.begin();) {
+      reversed.push_back(*--position);
+    }
+    {
+      // Destroying the moved item unlinks it from its new position
+      [[maybe_unused]] auto moved = std::move(item0);
+    }
+    const auto after_destroy = collect();
+
+    // Verify
+    expect(std::vector<int>{ 2, 0, 1 } == after_tail);
+    expect(std::vector<int>{ 0, 2, 1 } == after_middle);
+    expect(std::vector<int>{ 0, 2, 1 } == unchanged);
+    expect(std::vector<int>{ 1, 2, 0 } == reversed);
+    expect(std::vector<int>{ 2, 1 } == after_destroy);
+    expect(that % 2 == list.size());
+  };
+
   "static_list::dtor() handles dandling list items"_test = []() {
     // Setup
     auto destroy_list_keep_items = []() -> auto